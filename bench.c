@@ -0,0 +1,691 @@
+/*
+ * Copyright (c) 2026 Vadim Zhukov <zhuk@openbsd.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Microbenchmarks for the hot paths: protocol decoding and encoding,
+ * multi-byte string handling, output formatting and history saving.
+ *
+ * Each benchmark runs until it takes at least the given time (see -t),
+ * then a single line is printed:
+ *
+ *   name  iterations  ns/op  B/op  allocs/op
+ *
+ * Columns are fixed-width, so results of two runs could be compared
+ * with diff(1) or any column-aware tool.  Allocation statistics are
+ * available only when linker supports --wrap, otherwise "-" is printed.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <locale.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "oicb.h"
+#include "icb.h"
+#include "chat.h"
+#include "fields.h"
+#include "history.h"
+#include "intern.h"
+#include "linebuf.h"
+#include "private.h"
+#include "stats.h"
+#include "utf8.h"
+
+
+struct benchmark {
+	const char	*b_name;
+	void		(*b_fn)(size_t n);
+};
+
+static uint64_t	 now_nsec(void);
+static size_t	 make_wire_msg(unsigned char *dst, char type,
+		               const char *text);
+static void	 fill_text(char *dst, size_t len, const char *pattern);
+static void	 feed(const unsigned char *data, size_t len);
+static size_t	 drain_icb_msgs(void);
+static void	 split_text(const char *text, size_t len);
+static void	 run_benchmark(const struct benchmark *b);
+static void	 setup(void);
+static void	 cleanup(void);
+static __dead void	 usage(void);
+
+static void	 bench_decode_single(size_t n);
+static void	 bench_decode_multi(size_t n);
+static void	 bench_decode_burst(size_t n);
+static void	 bench_encode_ws(size_t n);
+static void	 bench_encode_ws_64k(size_t n);
+static void	 bench_encode_ext(size_t n);
+static void	 bench_codec_decode(size_t n);
+static void	 bench_codec_encode(size_t n);
+static void	 bench_mbsvalidate(size_t n);
+static void	 bench_mbsseg(size_t n);
+static void	 bench_mbsseg_64k(size_t n);
+static void	 bench_split_fields(size_t n);
+static void	 bench_user_list(size_t n);
+static void	 bench_untrusted_valid(size_t n);
+static void	 bench_untrusted_invalid(size_t n);
+static void	 bench_intern_hit(size_t n);
+static void	 bench_nick_history(size_t n);
+static void	 bench_history_line(size_t n);
+static void	 bench_history_batch(size_t n);
+static void	 bench_history_mapped(size_t n);
+static void	 bench_history_last(size_t n);
+
+#define BURST_MSGS	64
+#define HISTORY_BATCH	64
+
+static const struct benchmark benchmarks[] = {
+	{ "get_next_icb_msg/single",		bench_decode_single },
+	{ "get_next_icb_msg/multi-packet",	bench_decode_multi },
+	{ "get_next_icb_msg/burst64",		bench_decode_burst },
+	{ "push_icb_msg/ws-1k",			bench_encode_ws },
+	{ "push_icb_msg/ws-64k",		bench_encode_ws_64k },
+	{ "push_icb_msg/extended-1k",		bench_encode_ext },
+	{ "icb_decode/burst64",			bench_codec_decode },
+	{ "icb_encode/extended-1k",		bench_codec_encode },
+	{ "mbsvalidate/1k",			bench_mbsvalidate },
+	{ "mbsseg/1k",				bench_mbsseg },
+	{ "mbsseg/64k",				bench_mbsseg_64k },
+	{ "split_msg_fields/userlist",		bench_split_fields },
+	{ "proceed_icb_msg/userlist",		bench_user_list },
+	{ "lb_untrusted/valid",			bench_untrusted_valid },
+	{ "lb_untrusted/invalid",		bench_untrusted_invalid },
+	{ "intern_name/hit",			bench_intern_hit },
+	{ "update_nick_history/64-of-256",	bench_nick_history },
+	{ "history/save+proceed",		bench_history_line },
+	{ "history/save64+proceed",		bench_history_batch },
+	{ "history/mapped/save+proceed",	bench_history_mapped },
+	{ "history/last20",			bench_history_last },
+};
+#define NBENCHMARKS	(sizeof(benchmarks) / sizeof(benchmarks[0]))
+
+static const char	 ascii_text[] =
+    "The quick brown fox jumps over the lazy dog. ";
+static const char	 utf8_text[] =
+    "\xd0\xa1\xd1\x8a\xd0\xb5\xd1\x88\xd1\x8c \xd0\xb6\xd0\xb5 "
+    "\xd0\xb5\xd1\x89\xd1\x91 \xd1\x8d\xd1\x82\xd0\xb8\xd1\x85, fox. ";
+
+static int	 pipefd[2] = { -1, -1 };
+static uint64_t	 min_nsec = 200 * 1000 * 1000ULL;
+
+// wire images prepared in setup()
+static unsigned char	 wire_single[256];
+static size_t		 wire_single_len;
+static unsigned char	 wire_multi[4096];
+static size_t		 wire_multi_len;
+static unsigned char	 wire_burst[BURST_MSGS * 256];
+static size_t		 wire_burst_len;
+
+static char	 text_ascii_1k[1025];
+static char	 text_utf8_1k[1025];
+static char	 text_utf8_64k[65537];
+static char	 text_short[101];
+static char	 text_invalid[101];
+
+
+#ifdef BENCH_COUNT_ALLOCS
+/*
+ * Allocation accounting, enabled with "-Wl,--wrap=malloc,..." linker flags.
+ * Only allocations done by oicb code itself are seen, not libc internals.
+ */
+static uint64_t	 nallocs, nallocbytes;
+
+void	*__real_malloc(size_t sz);
+void	*__real_calloc(size_t nmemb, size_t sz);
+void	*__real_realloc(void *p, size_t sz);
+void	*__real_reallocarray(void *p, size_t nmemb, size_t sz);
+char	*__real_strdup(const char *s);
+void	*__wrap_malloc(size_t sz);
+void	*__wrap_calloc(size_t nmemb, size_t sz);
+void	*__wrap_realloc(void *p, size_t sz);
+void	*__wrap_reallocarray(void *p, size_t nmemb, size_t sz);
+char	*__wrap_strdup(const char *s);
+int	 __wrap_asprintf(char **ret, const char *fmt, ...);
+
+void *
+__wrap_malloc(size_t sz) {
+	nallocs++;
+	nallocbytes += sz;
+	return __real_malloc(sz);
+}
+
+void *
+__wrap_calloc(size_t nmemb, size_t sz) {
+	nallocs++;
+	nallocbytes += nmemb * sz;
+	return __real_calloc(nmemb, sz);
+}
+
+void *
+__wrap_realloc(void *p, size_t sz) {
+	nallocs++;
+	nallocbytes += sz;
+	return __real_realloc(p, sz);
+}
+
+void *
+__wrap_reallocarray(void *p, size_t nmemb, size_t sz) {
+	nallocs++;
+	nallocbytes += nmemb * sz;
+	return __real_reallocarray(p, nmemb, sz);
+}
+
+char *
+__wrap_strdup(const char *s) {
+	nallocs++;
+	nallocbytes += strlen(s) + 1;
+	return __real_strdup(s);
+}
+
+int
+__wrap_asprintf(char **ret, const char *fmt, ...) {
+	va_list	 ap;
+	int	 rv;
+
+	va_start(ap, fmt);
+	rv = vasprintf(ret, fmt, ap);
+	va_end(ap);
+	if (rv != -1) {
+		nallocs++;
+		nallocbytes += (uint64_t)rv + 1;
+	}
+	return rv;
+}
+#endif // BENCH_COUNT_ALLOCS
+
+
+static uint64_t
+now_nsec(void) {
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/*
+ * Encode message the way server does, using extended packets for
+ * messages not fitting in a single one.  Returns number of bytes written.
+ */
+static size_t
+make_wire_msg(unsigned char *dst, char type, const char *text) {
+	size_t	 len, n = 0;
+
+	len = strlen(text) + 1;		// with trailing NUL
+	for (; len > 254; len -= 254, text += 254) {
+		dst[n++] = 0;
+		dst[n++] = (unsigned char)type;
+		memcpy(dst + n, text, 254);
+		n += 254;
+	}
+	dst[n++] = (unsigned char)(len + 1);
+	dst[n++] = (unsigned char)type;
+	memcpy(dst + n, text, len);
+	return n + len;
+}
+
+/*
+ * Fills 'dst' with 'len' bytes of repeated pattern, not breaking
+ * multi-byte characters, and NUL-terminates it.
+ */
+static void
+fill_text(char *dst, size_t len, const char *pattern) {
+	size_t	 plen, n = 0;
+
+	plen = strlen(pattern);
+	while (n + plen <= len) {
+		memcpy(dst + n, pattern, plen);
+		n += plen;
+	}
+	memset(dst + n, '.', len - n);
+	dst[len] = '\0';
+}
+
+static void
+feed(const unsigned char *data, size_t len) {
+	ssize_t	 nw;
+
+	while (len > 0) {
+		if ((nw = write(pipefd[1], data, len)) == -1)
+			err(1, "%s: write", __func__);
+		data += nw;
+		len -= (size_t)nw;
+	}
+}
+
+static size_t
+drain_icb_msgs(void) {
+	size_t	 msglen, nmsgs = 0;
+
+	while (get_next_icb_msg(&msglen) != NULL)
+		nmsgs++;
+	return nmsgs;
+}
+
+static void
+bench_decode_single(size_t n) {
+	while (n-- > 0) {
+		feed(wire_single, wire_single_len);
+		if (drain_icb_msgs() != 1)
+			errx(1, "%s: decoding failed", __func__);
+	}
+}
+
+static void
+bench_decode_multi(size_t n) {
+	while (n-- > 0) {
+		feed(wire_multi, wire_multi_len);
+		if (drain_icb_msgs() != 1)
+			errx(1, "%s: decoding failed", __func__);
+	}
+}
+
+static void
+bench_decode_burst(size_t n) {
+	while (n-- > 0) {
+		feed(wire_burst, wire_burst_len);
+		if (drain_icb_msgs() != BURST_MSGS)
+			errx(1, "%s: decoding failed", __func__);
+	}
+}
+
+static void
+bench_encode_ws(size_t n) {
+	srv_features &= ~ExtPkt;
+	while (n-- > 0) {
+		push_icb_msg('b', text_utf8_1k, sizeof(text_utf8_1k) - 1);
+		drop_tasks(&tasks_net, &stats.st_net);
+	}
+}
+
+// pasting a long document costs O(n), not O(n * packets)
+static void
+bench_encode_ws_64k(size_t n) {
+	srv_features &= ~ExtPkt;
+	while (n-- > 0) {
+		push_icb_msg('b', text_utf8_64k, sizeof(text_utf8_64k) - 1);
+		drop_tasks(&tasks_net, &stats.st_net);
+	}
+}
+
+static void
+bench_encode_ext(size_t n) {
+	srv_features |= ExtPkt;
+	while (n-- > 0) {
+		push_icb_msg('b', text_utf8_1k, sizeof(text_utf8_1k) - 1);
+		drop_tasks(&tasks_net, &stats.st_net);
+	}
+	srv_features &= ~ExtPkt;
+}
+
+/*
+ * libicb alone, without system calls and allocations.
+ */
+static void
+bench_codec_decode(size_t n) {
+	static unsigned char	 buf[sizeof(wire_burst) + 1];
+	struct icb_decoder	 dec;
+	struct icb_msg		 m;
+	size_t			 avail, nmsgs;
+	void			*space;
+
+	icb_decoder_init(&dec, buf, sizeof(buf));
+	while (n-- > 0) {
+		space = icb_decoder_space(&dec, &avail);
+		memcpy(space, wire_burst, wire_burst_len);
+		icb_decoder_commit(&dec, wire_burst_len);
+		for (nmsgs = 0; icb_decode(&dec, &m) == ICB_MSG; nmsgs++)
+			;
+		if (nmsgs != BURST_MSGS)
+			errx(1, "%s: decoding failed", __func__);
+	}
+}
+
+static void
+bench_codec_encode(size_t n) {
+	static unsigned char	 buf[2048];
+	struct icb_encoder	 enc;
+
+	icb_encoder_init(&enc, ICB_EXTPKT);
+	while (n-- > 0)
+		if (icb_encode(&enc, 'b', text_utf8_1k,
+		    sizeof(text_utf8_1k) - 1, buf, sizeof(buf)) == 0)
+			errx(1, "%s: encoding failed", __func__);
+}
+
+static void
+bench_mbsvalidate(size_t n) {
+	while (n-- > 0)
+		if (mbsvalidate(text_utf8_1k) == -1)
+			errx(1, "%s: unexpected result", __func__);
+}
+
+static void
+split_text(const char *text, size_t len) {
+	struct mbs_segmenter	 seg;
+	const char		*p;
+
+	// split the whole text as push_icb_msg_ws() would do
+	mbsseg_init(&seg, text, len, 240, SegUTF8);
+	while (mbsseg_next(&seg, &p) != 0)
+		continue;
+}
+
+static void
+bench_mbsseg(size_t n) {
+	while (n-- > 0)
+		split_text(text_utf8_1k, sizeof(text_utf8_1k) - 1);
+}
+
+static void
+bench_mbsseg_64k(size_t n) {
+	while (n-- > 0)
+		split_text(text_utf8_64k, sizeof(text_utf8_64k) - 1);
+}
+
+static void
+bench_split_fields(size_t n) {
+	static const char	 line[] = "m\001somebody\001120\0010\001"
+	    "1460893072\001someuser\001host.example.com";
+	struct msg_field	 f[8];
+
+	while (n-- > 0)
+		if (split_msg_fields(line, sizeof(line) - 1, f, 8) != 7)
+			errx(1, "%s: unexpected result", __func__);
+}
+
+static void
+bench_user_list(size_t n) {
+	static const char	 line[] = "iwl\001m\001somebody\001120\0010\001"
+	    "1460893072\001someuser\001host.example.com";
+	char			 msg[sizeof(line)];
+
+	while (n-- > 0) {
+		memcpy(msg, line, sizeof(line));
+		proceed_icb_msg(msg, sizeof(line) - 1);
+		drop_tasks(&tasks_stdout, &stats.st_stdout);
+	}
+}
+
+static void
+bench_untrusted_valid(size_t n) {
+	struct line_buf	 lb;
+
+	while (n-- > 0) {
+		lb_init(&lb);
+		lb_untrusted(&lb, text_short, strlen(text_short));
+		lb_commit(&lb);
+		drop_tasks(&tasks_stdout, &stats.st_stdout);
+	}
+}
+
+static void
+bench_untrusted_invalid(size_t n) {
+	struct line_buf	 lb;
+
+	while (n-- > 0) {
+		lb_init(&lb);
+		lb_untrusted(&lb, text_invalid, strlen(text_invalid));
+		lb_commit(&lb);
+		drop_tasks(&tasks_stdout, &stats.st_stdout);
+	}
+}
+
+static void
+bench_intern_hit(size_t n) {
+	static const char	 name[] = "somebody";
+
+	while (n-- > 0)
+		if (intern_name(name, sizeof(name) - 1) == NAME_NONE)
+			errx(1, "%s: unexpected result", __func__);
+}
+
+/*
+ * Private chats with more nicks than remembered, so some get forgotten.
+ */
+static void
+bench_nick_history(size_t n) {
+	static name_id	 ids[256];
+	char		 buf[16];
+	size_t		 i;
+
+	if (ids[0] == NAME_NONE) {
+		priv_chats_max = 64;
+		for (i = 0; i < 256; i++) {
+			snprintf(buf, sizeof(buf), "user%zu", i);
+			ids[i] = intern_name(buf, strlen(buf));
+		}
+	}
+	for (i = 0; n-- > 0; i++)
+		update_nick_history(ids[(i * 7 + (i >> 3)) & 255]);
+}
+
+static void
+bench_history_line(size_t n) {
+	while (n-- > 0) {
+		save_history('b', intern_name("bench", 5), text_short, 1);
+		proceed_history();
+	}
+}
+
+static void
+bench_history_batch(size_t n) {
+	int	 i;
+
+	while (n-- > 0) {
+		for (i = 0; i < HISTORY_BATCH; i++)
+			save_history('b', intern_name("bench", 5), text_short, 1);
+		proceed_history();
+	}
+}
+
+static void
+bench_history_mapped(size_t n) {
+	history_mmap = 1;
+	bench_history_line(n);
+	close_history_files();
+	history_mmap = 0;
+}
+
+static void
+bench_history_last(size_t n) {
+	static int	 filled;
+	int		 i;
+
+	if (!filled) {
+		for (i = 0; i < 1000; i++)
+			save_history('b', intern_name("bench", 5), text_short, 1);
+		proceed_history();
+		filled = 1;
+	}
+	while (n-- > 0) {
+		show_last_lines(NULL, 20);
+		drop_tasks(&tasks_stdout, &stats.st_stdout);
+	}
+}
+
+/*
+ * Grows number of iterations until the run takes at least min_nsec,
+ * in the same manner Go testing package does, then reports results.
+ */
+static void
+run_benchmark(const struct benchmark *b) {
+	uint64_t	 start, elapsed, allocs = 0, bytes = 0;
+	size_t		 n = 1, next;
+
+	for (;;) {
+#ifdef BENCH_COUNT_ALLOCS
+		nallocs = nallocbytes = 0;
+#endif
+		start = now_nsec();
+		b->b_fn(n);
+		elapsed = now_nsec() - start;
+#ifdef BENCH_COUNT_ALLOCS
+		allocs = nallocs;
+		bytes = nallocbytes;
+#endif
+		if (elapsed >= min_nsec || n >= 1000000000)
+			break;
+
+		// aim 20% over the target, but don't grow too fast
+		if (elapsed == 0)
+			next = n * 100;
+		else
+			next = (size_t)(min_nsec * 6 / 5 * n / elapsed);
+		if (next > n * 100)
+			next = n * 100;
+		if (next <= n)
+			next = n + 1;
+		n = next;
+	}
+
+	printf("%-36s %12zu %12.1f", b->b_name, n, (double)elapsed / n);
+#ifdef BENCH_COUNT_ALLOCS
+	printf(" %10llu %10.2f\n", (unsigned long long)(bytes / n),
+	    (double)allocs / n);
+#else
+	(void)allocs;
+	(void)bytes;
+	printf(" %10s %10s\n", "-", "-");
+#endif
+	fflush(stdout);
+}
+
+static void
+setup(void) {
+	static char	 nickbuf[] = "bench", roombuf[] = "bench",
+			 hostbuf[] = "localhost";
+	unsigned char	*p;
+	const char	*tmpdir;
+	char		 line[128];
+	int		 i;
+
+	if (setlocale(LC_CTYPE, "C.UTF-8") != NULL ||
+	    setlocale(LC_CTYPE, "en_US.UTF-8") != NULL)
+		utf8_ready = 1;
+	else
+		warnx("UTF-8 locale is not available, results will differ");
+
+	SIMPLEQ_INIT(&tasks_stdout);
+	SIMPLEQ_INIT(&tasks_net);
+	nick = nickbuf;
+	nicklen = strlen(nick);
+	room = roombuf;
+	hostname = hostbuf;
+	state = Chat;
+
+	// get_next_icb_msg() reads from 'sock' until EAGAIN
+	if (pipe(pipefd) == -1)
+		err(1, "pipe");
+	if (fcntl(pipefd[0], F_SETFL, O_NONBLOCK) == -1)
+		err(1, "fcntl");
+	sock = pipefd[0];
+
+	fill_text(text_ascii_1k, sizeof(text_ascii_1k) - 1, ascii_text);
+	fill_text(text_utf8_1k, sizeof(text_utf8_1k) - 1, utf8_text);
+	fill_text(text_utf8_64k, sizeof(text_utf8_64k) - 1, utf8_text);
+	fill_text(text_short, sizeof(text_short) - 1, utf8_text);
+	fill_text(text_invalid, sizeof(text_invalid) - 1, "\xff\xfe text\x01 ");
+
+	snprintf(line, sizeof(line), "someone\001%.100s", text_short);
+	wire_single_len = make_wire_msg(wire_single, 'b', line);
+	wire_multi_len = make_wire_msg(wire_multi, 'b', text_ascii_1k);
+	for (p = wire_burst, i = 0; i < BURST_MSGS; i++)
+		p += make_wire_msg(p, 'b', line);
+	wire_burst_len = (size_t)(p - wire_burst);
+
+	if ((tmpdir = getenv("TMPDIR")) == NULL || *tmpdir == '\0')
+		tmpdir = "/tmp";
+	if ((size_t)snprintf(history_path, sizeof(history_path),
+	    "%s/oicb-bench.XXXXXXXXXX", tmpdir) >= sizeof(history_path))
+		errx(1, "TMPDIR is too long");
+	if (mkdtemp(history_path) == NULL)
+		err(1, "%s", history_path);
+	LIST_INIT(&history_files);
+	enable_history = 1;
+}
+
+static void
+cleanup(void) {
+	char	 path[PATH_MAX];
+
+	if ((size_t)snprintf(path, sizeof(path), "%s/room-%s.log",
+	    history_path, room) < sizeof(path) &&
+	    unlink(path) == -1 && errno != ENOENT)
+		warn("%s", path);
+	if (rmdir(history_path) == -1)
+		warn("%s", history_path);
+}
+
+static void
+usage(void) {
+	fprintf(stderr, "usage: %s [-l] [-t msecs] [name ...]\n",
+	    getprogname());
+	exit(1);
+}
+
+int
+main(int argc, char **argv) {
+	const char	*errstr;
+	size_t		 i;
+	int		 ch, j, list = 0, matched;
+
+	while ((ch = getopt(argc, argv, "lt:")) != -1) {
+		switch (ch) {
+		case 'l':
+			list = 1;
+			break;
+		case 't':
+			min_nsec = strtonum(optarg, 1, 3600 * 1000, &errstr);
+			if (errstr)
+				errx(1, "run time is %s: %s", errstr, optarg);
+			min_nsec *= 1000 * 1000;
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (list) {
+		for (i = 0; i < NBENCHMARKS; i++)
+			puts(benchmarks[i].b_name);
+		return 0;
+	}
+
+	setup();
+	printf("%-36s %12s %12s %10s %10s\n",
+	    "# benchmark", "iterations", "ns/op", "B/op", "allocs/op");
+	for (i = 0; i < NBENCHMARKS; i++) {
+		// run only benchmarks with names containing given strings
+		for (matched = argc == 0, j = 0; !matched && j < argc; j++)
+			matched = strstr(benchmarks[i].b_name, argv[j]) != NULL;
+		if (matched)
+			run_benchmark(&benchmarks[i]);
+	}
+	cleanup();
+	return 0;
+}
@@ -0,0 +1,193 @@
+/*
+ * Copyright (c) 2026 Vadim Zhukov <zhuk@openbsd.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Capture file format:
+ *
+ *   "OICBCAP\001" magic, where the last byte is the format version;
+ *   nick, host name and room, each terminated by NUL;
+ *   records, each being:
+ *     delay since previous record, in microseconds (varint);
+ *     data length (varint);
+ *     data bytes, exactly as read from the server socket.
+ *
+ * Varints are little-endian base 128, as in LEB128.
+ */
+
+#include <sys/types.h>
+#include <err.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "oicb.h"
+#include "capture.h"
+#include "stats.h"
+
+
+#define CAPTURE_MAGIC		"OICBCAP\001"
+#define CAPTURE_MAGIC_LEN	8
+#define CAPTURE_MAX_RECORD	(16*1024*1024)
+
+static void	 put_varint(uint64_t v);
+static int	 get_varint(uint64_t *v);
+static char	*get_string(void);
+static void	 capture_finish(void);
+
+static FILE		*capf, *replayf;
+static uint64_t		 last_ts;
+
+
+static void
+put_varint(uint64_t v) {
+	while (v >= 0x80) {
+		putc((int)(v & 0x7f) | 0x80, capf);
+		v >>= 7;
+	}
+	putc((int)v, capf);
+}
+
+/*
+ * Returns 1 on success, 0 on clean EOF; exits on truncated input.
+ */
+static int
+get_varint(uint64_t *v) {
+	int	 ch, shift;
+
+	*v = 0;
+	for (shift = 0; shift < 64; shift += 7) {
+		if ((ch = getc(replayf)) == EOF) {
+			if (shift == 0 && !ferror(replayf))
+				return 0;
+			errx(1, "capture file is truncated");
+		}
+		*v |= (uint64_t)(ch & 0x7f) << shift;
+		if ((ch & 0x80) == 0)
+			return 1;
+	}
+	errx(1, "capture file is corrupted");
+}
+
+static char *
+get_string(void) {
+	char	*s = NULL;
+	size_t	 sz = 0;
+
+	if (getdelim(&s, &sz, '\0', replayf) == -1)
+		errx(1, "capture file header is truncated");
+	return s;
+}
+
+static void
+capture_finish(void) {
+	if (capf != NULL && fclose(capf) == EOF)
+		warn("capture");
+	capf = NULL;
+}
+
+/*
+ * Start recording data received from server to the given file.
+ * Must be called after nick, host name and room are known.
+ */
+void
+capture_start(const char *path) {
+	if ((capf = fopen(path, "w")) == NULL)
+		err(1, "%s", path);
+	fwrite(CAPTURE_MAGIC, 1, CAPTURE_MAGIC_LEN, capf);
+	fwrite(nick, 1, strlen(nick) + 1, capf);
+	fwrite(hostname, 1, strlen(hostname) + 1, capf);
+	fwrite(room, 1, strlen(room) + 1, capf);
+	if (ferror(capf))
+		err(1, "%s", path);
+	last_ts = now_usec();
+	atexit(capture_finish);
+}
+
+/*
+ * Record a chunk of data just read from server, if capturing is enabled.
+ */
+void
+capture_data(const void *data, size_t len) {
+	uint64_t	 ts;
+
+	if (capf == NULL)
+		return;
+	ts = now_usec();
+	put_varint(ts - last_ts);
+	put_varint(len);
+	fwrite(data, 1, len, capf);
+	last_ts = ts;
+	if (ferror(capf)) {
+		warn("capture write failed, capturing stopped");
+		fclose(capf);
+		capf = NULL;
+	}
+}
+
+/*
+ * Open capture file for replaying, and set up nick, hostname and room
+ * from its header.
+ */
+void
+replay_start(const char *path) {
+	char	 magic[CAPTURE_MAGIC_LEN];
+
+	if ((replayf = fopen(path, "r")) == NULL)
+		err(1, "%s", path);
+	if (fread(magic, 1, CAPTURE_MAGIC_LEN, replayf) != CAPTURE_MAGIC_LEN ||
+	    memcmp(magic, CAPTURE_MAGIC, CAPTURE_MAGIC_LEN) != 0)
+		errx(1, "%s: not an oicb capture file", path);
+	nick = get_string();
+	hostname = get_string();
+	room = get_string();
+	nicklen = strlen(nick);
+	if (nicklen >= NICKNAME_MAX)
+		errx(1, "%s: too long nickname", path);
+}
+
+/*
+ * Read next captured record.
+ * Returns 1 on success, 0 when there is no more records.
+ */
+int
+replay_next(struct capture_record *rec) {
+	static unsigned char	*buf;
+	static size_t		 bufsize;
+	unsigned char		*nbuf;
+	uint64_t		 len;
+
+	if (!get_varint(&rec->cr_delay))
+		return 0;
+	if (!get_varint(&len))
+		errx(1, "capture file is truncated");
+	if (len > CAPTURE_MAX_RECORD)
+		errx(1, "capture file is corrupted: record of %llu bytes",
+		    (unsigned long long)len);
+	if (len > bufsize) {
+		if ((nbuf = realloc(buf, len)) == NULL)
+			err(1, __func__);
+		buf = nbuf;
+		bufsize = len;
+	}
+	if (fread(buf, 1, len, replayf) != len)
+		errx(1, "capture file is truncated");
+	rec->cr_len = len;
+	rec->cr_data = buf;
+	return 1;
+}
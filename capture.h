@@ -0,0 +1,34 @@
+/*
+ * Copyright (c) 2026 Vadim Zhukov <zhuk@openbsd.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef OICB_CAPTURE_H
+#define OICB_CAPTURE_H
+
+#include <stdint.h>
+
+struct capture_record {
+	uint64_t	 cr_delay;	// microseconds since previous record
+	size_t		 cr_len;
+	unsigned char	*cr_data;	// valid until next replay_next() call
+};
+
+void	 capture_start(const char *path);
+void	 capture_data(const void *data, size_t len);
+
+void	 replay_start(const char *path);
+int	 replay_next(struct capture_record *rec);
+
+#endif // OICB_CAPTURE_H
@@ -26,9 +26,21 @@
 #include <unistd.h>
 
 #include "oicb.h"
+#include "icb.h"
 #include "chat.h"
+#include "fields.h"
 #include "history.h"
+#include "intern.h"
+#include "json.h"
+#include "latency.h"
+#include "linebuf.h"
+#include "ping.h"
 #include "private.h"
+#include "probes.h"
+#include "scrollback.h"
+#include "search.h"
+#include "stats.h"
+#include "trace.h"
 #include "utf8.h"
 
 
@@ -36,14 +48,38 @@ static void	 err_unexpected_msg(char type);
 static void	 err_invalid_msg(char type, const char *desc);
 static void	 push_icb_msg_ws(char type, const char *src, size_t len);
 static void	 push_icb_msg_extended(char type, const char *src, size_t len);
+static int	 proceed_local_cmd(const struct line_cmd *cmd);
+static void	 local_cmd_last(const char *args);
+static void	 local_cmd_latency(const char *args);
+static void	 local_cmd_stats(const char *args);
+static void	 local_cmd_rtt(const char *args);
+static void	 local_cmd_search(const char *args);
+
+static const char	*json_msg_type(char type);
+static void	 proceed_chat_msg(char type, const char *author,
+		                  size_t authorlen, const char *text,
+		                  size_t textlen);
+static void	 proceed_cmd_result(const char *msg, size_t len);
+static void	 proceed_cmd_result_end(const char *msg, size_t len);
+static void	 proceed_user_list(const char *msg, size_t len);
+static void	 proceed_group_list(const char *msg, size_t len);
 
-static void	 proceed_chat_msg(char type, const char *author, const char *text);
-static void	 proceed_cmd_result(char *msg, size_t len);
-static void	 proceed_cmd_result_end(char *msg, size_t len);
-static void	 proceed_user_list(char *msg, size_t len);
-static void	 proceed_group_list(char *msg, size_t len);
+/*
+ * Commands handled by client itself, instead of being sent to server.
+ * Handlers get arguments with leading whitespace skipped, or NULL.
+ */
+struct local_cmd {
+	const char	*name;
+	void		(*handler)(const char *args);
+} local_cmds[] = {
+	{ "last",	&local_cmd_last },
+	{ "latency",	&local_cmd_latency },
+	{ "rtt",	&local_cmd_rtt },
+	{ "search",	&local_cmd_search },
+	{ "stats",	&local_cmd_stats },
+};
 
-typedef void (*icb_msg_handler)(char *, size_t);
+typedef void (*icb_msg_handler)(const char *, size_t);
 struct cmd_result_handler {
 	char		outtype[4];
 	icb_msg_handler	handler;
@@ -70,6 +106,9 @@ push_icb_msg(char type, const char *src, size_t len) {
 		warnx("%s: asked type '%c' with size %zu: %s, queue %p",
 		    __func__, type, len, src, &tasks_net);
 	}
+	stats.st_msgs_out[(unsigned char)type]++;
+	OICB_PROBE3(msg_queued, type, len, src);
+	TRACE(TraceMsgQueued, type, len);
 	if ((srv_features & ExtPkt) == ExtPkt)
 		push_icb_msg_extended(type, src, len);
 	else
@@ -82,11 +121,17 @@ push_icb_msg(char type, const char *src, size_t len) {
  */
 void
 push_icb_msg_ws(char type, const char *msg, size_t len) {
-	struct icb_task	*it;
-	int		 privmsg;
-	unsigned char	 msglen, maxlen, commonlen;
-	const char	*p, *src;
-
+	struct icb_encoder	 enc;
+	struct mbs_segmenter	 seg;
+	struct icb_task		*it;
+	struct iovec		 iov[2];
+	enum SegMode		 mode;
+	int			 privmsg;
+	size_t			 msglen;
+	unsigned char		 maxlen, commonlen;
+	const char		*p, *src;
+
+	icb_encoder_init(&enc, 0);
 	commonlen = 0;
 	privmsg = type == 'h' && memcmp(msg, "m\001", 2) == 0;
 	if (privmsg) {
@@ -98,75 +143,149 @@ push_icb_msg_ws(char type, const char *msg, size_t len) {
 	len -= commonlen;
 
 	// give a chance to server to prepend nickname field without breaking
-	maxlen = 253 - ((unsigned char)nicklen + 1) - commonlen;
+	maxlen = ICB_MSG_MAX - ((unsigned char)nicklen + 1) - commonlen;
+	if (type == 'b' || privmsg)
+		mode = utf8_ready ? SegUTF8 : SegSingleByte;
+	else
+		mode = SegBytes;
+	mbsseg_init(&seg, src, len, maxlen, mode);
+
+	iov[0].iov_base = (void *)(uintptr_t)msg;
+	iov[0].iov_len = commonlen;
 	do {
-		if (len > maxlen) {
-			msglen = maxlen;
-			if (type == 'b' || privmsg) {
-				if (utf8_ready)
-					msglen = mbsbreak(src, msglen);
-				else {
-					for (p = src + msglen - 1; p > src; p--)
-						if (isblank((unsigned char)*p) ||
-						    ispunct((unsigned char)*p)) {
-							msglen = p - src + 1;
-							break;
-						}
-				}
-			}
-		} else
-			msglen = len;
-		if ((it = calloc(1, sizeof(struct icb_task) + msglen + commonlen + 3)) == NULL)
+		msglen = mbsseg_next(&seg, &src);
+		iov[1].iov_base = (void *)(uintptr_t)src;
+		iov[1].iov_len = msglen;
+		if ((it = alloc_task(msglen + commonlen + 3)) == NULL)
 			err(1, __func__);
-		it->it_len = msglen + commonlen + 3;
-		it->it_data[0] = (char)((unsigned char)msglen + commonlen + 2);
-		it->it_data[1] = type;
-		memcpy(it->it_data + 2, msg, commonlen);
-		memcpy(it->it_data + 2 + commonlen, src, msglen);
-		src += msglen;
-		len -= msglen;
-		SIMPLEQ_INSERT_TAIL(&tasks_net, it, it_entry);
-	} while (len);
+		it->it_len = icb_encodev(&enc, type, iov, 2, it->it_data,
+		    msglen + commonlen + 3);
+		enqueue_task(&tasks_net, &stats.st_net, it);
+		stats.st_pkts_out++;
+	} while (!mbsseg_done(&seg));
 }
 
 /*
- * Use proposed "extended" messages. Not tested on real servers yet.
+ * Send message at once, using proposed "extended" messages, when server
+ * announces support for them with "ExtPkt" word in its ID, or when asked
+ * to with -x option.  Receiving end gets the message reassembled,
+ * without any splitting artifacts.
  */
 void
 push_icb_msg_extended(char type, const char *src, size_t len) {
-	struct icb_task	*it;
-	size_t		 msgcnt;
-	unsigned char	*dst, szfinal;
-
-	len++;    // for trailing NUL
-	msgcnt = (len + 253) / 254;
+	struct icb_encoder	 enc;
+	struct icb_task		*it;
+	size_t			 sz, npkts;
+
+	icb_encoder_init(&enc, ICB_EXTPKT);
+	sz = icb_encoded_len(&enc, len);
+	npkts = (sz + ICB_PKT_MAX - 1) / ICB_PKT_MAX;
+	if ((it = alloc_task(sz)) == NULL)
+		err(1, __func__);
+	it->it_len = icb_encode(&enc, type, src, len, it->it_data, sz);
+	stats.st_pkts_out += npkts;
+	TRACE(TraceExtSplit, type, len, npkts,
+	    sz - (npkts - 1) * ICB_PKT_MAX - 1);
 	if (debug >= 3)
-		warnx("%s: there will be %zu messages", __func__, msgcnt);
+		warnx("%s: %zu bytes in %zu packets", __func__, sz, npkts);
+	enqueue_task(&tasks_net, &stats.st_net, it);
+}
 
-	// +1 for sizeof(struct icb_task)
-	if ((it = calloc(msgcnt + 1, 256)) == NULL)
-		err(1, __func__);
-	it->it_len = len + msgcnt * 2;   // for size and type bytes in each message
-	dst = (unsigned char *)it->it_data;
-	while (msgcnt-- > 1) {
-		*dst++ = 0;
-		*dst++ = type;
-		memcpy(dst, src, 254);
-		src += 254;
-		dst += 254;
-		if (debug >= 3) {
-			warnx("\tinitialized msg #%zu", msgcnt);
+/*
+ * Runs local command handler, if any.
+ * Returns 1 if command was handled, 0 otherwise.
+ */
+int
+proceed_local_cmd(const struct line_cmd *cmd) {
+	const char	*args = NULL;
+	size_t		 i;
+
+	for (i = 0; i < sizeof(local_cmds) / sizeof(local_cmds[0]); i++) {
+		if (strlen(local_cmds[i].name) != (size_t)cmd->cmd_name_len ||
+		    memcmp(cmd->cmd_name, local_cmds[i].name,
+		    (size_t)cmd->cmd_name_len) != 0)
+			continue;
+		if (cmd->has_args) {
+			for (args = cmd->cmd_name_end;
+			    isspace((unsigned char)*args); args++)
+				;
+			if (*args == '\0')
+				args = NULL;
 		}
+		local_cmds[i].handler(args);
+		return 1;
 	}
-	szfinal = (unsigned char)(len % 254);
-	if (debug >= 3) {
-		warnx("\tputting last %hhu bytes", szfinal);
+	return 0;
+}
+
+/*
+ * /last [count [nick]]
+ */
+void
+local_cmd_last(const char *args) {
+	char		 count[16], peer[NICKNAME_MAX];
+	const char	*errstr;
+	size_t		 len, n = LAST_LINES_DEFAULT;
+
+	if (args == NULL) {
+		show_last_lines(NULL, n);
+		return;
 	}
-	*dst++ = szfinal + 1;    // for type byte
-	*dst++ = type;
-	memcpy(dst, src, szfinal);
-	// NUL is already there, thanks to calloc
-	SIMPLEQ_INSERT_TAIL(&tasks_net, it, it_entry);
+
+	len = strcspn(args, " \t");
+	if (len >= sizeof(count))
+		goto usage;
+	memcpy(count, args, len);
+	count[len] = '\0';
+	n = (size_t)strtonum(count, 1, LAST_LINES_MAX, &errstr);
+	if (errstr)
+		goto usage;
+
+	for (args += len; isspace((unsigned char)*args); args++)
+		;
+	if (*args == '\0') {
+		show_last_lines(NULL, n);
+		return;
+	}
+	len = strcspn(args, " \t/");
+	if (len >= sizeof(peer) || args[len + strspn(args + len, " \t")])
+		goto usage;
+	memcpy(peer, args, len);
+	peer[len] = '\0';
+	show_last_lines(peer, n);
+	return;
+
+usage:
+	push_stdout("usage: /last [count [nick]], count is 1 to %d\n",
+	    LAST_LINES_MAX);
+}
+
+void
+local_cmd_latency(const char *args) {
+	(void)args;
+	push_latency_stats();
+}
+
+void
+local_cmd_stats(const char *args) {
+	(void)args;
+	push_stats();
+}
+
+void
+local_cmd_rtt(const char *args) {
+	(void)args;
+	push_rtt_stats();
+	if ((srv_features & Ping) == Ping)
+		send_ping(1);
+	else
+		push_stdout("%s: server doesn't support pings\n",
+		    getprogname());
+}
+
+void
+local_cmd_search(const char *args) {
+	search_history(args);
 }
 
 /*
@@ -188,19 +307,20 @@ proceed_user_input(char *line) {
 		return;    // add some insult like icb(1) does?
 
 	if (parse_cmd_line(line, &cmd)) {
+		if (proceed_local_cmd(&cmd))
+			return;
 		if (cmd.has_args)
 			*cmd.cmd_name_end = '\001';    // separate args
 
 		if (cmd.is_private) {
-			char	ch;
+			name_id	peer;
 
 			if (!cmd.private_msg)
 				return;    // skip empty line
-			ch = *cmd.peer_nick_end;
-			*cmd.peer_nick_end = '\0';
-			update_nick_history(cmd.peer_nick, cmd.private_msg);
-			save_history('c', cmd.peer_nick, cmd.private_msg, 0);
-			*cmd.peer_nick_end = ch;
+			peer = intern_name(cmd.peer_nick,
+			    (size_t)cmd.peer_nick_len);
+			update_nick_history(peer);
+			save_history('c', peer, cmd.private_msg, 0);
 			repeat_priv_nick = 1;
 			prefer_long_priv_cmd = cmd.cmd_name_len == 3;
 		}
@@ -209,8 +329,7 @@ proceed_user_input(char *line) {
 	}
 
 	// public message
-	update_nick_history(NULL, NULL);
-	save_history('b', nick, line, 0);
+	save_history('b', NAME_NONE, line, 0);
 	push_icb_msg('b', line, strlen(line));
 }
 
@@ -224,18 +343,51 @@ err_invalid_msg(char type, const char *desc) {
 	err(2, "invalid message of type '%c' received: %s", type, desc);
 }
 
+/*
+ * Event type names used in JSON output mode.
+ */
+const char *
+json_msg_type(char type) {
+	switch (type) {
+	case 'b':	return "open";
+	case 'c':	return "private";
+	case 'd':	return "status";
+	case 'e':	return "error";
+	case 'f':	return "important";
+	case 'k':	return "beep";
+	default:	return "unknown";
+	}
+}
+
 /*
  * Queue formatted incoming chat message for displaying.
+ * The 'author' is not required to be NUL-terminated.
  */
 void
-proceed_chat_msg(char type, const char *author, const char *text) {
-	size_t		 textlen;
+proceed_chat_msg(char type, const char *author, size_t authorlen,
+    const char *text, size_t textlen) {
+	struct line_buf	 lb;
 	char		 timebuf[sizeof("[00:00:00]")];
 	const char	*preuser, *postuser, *s;
 	time_t		 t;
+	name_id		 id;
 	int		 bell = 0;
 
-	save_history(type, author, text, 1);
+	id = intern_name(author, authorlen);
+	save_history(type, id, text, 1);
+
+	if (json_output) {
+		const struct json_field	 fields[] = {
+			JSON_STR("type", json_msg_type(type)),
+			JSON_NUM("ts", (long long)time(NULL)),
+			JSON_STRN("author", author, authorlen),
+			JSON_STR("room", type == 'c' ? NULL : room),
+			JSON_STRN("text", text, textlen),
+		};
+
+		push_stdout_json(fields, sizeof(fields) / sizeof(fields[0]));
+		return;
+	}
 
 	switch (type) {
 	case 'c':
@@ -269,34 +421,56 @@ proceed_chat_msg(char type, const char *author, const char *text) {
 
 	t = time(NULL);
 	strftime(timebuf, sizeof(timebuf), "[%H:%M:%S]", localtime(&t));
-	push_stdout_untrusted("%s %s%s%s %s",
-	                      timebuf, preuser, author, postuser, text);
-	push_stdout("\n");
+	lb_init(&lb);
+	if (type == 'e')
+		lb_raw(&lb, "\007", 1);
+	lb_printf(&lb, "%s %s", timebuf, preuser);
+	lb_name(&lb, id);
+	lb_printf(&lb, "%s ", postuser);
+	lb_untrusted(&lb, text, textlen);
+	lb_raw(&lb, "\n", 1);
+	// no bell in scrollback
+	scrollback_add(lb.lb_data + (type == 'e'), lb.lb_len - (type == 'e'));
+	lb_commit(&lb);
 }
 
 void
-proceed_cmd_result(char *msg, size_t len) {
-	(void)len;
-	push_stdout_untrusted(msg);
-	push_stdout("\n");
+proceed_cmd_result(const char *msg, size_t len) {
+	struct line_buf	 lb;
+
+	if (json_output) {
+		const struct json_field	 fields[] = {
+			JSON_STR("type", "output"),
+			JSON_NUM("ts", (long long)time(NULL)),
+			JSON_STR("text", msg),
+		};
+
+		push_stdout_json(fields, sizeof(fields) / sizeof(fields[0]));
+		return;
+	}
+	lb_init(&lb);
+	lb_untrusted(&lb, msg, len);
+	lb_raw(&lb, "\n", 1);
+	scrollback_add(lb.lb_data, lb.lb_len);
+	lb_commit(&lb);
 }
 
 void
-proceed_cmd_result_end(char *msg, size_t len) {
-	(void)len;
-	push_stdout_untrusted(msg);
-	push_stdout("\n");
+proceed_cmd_result_end(const char *msg, size_t len) {
+	proceed_cmd_result(msg, len);
 	state = Chat;
 }
 
 void
-proceed_user_list(char *msg, size_t len) {
-	char		*p, *endptr;
-	const char	*peer_nick, *ident, *srcaddr;
-	long long	 signedon, idle;
-	struct tm	 tm;
-
-	(void)len;
+proceed_user_list(const char *msg, size_t len) {
+	struct msg_field	 f[8];
+	const struct msg_field	*peer_nick, *ident = NULL, *srcaddr = NULL;
+	char			*endptr;
+	long long		 signedon = 0, idle = 0;
+	size_t			 nf;
+	int			 moderator, has_idle = 0, has_signon = 0;
+	struct tm		 tm;
+	struct line_buf		 lb;
 
 /*
 moderator ("m" or else)
@@ -308,97 +482,131 @@ user (ident result)
 IP address/domain
 */
 
-	p = strchr(msg, '\001');
-	if (p == NULL) {
+	// fields are followed by either \001 or NUL, so strtoll() stops there
+	nf = split_msg_fields(msg, len, f, sizeof(f) / sizeof(f[0]));
+	if (nf < 2) {
 		warnx("invalid user info line received, ignoring");
 		return;
 	}
-	*p = '\0';
-	if (p == msg + 1 && *msg == 'm')
-		push_stdout("*");
-	else
-		push_stdout(" ");
-	peer_nick = p + 1;
-	p = strchr(peer_nick, '\001');
-	if (p != NULL)
-		*p = '\0';
-	push_stdout_untrusted(peer_nick);
-
-	if (p == NULL)
-		goto end;
-	p++;
-	idle = strtoll(p, &endptr, 10);
-	*endptr = '\0';
-	push_stdout(" % 7llds", idle);
-	p = strchr(endptr + 1, '\001');
-	if (p == NULL)
+	moderator = (f[0].mf_len == 1 && *f[0].mf_str == 'm');
+	peer_nick = &f[1];
+	if (nf < 3)
+		goto parsed;
+	idle = strtoll(f[2].mf_str, &endptr, 10);
+	has_idle = 1;
+	if (endptr != f[2].mf_str + f[2].mf_len || nf < 5)
+		goto parsed;
+	/* f[3] is always zero, no interest */
+	signedon = strtoll(f[4].mf_str, &endptr, 10);
+	if (endptr != f[4].mf_str + f[4].mf_len)
+		goto parsed;
+	has_signon = 1;
+	if (nf > 5)
+		ident = &f[5];
+	if (nf > 6)
+		srcaddr = &f[6];
+
+parsed:
+	if (json_output) {
+		const struct json_field	 fields[] = {
+			JSON_STR("type", "user"),
+			JSON_NUM("ts", (long long)time(NULL)),
+			JSON_STRN("author", peer_nick->mf_str, peer_nick->mf_len),
+			JSON_NUM("moderator", moderator),
+			JSON_NUM_IF("idle", idle, has_idle),
+			JSON_NUM_IF("signon", signedon, has_signon),
+			JSON_STRN("ident", ident ? ident->mf_str : NULL,
+			    ident ? ident->mf_len : 0),
+			JSON_STRN("host", srcaddr ? srcaddr->mf_str : NULL,
+			    srcaddr ? srcaddr->mf_len : 0),
+		};
+
+		push_stdout_json(fields, sizeof(fields) / sizeof(fields[0]));
+		return;
+	}
+
+	lb_init(&lb);
+	lb_raw(&lb, moderator ? "*" : " ", 1);
+	lb_name(&lb, intern_name(peer_nick->mf_str, peer_nick->mf_len));
+	if (!has_idle)
 		goto end;
-	/* this field is always zero, no interest */
-	p++;
-	signedon = strtoll(p, &endptr, 10);
-	if (*endptr != '\001' && *endptr != '\0')
+	lb_printf(&lb, " % 7llds", idle);
+	if (!has_signon)
 		goto end;
 	localtime_r((time_t*)&signedon, &tm);
 	// TODO: omit date when not needed? print 'today'/'yesterday'?..
-	push_stdout(" %d-%02d-%02d %02d:%02d:%02d",
-	            tm.tm_year+1900, tm.tm_mon+1, tm.tm_mday,
-	            tm.tm_hour, tm.tm_min, tm.tm_sec);
-	if (*endptr == '\0')
+	lb_printf(&lb, " %d-%02d-%02d %02d:%02d:%02d",
+	          tm.tm_year+1900, tm.tm_mon+1, tm.tm_mday,
+	          tm.tm_hour, tm.tm_min, tm.tm_sec);
+	if (ident == NULL)
 		goto end;
-
-	ident = endptr + 1;
-	p = strchr(ident, '\001');
-	if (p != NULL)
-		*p = '\0';
-	push_stdout("\t");
-	push_stdout_untrusted(ident);
-	if (p == NULL)
+	lb_raw(&lb, "\t", 1);
+	lb_untrusted(&lb, ident->mf_str, ident->mf_len);
+	if (srcaddr == NULL)
 		goto end;
-
-	srcaddr = p + 1;
-	p = strchr(srcaddr, '\001');
-	if (p != NULL)
-		*p = '\0';
-	push_stdout("\t");
-	push_stdout_untrusted(srcaddr);
+	lb_raw(&lb, "\t", 1);
+	lb_untrusted(&lb, srcaddr->mf_str, srcaddr->mf_len);
 
 end:
-	push_stdout("\n");
+	lb_raw(&lb, "\n", 1);
+	scrollback_add(lb.lb_data, lb.lb_len);
+	lb_commit(&lb);
 }
 
 void
-proceed_group_list(char *msg, size_t len) {
-	int		 name_out_len;
-	char		*name, *topic, *msgid;
-	const int	 min_name_len = 30;
-
-	(void)len;
-
-	name = msg;
-	if ((topic = strchr(name, '\001')) == NULL) {
+proceed_group_list(const char *msg, size_t len) {
+	struct msg_field	 f[3];
+	const struct msg_field	*name, *topic, *msgid = NULL;
+	struct line_buf		 lb;
+	size_t			 nf, name_out_len;
+	int			 current;
+	const size_t		 min_name_len = 29;
+
+	nf = split_msg_fields(msg, len, f, sizeof(f) / sizeof(f[0]));
+	if (nf < 2) {
 		warnx("invalid group info line received, ignoring");
 		return;
 	}
-	*topic++ = '\0';
-	if ((msgid = strchr(topic, '\001')) != NULL)
-		*msgid++ = '\0';
+	name = &f[0];
+	topic = &f[1];
+	if (nf > 2)
+		msgid = &f[2];
+	current = msg_field_eq(name, room);
+
+	if (json_output) {
+		const struct json_field	 fields[] = {
+			JSON_STR("type", "group"),
+			JSON_NUM("ts", (long long)time(NULL)),
+			JSON_STRN("room", name->mf_str, name->mf_len),
+			JSON_NUM("current", current),
+			JSON_STRN("text", topic->mf_str, topic->mf_len),
+			JSON_STRN("id", msgid ? msgid->mf_str : NULL,
+			    msgid ? msgid->mf_len : 0),
+		};
+
+		push_stdout_json(fields, sizeof(fields) / sizeof(fields[0]));
+		return;
+	}
 
-	push_stdout(strcmp(name, room) ? " " : "*");
-	name_out_len = push_stdout_untrusted(name);
+	lb_init(&lb);
+	lb_raw(&lb, current ? "*" : " ", 1);
+	name_out_len = lb_name(&lb, intern_name(name->mf_str, name->mf_len));
 	if (name_out_len < min_name_len)
-		push_stdout("%*s", min_name_len - name_out_len, "");
+		lb_printf(&lb, "%*s", (int)(min_name_len - name_out_len), "");
 
-	if (*topic) {
-		push_stdout(" <");
-		push_stdout_untrusted(topic);
-		push_stdout(">");
+	if (topic->mf_len) {
+		lb_raw(&lb, " <", 2);
+		lb_untrusted(&lb, topic->mf_str, topic->mf_len);
+		lb_raw(&lb, ">", 1);
 	}
 	if (msgid) {
-		push_stdout(" [");
-		push_stdout_untrusted(msgid);
-		push_stdout("]");
+		lb_raw(&lb, " [", 2);
+		lb_untrusted(&lb, msgid->mf_str, msgid->mf_len);
+		lb_raw(&lb, "]", 1);
 	}
-	push_stdout("\n");
+	lb_raw(&lb, "\n", 1);
+	scrollback_add(lb.lb_data, lb.lb_len);
+	lb_commit(&lb);
 }
 
 /*
@@ -406,10 +614,13 @@ proceed_group_list(char *msg, size_t len) {
  */
 void
 proceed_icb_msg(char *msg, size_t len) {
-	char	type;
+	struct msg_field	 f[3];
+	char			 type;
 
 	type = *msg++;
 	len--;
+	OICB_PROBE3(msg_received, type, len, msg);
+	TRACE(TraceMsgReceived, type, len);
 	if (debug) {
 		warnx("got message of type %c with size %zu: %s",
 		    type, len, msg);
@@ -420,22 +631,24 @@ proceed_icb_msg(char *msg, size_t len) {
 			err_unexpected_msg(type);
 		push_stdout("Logged in to room %s as %s\n", room, nick);
 		state = Chat;
+		if (backlog_lines) {
+			show_last_lines(NULL, backlog_lines);
+			backlog_lines = 0;	// not again after reconnect
+		}
 		break;
 
 	case 'b':	// open message
 	case 'c':	// private message
 	case 'd':	// status message
 	case 'f':	// important message
-	{
-		char	*text;
 		if (state != Chat)
 			err_unexpected_msg(type);
-		if ((text = strchr(msg, '\001')) == NULL)
+		if (split_msg_fields(msg, len, f, 2) < 2)
 			err_invalid_msg(type, "missing text");
-		*text++ = '\0';
-		proceed_chat_msg(type, msg, text);
+		// the text is the last field, thus NUL-terminated
+		proceed_chat_msg(type, f[0].mf_str, f[0].mf_len, f[1].mf_str,
+		    f[1].mf_len);
 		break;
-	}
 
 	case 'e':	// error
 		if (state != Chat)
@@ -444,13 +657,14 @@ proceed_icb_msg(char *msg, size_t len) {
 			/* server doesn't support ping-pong */
 			srv_features &= (~Ping);
 			/* XXX set socket timeout options? */
+			TRACE(TraceNoPingPong);
 			if (debug)
 				warnx("server doesn't support ping-pong,"
 				    " switching to no-op messages");
 			break;
 		}
-		push_stdout("\007");
-		proceed_chat_msg(type, hostname, msg);
+		proceed_chat_msg(type, hostname, strlen(hostname), msg,
+		    strlen(msg));
 		break;
 
 	case 'g':       // exit
@@ -463,20 +677,17 @@ proceed_icb_msg(char *msg, size_t len) {
 	case 'i':       // command result
 	{
 		int	 i;
-		char	*outtype;
 
 		if (state != Chat)
 			err_unexpected_msg(type);
-		outtype = msg;
-		if ((msg = strchr(msg, '\001')) == NULL)
+		if (split_msg_fields(msg, len, f, 2) < 2)
 			err_invalid_msg(type, "missing output type");
-		*msg++ = '\0';
-		len -= msg - outtype;
 		for (i = 0; i < (int)(sizeof(cmd_handlers)/sizeof(cmd_handlers[0]));
 		    i++)
-			if (strcmp(outtype, cmd_handlers[i].outtype) == 0) {
+			if (msg_field_eq(&f[0], cmd_handlers[i].outtype)) {
 				if (cmd_handlers[i].handler)
-					cmd_handlers[i].handler(msg, len);
+					cmd_handlers[i].handler(f[1].mf_str,
+					    f[1].mf_len);
 				goto cmd_handler_found;
 			}
 		err_invalid_msg(type, "unsupported output type");
@@ -486,22 +697,22 @@ cmd_handler_found:
 
 	case 'j':       // protocol
 	{
-		char	*hostid = "HIDDEN", *srvid = "unknown implementation", *p;
+		char	*p;
+		size_t	 nf;
 
 		if (state != Connected)
 			err_unexpected_msg(type);
-		if ((p = strchr(msg, '\001')) != NULL) {
-			*p++ = '\0';
-			hostid = p;
-			if ((p = strchr(hostid, '\001')) != NULL) {
-				*p++ = '\0';
-				srvid = p;
-			}
-		}
-		// TODO use srvid
-		(void)srvid;
-		if (strcmp(msg, "1") != 0)
+		// version, then optional host ID and server ID
+		nf = split_msg_fields(msg, len, f, 3);
+		if (!msg_field_eq(&f[0], "1"))
 			err(2, "unsupported protocol version");
+		if (nf == 3 && msg_field_has_word(&f[2], "ExtPkt"))
+			srv_features |= ExtPkt;
+		if (debug)
+			warnx("server ID: %.*s, extended messages %s",
+			    nf == 3 ? (int)f[2].mf_len : 0,
+			    nf == 3 ? f[2].mf_str : "",
+			    (srv_features & ExtPkt) ? "on" : "off");
 		if (asprintf(&p, "%1$s\001%1$s\001%2$s\001login\001", nick, room) == -1)
 			err(1, __func__);
 		push_icb_msg('a', p, strlen(p));
@@ -513,7 +724,7 @@ cmd_handler_found:
 	case 'k':       // beep
 		if (state != Chat)
 			err_unexpected_msg(type);
-		proceed_chat_msg(type, "SERVER", "\007BEEP!");
+		proceed_chat_msg(type, "SERVER", 6, "\007BEEP!", 6);
 		break;
 
 	case 'l':       // ping
@@ -524,10 +735,8 @@ cmd_handler_found:
 		/*
 		 * XXX silently ignoring other unexpected pongs,
 		 * even if server said it doesn't support them previously.
-		 *
-		 * The main purpose of pings sent are forcing server to send
-		 * something back, so we don't bother with message IDs.
 		 */
+		proceed_pong(msg);
 		break;
 
 	case 'n':       // no-op
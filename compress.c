@@ -0,0 +1,259 @@
+/*
+ * Copyright (c) 2026 Vadim Zhukov <zhuk@openbsd.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Compression of rotated history segments, done by a background thread.
+ *
+ * The thread only writes "foo.log.gz.tmp" next to "foo.log".  Putting
+ * the result in place is left for the main thread, which renames it to
+ * "foo.log.gz" and removes the original, updating search index at the
+ * same time: this way readers never see both versions, or none of them.
+ * If oicb exits before that, the segment is compressed again on the next
+ * start, see compress_leftovers() in history.c.
+ *
+ * Other oicb instances could still append to the segment until they
+ * notice it was rotated, holding a shared lock; such segments are put
+ * aside and retried later, not to hold up the rest.
+ */
+
+#include <sys/types.h>
+#include <sys/file.h>
+#include <sys/queue.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "oicb.h"
+#include "compress.h"
+#include "search.h"
+#include "stats.h"
+
+#define COMPRESS_CHUNK	(64 * 1024)
+#define TMP_SUFFIX	".gz.tmp"
+#define COMPRESS_RETRY	1		// seconds to wait for busy segment
+
+struct compress_job {
+	SIMPLEQ_ENTRY(compress_job)	 cj_entry;
+	int				 cj_errno;	// 0 if succeeded
+	time_t				 cj_retry;	// if busy
+	char				 cj_path[];
+};
+SIMPLEQ_HEAD(compress_jobs, compress_job);
+
+static void	*compress_worker(void *arg);
+static int	 compress_file(const char *path);
+
+static pthread_mutex_t	 jobs_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	 jobs_cv = PTHREAD_COND_INITIALIZER;
+static struct compress_jobs	 jobs_todo = SIMPLEQ_HEAD_INITIALIZER(jobs_todo);
+static struct compress_jobs	 jobs_busy = SIMPLEQ_HEAD_INITIALIZER(jobs_busy);
+static struct compress_jobs	 jobs_done = SIMPLEQ_HEAD_INITIALIZER(jobs_done);
+static int		 worker_started;
+static size_t		 jobs_pending;	// queued and not put in place yet
+
+
+/*
+ * Compresses the given file to path + TMP_SUFFIX.
+ * Returns 0 on success, or errno value: EWOULDBLOCK if it's still
+ * used by other oicb instances.
+ */
+static int
+compress_file(const char *path) {
+	char	 tmppath[PATH_MAX], buf[COMPRESS_CHUNK];
+	gzFile	 gz = NULL;
+	ssize_t	 n;
+	int	 fd, tmpfd = -1, error = 0, rv;
+
+	rv = snprintf(tmppath, sizeof(tmppath), "%s%s", path, TMP_SUFFIX);
+	if (rv < 0 || (size_t)rv >= sizeof(tmppath))
+		return ENAMETOOLONG;
+	if ((fd = open(path, O_RDONLY)) == -1)
+		return errno;
+	// other oicb instances could still append to it, see history.c
+	if (flock(fd, LOCK_EX|LOCK_NB) == -1 && errno != EOPNOTSUPP) {
+		error = errno;
+		close(fd);
+		return error;
+	}
+	errno = 0;
+	if ((tmpfd = open(tmppath, O_WRONLY|O_CREAT|O_TRUNC, 0666)) == -1 ||
+	    (gz = gzdopen(dup(tmpfd), "wb")) == NULL) {
+		error = errno ? errno : ENOMEM;
+		goto out;
+	}
+	while ((n = read(fd, buf, sizeof(buf))) > 0)
+		if (gzwrite(gz, buf, (unsigned)n) != (int)n) {
+			error = EIO;
+			goto out;
+		}
+	if (n == -1)
+		error = errno;
+
+out:
+	if (gz != NULL && gzclose(gz) != Z_OK && error == 0)
+		error = EIO;
+	if (tmpfd != -1) {
+		// original is removed after that, so make sure data is there
+		if (error == 0 && fsync(tmpfd) == -1)
+			error = errno;
+		close(tmpfd);
+		if (error != 0)
+			unlink(tmppath);
+	}
+	close(fd);
+	return error;
+}
+
+/*
+ * New segments go first; busy ones are retried in order they were put
+ * aside, so the first of them is always the one to be retried first.
+ */
+static void *
+compress_worker(void *arg) {
+	struct compress_job	*cj;
+	struct timespec		 ts;
+
+	(void)arg;
+	pthread_mutex_lock(&jobs_mtx);
+	for (;;) {
+		if ((cj = SIMPLEQ_FIRST(&jobs_todo)) != NULL)
+			SIMPLEQ_REMOVE_HEAD(&jobs_todo, cj_entry);
+		else if ((cj = SIMPLEQ_FIRST(&jobs_busy)) != NULL &&
+		    cj->cj_retry <= time(NULL))
+			SIMPLEQ_REMOVE_HEAD(&jobs_busy, cj_entry);
+		else {
+			if (cj == NULL)
+				pthread_cond_wait(&jobs_cv, &jobs_mtx);
+			else {
+				ts.tv_sec = cj->cj_retry;
+				ts.tv_nsec = 0;
+				pthread_cond_timedwait(&jobs_cv, &jobs_mtx,
+				    &ts);
+			}
+			continue;
+		}
+		pthread_mutex_unlock(&jobs_mtx);
+
+		cj->cj_errno = compress_file(cj->cj_path);
+
+		pthread_mutex_lock(&jobs_mtx);
+		if (cj->cj_errno == EWOULDBLOCK) {
+			cj->cj_retry = time(NULL) + COMPRESS_RETRY;
+			SIMPLEQ_INSERT_TAIL(&jobs_busy, cj, cj_entry);
+		} else
+			SIMPLEQ_INSERT_TAIL(&jobs_done, cj, cj_entry);
+	}
+	return NULL;
+}
+
+/*
+ * Queues the closed history segment for compression.
+ */
+void
+compress_log(const char *path) {
+	struct compress_job	*cj;
+	pthread_t		 thread;
+	size_t			 len;
+	int			 error;
+
+	if (!worker_started) {
+		if ((error = pthread_create(&thread, NULL, compress_worker,
+		    NULL)) != 0) {
+			errno = error;
+			warn("cannot start compression thread");
+			return;
+		}
+		pthread_detach(thread);
+		worker_started = 1;
+	}
+
+	len = strlen(path) + 1;
+	if ((cj = malloc(sizeof(*cj) + len)) == NULL) {
+		warn(__func__);
+		return;
+	}
+	STATS_ALLOC(sizeof(*cj) + len);
+	memcpy(cj->cj_path, path, len);
+	cj->cj_errno = 0;
+	cj->cj_retry = 0;
+
+	pthread_mutex_lock(&jobs_mtx);
+	SIMPLEQ_INSERT_TAIL(&jobs_todo, cj, cj_entry);
+	pthread_cond_signal(&jobs_cv);
+	pthread_mutex_unlock(&jobs_mtx);
+	jobs_pending++;
+}
+
+/*
+ * Returns number of segments queued for compression, which results were
+ * not put in place by compress_proceed() yet.
+ */
+size_t
+compress_pending(void) {
+	return jobs_pending;
+}
+
+/*
+ * Puts segments compressed in place; to be called from the main loop.
+ */
+void
+compress_proceed(void) {
+	struct compress_jobs	 done;
+	struct compress_job	*cj;
+	char			 tmppath[PATH_MAX], gzpath[PATH_MAX];
+
+	if (!worker_started)
+		return;
+	SIMPLEQ_INIT(&done);
+	pthread_mutex_lock(&jobs_mtx);
+	while ((cj = SIMPLEQ_FIRST(&jobs_done)) != NULL) {
+		SIMPLEQ_REMOVE_HEAD(&jobs_done, cj_entry);
+		SIMPLEQ_INSERT_TAIL(&done, cj, cj_entry);
+	}
+	pthread_mutex_unlock(&jobs_mtx);
+
+	while ((cj = SIMPLEQ_FIRST(&done)) != NULL) {
+		SIMPLEQ_REMOVE_HEAD(&done, cj_entry);
+		jobs_pending--;
+		if (cj->cj_errno != 0) {
+			errno = cj->cj_errno;
+			warn("cannot compress %s", cj->cj_path);
+			free(cj);
+			continue;
+		}
+		// lengths were checked by compress_file()
+		snprintf(tmppath, sizeof(tmppath), "%s%s", cj->cj_path,
+		    TMP_SUFFIX);
+		snprintf(gzpath, sizeof(gzpath), "%s.gz", cj->cj_path);
+		if (rename(tmppath, gzpath) == -1) {
+			warn("cannot rename %s to %s", tmppath, gzpath);
+			unlink(tmppath);
+		} else {
+			search_history_renamed(cj->cj_path, gzpath);
+			if (unlink(cj->cj_path) == -1)
+				warn("%s", cj->cj_path);
+		}
+		free(cj);
+	}
+}
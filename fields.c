@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2026 Vadim Zhukov <zhuk@openbsd.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/types.h>
+#include <string.h>
+
+#include "fields.h"
+
+
+/*
+ * Splits 'len' bytes of message data into \001-separated fields, without
+ * modifying the data.  If there are more than 'maxfields' fields, the
+ * last one returned holds all the remaining data, separators included.
+ *
+ * The data is scanned once, with memchr(3), which is vectorized by
+ * every libc we care about.
+ *
+ * Returns number of fields filled, at least one if 'maxfields' > 0.
+ */
+size_t
+split_msg_fields(const char *msg, size_t len, struct msg_field *fields,
+    size_t maxfields) {
+	const char	*end = msg + len, *sep;
+	size_t		 n;
+
+	for (n = 0; n < maxfields; n++) {
+		fields[n].mf_str = msg;
+		if (n + 1 == maxfields ||
+		    (sep = memchr(msg, '\001', (size_t)(end - msg))) == NULL) {
+			fields[n].mf_len = (size_t)(end - msg);
+			return n + 1;
+		}
+		fields[n].mf_len = (size_t)(sep - msg);
+		msg = sep + 1;
+	}
+	return 0;
+}
+
+/*
+ * Returns non-zero if field content equals to the given string.
+ */
+int
+msg_field_eq(const struct msg_field *f, const char *s) {
+	size_t	 i;
+
+	for (i = 0; i < f->mf_len; i++)
+		if (s[i] == '\0' || s[i] != f->mf_str[i])
+			return 0;
+	return s[i] == '\0';
+}
+
+/*
+ * Returns non-zero if field contains the given word, separated by spaces
+ * from the rest of the text, if any.  Used for looking up features
+ * advertised in server ID.
+ */
+int
+msg_field_has_word(const struct msg_field *f, const char *word) {
+	const char	*p, *end, *wend;
+	size_t		 wlen;
+
+	wlen = strlen(word);
+	end = f->mf_str + f->mf_len;
+	for (p = f->mf_str; p < end; p = wend + 1) {
+		if ((wend = memchr(p, ' ', (size_t)(end - p))) == NULL)
+			wend = end;
+		if ((size_t)(wend - p) == wlen && memcmp(p, word, wlen) == 0)
+			return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,36 @@
+/*
+ * Copyright (c) 2026 Vadim Zhukov <zhuk@openbsd.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef OICB_FIELDS_H
+#define OICB_FIELDS_H
+
+#include <sys/types.h>
+
+/*
+ * View of a single \001-separated field of ICB message data.
+ * Not NUL-terminated, except for the last field in message.
+ */
+struct msg_field {
+	const char	*mf_str;
+	size_t		 mf_len;
+};
+
+size_t	 split_msg_fields(const char *msg, size_t len,
+	                  struct msg_field *fields, size_t maxfields);
+int	 msg_field_eq(const struct msg_field *f, const char *s);
+int	 msg_field_has_word(const struct msg_field *f, const char *word);
+
+#endif // OICB_FIELDS_H
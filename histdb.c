@@ -0,0 +1,1122 @@
+/*
+ * Copyright (c) 2026 Vadim Zhukov <zhuk@openbsd.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Converter between text history logs written by oicb and the indexed
+ * binary store described in histdb.h, and query tool for the latter.
+ *
+ * Import is incremental: only lines added to the text log since the
+ * previous run are appended, so it's cheap to run it from cron(8).
+ * Segments rotated since then, compressed or not, are imported first.
+ *
+ * Deliberately doesn't depend on libbsd or anything else from oicb,
+ * only on zlib, for reading compressed segments.
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "histdb.h"
+
+#define DATELEN		20	// "YYYY-MM-DD HH:MM:SS ", as in save_history()
+#define DATEFMT		"%Y-%m-%d %H:%M:%S "
+#define HDB_PAD(n)	(((n) + HDB_ALIGN - 1) & ~(size_t)(HDB_ALIGN - 1))
+#define GZ_BUFSIZE	(64*1024)
+
+struct histdb {
+	char			*db_logpath;
+	char			*db_datapath;
+	char			*db_idxpath;
+	char			*db_authpath;
+
+	// writer side
+	int			 db_datafd;
+	int			 db_idxfd;
+	FILE			*db_data;
+	FILE			*db_idx;
+	uint64_t		 db_end;	// offset of the next record
+	uint64_t		 db_srcend;	// text log offset to go on from
+	int64_t			 db_lasttime;
+	char			*db_lastkey;	// to find the log it came from
+	size_t			 db_lastkeylen;
+	uint64_t		 db_lastkeyoff;
+
+	// reader side
+	const char		*db_datamap;
+	size_t			 db_datasize;
+	const struct hdx_entry	*db_index;
+	size_t			 db_nentries;
+	const struct hda_entry	*db_authors;	// NULL if there is no index
+	size_t			 db_nauthors;
+	size_t			 db_authcovered;
+};
+
+/*
+ * Text log or its rotated segment, "base.YYYY-MM-DD[.N].log[.gz]",
+ * see history.c.
+ */
+struct segment {
+	char		*s_path;
+	char		 s_day[11];
+	unsigned long	 s_seq;
+	int		 s_compressed;
+	int		 s_current;	// the log itself, could still grow
+};
+
+struct query {
+	const char	*q_author;
+	size_t		 q_authorlen;
+	uint32_t	 q_authorhash;
+	int64_t		 q_since;
+	int64_t		 q_until;
+};
+
+static void	 usage(void);
+static uint32_t	 author_hash(const char *s, size_t len);
+static void	 db_paths(struct histdb *db, const char *path);
+static int	 open_store(const char *path, const char *magic);
+static const char *map_store(const char *path, const char *magic,
+		           size_t *sizep, int optional);
+static void	 pread_full(int fd, void *buf, size_t len, off_t off,
+		           const char *path);
+static uint64_t	 rec_srclen(const struct hdb_rec *hr);
+static void	 db_open_writer(struct histdb *db, const char *path);
+static void	 db_close_writer(struct histdb *db);
+static int	 hda_cmp(const void *a, const void *b);
+static void	 db_update_authors(struct histdb *db);
+static void	 db_append(struct histdb *db, int64_t t, uint64_t srcoff,
+		           uint16_t flags, const char *author, size_t alen,
+		           const char *text, size_t tlen);
+static int	 date_matches(const char *s, time_t t);
+static int	 parse_date(const char *s, time_t *tp);
+static void	 import_line(struct histdb *db, const char *line, size_t len,
+		           uint64_t srcoff);
+static const char *segment_suffix(const char *name);
+static int	 segment_cmp(const void *a, const void *b);
+static size_t	 list_segments(const char *logpath, struct segment **segsp);
+static int	 source_matches(const struct histdb *db, const char *path);
+static void	 import_plain(struct histdb *db, const char *path,
+		              uint64_t off, int current);
+static void	 import_compressed(struct histdb *db, const char *path,
+		                   uint64_t off);
+static void	 import_log(const char *path, int verbose);
+static void	 db_open_reader(struct histdb *db, const char *path);
+static void	 print_rec(const struct hdb_rec *hr);
+static size_t	 query_entry(const struct histdb *db, const struct query *q,
+		           const struct hdx_entry *he);
+static size_t	 run_query(const struct histdb *db, const struct query *q);
+static int64_t	 parse_time(const char *s);
+
+
+static void
+usage(void) {
+	fprintf(stderr,
+	    "usage: oicb-histdb import [-v] log ...\n"
+	    "       oicb-histdb export store ...\n"
+	    "       oicb-histdb query [-a author] [-s since] [-u until]"
+	    " store ...\n");
+	exit(1);
+}
+
+/*
+ * FNV-1a, good enough to skip most of non-matching index entries.
+ */
+static uint32_t
+author_hash(const char *s, size_t len) {
+	uint32_t	 h = 2166136261u;
+
+	while (len-- > 0) {
+		h ^= (unsigned char)*s++;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+/*
+ * Store could be specified by name of any of its files, or by the name
+ * of text log it was made from.
+ */
+static void
+db_paths(struct histdb *db, const char *path) {
+	size_t	 len;
+	int	 rv;
+
+	len = strlen(path);
+	if (len > INT32_MAX)
+		errx(1, "%s: path is too long", path);
+	if (len > 4 && (strcmp(path + len - 4, ".hdb") == 0 ||
+	    strcmp(path + len - 4, ".hdx") == 0)) {
+		len -= 4;
+		rv = asprintf(&db->db_logpath, "%.*s.log", (int)len, path);
+	} else {
+		if (len > 4 && strcmp(path + len - 4, ".log") == 0)
+			len -= 4;
+		rv = asprintf(&db->db_logpath, "%s", path);
+	}
+	if (rv == -1 ||
+	    asprintf(&db->db_datapath, "%.*s.hdb", (int)len, path) == -1 ||
+	    asprintf(&db->db_idxpath, "%.*s.hdx", (int)len, path) == -1 ||
+	    asprintf(&db->db_authpath, "%.*s.hda", (int)len, path) == -1)
+		err(1, NULL);
+}
+
+/*
+ * Opens store file for appending, creating it if needed.
+ */
+static int
+open_store(const char *path, const char *magic) {
+	struct hdb_header	 hh;
+	struct stat		 st;
+	int			 fd;
+
+	if ((fd = open(path, O_RDWR|O_CREAT|O_APPEND, 0666)) == -1)
+		err(1, "%s", path);
+	if (fstat(fd, &st) == -1)
+		err(1, "%s", path);
+	if (st.st_size == 0) {
+		memset(&hh, 0, sizeof(hh));
+		memcpy(hh.hh_magic, magic, sizeof(hh.hh_magic));
+		if (write(fd, &hh, sizeof(hh)) != sizeof(hh))
+			err(1, "%s", path);
+		return fd;
+	}
+	pread_full(fd, &hh, sizeof(hh), 0, path);
+	if (memcmp(hh.hh_magic, magic, sizeof(hh.hh_magic)) != 0)
+		errx(1, "%s: not an oicb history store", path);
+	return fd;
+}
+
+/*
+ * Maps whole store file read-only.  Missing optional file gives NULL.
+ */
+static const char *
+map_store(const char *path, const char *magic, size_t *sizep, int optional) {
+	struct stat	 st;
+	const char	*p;
+	int		 fd;
+
+	if ((fd = open(path, O_RDONLY)) == -1) {
+		if (optional && errno == ENOENT)
+			return NULL;
+		err(1, "%s", path);
+	}
+	if (fstat(fd, &st) == -1)
+		err(1, "%s", path);
+	if ((size_t)st.st_size < sizeof(struct hdb_header))
+		errx(1, "%s: not an oicb history store", path);
+	p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED)
+		err(1, "%s", path);
+	close(fd);
+	if (memcmp(p, magic, sizeof(((struct hdb_header *)0)->hh_magic)) != 0)
+		errx(1, "%s: not an oicb history store", path);
+	*sizep = (size_t)st.st_size;
+	return p;
+}
+
+static void
+pread_full(int fd, void *buf, size_t len, off_t off, const char *path) {
+	ssize_t	 n;
+
+	if ((n = pread(fd, buf, len, off)) == -1)
+		err(1, "%s", path);
+	if ((size_t)n != len)
+		errx(1, "%s: truncated", path);
+}
+
+/*
+ * Returns length of the text log line the record was made from.
+ */
+static uint64_t
+rec_srclen(const struct hdb_rec *hr) {
+	if (hr->hr_flags & HDB_RAW)
+		return (uint64_t)hr->hr_textlen + 1;
+	return DATELEN + (uint64_t)hr->hr_authorlen + 2 + hr->hr_textlen + 1;
+}
+
+/*
+ * Opens store for appending, throwing away any leftovers of interrupted
+ * import: partially written index entries, index entries pointing past
+ * the data written, and records that didn't get into index.  The lines
+ * those came from will be imported again.
+ */
+static void
+db_open_writer(struct histdb *db, const char *path) {
+	struct hdx_entry	 he;
+	struct hdb_rec		 hr;
+	struct stat		 st;
+	off_t			 datasize;
+	size_t			 n, datalen;
+	char			*data;
+
+	memset(db, 0, sizeof(*db));
+	db_paths(db, path);
+	db->db_datafd = open_store(db->db_datapath, HDB_MAGIC);
+	db->db_idxfd = open_store(db->db_idxpath, HDX_MAGIC);
+
+	if (fstat(db->db_datafd, &st) == -1)
+		err(1, "%s", db->db_datapath);
+	datasize = st.st_size;
+	if (fstat(db->db_idxfd, &st) == -1)
+		err(1, "%s", db->db_idxpath);
+	n = ((size_t)st.st_size - sizeof(struct hdb_header)) / sizeof(he);
+
+	db->db_end = sizeof(struct hdb_header);
+	db->db_srcend = 0;
+	db->db_lasttime = INT64_MIN;
+	while (n > 0) {
+		pread_full(db->db_idxfd, &he, sizeof(he),
+		    (off_t)(sizeof(struct hdb_header) + (n - 1) * sizeof(he)),
+		    db->db_idxpath);
+		if (he.he_offset + he.he_size <= (uint64_t)datasize) {
+			pread_full(db->db_datafd, &hr, sizeof(hr),
+			    (off_t)he.he_offset, db->db_datapath);
+			datalen = (size_t)hr.hr_authorlen + hr.hr_textlen;
+			if (hr.hr_size != he.he_size ||
+			    sizeof(hr) + datalen > hr.hr_size)
+				errx(1, "%s: corrupted", db->db_datapath);
+			if ((data = malloc(datalen + 2)) == NULL)
+				err(1, NULL);
+			pread_full(db->db_datafd, data, datalen,
+			    (off_t)(he.he_offset + sizeof(hr)),
+			    db->db_datapath);
+			if (hr.hr_flags & HDB_RAW) {
+				db->db_lastkeyoff = hr.hr_srcoff;
+			} else {
+				// date is left out, it depends on time zone
+				memmove(data + hr.hr_authorlen + 2,
+				    data + hr.hr_authorlen, hr.hr_textlen);
+				memcpy(data + hr.hr_authorlen, ": ", 2);
+				datalen += 2;
+				db->db_lastkeyoff = hr.hr_srcoff + DATELEN;
+			}
+			db->db_lastkey = data;
+			db->db_lastkeylen = datalen;
+			db->db_end = he.he_offset + he.he_size;
+			db->db_srcend = hr.hr_srcoff + rec_srclen(&hr);
+			db->db_lasttime = he.he_time;
+			break;
+		}
+		n--;
+	}
+	db->db_nentries = n;
+
+	if (ftruncate(db->db_idxfd,
+	    (off_t)(sizeof(struct hdb_header) + n * sizeof(he))) == -1)
+		err(1, "%s", db->db_idxpath);
+	if ((uint64_t)datasize > db->db_end &&
+	    ftruncate(db->db_datafd, (off_t)db->db_end) == -1)
+		err(1, "%s", db->db_datapath);
+
+	if ((db->db_data = fdopen(db->db_datafd, "a")) == NULL)
+		err(1, "%s", db->db_datapath);
+	if ((db->db_idx = fdopen(db->db_idxfd, "a")) == NULL)
+		err(1, "%s", db->db_idxpath);
+}
+
+/*
+ * Data goes to disk before index entries, see db_open_writer().
+ */
+static void
+db_close_writer(struct histdb *db) {
+	if (fflush(db->db_data) == EOF || fsync(db->db_datafd) == -1)
+		err(1, "%s", db->db_datapath);
+	if (fclose(db->db_data) == EOF)
+		err(1, "%s", db->db_datapath);
+	if (fclose(db->db_idx) == EOF)
+		err(1, "%s", db->db_idxpath);
+	free(db->db_logpath);
+	free(db->db_datapath);
+	free(db->db_idxpath);
+	free(db->db_authpath);
+	free(db->db_lastkey);
+}
+
+static int
+hda_cmp(const void *a, const void *b) {
+	const struct hda_entry	*x = a, *y = b;
+
+	if (x->ha_authorhash != y->ha_authorhash)
+		return x->ha_authorhash < y->ha_authorhash ? -1 : 1;
+	if (x->ha_entry != y->ha_entry)
+		return x->ha_entry < y->ha_entry ? -1 : 1;
+	return 0;
+}
+
+/*
+ * Brings author index up to date with the time one: entries added since
+ * the previous run are sorted and merged with the old ones into a new
+ * file, which then replaces the old one.  Old entries pointing past the
+ * time index end are left out, they could appear after interrupted import.
+ */
+static void
+db_update_authors(struct histdb *db) {
+	struct hdb_header	 hh;
+	struct hda_entry	*fresh;
+	const struct hda_entry	*old = NULL, *a;
+	const struct hdx_entry	*idx;
+	const char		*idxmap, *amap;
+	size_t			 idxsize, asize, nold = 0, nfresh, covered = 0;
+	size_t			 i, j;
+	char			*tmppath;
+	FILE			*fp;
+
+	amap = map_store(db->db_authpath, HDA_MAGIC, &asize, 1);
+	if (amap != NULL) {
+		memcpy(&hh, amap, sizeof(hh));
+		if (hh.hh_reserved == db->db_nentries) {
+			munmap((void *)(uintptr_t)amap, asize);
+			return;
+		}
+		covered = hh.hh_reserved < db->db_nentries ?
+		    (size_t)hh.hh_reserved : db->db_nentries;
+		old = (const struct hda_entry *)(const void *)
+		    (amap + sizeof(struct hdb_header));
+		nold = (asize - sizeof(struct hdb_header)) / sizeof(*old);
+	}
+
+	if (fflush(db->db_idx) == EOF)
+		err(1, "%s", db->db_idxpath);
+	idxmap = map_store(db->db_idxpath, HDX_MAGIC, &idxsize, 0);
+	idx = (const struct hdx_entry *)(const void *)
+	    (idxmap + sizeof(struct hdb_header));
+	nfresh = db->db_nentries - covered;
+	if ((fresh = calloc(nfresh ? nfresh : 1, sizeof(*fresh))) == NULL)
+		err(1, NULL);
+	for (i = 0; i < nfresh; i++) {
+		fresh[i].ha_authorhash = idx[covered + i].he_authorhash;
+		fresh[i].ha_entry = covered + i;
+	}
+	munmap((void *)(uintptr_t)idxmap, idxsize);
+	qsort(fresh, nfresh, sizeof(*fresh), hda_cmp);
+
+	if (asprintf(&tmppath, "%s.tmp", db->db_authpath) == -1)
+		err(1, NULL);
+	if ((fp = fopen(tmppath, "w")) == NULL)
+		err(1, "%s", tmppath);
+	memset(&hh, 0, sizeof(hh));
+	memcpy(hh.hh_magic, HDA_MAGIC, sizeof(hh.hh_magic));
+	hh.hh_reserved = db->db_nentries;
+	if (fwrite(&hh, sizeof(hh), 1, fp) != 1)
+		err(1, "%s", tmppath);
+	for (i = j = 0; i < nold || j < nfresh;) {
+		if (i < nold && old[i].ha_entry >= covered) {
+			i++;
+			continue;
+		}
+		if (j == nfresh || (i < nold && hda_cmp(&old[i], &fresh[j]) < 0))
+			a = &old[i++];
+		else
+			a = &fresh[j++];
+		if (fwrite(a, sizeof(*a), 1, fp) != 1)
+			err(1, "%s", tmppath);
+	}
+	if (fflush(fp) == EOF || fsync(fileno(fp)) == -1 || fclose(fp) == EOF)
+		err(1, "%s", tmppath);
+	if (rename(tmppath, db->db_authpath) == -1)
+		err(1, "%s", db->db_authpath);
+	if (amap != NULL)
+		munmap((void *)(uintptr_t)amap, asize);
+	free(fresh);
+	free(tmppath);
+}
+
+static void
+db_append(struct histdb *db, int64_t t, uint64_t srcoff, uint16_t flags,
+    const char *author, size_t alen, const char *text, size_t tlen) {
+	static const char	 pad[HDB_ALIGN];
+	struct hdb_rec		 hr;
+	struct hdx_entry	 he;
+	size_t			 size;
+
+	if (tlen > UINT32_MAX - sizeof(hr) - UINT16_MAX - HDB_ALIGN)
+		errx(1, "%s: line at offset %llu is too long",
+		    db->db_datapath, (unsigned long long)srcoff);
+	size = HDB_PAD(sizeof(hr) + alen + tlen);
+
+	memset(&hr, 0, sizeof(hr));
+	hr.hr_size = (uint32_t)size;
+	hr.hr_authorhash = author_hash(author, alen);
+	hr.hr_time = t;
+	hr.hr_srcoff = srcoff;
+	hr.hr_authorlen = (uint16_t)alen;
+	hr.hr_flags = flags;
+	hr.hr_textlen = (uint32_t)tlen;
+	if (fwrite(&hr, sizeof(hr), 1, db->db_data) != 1 ||
+	    (alen != 0 && fwrite(author, 1, alen, db->db_data) != alen) ||
+	    fwrite(text, 1, tlen, db->db_data) != tlen ||
+	    fwrite(pad, 1, size - sizeof(hr) - alen - tlen, db->db_data) !=
+	    size - sizeof(hr) - alen - tlen)
+		err(1, "%s", db->db_datapath);
+
+	memset(&he, 0, sizeof(he));
+	he.he_time = t > db->db_lasttime ? t : db->db_lasttime;
+	he.he_offset = db->db_end;
+	he.he_authorhash = hr.hr_authorhash;
+	he.he_size = hr.hr_size;
+	if (fwrite(&he, sizeof(he), 1, db->db_idx) != 1)
+		err(1, "%s", db->db_idxpath);
+
+	db->db_end += size;
+	db->db_srcend = srcoff + rec_srclen(&hr);
+	db->db_lasttime = he.he_time;
+	db->db_nentries++;
+}
+
+/*
+ * Checks that time given is displayed as the date prefix of the line.
+ */
+static int
+date_matches(const char *s, time_t t) {
+	struct tm	 tm;
+	char		 buf[DATELEN + 1];
+
+	if (localtime_r(&t, &tm) == NULL ||
+	    strftime(buf, sizeof(buf), DATEFMT, &tm) != DATELEN)
+		return 0;
+	return memcmp(buf, s, DATELEN) == 0;
+}
+
+/*
+ * Parses date prefix of history line.  Dates that don't survive
+ * conversion back to text unchanged are rejected, so export always
+ * gives the original line.
+ *
+ * The mktime(3) is slow, because it checks for time zone changes every
+ * time, so the start of the last hour seen is remembered and reused
+ * while the result passes the check above.
+ */
+static int
+parse_date(const char *s, time_t *tp) {
+	static const char	 pattern[] = "dddd-dd-dd dd:dd:dd ";
+	static char		 last_hour[13];		// "YYYY-MM-DD HH"
+	static time_t		 last_base = -1;
+	struct tm		 tm;
+	int			 i, minsec;
+
+	for (i = 0; i < DATELEN; i++)
+		if (pattern[i] == 'd' ? (s[i] < '0' || s[i] > '9') :
+		    s[i] != pattern[i])
+			return 0;
+
+#define DIGITS2(p)	(((p)[0] - '0') * 10 + (p)[1] - '0')
+	minsec = DIGITS2(s + 14) * 60 + DIGITS2(s + 17);
+	if (last_base != -1 && memcmp(s, last_hour, sizeof(last_hour)) == 0) {
+		*tp = last_base + minsec;
+		if (date_matches(s, *tp))
+			return 1;
+		// time offset has changed within this hour
+	}
+
+	memset(&tm, 0, sizeof(tm));
+	tm.tm_year = DIGITS2(s) * 100 + DIGITS2(s + 2) - 1900;
+	tm.tm_mon = DIGITS2(s + 5) - 1;
+	tm.tm_mday = DIGITS2(s + 8);
+	tm.tm_hour = DIGITS2(s + 11);
+	tm.tm_min = DIGITS2(s + 14);
+	tm.tm_sec = DIGITS2(s + 17);
+	tm.tm_isdst = -1;
+#undef DIGITS2
+	if ((*tp = mktime(&tm)) == -1 || !date_matches(s, *tp))
+		return 0;
+	memcpy(last_hour, s, sizeof(last_hour));
+	last_base = *tp - minsec;
+	return 1;
+}
+
+static void
+import_line(struct histdb *db, const char *line, size_t len,
+    uint64_t srcoff) {
+	const char	*author, *p, *end = line + len;
+	time_t		 t;
+
+	if (len < DATELEN + 2 || !parse_date(line, &t))
+		goto raw;
+	author = line + DATELEN;
+	for (p = author; (p = memchr(p, ':', (size_t)(end - p))) != NULL; p++)
+		if (p + 1 < end && p[1] == ' ')
+			break;
+	if (p == NULL || p - author > UINT16_MAX)
+		goto raw;
+	db_append(db, t, srcoff, 0, author, (size_t)(p - author),
+	    p + 2, (size_t)(end - p - 2));
+	return;
+
+raw:
+	db_append(db, db->db_lasttime == INT64_MIN ? 0 : db->db_lasttime,
+	    srcoff, HDB_RAW, NULL, 0, line, len);
+}
+
+/*
+ * If the file name is of rotated log segment, returns pointer to the
+ * suffix added, ".YYYY-MM-DD[.N].log[.gz]".
+ */
+static const char *
+segment_suffix(const char *name) {
+	static const char	 pattern[] = ".dddd-dd-dd";
+	const char		*p, *end;
+	size_t			 len, i;
+
+	len = strlen(name);
+	if (len > 7 && strcmp(name + len - 7, ".log.gz") == 0)
+		end = name + len - 7;
+	else if (len > 4 && strcmp(name + len - 4, ".log") == 0)
+		end = name + len - 4;
+	else
+		return NULL;
+
+	for (p = end; p > name && p[-1] >= '0' && p[-1] <= '9'; p--)
+		;
+	if (p < end && p > name && p[-1] == '.' && *p != '0')
+		end = p - 1;
+	if (end - name < (ptrdiff_t)sizeof(pattern))
+		return NULL;
+	p = end - (sizeof(pattern) - 1);
+	for (i = 0; i < sizeof(pattern) - 1; i++)
+		if (pattern[i] == 'd' ? (p[i] < '0' || p[i] > '9') :
+		    p[i] != pattern[i])
+			return NULL;
+	return p;
+}
+
+static int
+segment_cmp(const void *a, const void *b) {
+	const struct segment	*x = a, *y = b;
+	int			 rv;
+
+	if (x->s_current != y->s_current)
+		return x->s_current - y->s_current;
+	if ((rv = strcmp(x->s_day, y->s_day)) != 0)
+		return rv;
+	if (x->s_seq != y->s_seq)
+		return x->s_seq < y->s_seq ? -1 : 1;
+	return x->s_compressed - y->s_compressed;
+}
+
+/*
+ * Finds rotated segments of the log, and puts them into *segsp, oldest
+ * first, followed by the log itself, if it exists.  Segments being
+ * compressed are taken in plain form.  Returns number of entries.
+ */
+static size_t
+list_segments(const char *logpath, struct segment **segsp) {
+	struct segment	*segs = NULL, *seg;
+	struct dirent	*de;
+	struct stat	 st;
+	const char	*base, *suffix;
+	char		*dir;
+	size_t		 baselen, n = 0, size = 16, i, j;
+	DIR		*dp;
+
+	base = strrchr(logpath, '/');
+	if (base == NULL) {
+		dir = strdup("./");
+		base = logpath;
+	} else {
+		dir = strndup(logpath, (size_t)(base - logpath) + 1);
+		base++;
+	}
+	if (dir == NULL || (segs = calloc(size, sizeof(*segs))) == NULL)
+		err(1, NULL);
+	baselen = strlen(base);
+	// logs not named by oicb aren't rotated
+	if (baselen > 4 && strcmp(base + baselen - 4, ".log") == 0)
+		dp = opendir(dir);
+	else
+		dp = NULL;
+	baselen -= 4;
+	while (dp != NULL && (de = readdir(dp)) != NULL) {
+		suffix = segment_suffix(de->d_name);
+		if (suffix != de->d_name + baselen ||
+		    strncmp(de->d_name, base, baselen) != 0)
+			continue;
+		// one more for the log itself
+		if (n + 1 == size) {
+			size *= 2;
+			if ((seg = reallocarray(segs, size,
+			    sizeof(*seg))) == NULL)
+				err(1, NULL);
+			segs = seg;
+		}
+		seg = &segs[n++];
+		memset(seg, 0, sizeof(*seg));
+		if (asprintf(&seg->s_path, "%s%s", dir, de->d_name) == -1)
+			err(1, NULL);
+		memcpy(seg->s_day, suffix + 1, sizeof(seg->s_day) - 1);
+		if (suffix[11] == '.' && suffix[12] != 'l')
+			seg->s_seq = strtoul(suffix + 12, NULL, 10);
+		seg->s_compressed = strcmp(de->d_name + strlen(de->d_name) - 3,
+		    ".gz") == 0;
+	}
+	if (dp != NULL)
+		closedir(dp);
+	free(dir);
+	if (stat(logpath, &st) == 0) {
+		seg = &segs[n++];
+		memset(seg, 0, sizeof(*seg));
+		if ((seg->s_path = strdup(logpath)) == NULL)
+			err(1, NULL);
+		seg->s_current = 1;
+	}
+	qsort(segs, n, sizeof(*segs), segment_cmp);
+
+	// plain ones go first, see segment_cmp()
+	for (i = j = 0; i < n; i++) {
+		if (j > 0 && !segs[i].s_current && !segs[j - 1].s_current &&
+		    segs[i].s_seq == segs[j - 1].s_seq &&
+		    strcmp(segs[i].s_day, segs[j - 1].s_day) == 0) {
+			free(segs[i].s_path);
+			continue;
+		}
+		segs[j++] = segs[i];
+	}
+	*segsp = segs;
+	return j;
+}
+
+/*
+ * Tells if the log, plain or compressed, has the last line imported
+ * at its place.  Reading on through compressed log is the only way
+ * to get there, but that's done once per rotation.
+ */
+static int
+source_matches(const struct histdb *db, const char *path) {
+	gzFile	 gz;
+	char	*buf;
+	int	 n, rv = 0;
+
+	if (db->db_lastkeylen > INT32_MAX)
+		return 0;
+	if ((gz = gzopen(path, "rb")) == NULL) {
+		warn("%s", path);
+		return 0;
+	}
+	if ((buf = malloc(db->db_lastkeylen + 1)) == NULL)
+		err(1, NULL);
+	if (gzseek(gz, (z_off_t)db->db_lastkeyoff, SEEK_SET) != -1 &&
+	    (n = gzread(gz, buf, (unsigned)db->db_lastkeylen + 1)) >= 0 &&
+	    (size_t)n >= db->db_lastkeylen &&
+	    memcmp(buf, db->db_lastkey, db->db_lastkeylen) == 0)
+		// unfinished line at the end of rotated segment is fine
+		rv = (size_t)n == db->db_lastkeylen ||
+		    buf[db->db_lastkeylen] == '\n';
+	free(buf);
+	gzclose(gz);
+	return rv;
+}
+
+/*
+ * Imports lines of plain text log starting at the offset given.
+ * Unfinished line at the end is left for the next time, unless
+ * the log is rotated segment and won't grow anymore.
+ */
+static void
+import_plain(struct histdb *db, const char *path, uint64_t off,
+    int current) {
+	struct stat	 st;
+	const char	*map, *p, *end, *nl;
+	size_t		 maplen;
+	off_t		 mapoff;
+	long		 pagesize;
+	int		 fd;
+
+	if ((fd = open(path, O_RDONLY)) == -1)
+		err(1, "%s", path);
+	if (fstat(fd, &st) == -1)
+		err(1, "%s", path);
+	if ((uint64_t)st.st_size > off) {
+		// map only the part not imported yet
+		pagesize = sysconf(_SC_PAGESIZE);
+		mapoff = (off_t)off & ~(off_t)(pagesize - 1);
+		maplen = (size_t)(st.st_size - mapoff);
+		map = mmap(NULL, maplen, PROT_READ, MAP_SHARED, fd, mapoff);
+		if (map == MAP_FAILED)
+			err(1, "%s", path);
+		posix_madvise((void *)(uintptr_t)map, maplen,
+		    POSIX_MADV_SEQUENTIAL);
+		end = map + maplen;
+		for (p = map + (off - (uint64_t)mapoff); p < end;
+		    p = nl + 1) {
+			if ((nl = memchr(p, '\n', (size_t)(end - p))) == NULL) {
+				if (!current)
+					import_line(db, p, (size_t)(end - p),
+					    (uint64_t)mapoff +
+					    (uint64_t)(p - map));
+				break;
+			}
+			import_line(db, p, (size_t)(nl - p),
+			    (uint64_t)mapoff + (uint64_t)(p - map));
+		}
+		munmap((void *)(uintptr_t)map, maplen);
+	}
+	close(fd);
+}
+
+/*
+ * Imports lines of compressed log segment, starting at the offset
+ * in text given.
+ */
+static void
+import_compressed(struct histdb *db, const char *path, uint64_t off) {
+	gzFile		 gz;
+	char		*buf, *nbuf;
+	const char	*p, *nl;
+	size_t		 bufsize = GZ_BUFSIZE, have = 0;
+	int		 n;
+
+	if ((gz = gzopen(path, "rb")) == NULL)
+		err(1, "%s", path);
+	gzbuffer(gz, GZ_BUFSIZE);
+	if (off > 0 && gzseek(gz, (z_off_t)off, SEEK_SET) == -1)
+		errx(1, "%s: %s", path, gzerror(gz, &n));
+	if ((buf = malloc(bufsize)) == NULL)
+		err(1, NULL);
+	for (;;) {
+		if (have == bufsize) {
+			// line doesn't fit
+			if ((nbuf = realloc(buf, bufsize * 2)) == NULL)
+				err(1, NULL);
+			buf = nbuf;
+			bufsize *= 2;
+		}
+		n = gzread(gz, buf + have, (unsigned)(bufsize - have));
+		if (n == -1)
+			errx(1, "%s: %s", path, gzerror(gz, &n));
+		if (n == 0)
+			break;
+		have += (size_t)n;
+		for (p = buf; (nl = memchr(p, '\n',
+		    have - (size_t)(p - buf))) != NULL; p = nl + 1) {
+			import_line(db, p, (size_t)(nl - p), off);
+			off += (uint64_t)(nl - p) + 1;
+		}
+		have -= (size_t)(p - buf);
+		memmove(buf, p, have);
+	}
+	if (have > 0)
+		import_line(db, buf, have, off);
+	free(buf);
+	gzclose(gz);
+}
+
+/*
+ * Continues import from the log the last line imported came from,
+ * going through segments rotated after it.  Stores made from scratch
+ * get all the segments.  Rotated segments given by themselves are
+ * skipped, the log they came from takes care of them.
+ */
+static void
+import_log(const char *path, int verbose) {
+	struct histdb	 db;
+	struct segment	*segs;
+	const char	*name;
+	size_t		 nsegs, first, i, nimported;
+
+	name = strrchr(path, '/');
+	name = name ? name + 1 : path;
+	if (segment_suffix(name) != NULL) {
+		if (verbose)
+			fprintf(stderr, "%s: rotated segment, skipped\n", path);
+		return;
+	}
+
+	db_open_writer(&db, path);
+	path = db.db_logpath;
+	nimported = db.db_nentries;
+	nsegs = list_segments(path, &segs);
+	first = 0;
+	if (db.db_lastkey != NULL) {
+		for (first = nsegs; first > 0; first--)
+			if (source_matches(&db, segs[first - 1].s_path))
+				break;
+		if (first-- == 0)
+			errx(1, "%s: last line imported is not found, "
+			    "was it replaced?", path);
+	}
+	for (i = first; i < nsegs; i++) {
+		if (segs[i].s_compressed)
+			import_compressed(&db, segs[i].s_path,
+			    i == first ? db.db_srcend : 0);
+		else
+			import_plain(&db, segs[i].s_path,
+			    i == first ? db.db_srcend : 0, segs[i].s_current);
+	}
+	for (i = 0; i < nsegs; i++)
+		free(segs[i].s_path);
+	free(segs);
+
+	nimported = db.db_nentries - nimported;
+	if (verbose)
+		fprintf(stderr, "%s: %zu records imported\n", path, nimported);
+	db_update_authors(&db);
+	db_close_writer(&db);
+}
+
+static void
+db_open_reader(struct histdb *db, const char *path) {
+	struct hdb_header	 hh;
+	const char		*idx, *amap;
+	size_t			 idxsize, asize;
+
+	memset(db, 0, sizeof(*db));
+	db_paths(db, path);
+	db->db_datamap = map_store(db->db_datapath, HDB_MAGIC,
+	    &db->db_datasize, 0);
+	idx = map_store(db->db_idxpath, HDX_MAGIC, &idxsize, 0);
+	db->db_index = (const struct hdx_entry *)(const void *)
+	    (idx + sizeof(struct hdb_header));
+	db->db_nentries = (idxsize - sizeof(struct hdb_header)) /
+	    sizeof(struct hdx_entry);
+
+	// stores made by older versions have no author index
+	amap = map_store(db->db_authpath, HDA_MAGIC, &asize, 1);
+	if (amap == NULL)
+		return;
+	memcpy(&hh, amap, sizeof(hh));
+	db->db_authors = (const struct hda_entry *)(const void *)
+	    (amap + sizeof(struct hdb_header));
+	db->db_nauthors = (asize - sizeof(struct hdb_header)) /
+	    sizeof(struct hda_entry);
+	db->db_authcovered = hh.hh_reserved < db->db_nentries ?
+	    (size_t)hh.hh_reserved : db->db_nentries;
+}
+
+/*
+ * Prints record in the text log format.
+ */
+static void
+print_rec(const struct hdb_rec *hr) {
+	static int64_t	 last_time = INT64_MIN;
+	static char	 date[DATELEN + 1];
+	const char	*data = (const char *)(hr + 1);
+	struct tm	 tm;
+	time_t		 t;
+
+	if (hr->hr_flags & HDB_RAW) {
+		fwrite(data, 1, hr->hr_textlen, stdout);
+		putchar('\n');
+		return;
+	}
+	if (hr->hr_time != last_time) {
+		t = (time_t)hr->hr_time;
+		if (localtime_r(&t, &tm) == NULL)
+			err(1, "localtime");
+		strftime(date, sizeof(date), DATEFMT, &tm);
+		last_time = hr->hr_time;
+	}
+	fwrite(date, 1, DATELEN, stdout);
+	fwrite(data, 1, hr->hr_authorlen, stdout);
+	fputs(": ", stdout);
+	fwrite(data + hr->hr_authorlen, 1, hr->hr_textlen, stdout);
+	putchar('\n');
+}
+
+/*
+ * Prints record of index entry if it matches query, returning 1 then.
+ */
+static size_t
+query_entry(const struct histdb *db, const struct query *q,
+    const struct hdx_entry *he) {
+	const struct hdb_rec	*hr;
+
+	if (q->q_author != NULL && he->he_authorhash != q->q_authorhash)
+		return 0;
+	if (he->he_offset > db->db_datasize ||
+	    he->he_size > db->db_datasize - he->he_offset ||
+	    he->he_size < sizeof(*hr))
+		errx(1, "%s: corrupted index", db->db_idxpath);
+	hr = (const struct hdb_rec *)(const void *)
+	    (db->db_datamap + he->he_offset);
+	if (sizeof(*hr) + hr->hr_authorlen + (size_t)hr->hr_textlen >
+	    he->he_size)
+		errx(1, "%s: corrupted", db->db_datapath);
+	if (q->q_author != NULL && ((hr->hr_flags & HDB_RAW) ||
+	    hr->hr_authorlen != q->q_authorlen ||
+	    memcmp(hr + 1, q->q_author, q->q_authorlen) != 0))
+		return 0;
+	// real time differs from indexed one after clock went back
+	if (hr->hr_time < q->q_since)
+		return 0;
+	print_rec(hr);
+	return 1;
+}
+
+/*
+ * Prints records matching query, returning their count.
+ */
+static size_t
+run_query(const struct histdb *db, const struct query *q) {
+	const struct hdx_entry	*he, *end;
+	const struct hda_entry	*a, *aend;
+	size_t			 lo, hi, alo, ahi, mid, n = 0;
+
+	// first entry with he_time >= q_since
+	lo = 0;
+	hi = db->db_nentries;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (db->db_index[mid].he_time < q->q_since)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (q->q_author != NULL && db->db_authors != NULL) {
+		// first author index entry of the author at or after lo
+		alo = 0;
+		ahi = db->db_nauthors;
+		while (alo < ahi) {
+			mid = alo + (ahi - alo) / 2;
+			a = &db->db_authors[mid];
+			if (a->ha_authorhash < q->q_authorhash ||
+			    (a->ha_authorhash == q->q_authorhash &&
+			    a->ha_entry < lo))
+				alo = mid + 1;
+			else
+				ahi = mid;
+		}
+		aend = db->db_authors + db->db_nauthors;
+		for (a = db->db_authors + alo; a < aend &&
+		    a->ha_authorhash == q->q_authorhash &&
+		    a->ha_entry < db->db_authcovered; a++) {
+			he = db->db_index + a->ha_entry;
+			if (he->he_time >= q->q_until)
+				break;
+			n += query_entry(db, q, he);
+		}
+		// entries added after author index was written
+		if (lo < db->db_authcovered)
+			lo = db->db_authcovered;
+	}
+
+	end = db->db_index + db->db_nentries;
+	for (he = db->db_index + lo; he < end && he->he_time < q->q_until;
+	    he++)
+		n += query_entry(db, q, he);
+	return n;
+}
+
+/*
+ * Accepts local time in the same format as history logs, with time
+ * or seconds part optional.
+ */
+static int64_t
+parse_time(const char *s) {
+	static const char	*formats[] = {
+		"%Y-%m-%d %H:%M:%S", "%Y-%m-%d %H:%M", "%Y-%m-%d",
+	};
+	struct tm		 tm;
+	const char		*ep;
+	size_t			 i;
+	time_t			 t;
+
+	for (i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+		memset(&tm, 0, sizeof(tm));
+		ep = strptime(s, formats[i], &tm);
+		if (ep == NULL || *ep != '\0')
+			continue;
+		tm.tm_isdst = -1;
+		if ((t = mktime(&tm)) == -1)
+			break;
+		return (int64_t)t;
+	}
+	errx(1, "invalid time: %s", s);
+}
+
+int
+main(int argc, char **argv) {
+	struct histdb	 db;
+	struct query	 q;
+	const char	*cmd;
+	int		 ch, i, verbose = 0;
+
+	if (argc < 2)
+		usage();
+	cmd = argv[1];
+	argc--;
+	argv++;
+
+	if (strcmp(cmd, "import") == 0) {
+		while ((ch = getopt(argc, argv, "v")) != -1) {
+			switch (ch) {
+			case 'v':
+				verbose = 1;
+				break;
+			default:
+				usage();
+			}
+		}
+		argc -= optind;
+		argv += optind;
+		if (argc == 0)
+			usage();
+		for (i = 0; i < argc; i++)
+			import_log(argv[i], verbose);
+		return 0;
+	}
+
+	memset(&q, 0, sizeof(q));
+	q.q_since = INT64_MIN;
+	q.q_until = INT64_MAX;
+	if (strcmp(cmd, "query") == 0) {
+		while ((ch = getopt(argc, argv, "a:s:u:")) != -1) {
+			switch (ch) {
+			case 'a':
+				q.q_author = optarg;
+				q.q_authorlen = strlen(optarg);
+				q.q_authorhash = author_hash(optarg,
+				    q.q_authorlen);
+				break;
+			case 's':
+				q.q_since = parse_time(optarg);
+				break;
+			case 'u':
+				q.q_until = parse_time(optarg);
+				break;
+			default:
+				usage();
+			}
+		}
+		argc -= optind;
+		argv += optind;
+	} else if (strcmp(cmd, "export") == 0) {
+		argc--;
+		argv++;
+	} else
+		usage();
+	if (argc == 0)
+		usage();
+
+	for (i = 0; i < argc; i++) {
+		db_open_reader(&db, argv[i]);
+		run_query(&db, &q);
+	}
+	if (fflush(stdout) == EOF || ferror(stdout))
+		err(1, "stdout");
+	return 0;
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2026 Vadim Zhukov <zhuk@openbsd.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Indexed binary history store, made from text logs by oicb-histdb.
+ *
+ * Each "foo.log" gets a pair of append-only files: "foo.hdb" holding
+ * records, and "foo.hdx" holding fixed-size index entries, one per record,
+ * sorted by time.  A third file, "foo.hda", lists index entry numbers
+ * sorted by author hash, and is rewritten by every import.  All of them
+ * are meant to be read through mmap(2): time ranges are found with binary
+ * search in the time index, and per-author queries with binary search
+ * in the author one, so only records of the author are looked at.
+ *
+ * Data is stored in host byte order, and every structure is 8-byte aligned.
+ */
+
+#ifndef OICB_HISTDB_H
+#define OICB_HISTDB_H
+
+#include <stdint.h>
+
+#define HDB_MAGIC	"OICBHDB1"
+#define HDX_MAGIC	"OICBHDX1"
+#define HDA_MAGIC	"OICBHDA1"
+#define HDB_ALIGN	8
+
+struct hdb_header {
+	char		hh_magic[8];
+	uint64_t	hh_reserved;
+};
+
+/*
+ * Author and text follow the record header, without NULs; the record
+ * is padded to HDB_ALIGN.  hr_srcoff is the offset of the line in text
+ * log, this way the import can be continued after the last record.
+ */
+struct hdb_rec {
+	uint32_t	hr_size;	// including header and padding
+	uint32_t	hr_authorhash;
+	int64_t		hr_time;
+	uint64_t	hr_srcoff;
+	uint16_t	hr_authorlen;
+	uint16_t	hr_flags;
+	uint32_t	hr_textlen;
+};
+
+#define HDB_RAW		0x0001	// not a "date author: text" line, kept as is
+
+/*
+ * Index entries are kept sorted by he_time, which is never less than
+ * of the previous entry, even if clock went backwards while logging;
+ * hr_time always has the real value.
+ */
+struct hdx_entry {
+	int64_t		he_time;
+	uint64_t	he_offset;
+	uint32_t	he_authorhash;
+	uint32_t	he_size;
+};
+
+/*
+ * Author index entries are sorted by author hash, then by entry number,
+ * and so by time, too.  The hh_reserved field of author index header
+ * holds the number of time index entries covered; the ones added after
+ * that, e.g., by an interrupted import, have to be looked through.
+ */
+struct hda_entry {
+	uint32_t	ha_authorhash;
+	uint32_t	ha_reserved;
+	uint64_t	ha_entry;	// number of entry in time index
+};
+
+#endif // OICB_HISTDB_H
@@ -15,11 +15,16 @@
  */
 
 #include <sys/types.h>
+#include <sys/file.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <ctype.h>
+#include <dirent.h>
 #include <err.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <stdint.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -27,47 +32,78 @@
 #include <unistd.h>
 
 #include "oicb.h"
+#include "compress.h"
 #include "history.h"
+#include "intern.h"
+#include "json.h"
+#include "linebuf.h"
+#include "logfile.h"
+#include "probes.h"
+#include "search.h"
+#include "stats.h"
+#include "trace.h"
 
 
 struct history_files_list history_files;
 
-static struct history_file	*get_history_file(char *path);
-static char			*get_save_path_for(char type, const char *peer,
+static struct history_file	*get_history_file(const char *path);
+static struct icb_task		*dequeue_history_task(struct history_file *hf);
+static const char		*get_save_path_for(char type, name_id peer,
                                                    const char *msg);
+static int			 open_history_file(struct history_file *hf);
+static void			 close_history_file(struct history_file *hf);
+static void			 unmap_history_file(struct history_file *hf);
+static int			 open_wait_file(const struct history_file *hf,
+                                               int flags);
+static int			 history_file_moved(const struct history_file *hf);
+static void			 check_history_file(struct history_file *hf,
+                                                    time_t now);
+static void			 share_history_file(struct history_file *hf);
+static off_t			 drop_partial_line(struct history_file *hf,
+                                                   size_t nwritten);
+static off_t			 find_text_end(int fd, off_t size);
+static int			 preallocate(int fd, off_t off, off_t len);
+static int			 map_history_window(struct history_file *hf,
+                                                    size_t len);
+static int			 append_mapped(struct history_file *hf,
+                                               const struct icb_task *it);
+static int			 need_rotation(struct history_file *hf,
+                                               const struct icb_task *it);
+static int			 lock_history_dir(const struct history_file *hf);
+static int			 rotate_history_file(struct history_file *hf);
+static int			 parse_segment_name(const char *name,
+                                                    size_t *baselen,
+                                                    char *day, unsigned *seq);
 
 int		 enable_history = 1;
+int		 history_mmap;
+size_t		 backlog_lines;
+off_t		 rotate_size;
+int		 rotate_daily;
 char		 history_path[PATH_MAX];
 
 
-static char*
-get_save_path_for(char type, const char *peer, const char *msg) {
-	int		 rv;
-	const char	*prefix;
-	char		*path;
+/*
+ * Paths are made once per name, see intern.c.
+ */
+static const char *
+get_save_path_for(char type, name_id peer, const char *msg) {
+	const char	*p;
 
 #define NO_SUCH_USER	"No such user "
 	if (type == 'e' &&
 	    strncmp(msg, NO_SUCH_USER, strlen(NO_SUCH_USER)) == 0) {
 		// Those errors occur happen in private chats,
 		// so it's logical to save them there.
-		peer = msg + strlen(NO_SUCH_USER);
-		prefix = "private-";
-	} else if (type != 'c') {
-		peer = room;
-		prefix = "room-";
-	} else {
-		prefix = "private-";
-	}
-
-	rv = asprintf(&path, "%s/%s%s.log", history_path, prefix, peer);
-	if (rv == -1)
-		return NULL;
-	return path;
+		p = msg + strlen(NO_SUCH_USER);
+		return name_log_path(intern_name(p, strlen(p)), 1);
+	} else if (type != 'c')
+		return name_log_path(intern_name(room, strlen(room)), 0);
+	return name_log_path(peer, 1);
 }
 
 static struct history_file*
-get_history_file(char *path) {
+get_history_file(const char *path) {
 	struct history_file	*hf;
 
 	LIST_FOREACH(hf, &history_files, hf_entry) {
@@ -78,10 +114,14 @@ get_history_file(char *path) {
 	hf = calloc(1, sizeof(struct history_file));
 	if (hf == NULL)
 		goto fail;
-	hf->hf_path = strdup(path);
+	STATS_ALLOC(sizeof(struct history_file));
+	if ((hf->hf_path = strdup(path)) == NULL)
+		goto fail;
+	STATS_ALLOC(strlen(path) + 1);
 	if (create_dir_for(hf->hf_path) == -1)
 		goto fail;
 	hf->hf_fd = -1;    /* to be opened later */
+	hf->hf_waitfd = -1;
 	SIMPLEQ_INIT(&hf->hf_tasks);
 	LIST_INSERT_HEAD(&history_files, hf, hf_entry);
 
@@ -89,10 +129,21 @@ found:
 	return hf;
 
 fail:
+	if (hf != NULL)
+		free(hf->hf_path);
 	free(hf);
 	return NULL;
 }
 
+static struct icb_task *
+dequeue_history_task(struct history_file *hf) {
+	struct icb_task	*it;
+
+	if ((it = dequeue_task(&hf->hf_tasks, &hf->hf_qstats)) != NULL)
+		queue_stats_remove(&stats.st_history, it->it_len);
+	return it;
+}
+
 /*
  * Creates directory recursively.
  * Given /foo/bar/buz as path, it'll attempt to create /foo/var directory.
@@ -122,14 +173,19 @@ create_dir_for(char *path) {
 	return ec;
 }
 
+/*
+ * Queues the line to be saved in the history log.  For messages sent,
+ * the peer only matters in private chats.
+ */
 void
-save_history(char type, const char *peer, const char *msg, int incoming) {
+save_history(char type, name_id peer, const char *msg, int incoming) {
 	struct history_file	*hf;
 	struct icb_task		*it = NULL;
 	struct tm		*now;
-	size_t			 datasz;
+	size_t			 datasz, msglen, partlen, maxpart, peerlen;
 	time_t			 t;
-	char			*path;
+	const char		*path, *author;
+	char			*p;
 	const int		 datelen = 20;
 
 	if (!enable_history)
@@ -143,25 +199,57 @@ save_history(char type, const char *peer, const char *msg, int incoming) {
 	hf = get_history_file(path);
 	if (hf == NULL)
 		goto fail;
+	hf->hf_last_access = t;
 
-	if (!incoming)
-		peer = "me";
-	datasz = datelen + strlen(peer) + 2 + strlen(msg) + 1;
-	it = calloc(1, sizeof(struct icb_task) + datasz);
-	if (it == NULL)
-		goto fail;
-	strftime(it->it_data, datasz, "%Y-%m-%d %H:%M:%S ", now);
-	strlcat(it->it_data, peer, datasz);
-	strlcat(it->it_data, ": ", datasz);
-	strlcat(it->it_data, msg, datasz);
-	it->it_len = datasz;
-	it->it_data[datasz - 1] = '\n';
-	SIMPLEQ_INSERT_TAIL(&hf->hf_tasks, it, it_entry);
+	if (incoming) {
+		author = name_str(peer);
+		peerlen = name_len(peer);
+	} else {
+		author = "me";
+		peerlen = 2;
+	}
+	if (peerlen > HISTORY_RECORD_MAX / 4)
+		peerlen = HISTORY_RECORD_MAX / 4;
+
+	/*
+	 * Every line is written with a single write(2), so it doesn't get
+	 * mixed with lines of other oicb instances appending to the same
+	 * log.  Longer messages are saved as several lines, each with
+	 * the same date and author.
+	 */
+	maxpart = HISTORY_RECORD_MAX - (datelen + peerlen + 2 + 1);
+	msglen = strlen(msg);
+	do {
+		partlen = msglen;
+		if (partlen > maxpart) {
+			// avoid splitting UTF-8 characters
+			for (partlen = maxpart; partlen > maxpart - 3 &&
+			    ((unsigned char)msg[partlen] & 0xC0) == 0x80;
+			    partlen--)
+				;
+		}
+		datasz = datelen + peerlen + 2 + partlen + 1;
+		if ((it = alloc_task(datasz)) == NULL)
+			goto fail;
+		strftime(it->it_data, datasz, "%Y-%m-%d %H:%M:%S ", now);
+		p = it->it_data + datelen;
+		memcpy(p, author, peerlen);
+		p += peerlen;
+		*p++ = ':';
+		*p++ = ' ';
+		memcpy(p, msg, partlen);
+		it->it_len = datasz;
+		it->it_data[datasz - 1] = '\n';
+		enqueue_task(&hf->hf_tasks, &hf->hf_qstats, it);
+		queue_stats_add(&stats.st_history, it->it_len);
+		OICB_PROBE2(history_queued, hf->hf_path, it->it_len);
+		msg += partlen;
+		msglen -= partlen;
+	} while (msglen > 0);
 	return;
 
 fail:
 	warn(__func__);
-	free(path);
 }
 
 void
@@ -169,50 +257,88 @@ proceed_history(void) {
 	struct history_file	*hf, *thf;
 	struct icb_task	*it;
 	ssize_t			 nwritten;
+	off_t			 size;
+	time_t			 now;
 
+	compress_proceed();
+	now = time(NULL);
 	LIST_FOREACH_SAFE(hf, &history_files, hf_entry, thf) {
 		if (hf->hf_permerr)
 			continue;
+		if (hf->hf_fd != -1)
+			check_history_file(hf, now);
 		if (hf->hf_fd == -1) {
-			// error or reload happened
-			hf->hf_fd = open(hf->hf_path,
-			     O_WRONLY|O_CREAT|O_APPEND|O_NONBLOCK, 0666);
-			if (hf->hf_fd == -1) {
+			// error, reload or rotation happened, or log is busy
+			if (now < hf->hf_retry)
+				continue;
+			if (open_history_file(hf) == -1 &&
+			    errno == EWOULDBLOCK) {
+				hf->hf_retry = now + 1;
+				continue;
+			} else if (hf->hf_fd == -1) {
 				warnx("cannot open '%s', disabling history", hf->hf_path);
 				enable_history = 0;
-				while (!SIMPLEQ_EMPTY(&hf->hf_tasks)) {
-					it = SIMPLEQ_FIRST(&hf->hf_tasks);
-					SIMPLEQ_REMOVE_HEAD(&hf->hf_tasks, it_entry);
+				while ((it = dequeue_history_task(hf)) != NULL)
 					free(it);
-				}
-				hf->hf_ntasks = 0;
 				hf->hf_permerr = 1;
 			}
 		}
 		while (!SIMPLEQ_EMPTY(&hf->hf_tasks)) {
 			it = SIMPLEQ_FIRST(&hf->hf_tasks);
-			do {
-				nwritten = write(hf->hf_fd,
-				    it->it_data + it->it_ndone,
-				    it->it_len - it->it_ndone);
+			if (it->it_ndone == 0 && need_rotation(hf, it) &&
+			    rotate_history_file(hf) == -1)
+				goto next_file;	// will be reopened next time
+			size = (off_t)it->it_len;
+			if (it->it_ndone == 0 && history_mmap &&
+			    hf->hf_exclusive && !hf->hf_nomap &&
+			    append_mapped(hf, it) == 0) {
+				OICB_PROBE2(history_written, hf->hf_path,
+				    it->it_len);
+				TRACE(TraceHistoryWrite, hf->hf_fd, it->it_len);
+				it->it_ndone = it->it_len;
+				hf->hf_qstats.qs_written += it->it_len;
+				stats.st_history.qs_written += it->it_len;
+			}
+			// the whole line at once, see save_history()
+			if (it->it_ndone < it->it_len) {
+				nwritten = write(hf->hf_fd, it->it_data,
+				    it->it_len);
+				stats.st_writes++;
 				if (nwritten == -1) {
-					if (errno == EAGAIN)
+					if (errno == EAGAIN) {
+						stats.st_write_eagain++;
 						goto next_file;
+					}
 					warn("cannit write history to %s",
 					    hf->hf_path);
-					close(hf->hf_fd);
-					hf->hf_fd = -1;
+					close_history_file(hf);
 					goto next_file;
 				}
-				it->it_ndone += nwritten;
-			} while (it->it_ndone < it->it_len);
-			SIMPLEQ_REMOVE_HEAD(&hf->hf_tasks, it_entry);
-			free(it);
+				OICB_PROBE2(history_written, hf->hf_path,
+				    nwritten);
+				TRACE(TraceHistoryWrite, hf->hf_fd, nwritten);
+				it->it_ndone = it->it_len;
+				hf->hf_qstats.qs_written += nwritten;
+				stats.st_history.qs_written += nwritten;
+				if ((size_t)nwritten < it->it_len) {
+					warnx("cannot write the whole line to %s",
+					    hf->hf_path);
+					size = drop_partial_line(hf,
+					    (size_t)nwritten);
+				}
+			}
+			hf->hf_size += size;
+			memcpy(hf->hf_day, it->it_data, sizeof(hf->hf_day) - 1);
+			free(dequeue_history_task(hf));
+			search_history_written(hf->hf_path);
 		}
-		if (SIMPLEQ_EMPTY(&hf->hf_tasks) &&
-		    hf->hf_last_access < time(NULL)) {
+		// preallocating and mapping again would cost more than writes
+		if (SIMPLEQ_EMPTY(&hf->hf_tasks) && hf->hf_last_access <
+		    now - (hf->hf_map != NULL ? HISTORY_MAP_IDLE : 0)) {
 			LIST_REMOVE(hf, hf_entry);
-			close(hf->hf_fd);
+			close_history_file(hf);
+			if (hf->hf_waitfd != -1)
+				close(hf->hf_waitfd);
 			free(hf->hf_path);
 			free(hf);
 		}
@@ -221,3 +347,889 @@ next_file:
 	}
 
 }
+
+/*
+ * Tells if proceed_history() should be called again soon: lines wait
+ * for a busy log, logs open should be checked, see check_history_file(),
+ * or compressed segments should be put in place.
+ */
+int
+history_pending(void) {
+	struct history_file	*hf;
+
+	if (compress_pending() > 0)
+		return 1;
+	LIST_FOREACH(hf, &history_files, hf_entry)
+		if (hf->hf_fd != -1 || !SIMPLEQ_EMPTY(&hf->hf_tasks))
+			return 1;
+	return 0;
+}
+
+/*
+ * Opens history file for appending, and finds out its size.  Space
+ * preallocated for mapped appends, left after crash, is cut off.
+ * When rotation is enabled, date of the last line is taken, too.
+ *
+ * Other oicb instances could append to the same log: this is safe as
+ * long as lines are written at once, so everyone holds a shared lock.
+ * Mapping and cutting off need exclusive one; if the log is mapped by
+ * another instance, -1 is returned with errno set to EWOULDBLOCK, and
+ * that instance is asked to let us in, see check_history_file().
+ */
+static int
+open_history_file(struct history_file *hf) {
+	struct stat	 st;
+	off_t		 end;
+	int		 tries = 0;
+
+again:
+	// reading is needed for mapping and for recovery
+	hf->hf_fd = open(hf->hf_path, O_RDWR|O_CREAT|O_APPEND|O_NONBLOCK,
+	    0666);
+	if (hf->hf_fd == -1)
+		return -1;
+	hf->hf_exclusive = history_mmap && !hf->hf_nomap &&
+	    flock(hf->hf_fd, LOCK_EX|LOCK_NB) == 0;
+	if (!hf->hf_exclusive && flock(hf->hf_fd, LOCK_SH|LOCK_NB) == -1 &&
+	    errno == EWOULDBLOCK)
+		goto busy;
+	// rotated by another instance between open(2) and flock(2)?
+	if (history_file_moved(hf)) {
+		close(hf->hf_fd);
+		hf->hf_fd = -1;
+		if (++tries < 3)
+			goto again;
+		errno = EWOULDBLOCK;
+		return -1;
+	}
+	if (hf->hf_waitfd != -1) {
+		close(hf->hf_waitfd);
+		hf->hf_waitfd = -1;
+	}
+	hf->hf_checked = time(NULL);
+	hf->hf_size = 0;
+	hf->hf_day[0] = '\0';
+	if (fstat(hf->hf_fd, &st) == -1 || st.st_size == 0)
+		return 0;
+
+	hf->hf_size = st.st_size;
+	// preallocated windows end at page boundary
+	if (st.st_size % getpagesize() == 0 &&
+	    (end = find_text_end(hf->hf_fd, st.st_size)) != st.st_size) {
+		if (!hf->hf_exclusive &&
+		    flock(hf->hf_fd, LOCK_EX|LOCK_NB) == -1 &&
+		    errno == EWOULDBLOCK)
+			goto busy;
+		if (ftruncate(hf->hf_fd, end) == -1)
+			warn("cannot cut off preallocated space in %s",
+			    hf->hf_path);
+		if (!hf->hf_exclusive)
+			flock(hf->hf_fd, LOCK_SH);
+		hf->hf_size = end;
+	}
+	if (rotate_size || rotate_daily)
+		strftime(hf->hf_day, sizeof(hf->hf_day), "%Y-%m-%d",
+		    localtime(&st.st_mtime));
+	return 0;
+
+busy:
+	close(hf->hf_fd);
+	hf->hf_fd = -1;
+	if (hf->hf_waitfd == -1 &&
+	    (hf->hf_waitfd = open_wait_file(hf, O_RDONLY|O_CREAT)) != -1 &&
+	    flock(hf->hf_waitfd, LOCK_SH|LOCK_NB) == -1) {
+		close(hf->hf_waitfd);	// will try again
+		hf->hf_waitfd = -1;
+	}
+	errno = EWOULDBLOCK;
+	return -1;
+}
+
+/*
+ * Closes history file, cutting off space preallocated but not used.
+ */
+static void
+close_history_file(struct history_file *hf) {
+	if (hf->hf_fd == -1)
+		return;
+	unmap_history_file(hf);
+	close(hf->hf_fd);
+	hf->hf_fd = -1;
+}
+
+static void
+unmap_history_file(struct history_file *hf) {
+	if (hf->hf_map == NULL)
+		return;
+	munmap(hf->hf_map, hf->hf_maplen);
+	hf->hf_map = NULL;
+	if (ftruncate(hf->hf_fd, hf->hf_size) == -1)
+		warn("cannot cut off preallocated space in %s", hf->hf_path);
+}
+
+/*
+ * Opens "dir/.room-foo.log.wait" next to the log: instances waiting for
+ * the log hold a shared lock on it, so the one mapping the log knows
+ * it should let them in.
+ */
+static int
+open_wait_file(const struct history_file *hf, int flags) {
+	char		 path[PATH_MAX];
+	const char	*name;
+	int		 rv;
+
+	// there is always a slash, see get_history_file()
+	name = strrchr(hf->hf_path, '/') + 1;
+	rv = snprintf(path, sizeof(path), "%.*s.%s.wait",
+	    (int)(name - hf->hf_path), hf->hf_path, name);
+	if (rv < 0 || (size_t)rv >= sizeof(path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	return open(path, flags, 0666);
+}
+
+/*
+ * Tells if the path doesn't lead to the log open anymore, e.g., after
+ * another oicb instance rotated it.
+ */
+static int
+history_file_moved(const struct history_file *hf) {
+	struct stat	 st, pst;
+
+	if (fstat(hf->hf_fd, &st) == -1)
+		return 0;
+	if (stat(hf->hf_path, &pst) == -1)
+		return errno == ENOENT;
+	return st.st_dev != pst.st_dev || st.st_ino != pst.st_ino;
+}
+
+/*
+ * Called about once a second for every log open.  If someone else
+ * rotated or replaced the log, it's closed to be opened again by path.
+ * If the log is mapped while other instances wait for it, it's
+ * unmapped and shared with them.
+ */
+static void
+check_history_file(struct history_file *hf, time_t now) {
+	int	 fd;
+
+	if (hf->hf_checked == now)
+		return;
+	hf->hf_checked = now;
+	if (history_file_moved(hf)) {
+		close_history_file(hf);
+		hf->hf_retry = 0;
+		return;
+	}
+	if (!hf->hf_exclusive || (fd = open_wait_file(hf, O_RDONLY)) == -1)
+		return;
+	if (flock(fd, LOCK_EX|LOCK_NB) == -1 && errno == EWOULDBLOCK)
+		share_history_file(hf);
+	close(fd);
+}
+
+/*
+ * Stops mapping the log, and downgrades lock to the shared one, so other
+ * instances could append to it, too.  The log will be mapped again after
+ * it's reopened, if nobody else uses it then.
+ */
+static void
+share_history_file(struct history_file *hf) {
+	unmap_history_file(hf);
+	hf->hf_nomap = 1;
+	hf->hf_exclusive = 0;
+	// conversion isn't atomic, others could get exclusive lock meanwhile
+	if (flock(hf->hf_fd, LOCK_SH|LOCK_NB) == -1)
+		close_history_file(hf);
+}
+
+/*
+ * Gets rid of the line written partially, e.g., because disk is full, so
+ * the next line written doesn't continue it.  The part written is cut off
+ * if nobody appended after it, or the line is terminated otherwise.
+ * Returns how much the log grew.
+ */
+static off_t
+drop_partial_line(struct history_file *hf, size_t nwritten) {
+	struct stat	 st;
+	off_t		 end;
+
+	// the offset is right after the data appended
+	if ((end = lseek(hf->hf_fd, 0, SEEK_CUR)) != -1 &&
+	    fstat(hf->hf_fd, &st) == 0 && st.st_size == end &&
+	    ftruncate(hf->hf_fd, end - (off_t)nwritten) == 0)
+		return 0;
+	if (write(hf->hf_fd, "\n", 1) == 1)
+		return (off_t)nwritten + 1;
+	warn("cannot terminate partial line in %s", hf->hf_path);
+	return (off_t)nwritten;
+}
+
+/*
+ * Closes all history files, to be called on exit.  Logs mapped by other
+ * oicb instances are waited for a bit, while those let us in, see
+ * check_history_file().  Lines still queued after that are reported.
+ * Segments compressed by then are put in place, the rest will be
+ * compressed again on the next start, see compress_leftovers().
+ */
+void
+close_history_files(void) {
+	struct history_file	*hf;
+	struct timespec		 delay = { 0, 100 * 1000 * 1000 };
+	int			 i;
+
+	for (i = 0; i < HISTORY_EXIT_WAIT * 10; i++) {
+		LIST_FOREACH(hf, &history_files, hf_entry)
+			hf->hf_retry = 0;
+		proceed_history();
+		// hf_retry is set only if log is busy
+		LIST_FOREACH(hf, &history_files, hf_entry)
+			if (!SIMPLEQ_EMPTY(&hf->hf_tasks) && hf->hf_retry != 0)
+				break;
+		if (hf == NULL)
+			break;
+		nanosleep(&delay, NULL);
+	}
+	compress_proceed();
+
+	LIST_FOREACH(hf, &history_files, hf_entry) {
+		if (hf->hf_qstats.qs_len > 0)
+			warnx("%zu lines were not saved to %s", hf->hf_qstats.qs_len,
+			    hf->hf_path);
+		close_history_file(hf);
+		if (hf->hf_waitfd != -1) {
+			close(hf->hf_waitfd);
+			hf->hf_waitfd = -1;
+		}
+	}
+}
+
+/*
+ * Returns size of the text in the log: preallocated space is filled with
+ * NUL bytes, and they never appear in history lines.
+ */
+static off_t
+find_text_end(int fd, off_t size) {
+	char	 buf[4096];
+	off_t	 off;
+	ssize_t	 n;
+
+	while (size > 0) {
+		off = size > (off_t)sizeof(buf) ? size - (off_t)sizeof(buf) : 0;
+		if ((n = pread(fd, buf, (size_t)(size - off), off)) <= 0)
+			break;
+		while (n > 0 && buf[n - 1] == '\0')
+			n--;
+		if (n > 0)
+			return off + n;
+		size = off;
+	}
+	return size;
+}
+
+/*
+ * Makes sure file blocks in the range given are allocated, so stores
+ * into mapping can't fail with SIGBUS when disk gets full.  Without
+ * posix_fallocate(3), zeroes are appended up to the end of the range:
+ * space up to the current end of file was preallocated the same way.
+ * Returns errno value on failure.
+ */
+static int
+preallocate(int fd, off_t off, off_t len) {
+#ifdef HAVE_POSIX_FALLOCATE
+	return posix_fallocate(fd, off, len);
+#else
+	static const char	 zeroes[64 * 1024];
+	struct stat		 st;
+	off_t			 size;
+	size_t			 n;
+	ssize_t			 nwritten;
+
+	if (fstat(fd, &st) == -1)
+		return errno;
+	for (size = st.st_size; size < off + len; size += nwritten) {
+		n = sizeof(zeroes);
+		if (off + len - size < (off_t)n)
+			n = (size_t)(off + len - size);
+		if ((nwritten = write(fd, zeroes, n)) == -1)
+			return errno;
+	}
+	return 0;
+#endif
+}
+
+/*
+ * Maps the part of file starting at the page where text ends, at least
+ * len bytes more, preallocating space for it.  Window size is a multiple
+ * of HISTORY_EXTENT, so this happens rarely.
+ */
+static int
+map_history_window(struct history_file *hf, size_t len) {
+	off_t	 off;
+	size_t	 maplen;
+	int	 error;
+
+	if (hf->hf_map != NULL) {
+		munmap(hf->hf_map, hf->hf_maplen);
+		hf->hf_map = NULL;
+	}
+	off = hf->hf_size - hf->hf_size % getpagesize();
+	maplen = (size_t)(hf->hf_size - off) + len;
+	maplen += HISTORY_EXTENT - maplen % HISTORY_EXTENT;
+
+	if ((error = preallocate(hf->hf_fd, off, (off_t)maplen)) != 0) {
+		errno = error;
+		goto fail;
+	}
+	hf->hf_map = mmap(NULL, maplen, PROT_READ|PROT_WRITE, MAP_SHARED,
+	    hf->hf_fd, off);
+	if (hf->hf_map == MAP_FAILED) {
+		hf->hf_map = NULL;
+		goto fail;
+	}
+	hf->hf_mapoff = off;
+	hf->hf_maplen = maplen;
+	return 0;
+
+fail:
+	warn("cannot map %s, writing it as usual", hf->hf_path);
+	if (ftruncate(hf->hf_fd, hf->hf_size) == -1)
+		warn("cannot cut off preallocated space in %s", hf->hf_path);
+	hf->hf_nomap = 1;
+	// let other oicb instances in
+	if (flock(hf->hf_fd, LOCK_SH) == 0)
+		hf->hf_exclusive = 0;
+	return -1;
+}
+
+/*
+ * Copies the line into mapped window of the file, without system calls
+ * most of the time.
+ */
+static int
+append_mapped(struct history_file *hf, const struct icb_task *it) {
+	if ((hf->hf_map == NULL ||
+	    hf->hf_size + (off_t)it->it_len > hf->hf_mapoff +
+	    (off_t)hf->hf_maplen) && map_history_window(hf, it->it_len) == -1)
+		return -1;
+	memcpy(hf->hf_map + (hf->hf_size - hf->hf_mapoff), it->it_data,
+	    it->it_len);
+	return 0;
+}
+
+/*
+ * Should the file be rotated before the line given gets written there?
+ * Lines start with date, see save_history().  Shared log grows by lines
+ * of other oicb instances, too, so its size is taken from the file.
+ */
+static int
+need_rotation(struct history_file *hf, const struct icb_task *it) {
+	struct stat	 st;
+
+	if (rotate_size && !hf->hf_exclusive && fstat(hf->hf_fd, &st) == 0)
+		hf->hf_size = st.st_size;
+	if (hf->hf_size == 0 || hf->hf_norotate)
+		return 0;
+	if (rotate_size && hf->hf_size + (off_t)it->it_len > rotate_size)
+		return 1;
+	if (rotate_daily && hf->hf_day[0] != '\0' &&
+	    it->it_len >= sizeof(hf->hf_day) - 1 &&
+	    memcmp(hf->hf_day, it->it_data, sizeof(hf->hf_day) - 1) != 0)
+		return 1;
+	return 0;
+}
+
+/*
+ * Locks directory of the log exclusively, so only one oicb instance
+ * rotates logs there at a time.  Returns descriptor to close for
+ * unlocking, or -1; rotation goes on without lock then.
+ */
+static int
+lock_history_dir(const struct history_file *hf) {
+	char		 path[PATH_MAX];
+	const char	*name;
+	int		 fd;
+
+	// there is always a slash, see get_history_file()
+	name = strrchr(hf->hf_path, '/');
+	if ((size_t)(name - hf->hf_path) >= sizeof(path))
+		return -1;
+	memcpy(path, hf->hf_path, (size_t)(name - hf->hf_path));
+	path[name - hf->hf_path] = '\0';
+	if ((fd = open(path, O_RDONLY|O_DIRECTORY)) == -1)
+		return -1;
+	if (flock(fd, LOCK_EX) == -1) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/*
+ * Renames "room-foo.log" to "room-foo.YYYY-MM-DD.log", or to
+ * "room-foo.YYYY-MM-DD.N.log" if there is one already, and starts a new
+ * file in place.  The segment is then compressed in background.
+ * If another oicb instance has rotated the log already, the new file is
+ * just opened instead.  Returns -1 if the new file couldn't be opened.
+ */
+static int
+rotate_history_file(struct history_file *hf) {
+	struct stat	 st;
+	char		 segpath[PATH_MAX], gzpath[PATH_MAX];
+	size_t		 baselen;
+	unsigned	 seq;
+	int		 rv, lockfd;
+
+	lockfd = lock_history_dir(hf);
+	if (history_file_moved(hf)) {
+		close_history_file(hf);
+		goto reopen;
+	}
+
+	baselen = strlen(hf->hf_path) - strlen(LOG_SUFFIX);
+	for (seq = 0; seq < UINT_MAX; seq++) {
+		if (seq == 0)
+			rv = snprintf(segpath, sizeof(segpath), "%.*s.%s%s",
+			    (int)baselen, hf->hf_path, hf->hf_day, LOG_SUFFIX);
+		else
+			rv = snprintf(segpath, sizeof(segpath), "%.*s.%s.%u%s",
+			    (int)baselen, hf->hf_path, hf->hf_day, seq,
+			    LOG_SUFFIX);
+		if (rv >= 0 && (size_t)rv < sizeof(segpath))
+			rv = snprintf(gzpath, sizeof(gzpath), "%s.gz", segpath);
+		if (rv < 0 || (size_t)rv >= sizeof(gzpath)) {
+			errno = ENAMETOOLONG;
+			warn("cannot rotate %s", hf->hf_path);
+			hf->hf_norotate = 1;
+			if (lockfd != -1)
+				close(lockfd);
+			return 0;
+		}
+		if (stat(segpath, &st) == -1 && errno == ENOENT &&
+		    stat(gzpath, &st) == -1 && errno == ENOENT)
+			break;
+	}
+
+	close_history_file(hf);
+	if (rename(hf->hf_path, segpath) == -1) {
+		warn("cannot rotate %s", hf->hf_path);
+		hf->hf_norotate = 1;
+	} else {
+		search_history_renamed(hf->hf_path, segpath);
+		compress_log(segpath);
+	}
+reopen:
+	rv = open_history_file(hf);
+	if (lockfd != -1)
+		close(lockfd);
+	return rv;
+}
+
+/*
+ * Tells if the name is of rotated log segment, "base.YYYY-MM-DD[.N].log",
+ * possibly compressed.  If so, returns 1 and fills in length of the base
+ * name, date and sequence number.
+ */
+static int
+parse_segment_name(const char *name, size_t *baselen, char *day,
+    unsigned *seq) {
+	const char	*p, *end;
+	size_t		 len;
+
+	if ((len = log_name_len(name)) == 0)
+		return 0;
+	end = name + len;
+
+	*seq = 0;
+	for (p = end; p > name && isdigit((unsigned char)p[-1]); p--)
+		;
+	if (p < end && p > name && p[-1] == '.' && end - p < 10 &&
+	    *p != '0') {
+		*seq = (unsigned)strtoul(p, NULL, 10);
+		end = p - 1;
+	}
+
+	// ".YYYY-MM-DD"
+	if (end - name < 12)
+		return 0;
+	p = end - 11;
+	if (p[0] != '.' ||
+	    !isdigit((unsigned char)p[1]) || !isdigit((unsigned char)p[2]) ||
+	    !isdigit((unsigned char)p[3]) || !isdigit((unsigned char)p[4]) ||
+	    p[5] != '-' ||
+	    !isdigit((unsigned char)p[6]) || !isdigit((unsigned char)p[7]) ||
+	    p[8] != '-' ||
+	    !isdigit((unsigned char)p[9]) || !isdigit((unsigned char)p[10]))
+		return 0;
+	memcpy(day, p + 1, 10);
+	day[10] = '\0';
+	*baselen = (size_t)(p - name);
+	return 1;
+}
+
+/*
+ * Parses rotation rule: "daily", size in megabytes, or both, separated
+ * by comma.  Returns -1 if rule is invalid.
+ */
+int
+set_history_rotation(const char *rule) {
+	char		*copy, *word, *next;
+	const char	*errstr;
+	long long	 mbytes;
+
+	if ((copy = strdup(rule)) == NULL)
+		err(1, __func__);
+	for (next = copy; (word = strsep(&next, ",")) != NULL; ) {
+		if (strcmp(word, "daily") == 0) {
+			rotate_daily = 1;
+			continue;
+		}
+		mbytes = strtonum(word, 1, ROTATE_SIZE_MAX, &errstr);
+		if (errstr) {
+			free(copy);
+			return -1;
+		}
+		rotate_size = (off_t)mbytes * 1024 * 1024;
+	}
+	free(copy);
+	return 0;
+}
+
+/*
+ * Queues segments rotated but left uncompressed by previous runs.
+ */
+void
+compress_leftovers(void) {
+	DIR		*dir;
+	struct dirent	*de;
+	char		 path[PATH_MAX], day[11];
+	size_t		 baselen;
+	unsigned	 seq;
+	int		 rv;
+
+	if (!enable_history || (!rotate_size && !rotate_daily))
+		return;
+	if ((dir = opendir(history_path)) == NULL) {
+		warn("%s", history_path);
+		return;
+	}
+	while ((de = readdir(dir)) != NULL) {
+		if (log_is_compressed(de->d_name) ||
+		    !parse_segment_name(de->d_name, &baselen, day, &seq))
+			continue;
+		rv = snprintf(path, sizeof(path), "%s/%s", history_path,
+		    de->d_name);
+		if (rv > 0 && (size_t)rv < sizeof(path))
+			compress_log(path);
+	}
+	closedir(dir);
+}
+
+#define LAST_SEGMENTS_MAX	64
+#define LAST_CHUNK		(64 * 1024)
+
+struct log_segment {
+	char		*ls_name;
+	char		 ls_day[11];
+	unsigned	 ls_seq;
+	size_t		 ls_skip;	// lines not to be shown
+};
+
+static int
+segment_cmp(const void *a, const void *b) {
+	const struct log_segment	*sa = a, *sb = b;
+	int				 rv;
+
+	// newest first
+	if ((rv = strcmp(sb->ls_day, sa->ls_day)) != 0)
+		return rv;
+	return (sa->ls_seq < sb->ls_seq) - (sa->ls_seq > sb->ls_seq);
+}
+
+/*
+ * Returns rotated segments of the log with the base name given, newest
+ * first, or NULL if there are none.
+ */
+static struct log_segment *
+list_segments(const char *base, size_t baselen, size_t *nsegs) {
+	DIR			*dir;
+	struct dirent		*de;
+	struct log_segment	*segs = NULL, *ls;
+	size_t			 i, j, len, nalloc = 0;
+
+	*nsegs = 0;
+	if ((dir = opendir(history_path)) == NULL)
+		return NULL;
+	while ((de = readdir(dir)) != NULL) {
+		if (strncmp(de->d_name, base, baselen) != 0)
+			continue;
+		if (*nsegs == nalloc) {
+			nalloc = nalloc ? nalloc * 2 : 16;
+			ls = reallocarray(segs, nalloc, sizeof(*segs));
+			if (ls == NULL)
+				break;
+			STATS_ALLOC((nalloc - *nsegs) * sizeof(*segs));
+			segs = ls;
+		}
+		ls = &segs[*nsegs];
+		if (!parse_segment_name(de->d_name, &len, ls->ls_day,
+		    &ls->ls_seq) || len != baselen)
+			continue;
+		if ((ls->ls_name = strdup(de->d_name)) == NULL)
+			break;
+		STATS_ALLOC(strlen(ls->ls_name) + 1);
+		ls->ls_skip = 0;
+		(*nsegs)++;
+	}
+	closedir(dir);
+	if (*nsegs == 0)
+		return segs;
+	qsort(segs, *nsegs, sizeof(*segs), segment_cmp);
+
+	// both versions exist while compression is being finished
+	for (i = j = 1; i < *nsegs; i++) {
+		if (segment_cmp(&segs[j - 1], &segs[i]) == 0) {
+			free(segs[i].ls_name);
+			continue;
+		}
+		segs[j++] = segs[i];
+	}
+	*nsegs = j;
+	return segs;
+}
+
+static void
+print_log_lines(const char *name, const char *p, const char *end) {
+	struct line_buf	 lb;
+	const char	*nl;
+	size_t		 len;
+
+	for (; p < end; p = nl + 1) {
+		if ((nl = memchr(p, '\n', (size_t)(end - p))) == NULL)
+			nl = end - 1;	// unfinished line
+		len = (size_t)(nl - p) + (*nl != '\n');
+		if (json_output) {
+			const struct json_field	 fields[] = {
+				JSON_STR("type", "last"),
+				JSON_STRN("log", name, log_name_len(name)),
+				JSON_STRN("text", p, len),
+			};
+			push_stdout_json(fields,
+			    sizeof(fields) / sizeof(fields[0]));
+			continue;
+		}
+		lb_init(&lb);
+		lb_untrusted(&lb, p, len);
+		lb_raw(&lb, "\n", 1);
+		lb_commit(&lb);
+	}
+}
+
+/*
+ * Counts lines in the log segment, the unfinished one included.
+ * Returns (size_t)-1 on error.
+ */
+static size_t
+count_segment_lines(const char *path) {
+	struct log_reader	 lr;
+	char			 buf[LAST_CHUNK];
+	const char		*p, *end;
+	uint64_t		 off = 0;
+	ssize_t			 n;
+	size_t			 nlines = 0;
+	char			 last = '\n';
+
+	if (log_reader_open(&lr, path) == -1)
+		return (size_t)-1;
+	while ((n = log_reader_pread(&lr, buf, sizeof(buf), off)) > 0) {
+		end = buf + n;
+		for (p = buf; (p = memchr(p, '\n', (size_t)(end - p))) != NULL;
+		    p++)
+			nlines++;
+		last = end[-1];
+		off += (uint64_t)n;
+	}
+	log_reader_close(&lr);
+	if (n == -1)
+		return (size_t)-1;
+	return nlines + (last != '\n');
+}
+
+/*
+ * Prints lines of the log segment, skipping the first ones.
+ */
+static void
+print_segment_tail(const char *path, const char *name, size_t skip) {
+	struct log_reader	 lr;
+	const char		*p, *end, *nl;
+	char			*buf = NULL, *nbuf;
+	uint64_t		 off = 0;
+	size_t			 bufsz = LAST_CHUNK, have = 0;
+	ssize_t			 n;
+
+	if (log_reader_open(&lr, path) == -1) {
+		warn("%s", path);
+		return;
+	}
+	if ((buf = malloc(bufsz)) == NULL)
+		goto fail;
+	STATS_ALLOC(bufsz);
+	for (;;) {
+		if (have == bufsz) {
+			// line doesn't fit
+			if ((nbuf = realloc(buf, bufsz * 2)) == NULL)
+				goto fail;
+			STATS_ALLOC(bufsz);
+			buf = nbuf;
+			bufsz *= 2;
+		}
+		n = log_reader_pread(&lr, buf + have, bufsz - have, off);
+		if (n == -1)
+			goto fail;
+		off += (uint64_t)n;
+		have += (size_t)n;
+		end = buf + have;
+
+		for (p = buf; skip > 0 &&
+		    (nl = memchr(p, '\n', (size_t)(end - p))) != NULL; skip--)
+			p = nl + 1;
+		if (skip == 0) {
+			if (n == 0)
+				nl = end;
+			else if ((nl = memrchr(p, '\n', (size_t)(end - p))) ==
+			    NULL)
+				nl = p;
+			else
+				nl++;
+			print_log_lines(name, p, nl);
+			p = nl;
+		}
+		if (n == 0)
+			break;
+		have = (size_t)(end - p);
+		memmove(buf, p, have);
+	}
+	goto out;
+
+fail:
+	warn("%s", path);
+out:
+	log_reader_close(&lr);
+	free(buf);
+}
+
+/*
+ * Shows the last n lines of the current room log, or of the private chat
+ * log with the peer given.  The log is mapped and scanned backwards from
+ * the end, so only pages holding those lines are read, no matter how big
+ * the log is.  If there are not enough lines there, the rest is taken
+ * from rotated segments, compressed or not.
+ */
+void
+show_last_lines(const char *peer, size_t n) {
+	struct stat		 st;
+	struct log_segment	*segs = NULL;
+	const char		*p = NULL, *end = NULL, *name, *path;
+	char			*data = MAP_FAILED;
+	char			 segpath[PATH_MAX];
+	size_t			 nlines = 0, need, nsegs = 0, nused = 0, total;
+	size_t			 i;
+	int			 fd = -1, rv;
+
+	if (!enable_history) {
+		push_stdout("%s: history saving is disabled\n", getprogname());
+		return;
+	}
+
+	// lines just sent or received could be still queued
+	proceed_history();
+
+	path = get_save_path_for(peer != NULL ? 'c' : 'b',
+	    peer != NULL ? intern_name(peer, strlen(peer)) : NAME_NONE, "");
+	if (path == NULL) {
+		warn(__func__);
+		return;
+	}
+	name = path + strlen(history_path) + 1;
+	st.st_size = 0;
+	if ((fd = open(path, O_RDONLY)) == -1 || fstat(fd, &st) == -1) {
+		if (errno != ENOENT) {
+			warn("%s", path);
+			goto out;
+		}
+		st.st_size = 0;
+	}
+	if ((uintmax_t)st.st_size > SIZE_MAX)
+		goto out;
+	if (st.st_size > 0) {
+		data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE,
+		    fd, 0);
+		if (data == MAP_FAILED) {
+			warn("%s: mmap", path);
+			goto out;
+		}
+
+		// space preallocated for mapped appends, see -P
+		for (end = data + st.st_size; end > data && end[-1] == '\0';)
+			end--;
+		p = end;
+		if (p > data && p[-1] == '\n')
+			p--;
+		for (; p > data; p--)
+			if (p[-1] == '\n' && ++nlines == n)
+				break;
+		if (p == data && p < end)
+			nlines++;	// the first line
+	}
+
+	// take the rest from segments, going back in time
+	if (nlines < n &&
+	    (segs = list_segments(name, log_name_len(name), &nsegs)) != NULL) {
+		need = n - nlines;
+		for (; nused < nsegs && nused < LAST_SEGMENTS_MAX && need > 0;
+		    nused++) {
+			rv = snprintf(segpath, sizeof(segpath), "%s/%s",
+			    history_path, segs[nused].ls_name);
+			if (rv < 0 || (size_t)rv >= sizeof(segpath))
+				errno = ENAMETOOLONG;
+			else if ((total = count_segment_lines(segpath)) !=
+			    (size_t)-1)
+				rv = 0;
+			if (rv != 0) {
+				warn("%s", segs[nused].ls_name);
+				break;
+			}
+			if (total > need) {
+				segs[nused].ls_skip = total - need;
+				total = need;
+			}
+			need -= total;
+		}
+	}
+
+	if (nlines == 0 && nused == 0) {
+		push_stdout("%s: no history saved for %s yet\n",
+		    getprogname(), peer != NULL ? peer : room);
+		goto out;
+	}
+	for (i = nused; i > 0; i--) {
+		// length was checked above
+		rv = snprintf(segpath, sizeof(segpath), "%s/%s", history_path,
+		    segs[i - 1].ls_name);
+		if (rv > 0 && (size_t)rv < sizeof(segpath))
+			print_segment_tail(segpath, segs[i - 1].ls_name,
+			    segs[i - 1].ls_skip);
+	}
+	if (p != NULL)
+		print_log_lines(name, p, end);
+
+out:
+	for (i = 0; i < nsegs; i++)
+		free(segs[i].ls_name);
+	free(segs);
+	if (data != MAP_FAILED)
+		munmap(data, (size_t)st.st_size);
+	if (fd != -1)
+		close(fd);
+}
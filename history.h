@@ -17,25 +17,55 @@
 #ifndef OICB_HISTORY_H
 #define OICB_HISTORY_H
 
+#include "intern.h"
+#include "stats.h"
+
+#define LAST_LINES_DEFAULT	20
+#define LAST_LINES_MAX		10000
+#define ROTATE_SIZE_MAX		(1024 * 1024)	// in megabytes
+#define HISTORY_EXTENT		(4 * 1024 * 1024) // preallocated at once, see -P
+#define HISTORY_MAP_IDLE	60	// seconds mapped file is kept open
+#define HISTORY_RECORD_MAX	PIPE_BUF // longer lines are split
+#define HISTORY_EXIT_WAIT	3	// seconds to wait for busy logs on exit
 
 LIST_HEAD(history_files_list, history_file);
 extern struct history_files_list history_files;
 struct history_file {
 	LIST_ENTRY(history_file)	hf_entry;
 	struct icb_task_queue	hf_tasks;
+	struct queue_stats	hf_qstats;
 	char	*hf_path;
-	size_t	 hf_ntasks;
 	int	 hf_fd;
+	int	 hf_waitfd;       // locked while waiting for mapped log
 	int	 hf_permerr;      // failed to open?
+	int	 hf_norotate;     // failed to rotate?
+	int	 hf_nomap;        // failed to preallocate or map?
+	int	 hf_exclusive;    // no other oicb instances use it
 	time_t	 hf_last_access;
+	time_t	 hf_retry;        // when to try to open it again, if busy
+	time_t	 hf_checked;      // when it was last checked for rotation
+	off_t	 hf_size;         // of text, without preallocated space
+	char	 hf_day[11];      // date of the last line, YYYY-MM-DD
+	char	*hf_map;          // mapped window for appends, see -P
+	off_t	 hf_mapoff;
+	size_t	 hf_maplen;
 };
 
-void	 save_history(char type, const char *peer, const char *msg,
+void	 save_history(char type, name_id peer, const char *msg,
 	              int incoming);
 void	 proceed_history(void);
+int	 history_pending(void);
+void	 close_history_files(void);
 int	 create_dir_for(char *path);
+void	 show_last_lines(const char *peer, size_t n);
+int	 set_history_rotation(const char *rule);
+void	 compress_leftovers(void);
 
 extern int		 enable_history;
+extern int		 history_mmap;
+extern size_t		 backlog_lines;	// to show after login
+extern off_t		 rotate_size;	// 0 if not rotating by size
+extern int		 rotate_daily;
 extern char		 history_path[PATH_MAX];
 
 #endif // OICB_HISTORY_H
@@ -0,0 +1,223 @@
+/*
+ * Copyright (c) 2026 Vadim Zhukov <zhuk@openbsd.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Names are never forgotten: a chat session doesn't see that many of
+ * them, and handles could be kept anywhere.
+ */
+
+#include <sys/types.h>
+#include <err.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "oicb.h"
+#include "history.h"
+#include "intern.h"
+#include "linebuf.h"
+#include "stats.h"
+
+struct name_entry {
+	char		*ne_str;	// NUL-terminated
+	char		*ne_display;	// same as ne_str if no escaping needed
+	char		*ne_log_path[2];	// room and private chat logs
+	size_t		 ne_len;
+	size_t		 ne_display_len;
+	uint32_t	 ne_hash;
+};
+
+static uint32_t	 name_hash(const char *s, size_t len);
+static name_id	 lookup(const char *s, size_t len, uint32_t h, size_t *slotp);
+
+static struct name_entry	 empty_name = { "", "", { NULL, NULL }, 0, 0, 0 };
+static struct name_entry	*names = &empty_name;	// indexed by name_id
+static size_t			 nnames = 1, names_size = 1;
+static name_id			*names_tab;	// open addressing hash table
+static size_t			 names_tab_size;
+
+
+static uint32_t
+name_hash(const char *s, size_t len) {
+	uint32_t	 h = 2166136261u;
+
+	while (len-- > 0) {
+		h ^= (unsigned char)*s++;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+/*
+ * Returns handle of the name, or NAME_NONE, setting *slotp to the free
+ * slot in hash table where it should go.
+ */
+static name_id
+lookup(const char *s, size_t len, uint32_t h, size_t *slotp) {
+	const struct name_entry	*ne;
+	size_t			 i, mask;
+
+	if (names_tab_size == 0)
+		return NAME_NONE;
+	mask = names_tab_size - 1;
+	for (i = h & mask; names_tab[i] != NAME_NONE; i = (i + 1) & mask) {
+		ne = &names[names_tab[i]];
+		if (ne->ne_hash == h && ne->ne_len == len &&
+		    memcmp(ne->ne_str, s, len) == 0)
+			return names_tab[i];
+	}
+	*slotp = i;
+	return NAME_NONE;
+}
+
+/*
+ * Returns handle of the name given, adding it if needed.
+ * The string doesn't have to be NUL-terminated.
+ */
+name_id
+intern_name(const char *s, size_t len) {
+	struct name_entry	*ne;
+	name_id			*nt, id;
+	uint32_t		 h;
+	size_t			 i, j, slot = 0, newsize;
+
+	if (len == 0)
+		return NAME_NONE;
+	h = name_hash(s, len);
+	if ((id = lookup(s, len, h, &slot)) != NAME_NONE)
+		return id;
+
+	if (nnames == UINT32_MAX)
+		errx(1, "%s: too many names", __func__);
+	// keep the table at most half full
+	if (nnames * 2 >= names_tab_size) {
+		newsize = names_tab_size ? names_tab_size * 2 : 256;
+		if ((nt = calloc(newsize, sizeof(*nt))) == NULL)
+			err(1, __func__);
+		STATS_ALLOC(newsize * sizeof(*nt));
+		for (j = 0; j < names_tab_size; j++) {
+			if (names_tab[j] == NAME_NONE)
+				continue;
+			for (i = names[names_tab[j]].ne_hash & (newsize - 1);
+			    nt[i] != NAME_NONE; i = (i + 1) & (newsize - 1))
+				;
+			nt[i] = names_tab[j];
+		}
+		free(names_tab);
+		names_tab = nt;
+		names_tab_size = newsize;
+		for (slot = h & (newsize - 1); names_tab[slot] != NAME_NONE;
+		    slot = (slot + 1) & (newsize - 1))
+			;
+	}
+	if (nnames == names_size) {
+		newsize = names_size < 64 ? 64 : names_size * 2;
+		if (names == &empty_name) {
+			if ((ne = calloc(newsize, sizeof(*ne))) != NULL)
+				ne[0] = empty_name;
+		} else
+			ne = reallocarray(names, newsize, sizeof(*ne));
+		if (ne == NULL)
+			err(1, __func__);
+		STATS_ALLOC(newsize * sizeof(*ne));
+		names = ne;
+		names_size = newsize;
+	}
+
+	ne = &names[nnames];
+	memset(ne, 0, sizeof(*ne));
+	if ((ne->ne_str = malloc(len + 1)) == NULL)
+		err(1, __func__);
+	STATS_ALLOC(len + 1);
+	memcpy(ne->ne_str, s, len);
+	ne->ne_str[len] = '\0';
+	ne->ne_len = len;
+	ne->ne_hash = h;
+	names_tab[slot] = (name_id)nnames;
+	return (name_id)nnames++;
+}
+
+/*
+ * Like intern_name(), but returns NAME_NONE for names not seen yet.
+ */
+name_id
+find_name(const char *s, size_t len) {
+	size_t	 slot;
+
+	return lookup(s, len, name_hash(s, len), &slot);
+}
+
+const char *
+name_str(name_id id) {
+	return names[id].ne_str;
+}
+
+size_t
+name_len(name_id id) {
+	return names[id].ne_len;
+}
+
+/*
+ * Returns the name as lb_untrusted() would show it.
+ */
+const char *
+name_display(name_id id, size_t *lenp) {
+	struct name_entry	*ne = &names[id];
+	struct line_buf		 lb;
+	size_t			 len;
+
+	if (ne->ne_display == NULL) {
+		lb_init(&lb);
+		len = lb_untrusted(&lb, ne->ne_str, ne->ne_len);
+		if (len == ne->ne_len &&
+		    memcmp(lb.lb_data, ne->ne_str, len) == 0)
+			ne->ne_display = ne->ne_str;
+		else if ((ne->ne_display = strndup(lb.lb_data, len)) == NULL)
+			err(1, __func__);
+		else
+			STATS_ALLOC(len + 1);
+		ne->ne_display_len = len;
+		lb_discard(&lb);
+	}
+	if (lenp != NULL)
+		*lenp = ne->ne_display_len;
+	return ne->ne_display;
+}
+
+/*
+ * Returns path of history log for the room or private chat with
+ * the given name, or NULL on failure.
+ */
+const char *
+name_log_path(name_id id, int private) {
+	struct name_entry	*ne = &names[id];
+	char			**pathp = &ne->ne_log_path[private != 0];
+	int			 rv;
+
+	if (*pathp == NULL) {
+		rv = asprintf(pathp, "%s/%s%s.log", history_path,
+		    private ? "private-" : "room-", ne->ne_str);
+		if (rv == -1) {
+			*pathp = NULL;
+			return NULL;
+		}
+		STATS_ALLOC((size_t)rv + 1);
+	}
+	return *pathp;
+}
@@ -0,0 +1,40 @@
+/*
+ * Copyright (c) 2026 Vadim Zhukov <zhuk@openbsd.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef OICB_INTERN_H
+#define OICB_INTERN_H
+
+#include <sys/types.h>
+#include <stdint.h>
+
+/*
+ * Nicknames and room names are stored once, and get handles that stay
+ * valid until exit: equal names always have equal handles.  The form
+ * safe for display and paths of history logs are made once per name,
+ * too, when first asked for.
+ */
+typedef uint32_t	 name_id;
+
+#define NAME_NONE	0	// empty name
+
+name_id		 intern_name(const char *s, size_t len);
+name_id		 find_name(const char *s, size_t len);
+const char	*name_str(name_id id);
+size_t		 name_len(name_id id);
+const char	*name_display(name_id id, size_t *lenp);
+const char	*name_log_path(name_id id, int private);
+
+#endif // OICB_INTERN_H
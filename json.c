@@ -0,0 +1,211 @@
+/*
+ * Copyright (c) 2026 Vadim Zhukov <zhuk@openbsd.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/types.h>
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "oicb.h"
+#include "json.h"
+#include "latency.h"
+#include "stats.h"
+
+
+static size_t	 utf8_seqlen(const unsigned char *s, size_t avail);
+static size_t	 json_escape(char *dst, const char *src, size_t len);
+static size_t	 json_emit(char *dst, const struct json_field *fields,
+	                   size_t nfields);
+
+int	 json_output = 0;
+
+
+/*
+ * Returns length of valid UTF-8 sequence starting at 's',
+ * or 0 if the sequence is invalid or truncated.
+ *
+ * This intentionally doesn't depend on locale: the output is for machines.
+ */
+static size_t
+utf8_seqlen(const unsigned char *s, size_t avail) {
+	unsigned int	 cp;
+	size_t		 n, i;
+
+	if (s[0] < 0x80)
+		return 1;
+	else if ((s[0] & 0xe0) == 0xc0) {
+		n = 2;
+		cp = s[0] & 0x1f;
+	} else if ((s[0] & 0xf0) == 0xe0) {
+		n = 3;
+		cp = s[0] & 0x0f;
+	} else if ((s[0] & 0xf8) == 0xf0) {
+		n = 4;
+		cp = s[0] & 0x07;
+	} else
+		return 0;
+	if (n > avail)
+		return 0;
+	for (i = 1; i < n; i++) {
+		if ((s[i] & 0xc0) != 0x80)
+			return 0;
+		cp = (cp << 6) | (s[i] & 0x3f);
+	}
+
+	// overlong forms, surrogates and out of range code points
+	if ((n == 2 && cp < 0x80) || (n == 3 && cp < 0x800) ||
+	    (n == 4 && cp < 0x10000) || (cp >= 0xd800 && cp <= 0xdfff) ||
+	    cp > 0x10ffff)
+		return 0;
+	return n;
+}
+
+/*
+ * Escapes 'len' bytes at 'src' to be put inside JSON string literal.
+ * If 'dst' is NULL, only calculates the resulting length.
+ *
+ * Bytes not forming valid UTF-8 are treated as Latin-1 characters,
+ * so the output is always valid JSON, whatever server sends us.
+ *
+ * Returns number of bytes written (or to be written) to 'dst'.
+ */
+static size_t
+json_escape(char *dst, const char *src, size_t len) {
+	static const char	 hex[] = "0123456789abcdef";
+	const unsigned char	*s, *end;
+	size_t			 n, outlen = 0;
+	char			 esc;
+
+	for (s = (const unsigned char *)src, end = s + len; s < end;) {
+		switch (*s) {
+		case '"':	esc = '"';	break;
+		case '\\':	esc = '\\';	break;
+		case '\b':	esc = 'b';	break;
+		case '\f':	esc = 'f';	break;
+		case '\n':	esc = 'n';	break;
+		case '\r':	esc = 'r';	break;
+		case '\t':	esc = 't';	break;
+		default:	esc = 0;
+		}
+		if (esc) {
+			if (dst) {
+				dst[outlen] = '\\';
+				dst[outlen + 1] = esc;
+			}
+			outlen += 2;
+			s++;
+			continue;
+		}
+
+		if (*s >= 0x20 && *s != 0x7f &&
+		    (n = utf8_seqlen(s, (size_t)(end - s))) != 0) {
+			if (dst)
+				memcpy(dst + outlen, s, n);
+			outlen += n;
+			s += n;
+			continue;
+		}
+
+		// control character or invalid UTF-8
+		if (dst) {
+			memcpy(dst + outlen, "\\u00", 4);
+			dst[outlen + 4] = hex[*s >> 4];
+			dst[outlen + 5] = hex[*s & 0x0f];
+		}
+		outlen += 6;
+		s++;
+	}
+	return outlen;
+}
+
+/*
+ * Formats single JSON object, followed by newline, into 'dst'.
+ * If 'dst' is NULL, only calculates the resulting length.
+ * When writing, 'dst' must have room for one extra byte, for snprintf().
+ */
+static size_t
+json_emit(char *dst, const struct json_field *fields, size_t nfields) {
+	size_t	 i, outlen = 0, namelen;
+	int	 n;
+
+#define JSON_PUT(s, l) do {				\
+		if (dst)				\
+			memcpy(dst + outlen, (s), (l));	\
+		outlen += (l);				\
+	} while (0)
+
+	JSON_PUT("{", 1);
+	for (i = 0; i < nfields; i++) {
+		if (fields[i].jf_type == JSONNone ||
+		    (fields[i].jf_type == JSONString && fields[i].jf_str == NULL))
+			continue;
+		if (outlen > 1)
+			JSON_PUT(",", 1);
+
+		// field names are ours, no need to escape
+		namelen = strlen(fields[i].jf_name);
+		JSON_PUT("\"", 1);
+		JSON_PUT(fields[i].jf_name, namelen);
+		JSON_PUT("\":", 2);
+
+		switch (fields[i].jf_type) {
+		case JSONNone:
+			break;
+
+		case JSONString:
+			JSON_PUT("\"", 1);
+			outlen += json_escape(dst ? dst + outlen : NULL,
+			    fields[i].jf_str, fields[i].jf_len == JSON_STRLEN ?
+			    strlen(fields[i].jf_str) : fields[i].jf_len);
+			JSON_PUT("\"", 1);
+			break;
+
+		case JSONNumber:
+			n = snprintf(dst ? dst + outlen : NULL, dst ? 32 : 0,
+			    "%lld", fields[i].jf_num);
+			outlen += (size_t)n;
+			break;
+		}
+	}
+	JSON_PUT("}\n", 2);
+#undef JSON_PUT
+
+	return outlen;
+}
+
+/*
+ * Queue single event as a JSON object on its own line.
+ *
+ * Output is built right in the queued task buffer, so besides the task
+ * itself there are no allocations made.
+ *
+ * Returns number of bytes queued.
+ */
+int
+push_stdout_json(const struct json_field *fields, size_t nfields) {
+	struct icb_task	*it;
+	size_t		 len;
+
+	len = json_emit(NULL, fields, nfields);
+	if ((it = alloc_task(len + 1)) == NULL)
+		err(1, __func__);
+	json_emit(it->it_data, fields, nfields);
+	it->it_len = len;	// no trailing NUL: it would break consumers
+	latency_task_queued(it);
+	enqueue_task(&tasks_stdout, &stats.st_stdout, it);
+	return (int)len;
+}
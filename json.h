@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2026 Vadim Zhukov <zhuk@openbsd.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef OICB_JSON_H
+#define OICB_JSON_H
+
+enum JSONFieldType {
+	JSONNone,	// field is omitted
+	JSONString,
+	JSONNumber,
+};
+
+struct json_field {
+	const char		*jf_name;
+	enum JSONFieldType	 jf_type;
+	const char		*jf_str;	// NULL means "omit this field"
+	size_t			 jf_len;	// JSON_STRLEN if NUL-terminated
+	long long		 jf_num;
+};
+
+#define JSON_STRLEN	((size_t)-1)
+
+#define JSON_STR(name, s)	{ (name), JSONString, (s), JSON_STRLEN, 0 }
+#define JSON_STRN(name, s, len)	{ (name), JSONString, (s), (len), 0 }
+#define JSON_NUM(name, n)	{ (name), JSONNumber, NULL, 0, (n) }
+#define JSON_NUM_IF(name, n, cond)	\
+	{ (name), (cond) ? JSONNumber : JSONNone, NULL, 0, (n) }
+
+int	 push_stdout_json(const struct json_field *fields, size_t nfields);
+
+extern int	 json_output;
+
+#endif // OICB_JSON_H
@@ -0,0 +1,231 @@
+/*
+ * Copyright (c) 2026 Vadim Zhukov <zhuk@openbsd.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Receive-to-display latency tracing.
+ *
+ * Every incoming message is stamped with the time of the read(2) call
+ * which completed it.  Then the following stages are measured:
+ *
+ *   wakeup to read:        poll(2) returning to the first read(2) after it;
+ *   read to decoded:       message waiting in the receive buffer, behind
+ *                          messages read earlier, and being reassembled;
+ *   decoded to formatted:  proceed_icb_msg() run time;
+ *   formatted to written:  output waiting in tasks_stdout, until the
+ *                          last task produced for the message is written;
+ *   read to written:       the whole path.
+ *
+ * Time data spent in kernel socket buffer can't be seen from here.
+ */
+
+#include <sys/types.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "oicb.h"
+#include "latency.h"
+#include "stats.h"
+
+
+enum LatencyStage {
+	StageWakeup,
+	StageBuffered,
+	StageFormat,
+	StageOutput,
+	StageTotal,
+	StageCount
+};
+
+static const char	*stage_names[StageCount] = {
+	"wakeup to read",
+	"read to decoded",
+	"decoded to formatted",
+	"formatted to written",
+	"read to written",
+};
+
+static int	 print_stderr(const char *fmt, ...);
+static void	 report(int (*out)(const char *, ...));
+
+/*
+ * Ends of data read by each read(2) call, as offsets from the start
+ * of not yet decoded data, with times of those calls.
+ */
+#define RX_STAMPS_MAX	32
+static struct rx_stamp {
+	size_t		 rs_end;
+	uint64_t	 rs_usec;
+} rx_stamps[RX_STAMPS_MAX];
+static size_t		 nrx_stamps;
+
+static struct histogram	 stage_hist[StageCount];
+static uint64_t		 wakeup_usec;
+static uint64_t		 cur_rx_usec, cur_decoded_usec;
+static unsigned int	 cur_seq, last_seq;	// cur_seq is 0 between messages
+
+
+/*
+ * Called when poll(2) returns in the main loop.
+ */
+void
+latency_wakeup(void) {
+	wakeup_usec = now_usec();
+}
+
+/*
+ * Called after read(2) returned data, with total amount of not yet
+ * decoded data in receive buffer.
+ */
+void
+latency_read(size_t endoff) {
+	uint64_t	 now;
+
+	now = now_usec();
+	if (wakeup_usec) {
+		hist_add(&stage_hist[StageWakeup], now - wakeup_usec);
+		wakeup_usec = 0;
+	}
+	if (nrx_stamps == RX_STAMPS_MAX)
+		nrx_stamps--;		// merge with the last one
+	rx_stamps[nrx_stamps].rs_end = endoff;
+	rx_stamps[nrx_stamps].rs_usec = now;
+	nrx_stamps++;
+}
+
+/*
+ * Called when part of a long message was taken out of receive buffer,
+ * with number of bytes it took there.  The message is considered
+ * received when its last part is read.
+ */
+void
+latency_rx_consumed(size_t size) {
+	size_t		 i, j;
+
+	for (i = j = 0; i < nrx_stamps; i++) {
+		if (rx_stamps[i].rs_end <= size)
+			continue;
+		rx_stamps[j].rs_end = rx_stamps[i].rs_end - size;
+		rx_stamps[j].rs_usec = rx_stamps[i].rs_usec;
+		j++;
+	}
+	nrx_stamps = j;
+}
+
+/*
+ * Called when next message was decoded, with number of bytes it took
+ * in receive buffer, including packet headers.
+ */
+void
+latency_msg_received(size_t msgsize) {
+	uint64_t	 now;
+	size_t		 i;
+
+	now = now_usec();
+	cur_rx_usec = now;
+	for (i = 0; i < nrx_stamps; i++)
+		if (rx_stamps[i].rs_end >= msgsize) {
+			cur_rx_usec = rx_stamps[i].rs_usec;
+			break;
+		}
+	latency_rx_consumed(msgsize);
+
+	hist_add(&stage_hist[StageBuffered], now - cur_rx_usec);
+	cur_decoded_usec = now;
+	if (++last_seq == 0)
+		last_seq = 1;
+	cur_seq = last_seq;
+}
+
+/*
+ * Called after the message was processed.
+ */
+void
+latency_msg_done(void) {
+	if (cur_seq == 0)
+		return;
+	hist_add(&stage_hist[StageFormat], now_usec() - cur_decoded_usec);
+	cur_seq = 0;
+}
+
+/*
+ * Marks output task as belonging to the message being processed, if any.
+ */
+void
+latency_task_queued(struct icb_task *it) {
+	if (cur_seq == 0)
+		return;
+	it->it_rx_seq = cur_seq;
+	it->it_rx_usec = cur_rx_usec;
+	it->it_queued_usec = now_usec();
+}
+
+/*
+ * Called when output task was written fully.  The message is considered
+ * displayed when the last of its tasks is written.
+ */
+void
+latency_task_written(const struct icb_task *it, const struct icb_task *next) {
+	uint64_t	 now;
+
+	if (it->it_rx_seq == 0)
+		return;
+	if (next != NULL && next->it_rx_seq == it->it_rx_seq)
+		return;
+	now = now_usec();
+	hist_add(&stage_hist[StageOutput], now - it->it_queued_usec);
+	hist_add(&stage_hist[StageTotal], now - it->it_rx_usec);
+}
+
+static int
+print_stderr(const char *fmt, ...) {
+	va_list	 ap;
+	int	 rv;
+
+	va_start(ap, fmt);
+	rv = vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	return rv;
+}
+
+static void
+report(int (*out)(const char *, ...)) {
+	const struct histogram	*h;
+	int			 i;
+
+	for (i = 0; i < StageCount; i++) {
+		h = &stage_hist[i];
+		out("%s: %-20s %8llu samples, p50 %9.3f ms, p99 %9.3f ms,"
+		    " max %9.3f ms\n", getprogname(), stage_names[i],
+		    (unsigned long long)h->h_count,
+		    (double)hist_quantile(h, 0.5) / 1000,
+		    (double)hist_quantile(h, 0.99) / 1000,
+		    (double)h->h_max / 1000);
+	}
+}
+
+void
+push_latency_stats(void) {
+	report(push_stdout);
+}
+
+/*
+ * To be installed with atexit(3).
+ */
+void
+print_latency_stats_at_exit(void) {
+	report(print_stderr);
+}
@@ -0,0 +1,35 @@
+/*
+ * Copyright (c) 2026 Vadim Zhukov <zhuk@openbsd.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef OICB_LATENCY_H
+#define OICB_LATENCY_H
+
+#include <stdint.h>
+
+struct icb_task;
+
+void	 latency_wakeup(void);
+void	 latency_read(size_t endoff);
+void	 latency_rx_consumed(size_t size);
+void	 latency_msg_received(size_t msgsize);
+void	 latency_msg_done(void);
+void	 latency_task_queued(struct icb_task *it);
+void	 latency_task_written(const struct icb_task *it,
+	                      const struct icb_task *next);
+void	 push_latency_stats(void);
+void	 print_latency_stats_at_exit(void);
+
+#endif // OICB_LATENCY_H
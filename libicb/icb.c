@@ -0,0 +1,312 @@
+/*
+ * Copyright (c) 2026 Vadim Zhukov <zhuk@openbsd.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "icb.h"
+
+
+#define EXT_DATA	(ICB_PKT_MAX - 2)	// data bytes in extended packet
+
+struct iov_cursor {
+	const struct iovec	*ic_iov;	// next one to be used
+	const char		*ic_src;
+	size_t			 ic_left;
+};
+
+static unsigned char	*find_last_pkt(unsigned char *buf, size_t len);
+static void		 gather(unsigned char *dst, size_t n,
+			        struct iov_cursor *c);
+
+
+/*
+ * Looks for the packet ending the first ICB message in the buffer.
+ * Returns NULL if the message wasn't received fully yet.
+ */
+static unsigned char *
+find_last_pkt(unsigned char *buf, size_t len) {
+	unsigned char	*lastpkt, *end = buf + len;
+
+	for (lastpkt = buf; lastpkt < end && lastpkt[0] == 0;
+	    lastpkt += ICB_PKT_MAX)
+		if (end - lastpkt < ICB_PKT_MAX)
+			return NULL;    // not received ending packet yet
+	if (lastpkt >= end || end - lastpkt < 1 + lastpkt[0])
+		return NULL;    // not received ending packet fully yet
+	return lastpkt;
+}
+
+void
+icb_decoder_init(struct icb_decoder *d, void *buf, size_t size) {
+	memset(d, 0, sizeof(*d));
+	d->id_buf = buf;
+	d->id_size = size;
+}
+
+/*
+ * Tells decoder the buffer was moved or resized by caller, with its
+ * contents preserved, e.g., by realloc(3).
+ */
+void
+icb_decoder_setbuf(struct icb_decoder *d, void *buf, size_t size) {
+	d->id_buf = buf;
+	d->id_size = size;
+}
+
+/*
+ * Returns place to put next portion of incoming data to, and its size
+ * in 'avail'.  One byte of buffer is always kept in reserve, for adding
+ * NUL to messages missing it.
+ *
+ * Data not decoded yet is moved to the start of buffer only when free
+ * space at the end gets low, so bursts of small messages don't cause
+ * moving the rest of buffer after each of them.
+ */
+void *
+icb_decoder_space(struct icb_decoder *d, size_t *avail) {
+	if (d->id_start == d->id_len)
+		d->id_start = d->id_len = 0;
+	else if (d->id_start > 0 && d->id_size - d->id_len <= d->id_size / 2) {
+		memmove(d->id_buf, d->id_buf + d->id_start,
+		    d->id_len - d->id_start);
+		d->id_len -= d->id_start;
+		d->id_start = 0;
+	}
+	*avail = d->id_size - d->id_len - 1;
+	return d->id_buf + d->id_len;
+}
+
+/*
+ * Marks 'n' bytes put at place returned by icb_decoder_space() as valid.
+ */
+void
+icb_decoder_commit(struct icb_decoder *d, size_t n) {
+	d->id_len += n;
+}
+
+/*
+ * Returns non-zero if there is a complete message to be decoded.
+ */
+int
+icb_decoder_ready(const struct icb_decoder *d) {
+	return find_last_pkt(d->id_buf + d->id_start,
+	    d->id_len - d->id_start) != NULL;
+}
+
+/*
+ * Extracts next message from the buffer, removing packet headers in place.
+ * Returns ICB_MSG, ICB_AGAIN or (negative) error code.
+ */
+int
+icb_decode(struct icb_decoder *d, struct icb_msg *m) {
+	unsigned char	*buf, *end, *lastpkt, *msgend, *pkt;
+	size_t		 shift, npkts = 0;
+
+	buf = d->id_buf + d->id_start;
+	end = d->id_buf + d->id_len;
+	if ((lastpkt = find_last_pkt(buf, (size_t)(end - buf))) == NULL)
+		return icb_decoder_pending(d) + 1 >= d->id_size ?
+		    ICB_EFULL : ICB_AGAIN;
+	msgend = lastpkt + 1 + lastpkt[0];
+	m->im_wirelen = (size_t)(msgend - buf);
+
+	// got full message, now remove extra data to get continuous bytes
+	for (pkt = buf; pkt <= lastpkt; pkt += ICB_PKT_MAX) {
+		npkts++;
+		if (pkt[1] != lastpkt[1] ||
+		    (d->id_inmsg && (char)pkt[1] != d->id_type))
+			return ICB_ETYPE;
+		if (pkt != buf) {
+			shift = (pkt[-1] == '\0') ? 3 : 2;
+			memmove(pkt + 2 - shift, pkt + 2, (size_t)(end - pkt - 2));
+			end -= shift;
+			lastpkt -= shift;
+			msgend -= shift;
+			pkt -= shift;
+		}
+	}
+
+	// there always will be a place for NUL, see icb_decoder_space()
+	if (msgend[-1] != '\0') {
+		memmove(msgend + 1, msgend, (size_t)(end - msgend));
+		*msgend++ = '\0';
+		end++;
+	}
+
+	d->id_start = (size_t)(msgend - d->id_buf);
+	d->id_len = (size_t)(end - d->id_buf);
+	d->id_npkts += npkts;
+	d->id_nmsgs++;
+	m->im_type = (char)buf[1];
+	m->im_data = (char *)buf + 2;
+	m->im_len = (size_t)(msgend - buf) - 3;	// length, type and NUL
+	m->im_npkts = npkts;
+	m->im_flags = d->id_inmsg ? ICB_CONT : 0;
+	d->id_inmsg = 0;
+	return ICB_MSG;
+}
+
+/*
+ * Same as icb_decode(), but if the buffer holds only the beginning of
+ * an extended message, returns its packets received so far as a part
+ * of message, with ICB_PART flag set, freeing the buffer space they took.
+ * Following parts and the rest of message are returned with ICB_CONT set.
+ *
+ * This allows messages of any length to be received with fixed-size
+ * buffer, when called after ICB_EFULL.
+ */
+int
+icb_decode_part(struct icb_decoder *d, struct icb_msg *m) {
+	unsigned char	*buf, *end, *pkt, *dst;
+	size_t		 npkts = 0;
+	char		 type;
+
+	buf = d->id_buf + d->id_start;
+	end = d->id_buf + d->id_len;
+	if (find_last_pkt(buf, (size_t)(end - buf)) != NULL)
+		return icb_decode(d, m);
+	if (end - buf < ICB_PKT_MAX)
+		return ICB_AGAIN;
+
+	type = d->id_inmsg ? d->id_type : (char)buf[1];
+	for (pkt = buf; end - pkt >= ICB_PKT_MAX && pkt[0] == 0;
+	    pkt += ICB_PKT_MAX) {
+		if ((char)pkt[1] != type)
+			return ICB_ETYPE;
+		npkts++;
+	}
+	if (npkts == 0)
+		return ICB_AGAIN;
+
+	/*
+	 * Data is packed right after the type byte put in place of the
+	 * first length byte, so there is room for NUL before the next
+	 * packet, even if there was only one packet taken.
+	 */
+	dst = buf;
+	*dst++ = (unsigned char)type;
+	for (pkt = buf; npkts-- > 0; pkt += ICB_PKT_MAX) {
+		memmove(dst, pkt + 2, EXT_DATA);
+		dst += EXT_DATA;
+	}
+	*dst = '\0';
+
+	d->id_start = (size_t)(pkt - d->id_buf);
+	d->id_npkts += (size_t)(pkt - buf) / ICB_PKT_MAX;
+	m->im_type = type;
+	m->im_data = (char *)buf + 1;
+	m->im_len = (size_t)(dst - buf) - 1;
+	m->im_wirelen = (size_t)(pkt - buf);
+	m->im_npkts = m->im_wirelen / ICB_PKT_MAX;
+	m->im_flags = ICB_PART | (d->id_inmsg ? ICB_CONT : 0);
+	d->id_inmsg = 1;
+	d->id_type = type;
+	return ICB_MSG;
+}
+
+/*
+ * Copies next 'n' bytes of data gathered from I/O vectors.
+ * The caller makes sure there is enough data.
+ */
+static void
+gather(unsigned char *dst, size_t n, struct iov_cursor *c) {
+	size_t	 chunk;
+
+	while (n > 0) {
+		while (c->ic_left == 0) {
+			c->ic_src = c->ic_iov->iov_base;
+			c->ic_left = c->ic_iov->iov_len;
+			c->ic_iov++;
+		}
+		chunk = n < c->ic_left ? n : c->ic_left;
+		memcpy(dst, c->ic_src, chunk);
+		dst += chunk;
+		n -= chunk;
+		c->ic_src += chunk;
+		c->ic_left -= chunk;
+	}
+}
+
+void
+icb_encoder_init(struct icb_encoder *e, unsigned int flags) {
+	e->ie_flags = flags;
+}
+
+/*
+ * Returns number of bytes needed to encode message with 'len' data bytes,
+ * or 0 if it's too long to be encoded.
+ */
+size_t
+icb_encoded_len(const struct icb_encoder *e, size_t len) {
+	size_t	 npkts;
+
+	if ((e->ie_flags & ICB_EXTPKT) == 0)
+		return len > ICB_MSG_MAX ? 0 : len + 3;
+	len++;		// for NUL
+	npkts = (len + EXT_DATA - 1) / EXT_DATA;
+	return len + 2 * npkts;
+}
+
+/*
+ * Encodes message of the given type, with data gathered from 'iov',
+ * into 'dst'.  Returns number of bytes written, or 0 if message can't be
+ * encoded or doesn't fit in 'dstsize' bytes.
+ */
+size_t
+icb_encodev(const struct icb_encoder *e, char type, const struct iovec *iov,
+    int iovcnt, void *dst, size_t dstsize) {
+	struct iov_cursor	 c;
+	unsigned char		*p = dst;
+	size_t			 len = 0, need, left;
+	int			 i;
+
+	for (i = 0; i < iovcnt; i++)
+		len += iov[i].iov_len;
+	need = icb_encoded_len(e, len);
+	if (need == 0 || need > dstsize)
+		return 0;
+
+	c.ic_iov = iov;
+	c.ic_src = NULL;
+	c.ic_left = 0;
+	for (left = len + 1; left > EXT_DATA; left -= EXT_DATA) {
+		// only reached with ICB_EXTPKT
+		*p++ = 0;
+		*p++ = (unsigned char)type;
+		gather(p, EXT_DATA, &c);
+		p += EXT_DATA;
+	}
+
+	// the last packet, 'left' includes NUL
+	*p++ = (unsigned char)(left + 1);
+	*p++ = (unsigned char)type;
+	gather(p, left - 1, &c);
+	p[left - 1] = '\0';
+	return need;
+}
+
+size_t
+icb_encode(const struct icb_encoder *e, char type, const void *data,
+    size_t len, void *dst, size_t dstsize) {
+	struct iovec	 iov;
+
+	iov.iov_base = (void *)(uintptr_t)data;
+	iov.iov_len = len;
+	return icb_encodev(e, type, &iov, 1, dst, dstsize);
+}
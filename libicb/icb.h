@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2026 Vadim Zhukov <zhuk@openbsd.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * libicb: ICB protocol framing, without any I/O or memory allocation.
+ *
+ * Each packet on the wire is a length byte, followed by that many bytes:
+ * message type byte and data, normally ending with NUL.  Messages longer
+ * than fits in a single packet are sent as "extended" ones: a number of
+ * packets with zero length byte, each carrying type byte and 254 bytes
+ * of data, and then a usual packet with the rest of data.
+ */
+
+#ifndef ICB_H
+#define ICB_H
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#define ICB_PKT_MAX		256	// length byte included
+#define ICB_MSG_MAX		253	// data bytes fitting in single packet
+
+// icb_decode() return values
+#define ICB_MSG			1	// message decoded
+#define ICB_AGAIN		0	// need more data
+#define ICB_EFULL		(-1)	// buffer is full, but no message yet
+#define ICB_ETYPE		(-2)	// packets of message differ in type
+
+// encoder flags
+#define ICB_EXTPKT		0x01	// allow extended messages
+
+// icb_msg flags, see icb_decode_part()
+#define ICB_PART		0x01	// more data of message will follow
+#define ICB_CONT		0x02	// continues previously returned part
+
+struct icb_msg {
+	char		 im_type;
+	char		*im_data;	// always NUL-terminated, type byte
+					// is right before it
+	size_t		 im_len;	// not including NUL
+	size_t		 im_wirelen;	// bytes taken in the buffer
+	size_t		 im_npkts;	// packets message was made of
+	unsigned int	 im_flags;
+};
+
+/*
+ * Decoder state.  The buffer belongs to the caller; messages returned
+ * by icb_decode() stay valid until next icb_decoder_space() or
+ * icb_decoder_setbuf() call.
+ */
+struct icb_decoder {
+	unsigned char	*id_buf;
+	size_t		 id_size;
+	size_t		 id_start;	// start of data not decoded yet
+	size_t		 id_len;	// end of data in the buffer
+	int		 id_inmsg;	// returned part of message already
+	char		 id_type;	// type of the above
+	unsigned long long id_npkts;	// totals, for statistics
+	unsigned long long id_nmsgs;
+};
+
+#define icb_decoder_pending(d)	((d)->id_len - (d)->id_start)
+
+struct icb_encoder {
+	unsigned int	 ie_flags;
+};
+
+void	 icb_decoder_init(struct icb_decoder *d, void *buf, size_t size);
+void	 icb_decoder_setbuf(struct icb_decoder *d, void *buf, size_t size);
+void	*icb_decoder_space(struct icb_decoder *d, size_t *avail);
+void	 icb_decoder_commit(struct icb_decoder *d, size_t n);
+int	 icb_decoder_ready(const struct icb_decoder *d);
+int	 icb_decode(struct icb_decoder *d, struct icb_msg *m);
+int	 icb_decode_part(struct icb_decoder *d, struct icb_msg *m);
+
+void	 icb_encoder_init(struct icb_encoder *e, unsigned int flags);
+size_t	 icb_encoded_len(const struct icb_encoder *e, size_t len);
+size_t	 icb_encode(const struct icb_encoder *e, char type,
+	            const void *data, size_t len, void *dst, size_t dstsize);
+size_t	 icb_encodev(const struct icb_encoder *e, char type,
+	             const struct iovec *iov, int iovcnt,
+	             void *dst, size_t dstsize);
+
+#endif // ICB_H
@@ -0,0 +1,174 @@
+/*
+ * Copyright (c) 2026 Vadim Zhukov <zhuk@openbsd.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Output line builder: pieces of a line are appended to a single buffer,
+ * which is then queued to standard output as one task.
+ */
+
+#include <sys/types.h>
+#include <err.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vis.h>
+
+#include "oicb.h"
+#include "latency.h"
+#include "linebuf.h"
+#include "stats.h"
+#include "utf8.h"
+
+
+static char	*lb_reserve(struct line_buf *lb, size_t n);
+
+
+void
+lb_init(struct line_buf *lb) {
+	lb->lb_data = lb->lb_inline;
+	lb->lb_len = 0;
+	lb->lb_size = sizeof(lb->lb_inline);
+}
+
+/*
+ * Makes room for 'n' more bytes plus NUL, returning place to put them to.
+ */
+static char *
+lb_reserve(struct line_buf *lb, size_t n) {
+	size_t	 newsize;
+	char	*p;
+
+	if (lb->lb_len + n < lb->lb_size)
+		return lb->lb_data + lb->lb_len;
+
+	for (newsize = lb->lb_size * 2; lb->lb_len + n >= newsize;)
+		newsize *= 2;
+	if (lb->lb_data == lb->lb_inline) {
+		if ((p = malloc(newsize)) == NULL)
+			err(1, __func__);
+		memcpy(p, lb->lb_data, lb->lb_len);
+	} else if ((p = realloc(lb->lb_data, newsize)) == NULL)
+		err(1, __func__);
+	STATS_ALLOC(newsize);
+	lb->lb_data = p;
+	lb->lb_size = newsize;
+	return lb->lb_data + lb->lb_len;
+}
+
+void
+lb_raw(struct line_buf *lb, const char *s, size_t len) {
+	memcpy(lb_reserve(lb, len), s, len);
+	lb->lb_len += len;
+}
+
+int
+lb_vprintf(struct line_buf *lb, const char *fmt, va_list ap) {
+	va_list	 ap2;
+	int	 len;
+
+	// the first pass is enough unless the inline storage is exhausted
+	va_copy(ap2, ap);
+	len = vsnprintf(lb->lb_data + lb->lb_len, lb->lb_size - lb->lb_len,
+	    fmt, ap2);
+	va_end(ap2);
+	if (len < 0)
+		err(1, __func__);
+	if ((size_t)len >= lb->lb_size - lb->lb_len)
+		vsnprintf(lb_reserve(lb, (size_t)len), (size_t)len + 1, fmt, ap);
+	lb->lb_len += (size_t)len;
+	return len;
+}
+
+int
+lb_printf(struct line_buf *lb, const char *fmt, ...) {
+	va_list	 ap;
+	int	 len;
+
+	va_start(ap, fmt);
+	len = lb_vprintf(lb, fmt, ap);
+	va_end(ap);
+	return len;
+}
+
+/*
+ * Appends text coming from possibly untrusted source.  Unless it's valid
+ * UTF-8 and we're in UTF-8 locale, it gets processed with strvisx(3).
+ *
+ * Returns number of bytes appended.
+ */
+size_t
+lb_untrusted(struct line_buf *lb, const char *s, size_t len) {
+	size_t	 n;
+
+	if (utf8_ready && utf8_validate(s, len)) {
+		lb_raw(lb, s, len);
+		return len;
+	}
+	n = (size_t)strvisx(lb_reserve(lb, len * 4), s, len,
+	    VIS_SAFE|VIS_NOSLASH|VIS_NL);
+	lb->lb_len += n;
+	return n;
+}
+
+/*
+ * Appends the name like lb_untrusted() does, but without checking
+ * and escaping it every time.
+ *
+ * Returns number of bytes appended.
+ */
+size_t
+lb_name(struct line_buf *lb, name_id id) {
+	const char	*s;
+	size_t		 len;
+
+	s = name_display(id, &len);
+	lb_raw(lb, s, len);
+	return len;
+}
+
+/*
+ * Queues the line built to standard output as a single task,
+ * and makes the buffer ready for building the next line.
+ *
+ * Returns number of bytes queued.
+ */
+size_t
+lb_commit(struct line_buf *lb) {
+	struct icb_task	*it;
+	size_t		 len = lb->lb_len;
+
+	if (len != 0) {
+		if ((it = alloc_task(len)) == NULL)
+			err(1, __func__);
+		memcpy(it->it_data, lb->lb_data, len);
+		it->it_len = len;
+		latency_task_queued(it);
+		enqueue_task(&tasks_stdout, &stats.st_stdout, it);
+	}
+	lb_discard(lb);
+	return len;
+}
+
+/*
+ * Forgets about the line built, releasing memory taken, if any.
+ */
+void
+lb_discard(struct line_buf *lb) {
+	if (lb->lb_data != lb->lb_inline)
+		free(lb->lb_data);
+	lb_init(lb);
+}
@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2026 Vadim Zhukov <zhuk@openbsd.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef OICB_LINEBUF_H
+#define OICB_LINEBUF_H
+
+#include <sys/types.h>
+#include <stdarg.h>
+
+#include "intern.h"
+
+#define LINE_BUF_INLINE	256
+
+/*
+ * Output line being built, usually on stack.  Lines fitting in the
+ * inline storage cost no allocations besides the task queued.
+ */
+struct line_buf {
+	char	*lb_data;
+	size_t	 lb_len;
+	size_t	 lb_size;
+	char	 lb_inline[LINE_BUF_INLINE];
+};
+
+void	 lb_init(struct line_buf *lb);
+void	 lb_raw(struct line_buf *lb, const char *s, size_t len);
+int	 lb_printf(struct line_buf *lb, const char *fmt, ...)
+	__attribute__((__format__ (printf, 2, 3)));
+int	 lb_vprintf(struct line_buf *lb, const char *fmt, va_list ap)
+	__attribute__((__format__ (printf, 2, 0)));
+size_t	 lb_untrusted(struct line_buf *lb, const char *s, size_t len);
+size_t	 lb_name(struct line_buf *lb, name_id id);
+size_t	 lb_commit(struct line_buf *lb);
+void	 lb_discard(struct line_buf *lb);
+
+#endif // OICB_LINEBUF_H
@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2026 Vadim Zhukov <zhuk@openbsd.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/types.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "logfile.h"
+
+#define GZ_BUFSIZE	(128 * 1024)
+
+
+/*
+ * Returns length of log file name without the suffix, or 0 if it's not
+ * a name of log.
+ */
+size_t
+log_name_len(const char *name) {
+	size_t	 len = strlen(name);
+
+	if (len > strlen(LOG_SUFFIX) &&
+	    strcmp(name + len - strlen(LOG_SUFFIX), LOG_SUFFIX) == 0)
+		return len - strlen(LOG_SUFFIX);
+	if (len > strlen(LOG_GZ_SUFFIX) &&
+	    strcmp(name + len - strlen(LOG_GZ_SUFFIX), LOG_GZ_SUFFIX) == 0)
+		return len - strlen(LOG_GZ_SUFFIX);
+	return 0;
+}
+
+int
+log_is_compressed(const char *name) {
+	size_t	 len = strlen(name);
+
+	return len > strlen(LOG_GZ_SUFFIX) &&
+	    strcmp(name + len - strlen(LOG_GZ_SUFFIX), LOG_GZ_SUFFIX) == 0;
+}
+
+int
+log_reader_open(struct log_reader *lr, const char *path) {
+	lr->lr_gz = NULL;
+	lr->lr_pos = 0;
+	if ((lr->lr_fd = open(path, O_RDONLY)) == -1)
+		return -1;
+	if (!log_is_compressed(path))
+		return 0;
+	if ((lr->lr_gz = gzdopen(lr->lr_fd, "rb")) == NULL) {
+		close(lr->lr_fd);
+		lr->lr_fd = -1;
+		errno = ENOMEM;
+		return -1;
+	}
+	gzbuffer(lr->lr_gz, GZ_BUFSIZE);
+	return 0;
+}
+
+ssize_t
+log_reader_pread(struct log_reader *lr, void *buf, size_t len,
+    uint64_t off) {
+	int	 n;
+
+	if (lr->lr_gz == NULL)
+		return pread(lr->lr_fd, buf, len, (off_t)off);
+
+	if (len > INT_MAX)
+		len = INT_MAX;
+	if (off != lr->lr_pos) {
+		if (gzseek(lr->lr_gz, (z_off_t)off, SEEK_SET) == -1)
+			goto fail;
+		lr->lr_pos = off;
+	}
+	if ((n = gzread(lr->lr_gz, buf, (unsigned)len)) == -1)
+		goto fail;
+	lr->lr_pos += (uint64_t)n;
+	return n;
+
+fail:
+	// force seeking from scratch next time
+	lr->lr_pos = UINT64_MAX;
+	errno = EIO;
+	return -1;
+}
+
+void
+log_reader_close(struct log_reader *lr) {
+	if (lr->lr_gz != NULL)
+		gzclose(lr->lr_gz);	// closes lr_fd, too
+	else if (lr->lr_fd != -1)
+		close(lr->lr_fd);
+	lr->lr_gz = NULL;
+	lr->lr_fd = -1;
+}
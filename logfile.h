@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2026 Vadim Zhukov <zhuk@openbsd.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef OICB_LOGFILE_H
+#define OICB_LOGFILE_H
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <zlib.h>
+
+#define LOG_SUFFIX	".log"
+#define LOG_GZ_SUFFIX	".log.gz"
+
+/*
+ * Reads history logs, either plain or compressed after rotation, by
+ * offsets in the text.  Seeking back in compressed log means reading
+ * it from the start again, so it's better to go forward.
+ */
+struct log_reader {
+	int		 lr_fd;
+	gzFile		 lr_gz;		// NULL for plain logs
+	uint64_t	 lr_pos;	// in text of compressed log
+};
+
+int	 log_reader_open(struct log_reader *lr, const char *path);
+ssize_t	 log_reader_pread(struct log_reader *lr, void *buf, size_t len,
+	                  uint64_t off);
+void	 log_reader_close(struct log_reader *lr);
+
+size_t	 log_name_len(const char *name);
+int	 log_is_compressed(const char *name);
+
+#endif // OICB_LOGFILE_H
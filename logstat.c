@@ -0,0 +1,735 @@
+/*
+ * Copyright (c) 2026 Vadim Zhukov <zhuk@openbsd.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Message statistics over history logs written by oicb: counts per user,
+ * per room and per hour of day.
+ *
+ * Logs are mapped and cut into chunks at line boundaries, and chunks are
+ * parsed by a pool of threads, one per CPU by default.  Each thread
+ * counts into its own tables, merged after all of them finish, so no
+ * locking happens except for taking the next chunk.  Compressed rotated
+ * segments can't be mapped, and are parsed by a single thread each.
+ *
+ * Like oicb-histdb, doesn't depend on libbsd or anything else from oicb.
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#define DATELEN		20	// "YYYY-MM-DD HH:MM:SS ", as in save_history()
+#define DATEFMT		"%Y-%m-%d %H:%M:%S"
+#define CHUNK_SIZE	(4 * 1024 * 1024)	// of text parsed at once
+#define GZ_BUFSIZE	(1024 * 1024)
+#define DEPTH_MAX	8	// of directories scanned
+#define TOP_DEFAULT	20
+#define BAR_WIDTH	40
+
+struct log_file {
+	char		*lf_path;
+	const char	*lf_data;	// mapped, NULL for compressed logs
+	size_t		 lf_size;
+	size_t		 lf_room;	// index in rooms, or SIZE_MAX if private
+	const char	*lf_server;	// directory name, same as server host
+	size_t		 lf_serverlen;
+	int		 lf_compressed;
+};
+
+struct job {
+	size_t		 j_file;
+	size_t		 j_off;		// in mapped text
+	size_t		 j_len;
+};
+
+struct counter {
+	char		*c_name;
+	size_t		 c_namelen;
+	uint32_t	 c_hash;
+	uint64_t	 c_count;
+};
+
+// open addressing hash table
+struct counters {
+	struct counter	*cs_tab;
+	size_t		 cs_size;
+	size_t		 cs_n;
+};
+
+struct worker {
+	pthread_t	 w_thread;
+	struct counters	 w_users;
+	uint64_t	*w_rooms;	// messages, by room index
+	uint64_t	 w_hours[24];
+	uint64_t	 w_lines;
+	uint64_t	 w_msgs;
+	uint64_t	 w_private;	// messages in private chats
+	uint64_t	 w_status;	// status and error lines
+	uint64_t	 w_bad;		// not in the format of oicb logs
+	uint64_t	 w_bytes;
+};
+
+static void	 usage(void);
+static long	 parse_num(const char *s, long max, const char *what);
+static void	 norm_time(const char *s, char *buf);
+static uint32_t	 name_hash(const char *s, size_t len);
+static void	 counter_add(struct counters *cs, const char *name, size_t len,
+		             uint32_t hash, uint64_t n);
+static int	 counter_cmp(const void *a, const void *b);
+static size_t	 room_index(const char *name, size_t len);
+static void	 add_file(const char *path);
+static void	 add_path(const char *path, int depth);
+static void	 add_jobs(size_t fileid);
+static int	 is_status(const struct log_file *lf, const char *author,
+		           size_t len);
+static void	 parse_line(struct worker *w, const struct log_file *lf,
+		            const char *line, size_t len);
+static void	 parse_text(struct worker *w, const struct log_file *lf,
+		            const char *p, size_t len);
+static void	 parse_compressed(struct worker *w, const struct log_file *lf);
+static void	*worker_main(void *arg);
+static void	 print_bar(uint64_t n, uint64_t max);
+
+static struct log_file	*files;
+static size_t		 nfiles, files_size;
+static struct job	*jobs;
+static size_t		 njobs, jobs_size;
+static size_t		 next_job;
+static pthread_mutex_t	 jobs_mtx = PTHREAD_MUTEX_INITIALIZER;
+static char		**rooms;
+static size_t		 nrooms, rooms_size;
+static char		 since[DATELEN], until[DATELEN];	// "" if not set
+
+/*
+ * Status categories, saved as authors of 'd' messages.
+ */
+static const char	*status_names[] = {
+	"Arrive", "Boot", "Change", "Depart", "Drop", "FYI", "Message",
+	"Name", "No-Pass", "Notify-On", "Notify-Off", "Pass", "Probe",
+	"Register", "Sign-off", "Sign-on", "Status", "Timeout", "Topic",
+};
+
+
+static void
+usage(void) {
+	fprintf(stderr, "usage: oicb-logstat [-j threads] [-n top] [-s since]"
+	    " [-u until] [path ...]\n");
+	exit(1);
+}
+
+static long
+parse_num(const char *s, long max, const char *what) {
+	char	*ep;
+	long	 n;
+
+	errno = 0;
+	n = strtol(s, &ep, 10);
+	if (*s == '\0' || *ep != '\0' || errno != 0 || n < 0 || n > max)
+		errx(1, "invalid %s: %s", what, s);
+	return n;
+}
+
+/*
+ * Converts time given to the format used in logs.  Logs have local time
+ * with fixed-width fields, so lines are filtered by comparing strings.
+ */
+static void
+norm_time(const char *s, char *buf) {
+	static const char	*formats[] = {
+		"%Y-%m-%d %H:%M:%S", "%Y-%m-%d %H:%M", "%Y-%m-%d",
+	};
+	struct tm		 tm;
+	const char		*ep;
+	size_t			 i;
+
+	for (i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+		memset(&tm, 0, sizeof(tm));
+		ep = strptime(s, formats[i], &tm);
+		if (ep == NULL || *ep != '\0')
+			continue;
+		if (strftime(buf, DATELEN, DATEFMT, &tm) != DATELEN - 1)
+			break;
+		return;
+	}
+	errx(1, "invalid time: %s", s);
+}
+
+/*
+ * FNV-1a, as in oicb-histdb.
+ */
+static uint32_t
+name_hash(const char *s, size_t len) {
+	uint32_t	 h = 2166136261u;
+
+	while (len-- > 0) {
+		h ^= (unsigned char)*s++;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static void
+counter_add(struct counters *cs, const char *name, size_t len, uint32_t hash,
+    uint64_t n) {
+	struct counter	*c, *old;
+	size_t		 i, oldsize;
+
+	if (cs->cs_size == 0 || (cs->cs_n + 1) * 4 > cs->cs_size * 3) {
+		old = cs->cs_tab;
+		oldsize = cs->cs_size;
+		cs->cs_size = oldsize ? oldsize * 2 : 256;
+		if ((cs->cs_tab = calloc(cs->cs_size, sizeof(*c))) == NULL)
+			err(1, NULL);
+		for (i = 0; i < oldsize; i++) {
+			if (old[i].c_name == NULL)
+				continue;
+			c = &cs->cs_tab[old[i].c_hash & (cs->cs_size - 1)];
+			while (c->c_name != NULL)
+				if (++c == cs->cs_tab + cs->cs_size)
+					c = cs->cs_tab;
+			*c = old[i];
+		}
+		free(old);
+	}
+
+	c = &cs->cs_tab[hash & (cs->cs_size - 1)];
+	while (c->c_name != NULL) {
+		if (c->c_hash == hash && c->c_namelen == len &&
+		    memcmp(c->c_name, name, len) == 0) {
+			c->c_count += n;
+			return;
+		}
+		if (++c == cs->cs_tab + cs->cs_size)
+			c = cs->cs_tab;
+	}
+	// text of compressed logs is gone after parsing, so make a copy
+	if ((c->c_name = malloc(len + 1)) == NULL)
+		err(1, NULL);
+	memcpy(c->c_name, name, len);
+	c->c_name[len] = '\0';
+	c->c_namelen = len;
+	c->c_hash = hash;
+	c->c_count = n;
+	cs->cs_n++;
+}
+
+/*
+ * The most active first, then alphabetically.
+ */
+static int
+counter_cmp(const void *a, const void *b) {
+	const struct counter	*ca = a, *cb = b;
+
+	if (ca->c_count != cb->c_count)
+		return ca->c_count < cb->c_count ? 1 : -1;
+	return strcmp(ca->c_name, cb->c_name);
+}
+
+static size_t
+room_index(const char *name, size_t len) {
+	char	**p;
+	size_t	 i;
+
+	for (i = 0; i < nrooms; i++)
+		if (strlen(rooms[i]) == len && memcmp(rooms[i], name, len) == 0)
+			return i;
+	if (nrooms == rooms_size) {
+		rooms_size = rooms_size ? rooms_size * 2 : 16;
+		if ((p = reallocarray(rooms, rooms_size, sizeof(*p))) == NULL)
+			err(1, NULL);
+		rooms = p;
+	}
+	if ((rooms[nrooms] = strndup(name, len)) == NULL)
+		err(1, NULL);
+	return nrooms++;
+}
+
+/*
+ * Maps the log, or remembers it for reading if it's compressed.
+ * Names are "room-foo.log" and "private-bar.log", and rotated segments
+ * have date and, optionally, sequence number added before ".log".
+ */
+static void
+add_file(const char *path) {
+	struct log_file	*lf;
+	struct stat	 st;
+	const char	*name, *end, *p;
+	size_t		 len;
+	int		 fd = -1, compressed;
+
+	name = strrchr(path, '/');
+	name = name ? name + 1 : path;
+	len = strlen(name);
+	if (len > 4 && strcmp(name + len - 4, ".log") == 0) {
+		compressed = 0;
+		end = name + len - 4;
+	} else if (len > 7 && strcmp(name + len - 7, ".log.gz") == 0) {
+		compressed = 1;
+		end = name + len - 7;
+	} else
+		return;
+
+	// ".YYYY-MM-DD[.N]" of rotated segments, see history.c
+	for (p = end; p > name && p[-1] >= '0' && p[-1] <= '9'; p--)
+		;
+	if (p < end && p > name && p[-1] == '.' && end - p < 10 && *p != '0')
+		p--;
+	else
+		p = end;
+	if (p - name > 11 && p[-11] == '.' && p[-6] == '-' && p[-3] == '-')
+		end = p - 11;
+
+	if (nfiles == files_size) {
+		files_size = files_size ? files_size * 2 : 64;
+		if ((lf = reallocarray(files, files_size, sizeof(*lf))) == NULL)
+			err(1, NULL);
+		files = lf;
+	}
+	lf = &files[nfiles];
+	memset(lf, 0, sizeof(*lf));
+	lf->lf_compressed = compressed;
+	if (strncmp(name, "room-", 5) == 0)
+		lf->lf_room = room_index(name + 5, (size_t)(end - name) - 5);
+	else if (strncmp(name, "private-", 8) == 0)
+		lf->lf_room = SIZE_MAX;
+	else
+		return;
+	if ((lf->lf_path = strdup(path)) == NULL)
+		err(1, NULL);
+	// errors are saved with server host as the author, see chat.c
+	lf->lf_server = lf->lf_path + (name - path);
+	if (lf->lf_server > lf->lf_path) {
+		for (p = lf->lf_server - 1; p > lf->lf_path && p[-1] != '/'; p--)
+			;
+		lf->lf_serverlen = (size_t)(lf->lf_server - 1 - p);
+		lf->lf_server = p;
+	}
+
+	if (!compressed) {
+		if ((fd = open(path, O_RDONLY)) == -1 || fstat(fd, &st) == -1) {
+			warn("%s", path);
+			if (fd != -1)
+				close(fd);
+			free(lf->lf_path);
+			return;
+		}
+		if (st.st_size > 0) {
+			lf->lf_size = (size_t)st.st_size;
+			lf->lf_data = mmap(NULL, lf->lf_size, PROT_READ,
+			    MAP_PRIVATE, fd, 0);
+			if (lf->lf_data == MAP_FAILED)
+				err(1, "%s", path);
+			posix_madvise((void *)(uintptr_t)lf->lf_data,
+			    lf->lf_size, POSIX_MADV_SEQUENTIAL);
+			// space preallocated by oicb -P
+			while (lf->lf_size > 0 &&
+			    lf->lf_data[lf->lf_size - 1] == '\0')
+				lf->lf_size--;
+		}
+		close(fd);
+	}
+	add_jobs(nfiles++);
+}
+
+/*
+ * Logs found in directories are taken, files given explicitly are
+ * taken if they look like logs.
+ */
+static void
+add_path(const char *path, int depth) {
+	struct stat	 st;
+	struct dirent	*de;
+	DIR		*dp;
+	char		 sub[PATH_MAX];
+	int		 rv;
+
+	if (stat(path, &st) == -1) {
+		warn("%s", path);
+		return;
+	}
+	if (!S_ISDIR(st.st_mode)) {
+		add_file(path);
+		return;
+	}
+	if (depth == DEPTH_MAX)
+		return;
+	if ((dp = opendir(path)) == NULL) {
+		warn("%s", path);
+		return;
+	}
+	while ((de = readdir(dp)) != NULL) {
+		if (de->d_name[0] == '.')
+			continue;
+		rv = snprintf(sub, sizeof(sub), "%s/%s", path, de->d_name);
+		if (rv < 0 || (size_t)rv >= sizeof(sub)) {
+			warnx("%s/%s: path is too long", path, de->d_name);
+			continue;
+		}
+		add_path(sub, depth + 1);
+	}
+	closedir(dp);
+}
+
+/*
+ * Cuts mapped log into chunks, ending at line boundaries.
+ */
+static void
+add_jobs(size_t fileid) {
+	const struct log_file	*lf = &files[fileid];
+	const char		*nl;
+	struct job		*j;
+	size_t			 off = 0, len;
+
+	do {
+		len = lf->lf_size - off;
+		if (len > CHUNK_SIZE) {
+			nl = memchr(lf->lf_data + off + CHUNK_SIZE, '\n',
+			    len - CHUNK_SIZE);
+			if (nl != NULL)
+				len = (size_t)(nl + 1 - (lf->lf_data + off));
+		}
+		if (njobs == jobs_size) {
+			jobs_size = jobs_size ? jobs_size * 2 : 256;
+			if ((j = reallocarray(jobs, jobs_size, sizeof(*j))) ==
+			    NULL)
+				err(1, NULL);
+			jobs = j;
+		}
+		j = &jobs[njobs++];
+		j->j_file = fileid;
+		j->j_off = off;
+		j->j_len = len;
+		off += len;
+	} while (off < lf->lf_size);
+}
+
+/*
+ * Besides status messages, server errors and beeps aren't counted
+ * as user messages.
+ */
+static int
+is_status(const struct log_file *lf, const char *author, size_t len) {
+	size_t	 i;
+
+	if ((len == 6 && memcmp(author, "SERVER", 6) == 0) ||
+	    (len == lf->lf_serverlen &&
+	    memcmp(author, lf->lf_server, len) == 0))
+		return 1;
+
+	for (i = 0; i < sizeof(status_names) / sizeof(status_names[0]); i++)
+		if (strlen(status_names[i]) == len &&
+		    memcmp(status_names[i], author, len) == 0)
+			return 1;
+	return 0;
+}
+
+/*
+ * Lines are "YYYY-MM-DD HH:MM:SS author: text", see save_history().
+ */
+static void
+parse_line(struct worker *w, const struct log_file *lf, const char *line,
+    size_t len) {
+	static const char	 pattern[] = "dddd-dd-dd dd:dd:dd ";
+	const char		*author, *p, *end = line + len;
+	size_t			 i, alen, hour;
+
+	w->w_lines++;
+	if (len < DATELEN + 2)
+		goto bad;
+	for (i = 0; i < DATELEN; i++)
+		if (pattern[i] == 'd' ? (line[i] < '0' || line[i] > '9') :
+		    line[i] != pattern[i])
+			goto bad;
+	if ((since[0] != '\0' && memcmp(line, since, DATELEN - 1) < 0) ||
+	    (until[0] != '\0' && memcmp(line, until, DATELEN - 1) >= 0))
+		return;
+
+	author = line + DATELEN;
+	for (p = author; (p = memchr(p, ':', (size_t)(end - p))) != NULL; p++)
+		if (p + 1 < end && p[1] == ' ')
+			break;
+	if (p == NULL || p == author)
+		goto bad;
+	alen = (size_t)(p - author);
+	if (is_status(lf, author, alen)) {
+		w->w_status++;
+		return;
+	}
+
+	hour = (size_t)(line[11] - '0') * 10 + (size_t)(line[12] - '0');
+	if (hour >= 24)
+		goto bad;
+	w->w_msgs++;
+	w->w_hours[hour]++;
+	if (lf->lf_room == SIZE_MAX)
+		w->w_private++;
+	else
+		w->w_rooms[lf->lf_room]++;
+	counter_add(&w->w_users, author, alen, name_hash(author, alen), 1);
+	return;
+
+bad:
+	w->w_bad++;
+}
+
+static void
+parse_text(struct worker *w, const struct log_file *lf, const char *p,
+    size_t len) {
+	const char	*nl, *end = p + len;
+
+	w->w_bytes += len;
+	for (; p < end; p = nl + 1) {
+		if ((nl = memchr(p, '\n', (size_t)(end - p))) == NULL)
+			nl = end;	// unfinished line
+		parse_line(w, lf, p, (size_t)(nl - p));
+	}
+}
+
+static void
+parse_compressed(struct worker *w, const struct log_file *lf) {
+	gzFile		 gz;
+	char		*buf, *nbuf;
+	const char	*nl;
+	size_t		 bufsize = GZ_BUFSIZE, have = 0, used;
+	int		 n;
+
+	if ((gz = gzopen(lf->lf_path, "rb")) == NULL) {
+		warn("%s", lf->lf_path);
+		return;
+	}
+	gzbuffer(gz, GZ_BUFSIZE);
+	if ((buf = malloc(bufsize)) == NULL)
+		err(1, NULL);
+	for (;;) {
+		if (have == bufsize) {
+			// line doesn't fit
+			if ((nbuf = realloc(buf, bufsize * 2)) == NULL)
+				err(1, NULL);
+			buf = nbuf;
+			bufsize *= 2;
+		}
+		n = gzread(gz, buf + have, (unsigned)(bufsize - have));
+		if (n == -1) {
+			warnx("%s: %s", lf->lf_path, gzerror(gz, &n));
+			break;
+		}
+		have += (size_t)n;
+		if (n == 0) {
+			parse_text(w, lf, buf, have);
+			break;
+		}
+		if ((nl = memrchr(buf, '\n', have)) == NULL)
+			continue;
+		used = (size_t)(nl + 1 - buf);
+		parse_text(w, lf, buf, used);
+		have -= used;
+		memmove(buf, buf + used, have);
+	}
+	free(buf);
+	gzclose(gz);
+}
+
+static void *
+worker_main(void *arg) {
+	struct worker		*w = arg;
+	const struct log_file	*lf;
+	const struct job	*j;
+
+	for (;;) {
+		pthread_mutex_lock(&jobs_mtx);
+		j = next_job < njobs ? &jobs[next_job++] : NULL;
+		pthread_mutex_unlock(&jobs_mtx);
+		if (j == NULL)
+			break;
+		lf = &files[j->j_file];
+		if (lf->lf_compressed)
+			parse_compressed(w, lf);
+		else if (lf->lf_data != NULL)
+			parse_text(w, lf, lf->lf_data + j->j_off, j->j_len);
+	}
+	return NULL;
+}
+
+static void
+print_bar(uint64_t n, uint64_t max) {
+	size_t	 i, len;
+
+	len = max ? (size_t)(n * BAR_WIDTH / max) : 0;
+	putchar(' ');
+	for (i = 0; i < len; i++)
+		putchar('#');
+	putchar('\n');
+}
+
+int
+main(int argc, char **argv) {
+	struct worker	*workers, total;
+	struct counter	*sorted;
+	struct timespec	 start, finish;
+	const char	*home;
+	char		 path[PATH_MAX];
+	uint64_t	*room_counts, max;
+	size_t		 i, j, n, top = TOP_DEFAULT;
+	long		 ncpu;
+	int		 ch, nworkers = 0, error;
+
+	while ((ch = getopt(argc, argv, "j:n:s:u:")) != -1) {
+		switch (ch) {
+		case 'j':
+			nworkers = (int)parse_num(optarg, 1024,
+			    "number of workers");
+			if (nworkers == 0)
+				errx(1, "invalid number of workers: %s", optarg);
+			break;
+		case 'n':
+			top = (size_t)parse_num(optarg, INT_MAX,
+			    "number of users");
+			break;
+		case 's':
+			norm_time(optarg, since);
+			break;
+		case 'u':
+			norm_time(optarg, until);
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (argc == 0) {
+		if ((home = getenv("HOME")) == NULL)
+			errx(1, "HOME is not set");
+		if ((size_t)snprintf(path, sizeof(path), "%s/.oicb/logs", home)
+		    >= sizeof(path))
+			errx(1, "HOME is too long");
+		add_path(path, 0);
+	}
+	for (i = 0; i < (size_t)argc; i++)
+		add_path(argv[i], 0);
+	if (nfiles == 0)
+		errx(1, "no logs found");
+
+	if (nworkers == 0) {
+		ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+		nworkers = ncpu > 0 ? (int)ncpu : 1;
+	}
+	if ((size_t)nworkers > njobs)
+		nworkers = (int)njobs;
+	if ((workers = calloc((size_t)nworkers, sizeof(*workers))) == NULL)
+		err(1, NULL);
+	for (i = 0; i < (size_t)nworkers; i++) {
+		if ((workers[i].w_rooms = calloc(nrooms + 1,
+		    sizeof(uint64_t))) == NULL)
+			err(1, NULL);
+		if ((error = pthread_create(&workers[i].w_thread, NULL,
+		    worker_main, &workers[i])) != 0) {
+			errno = error;
+			err(1, "pthread_create");
+		}
+	}
+
+	memset(&total, 0, sizeof(total));
+	if ((room_counts = calloc(nrooms + 1, sizeof(uint64_t))) == NULL)
+		err(1, NULL);
+	for (i = 0; i < (size_t)nworkers; i++) {
+		pthread_join(workers[i].w_thread, NULL);
+		for (j = 0; j < workers[i].w_users.cs_size; j++) {
+			if (workers[i].w_users.cs_tab[j].c_name == NULL)
+				continue;
+			counter_add(&total.w_users,
+			    workers[i].w_users.cs_tab[j].c_name,
+			    workers[i].w_users.cs_tab[j].c_namelen,
+			    workers[i].w_users.cs_tab[j].c_hash,
+			    workers[i].w_users.cs_tab[j].c_count);
+			free(workers[i].w_users.cs_tab[j].c_name);
+		}
+		free(workers[i].w_users.cs_tab);
+		for (j = 0; j < nrooms; j++)
+			room_counts[j] += workers[i].w_rooms[j];
+		for (j = 0; j < 24; j++)
+			total.w_hours[j] += workers[i].w_hours[j];
+		total.w_lines += workers[i].w_lines;
+		total.w_msgs += workers[i].w_msgs;
+		total.w_private += workers[i].w_private;
+		total.w_status += workers[i].w_status;
+		total.w_bad += workers[i].w_bad;
+		total.w_bytes += workers[i].w_bytes;
+		free(workers[i].w_rooms);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &finish);
+
+	printf("%zu logs, %llu bytes, %llu lines parsed by %d thread%s"
+	    " in %.3f s\n", nfiles, (unsigned long long)total.w_bytes,
+	    (unsigned long long)total.w_lines, nworkers,
+	    nworkers == 1 ? "" : "s",
+	    (double)(finish.tv_sec - start.tv_sec) +
+	    (double)(finish.tv_nsec - start.tv_nsec) / 1e9);
+	printf("%llu messages, %llu status lines, %llu lines not recognized\n",
+	    (unsigned long long)total.w_msgs,
+	    (unsigned long long)total.w_status,
+	    (unsigned long long)total.w_bad);
+
+	printf("\nMessages by room:\n");
+	for (i = 0; i < nrooms; i++)
+		printf("%12llu  %s\n", (unsigned long long)room_counts[i],
+		    rooms[i]);
+	printf("%12llu  (private chats)\n",
+	    (unsigned long long)total.w_private);
+
+	n = total.w_users.cs_n;
+	if ((sorted = reallocarray(NULL, n ? n : 1, sizeof(*sorted))) == NULL)
+		err(1, NULL);
+	for (i = j = 0; i < total.w_users.cs_size; i++)
+		if (total.w_users.cs_tab[i].c_name != NULL)
+			sorted[j++] = total.w_users.cs_tab[i];
+	qsort(sorted, n, sizeof(*sorted), counter_cmp);
+	if (top != 0 && top < n)
+		printf("\nTop %zu of %zu users:\n", top, n);
+	else {
+		top = n;
+		printf("\nMessages by user:\n");
+	}
+	for (i = 0; i < top; i++)
+		printf("%12llu  %s\n", (unsigned long long)sorted[i].c_count,
+		    sorted[i].c_name);
+
+	printf("\nMessages by hour:\n");
+	for (i = 0, max = 0; i < 24; i++)
+		if (total.w_hours[i] > max)
+			max = total.w_hours[i];
+	for (i = 0; i < 24; i++) {
+		printf("%12llu  %02zu", (unsigned long long)total.w_hours[i],
+		    i);
+		print_bar(total.w_hours[i], max);
+	}
+	return 0;
+}
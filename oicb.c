@@ -39,16 +39,27 @@
 #include <stdio.h>
 #include <time.h>
 #include <unistd.h>
-#include <vis.h>
 
 #include <signal.h>
 
 #include <readline/readline.h>
 
 #include "oicb.h"
+#include "icb.h"
+#include "capture.h"
 #include "chat.h"
 #include "history.h"
+#include "intern.h"
+#include "json.h"
+#include "latency.h"
+#include "linebuf.h"
+#include "ping.h"
 #include "private.h"
+#include "probes.h"
+#include "scrollback.h"
+#include "search.h"
+#include "stats.h"
+#include "trace.h"
 #include "utf8.h"
 
 #ifndef HAVE_RL_BIND_KEYSEQ
@@ -78,6 +89,7 @@ int		 debug = 0;
 int		 sock = -1, histfile = -1;
 volatile int	 want_exit = 0;
 volatile int	 want_info = 0;
+size_t		 max_msg_size = 1024*1024;
 char		*nick, *hostname, *room;
 size_t		 nicklen;
 char		*o_rl_buf = NULL;
@@ -91,10 +103,12 @@ void	 pledge_me(void);
 int	 test_cmd(int count, int key);
 
 size_t	 push_data(int fd, char *data, size_t len);
-void	 proceed_output(struct icb_task_queue *q, int fd);
-char	*get_next_icb_msg(size_t *msglen);
+void	 proceed_output(struct icb_task_queue *q, struct queue_stats *qs,
+	                int fd);
 
 void	 update_pollfds(void);
+void	 setup_history(void);
+__dead void	 replay(int paced);
 #ifdef SIGINFO
 void	 siginfo_handler(int sig);
 #endif
@@ -137,6 +151,7 @@ prepare_stdout(void) {
 	o_rl_buf = strdup(rl_line_buffer);
 	if (o_rl_buf == NULL)
 		err(1, __func__);
+	STATS_ALLOC(strlen(o_rl_buf) + 1);
 	o_rl_point = rl_point;
 	o_rl_mark = rl_mark;
 	for (p = rl_line_buffer; *p; p++)
@@ -157,7 +172,7 @@ restore_rl(void) {
 			rl_insert_text("/msg ");
 		else
 			rl_insert_text("/m ");
-		rl_insert_text(priv_chats_nicks[0]);
+		rl_insert_text(name_str(last_priv_chat()));
 		rl_insert_text(" ");
 		kill(getpid(), SIGWINCH);
 		repeat_priv_nick = 0;
@@ -180,76 +195,27 @@ restore_rl(void) {
  * The data at 'text' won't be accessed after return, its contents will be
  * copied to internal buffer for the further processing.
  *
- * Returns number of bytes queued, not including terminating NUL.
+ * Returns number of bytes queued.
  */
 int
 push_stdout(const char *text, ...) {
-	struct icb_task	*it;
+	struct line_buf	 lb;
 	int		 len;
 	va_list		 ap;
 
-	va_start(ap, text);
-	len = vsnprintf(NULL, 0, text, ap);
-	va_end(ap);
-	if (len == 0)
-		return 0;
-	it = calloc(1, sizeof(struct icb_task) + len + 1);
-	if (it == NULL)
-		err(1, __func__);
-	it->it_len = len + 1;
-	va_start(ap, text);
-	vsnprintf(it->it_data, len + 1, text, ap);
-	va_end(ap);
-	SIMPLEQ_INSERT_TAIL(&tasks_stdout, it, it_entry);
-	return len;
-}
-
-/*
- * Queue text coming from possibly untrusted source to be displayed.
- * The data will be processed with strvis(3) internally, if needed.
- *
- * The data at 'text' won't be accessed after return, its contents will be
- * copied to internal buffer for the further processing.
- *
- * Returns number of bytes queued, not including terminating NUL.
- */
-int
-push_stdout_untrusted(const char *text, ...) {
-	struct icb_task	*it, *tmp = NULL;
-	size_t		 len, buflen;
-	va_list		 ap;
-	char		*fmtbuf;
-
-	va_start(ap, text);
-	len = vsnprintf(NULL, 0, text, ap);
-	va_end(ap);
-	if (len == 0)
-		return 0;
-
-	it = calloc(1, sizeof(struct icb_task) + len + 1);
-	if (it == NULL)
-		err(1, __func__);
+	if (json_output) {
+		// keep stdout machine-readable, notices go to stderr instead
+		va_start(ap, text);
+		len = vfprintf(stderr, text, ap);
+		va_end(ap);
+		return len;
+	}
 
+	lb_init(&lb);
 	va_start(ap, text);
-	vsnprintf(it->it_data, len + 1, text, ap);
+	lb_vprintf(&lb, text, ap);
 	va_end(ap);
-
-	if (utf8_ready && mbsvalidate(it->it_data) != -1) {
-		it->it_len = len + 1;
-		goto finish;
-	}
-
-	buflen = len * 4 + 1;
-	tmp = calloc(1, sizeof(struct icb_task) + buflen);
-	if (tmp == NULL)
-		err(1, __func__);
-	tmp->it_len = strvis(tmp->it_data, it->it_data, VIS_SAFE|VIS_NOSLASH|VIS_NL) + 1;
-	free(it);
-	it = tmp;
-
-finish:
-	SIMPLEQ_INSERT_TAIL(&tasks_stdout, it, it_entry);
-	return (int)it->it_len;
+	return (int)lb_commit(&lb);
 }
 
 // Input: line input from user
@@ -312,6 +278,8 @@ parse_cmd_line(char *line, struct line_cmd *cmd) {
 	}
 
 end:
+	TRACE(TraceCmdParsed, cmd->cmd_name_len, cmd->peer_nick_len,
+	    cmd->private_msg != NULL);
 	if (debug >= 2)
 		warnx("%s: cmd_name='%.*s' nick_name='%.*s' private_msg='%s'",
 		    __func__, cmd->cmd_name_len, cmd->cmd_name,
@@ -350,20 +318,60 @@ push_data(int fd, char *data, size_t len) {
 	size_t	total = 0;
 
 	while (len > 0 && (nwritten = write(fd, data, len)) >= 0) {
+		stats.st_writes++;
 		len -= (size_t) nwritten;
 		data += nwritten;
 		total += nwritten;
 	}
+	if (nwritten == -1) {
+		stats.st_writes++;
+		if (errno == EAGAIN)
+			stats.st_write_eagain++;
+	}
 	if (nwritten != -1 || errno == EAGAIN)
 		return total;
 	err(2, __func__);
 }
 
+/*
+ * Allocate task able to hold 'datasz' bytes, zero-filled.
+ * Returns NULL on failure.
+ */
+struct icb_task *
+alloc_task(size_t datasz) {
+	struct icb_task	*it;
+
+	if ((it = calloc(1, sizeof(struct icb_task) + datasz)) != NULL)
+		STATS_ALLOC(sizeof(struct icb_task) + datasz);
+	return it;
+}
+
+void
+enqueue_task(struct icb_task_queue *q, struct queue_stats *qs,
+    struct icb_task *it) {
+	SIMPLEQ_INSERT_TAIL(q, it, it_entry);
+	queue_stats_add(qs, it->it_len);
+}
+
+/*
+ * Removes first task from the queue and returns it, or NULL if empty.
+ */
+struct icb_task *
+dequeue_task(struct icb_task_queue *q, struct queue_stats *qs) {
+	struct icb_task	*it;
+
+	if ((it = SIMPLEQ_FIRST(q)) == NULL)
+		return NULL;
+	SIMPLEQ_REMOVE_HEAD(q, it_entry);
+	queue_stats_remove(qs, it->it_len);
+	return it;
+}
+
 /*
  * Push queued text.
  */
 void
-proceed_output(struct icb_task_queue *q, int fd) {
+proceed_output(struct icb_task_queue *q, struct queue_stats *qs, int fd) {
 	struct icb_task	*it;
 	size_t		 nwritten;
 
@@ -375,60 +383,124 @@ proceed_output(struct icb_task_queue *q, int fd) {
 			warnx("output %zu from %zu bytes at fileno %d",
 			    it->it_ndone, it->it_len, fd);
 		}
+		OICB_PROBE3(output_written, fd, nwritten, qs->qs_len);
+		TRACE(TraceOutput, fd, it->it_ndone, it->it_len, nwritten);
 		it->it_ndone += nwritten;
+		qs->qs_written += nwritten;
 		if (it->it_ndone < it->it_len)
 			break;
-		SIMPLEQ_REMOVE_HEAD(q, it_entry);
+		dequeue_task(q, qs);
+		latency_task_written(it, SIMPLEQ_FIRST(q));
 		if (it->it_cb)
 			(*it->it_cb)(it);
 		free(it);
 	}
 }
 
+#define RXBUF_SIZE	16384		// normal size of receive buffer
+#define BIGMSG_KEEP	(64*1024)
+
+/*
+ * Extended message too long for the receive buffer, being assembled.
+ * Data beyond max_msg_size is dropped, so the client can't be made to
+ * allocate arbitrary amounts of memory, and the buffer is freed after
+ * delivering the message if it grew above BIGMSG_KEEP bytes.
+ */
+struct big_msg {
+	char	*bm_data;	// type byte, then data
+	size_t	 bm_size;
+	size_t	 bm_len;	// data bytes, not including type byte
+	size_t	 bm_dropped;
+};
+
+static void
+big_msg_append(struct big_msg *bm, const struct icb_msg *m) {
+	size_t	 n, newsize;
+	char	*p;
+
+	if ((m->im_flags & ICB_CONT) == 0)
+		bm->bm_len = bm->bm_dropped = 0;
+
+	n = m->im_len;
+	if (n > max_msg_size - bm->bm_len) {
+		bm->bm_dropped += n - (max_msg_size - bm->bm_len);
+		n = max_msg_size - bm->bm_len;
+	}
+	if (bm->bm_len + n + 2 > bm->bm_size) {		// type and NUL
+		newsize = bm->bm_size ? bm->bm_size : RXBUF_SIZE;
+		while (bm->bm_len + n + 2 > newsize)
+			newsize *= 2;
+		if ((p = realloc(bm->bm_data, newsize)) == NULL)
+			err(1, "%s: realloc", __func__);
+		STATS_ALLOC(newsize);
+		bm->bm_data = p;
+		bm->bm_size = newsize;
+	}
+	bm->bm_data[0] = m->im_type;
+	memcpy(bm->bm_data + 1 + bm->bm_len, m->im_data, n);
+	bm->bm_len += n;
+	bm->bm_data[1 + bm->bm_len] = '\0';
+}
+
+static __dead void
+icb_decode_error(int rv) {
+	if (rv == ICB_ETYPE)
+		// XXX Or just ignore? Which to use then?
+		err(2, "message types messed up in a single message");
+	err(2, "cannot decode message: error %d", rv);
+}
+
 /*
  * Extract next incoming ICB message on the network socket.
  *
  * Returned pointer contains message type in the first byte,
  * with data bytes following it. Data always ends with NUL,
  * which isn't taken into account of msglen returned.
+ * Messages longer than max_msg_size are truncated.
  *
  * Returned pointer will be valid until next call of get_next_icb_msg().
  */
 char*
 get_next_icb_msg(size_t *msglen) {
-	static unsigned char	*buf = NULL, *msgend = NULL;
-	static size_t		 bufread = 0, bufsize = 1024;
-
-	unsigned char	*lastpkt, *pkt, *nbuf;
-	size_t		 roundread = 0;
-	ssize_t		 nread, shift;
-
-	if (buf == NULL) {
-		if ((buf = malloc(bufsize)) == NULL)
-			err(1, "%s: malloc", __func__);
-
-	} else if (msgend) {
-		// resetting state
-		memmove(buf, msgend, bufread - (msgend - buf));
-		bufread -= (msgend - buf);
-		msgend = NULL;
+	static struct icb_decoder	 dec;
+	static unsigned char		 buf[RXBUF_SIZE];
+	static struct big_msg		 bigmsg;
+
+	struct icb_msg	 m;
+	void		*space;
+	size_t		 avail;
+	ssize_t		 nread;
+	int		 rv;
+
+	if (dec.id_buf == NULL)
+		icb_decoder_init(&dec, buf, sizeof(buf));
+	if (bigmsg.bm_size > BIGMSG_KEEP) {
+		// shrink back after a spike
+		free(bigmsg.bm_data);
+		memset(&bigmsg, 0, sizeof(bigmsg));
 	}
 
 	for (;;) {
-		// Reserve one byte for ending NUL in case it's missing in the
-		// input packet, see the "msglen++" block at the end of function.
-		if (bufread == bufsize - 1) {
-			if (bufsize >= 1024*1024)
-				err(2, "too long message");
-			if ((nbuf = reallocarray(buf, 2, bufsize)) == NULL)
-				err(1, "%s: reallocarray", __func__);
-			buf = nbuf;
-			bufsize *= 2;
+		space = icb_decoder_space(&dec, &avail);
+		if (avail == 0) {
+			// do not read more while there is something to proceed
+			if (icb_decoder_ready(&dec))
+				break;
+			// buffer is filled with beginning of a long message
+			if ((rv = icb_decode_part(&dec, &m)) != ICB_MSG)
+				icb_decode_error(rv);
+			big_msg_append(&bigmsg, &m);
+			latency_rx_consumed(m.im_wirelen);
+			stats.st_pkts_in += m.im_npkts;
+			TRACE(TraceMsgPart, m.im_type, m.im_len, bigmsg.bm_len);
+			continue;
 		}
-		nread = read(sock, buf + bufread, bufsize - bufread - 1);
+		nread = read(sock, space, avail);
+		stats.st_reads++;
 		if (nread < 0) {
 			if (errno != EAGAIN)
 				err(1, "%s: read", __func__);
+			stats.st_read_eagain++;
 			break;
 		} else if (nread == 0) {
 			push_stdout("Server %s closed connection, exiting...\n",
@@ -436,45 +508,44 @@ get_next_icb_msg(size_t *msglen) {
 			want_exit = 1;
 			break;
 		}
-		roundread += nread;
-		bufread += nread;
+		capture_data(space, (size_t)nread);
+		stats.st_bytes_in += (uint64_t)nread;
+		icb_decoder_commit(&dec, (size_t)nread);
+		TRACE(TraceRead, nread, icb_decoder_pending(&dec));
+		latency_read(icb_decoder_pending(&dec));
 	}
-	if (bufread == 0 && roundread == 0)
+	if (icb_decoder_pending(&dec) == 0)
 		return NULL;
 
-	for (lastpkt = buf; lastpkt[0] == 0; lastpkt += 256) {
-		if (buf + bufread - 256 < lastpkt)
-			return NULL;    // not received ending packet yet
-	}
-	// now lastpkt points to the ending packet
-	if (buf + bufread - lastpkt[0] < lastpkt)
-		return NULL;    // not received ending packet fully yet
-
-	msgend = lastpkt + 1 + lastpkt[0];
-
-	// got full message, now remove extra data to get continious bytes
-	for (pkt = buf; pkt <= lastpkt; pkt += 256) {
-		if (pkt[1] != lastpkt[1])
-			// XXX Or just ignore? Which to use then?
-			err(2, "message types messed up in a single message");
-		if (pkt != buf) {
-			shift = (pkt[-1] == '\0') ? 3 : 2;
-			memmove(pkt + 2 - shift, pkt + 2, buf + bufread - (pkt + 2));
-			bufread -= shift;
-			lastpkt -= shift;
-			pkt -= shift;
-		}
-	}
-
-	// There always will be a place for NUL, see main read loop.
-	if (msgend[-1] != '\0') {
-		memmove(msgend + 1, msgend, bufread - (msgend - buf));
-		*msgend++ = '\0';
+	if ((rv = icb_decode(&dec, &m)) == ICB_AGAIN)
+		return NULL;
+	else if (rv != ICB_MSG)
+		icb_decode_error(rv);
+	latency_msg_received(m.im_wirelen);
+	stats.st_pkts_in += m.im_npkts;
+	stats.st_msgs_in[(unsigned char)m.im_type]++;
+
+	if (m.im_flags & ICB_CONT) {
+		big_msg_append(&bigmsg, &m);
+		m.im_data = bigmsg.bm_data + 1;
+		m.im_len = bigmsg.bm_len;
+	} else if (m.im_len > max_msg_size) {
+		bigmsg.bm_dropped = m.im_len - max_msg_size;
+		m.im_len = max_msg_size;
+		m.im_data[m.im_len] = '\0';
+	} else
+		bigmsg.bm_dropped = 0;
+	if (bigmsg.bm_dropped) {
+		stats.st_msgs_truncated++;
+		TRACE(TraceMsgTruncated, m.im_type, m.im_len,
+		    bigmsg.bm_dropped);
+		push_stdout("%s: incoming message truncated to %zu bytes,"
+		    " %zu bytes dropped\n", getprogname(), m.im_len,
+		    bigmsg.bm_dropped);
 	}
 
-	// -1 to skip initial byte count byte, another -1 for trailing NUL
-	*msglen = msgend - buf - 2;
-	return (char*)(buf + 1);
+	*msglen = m.im_len + 1;		// for type byte
+	return m.im_data - 1;
 }
 
 char *
@@ -488,7 +559,11 @@ __dead void
 usage(const char *msg) {
 	if (msg)
 		fprintf(stderr, "%s\n", msg);
-	fprintf(stderr, "usage: %s [-dH] [-t secs] [nick@]host[:port] room\n",
+	fprintf(stderr, "usage: %1$s [-adHjLPx] [-b lines] [-c chats] [-m kbytes]"
+	    " [-R rule] [-S kbytes] [-T file] [-t secs] [-w file]"
+	    " [nick@]host[:port] room\n"
+	    "       %1$s [-dHjLPpx] [-m kbytes] [-R rule] [-S kbytes] [-T file]"
+	    " [-w file] -r file\n",
 	    getprogname());
 	exit (1);
 }
@@ -527,12 +602,107 @@ update_pollfds(void) {
 	i = 0;
 	LIST_FOREACH(hfile, &history_files, hf_entry) {
 		pfd[MainFDCount + i].fd = hfile->hf_fd;
-		if (hfile->hf_ntasks)
+		if (hfile->hf_qstats.qs_len)
 			pfd[MainFDCount + i].events = POLLOUT;
 		i++;
 	}
 }
 
+void
+setup_history(void) {
+	if (!enable_history)
+		return;
+	snprintf(history_path, PATH_MAX, "%s/.oicb/logs/%s",
+	    getenv("HOME"), hostname);
+	if (create_dir_for(history_path) == -1 ||
+	    (mkdir(history_path, 0777) == -1 && errno != EEXIST)) {
+		warn("cannot make sure history directory \"%s\" exists",
+		    history_path);
+		warnx("history saving is disabled");
+		enable_history = 0;
+		memset(history_path, 0, PATH_MAX);
+		return;
+	}
+	compress_leftovers();
+	atexit(close_history_files);
+}
+
+void
+drop_tasks(struct icb_task_queue *q, struct queue_stats *qs) {
+	struct icb_task	*it;
+
+	while ((it = dequeue_task(q, qs)) != NULL)
+		free(it);
+}
+
+/*
+ * Feed previously captured server traffic through the usual decoding,
+ * formatting and history saving code, instead of talking to real server.
+ *
+ * Data is pushed through a pipe, so get_next_icb_msg() sees the same
+ * read() patterns it saw during capture.  Outgoing messages are dropped.
+ */
+__dead void
+replay(int paced) {
+	struct capture_record	 rec;
+	struct timespec		 start, end, delay;
+	size_t			 msglen, off, nrecs = 0, nbytes = 0, nmsgs = 0;
+	ssize_t			 nwritten;
+	double			 elapsed;
+	char			*msg;
+	int			 fds[2];
+
+	if (pipe(fds) == -1)
+		err(1, "pipe");
+	if (fcntl(fds[0], F_SETFL, O_NONBLOCK) == -1 ||
+	    fcntl(fds[1], F_SETFL, O_NONBLOCK) == -1)
+		err(1, "pipe: fcntl");
+	sock = fds[0];
+	state = Connected;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while (!want_exit && replay_next(&rec)) {
+		if (paced && rec.cr_delay) {
+			delay.tv_sec = (time_t)(rec.cr_delay / 1000000);
+			delay.tv_nsec = (long)(rec.cr_delay % 1000000) * 1000;
+			nanosleep(&delay, NULL);
+		}
+		for (off = 0; off < rec.cr_len && !want_exit;) {
+			nwritten = write(fds[1], rec.cr_data + off,
+			    rec.cr_len - off);
+			if (nwritten == -1 && errno != EAGAIN)
+				err(1, "pipe: write");
+			if (nwritten > 0)
+				off += (size_t)nwritten;
+			while (!want_exit &&
+			    (msg = get_next_icb_msg(&msglen)) != NULL) {
+				proceed_icb_msg(msg, msglen);
+				latency_msg_done();
+				nmsgs++;
+			}
+			drop_tasks(&tasks_net, &stats.st_net);
+			proceed_output(&tasks_stdout, &stats.st_stdout,
+			    STDOUT_FILENO);
+			proceed_history();
+		}
+		nrecs++;
+		nbytes += rec.cr_len;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	proceed_output(&tasks_stdout, &stats.st_stdout, STDOUT_FILENO);
+	proceed_history();
+
+	elapsed = (double)(end.tv_sec - start.tv_sec) +
+	    (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+	fprintf(stderr, "%s: replayed %zu reads, %zu bytes, %zu messages"
+	    " in %.3f s", getprogname(), nrecs, nbytes, nmsgs, elapsed);
+	if (elapsed > 0)
+		fprintf(stderr, " (%.0f msgs/s, %.2f MB/s)",
+		    (double)nmsgs / elapsed, (double)nbytes / elapsed / 1e6);
+	fprintf(stderr, "\n");
+	exit(0);
+}
+
 void
 icb_connect(const char *addr, const char *port) {
 	struct addrinfo		*res, *p, hints;
@@ -582,7 +752,7 @@ pledge_me() {
 
 #ifdef HAVE_UNVEIL
 	if (enable_history) {
-		if (unveil(history_path, "wc") == -1)
+		if (unveil(history_path, "rwc") == -1)
 			err(1, "history unveil");
 	}
 	if (unveil(NULL, NULL) == -1)
@@ -591,7 +761,7 @@ pledge_me() {
 
 #ifdef HAVE_PLEDGE
 	if (enable_history)
-		result = pledge("stdio wpath cpath tty", NULL);
+		result = pledge("stdio rpath wpath cpath flock tty", NULL);
 	else
 		result = pledge("stdio tty", NULL);
 	if (result == -1)
@@ -607,6 +777,7 @@ rl_bind_keyseq(const char *keyseq, int(*function)(int, int))
 }
 #endif
 
+#ifndef OICB_NO_MAIN	// defined when building benchmarks
 int
 main(int argc, char **argv) {
 #ifdef SIGINFO
@@ -614,12 +785,18 @@ main(int argc, char **argv) {
 #endif
 	size_t		 msglen;
 	time_t		 ts_lastnetinput, t;
-	int		 ch, i, net_timeout, poll_timeout, max_pings;
+	uint64_t	 rto, age;
+	int		 ch, i, net_timeout, poll_timeout, max_pings, timeout;
+	int		 nready;
 	char		*msg, *port = NULL;
 	const char	*errstr, *locale;
+	const char	*capture_path = NULL, *replay_path = NULL;
+	const char	*trace_path = NULL;
+	int		 replay_paced = 0;
 
 	SIMPLEQ_INIT(&tasks_stdout);
 	SIMPLEQ_INIT(&tasks_net);
+	stats.st_start = time(NULL);
 
 	locale = setlocale(LC_CTYPE, "");
 	if (strstr(locale, ".UTF-8")) {
@@ -629,14 +806,66 @@ main(int argc, char **argv) {
 	}
 
 	net_timeout = 30;
-	while ((ch = getopt(argc, argv, "dHt:")) != -1) {
+	while ((ch = getopt(argc, argv, "ab:c:dHjLm:PpR:r:S:T:t:w:x")) != -1) {
 		switch (ch) {
+		case 'a':
+			adaptive_pings = 1;
+			break;
+		case 'b':
+			backlog_lines = (size_t)strtonum(optarg, 0,
+			    LAST_LINES_MAX, &errstr);
+			if (errstr)
+				errx(1, "invalid backlog size: %s", errstr);
+			break;
+		case 'c':
+			priv_chats_max = (size_t)strtonum(optarg, 1,
+			    PRIV_CHATS_MAX, &errstr);
+			if (errstr)
+				errx(1, "invalid number of private chats: %s",
+				    errstr);
+			break;
 		case 'd':
 			debug++;
 			break;
 		case 'H':
 			enable_history = 0;
 			break;
+		case 'j':
+			json_output = 1;
+			break;
+		case 'L':
+			atexit(print_latency_stats_at_exit);
+			break;
+		case 'P':
+			history_mmap = 1;
+			break;
+		case 'p':
+			replay_paced = 1;
+			break;
+		case 'm':
+			max_msg_size = (size_t)strtonum(optarg, 1, 1024*1024,
+			    &errstr) * 1024;
+			if (errstr)
+				errx(1, "invalid message size limit: %s",
+				    errstr);
+			break;
+		case 'R':
+			if (set_history_rotation(optarg) == -1)
+				errx(1, "invalid rotation rule: %s", optarg);
+			break;
+		case 'r':
+			replay_path = optarg;
+			break;
+		case 'S':
+			scrollback_size = (size_t)strtonum(optarg, 0,
+			    SCROLLBACK_MAX, &errstr) * 1024;
+			if (errstr)
+				errx(1, "invalid scrollback size: %s",
+				    errstr);
+			break;
+		case 'T':
+			trace_path = optarg;
+			break;
 		case 't':
 			net_timeout = strtonum(optarg, 0, INT_MAX/1000,
 			    &errstr);
@@ -644,6 +873,12 @@ main(int argc, char **argv) {
 				errx(1, "invalid network timeout: %s",
 				    errstr);
 			break;
+		case 'w':
+			capture_path = optarg;
+			break;
+		case 'x':
+			srv_features |= ExtPkt;
+			break;
 		default:
 			/* error message is already printed by getopt() */
 			usage(NULL);
@@ -652,6 +887,20 @@ main(int argc, char **argv) {
 	argc -= optind;
 	argv += optind;
 
+	if (trace_path != NULL)
+		trace_start(trace_path);
+
+	if (replay_path != NULL) {
+		if (argc != 0)
+			usage("host and room are taken from the capture file");
+		replay_start(replay_path);
+		if (capture_path != NULL)
+			capture_start(capture_path);
+		setup_history();
+		pledge_me();
+		replay(replay_paced);
+	}
+
 	if (argc != 2)
 		usage(NULL);
 
@@ -686,6 +935,8 @@ main(int argc, char **argv) {
 			*port++ = '\0';
 	}
 
+	if (capture_path != NULL)
+		capture_start(capture_path);
 	icb_connect(hostname, port);
 	if (fcntl(STDIN_FILENO, F_SETFL, O_NONBLOCK) == -1)
 		err(1, "stdin: fcntl");
@@ -699,6 +950,8 @@ main(int argc, char **argv) {
 	ts_lastnetinput = time(NULL);
 	max_pings = 3;
 
+	if (json_output)
+		rl_outstream = stderr;
 	rl_callback_handler_install("", &proceed_user_input);
 	atexit(&rl_callback_handler_remove);
 
@@ -709,6 +962,7 @@ main(int argc, char **argv) {
 	rl_bind_keyseq("\\e[Z", cycle_priv_chats_backward);
 	rl_bind_key(CTRL('p'), list_priv_chats_nicks_wrapper);
 	rl_bind_key(CTRL('t'), siginfo_cmd);
+	rl_bind_keyseq("\\er", scrollback_isearch);
 	if (debug)
 		rl_bind_key(CTRL('x'), test_cmd);
 
@@ -722,19 +976,7 @@ main(int argc, char **argv) {
 	}
 #endif
 
-	if (enable_history) {
-		snprintf(history_path, PATH_MAX, "%s/.oicb/logs/%s",
-		    getenv("HOME"), hostname);
-		if (create_dir_for(history_path) == -1 ||
-		    (mkdir(history_path, 0777) == -1 && errno != EEXIST)) {
-			warn("cannot make sure history directory \"%s\" exists",
-			    history_path);
-			warnx("history saving is disabled");
-			enable_history = 0;
-			memset(history_path, 0, PATH_MAX);
-		}
-	}
-
+	setup_history();
 	pledge_me();
 
 	while (!want_exit) {
@@ -744,6 +986,7 @@ main(int argc, char **argv) {
 			if (port)
 				push_stdout(":%s", port);
 			push_stdout(" as %s\n", nick);
+			push_stats();
 
 			if (debug)
 				push_stdout("%s: rl_line_buffer=0x%p '%s' [%zu] rl_point=%d rl_mark=%d\n",
@@ -755,24 +998,52 @@ main(int argc, char **argv) {
 			want_info = 0;
 		}
 
-		proceed_output(&tasks_net, sock);
+		proceed_output(&tasks_net, &stats.st_net, sock);
 		t = time(NULL);
 		if (net_timeout &&
 		    ts_lastnetinput + net_timeout * (pings_sent + 1) < t) {
 			if ((srv_features & Ping) == Ping) {
-				push_icb_msg('l', "", 0);
+				send_ping(0);
 				pings_sent++;
 			} else {
 				push_icb_msg('n', "", 0);
 				ts_lastnetinput = t;
 			}
 		}
+
+		// retry unanswered pings faster, based on round-trip time seen
+		timeout = poll_timeout;
+		rto = age = 0;
+		if (adaptive_pings && net_timeout && pings_sent > 0 &&
+		    (srv_features & Ping) == Ping) {
+			rto = ping_retry_timeout((uint64_t)net_timeout * 1000000);
+			age = last_ping_age();
+			if (age >= rto && pings_sent < max_pings) {
+				send_ping(0);
+				pings_sent++;
+				age = 0;
+			}
+			if (age < rto && (rto - age) / 1000 < (uint64_t)timeout)
+				timeout = (int)((rto - age) / 1000) + 1;
+		}
+
+		// don't sleep while logs are being indexed for /search
+		if (search_pending())
+			timeout = 0;
+		// logs waited for or mapped are checked every second
+		if (history_pending() && (timeout == INFTIM || timeout > 1000))
+			timeout = 1000;
+
 		update_pollfds();
-		if (poll(pfd, npfd, poll_timeout) == -1) {
+		if ((nready = poll(pfd, npfd, timeout)) == -1) {
 			if (errno == EINTR)
 				continue;
 			err(1, "poll");
 		}
+		OICB_PROBE2(poll_wake, nready, timeout);
+		TRACE(TracePollWake, nready, timeout);
+		stats.st_poll_wakeups++;
+		latency_wakeup();
 
 		for (i = 0; i < MainFDCount; i++)
 			if ((pfd[i].revents & (POLLERR|POLLHUP|POLLNVAL)))
@@ -790,20 +1061,26 @@ main(int argc, char **argv) {
 		if ((pfd[Network].revents & POLLIN)) {
 			ts_lastnetinput = time(NULL);
 			pings_sent = 0;
-			while (!want_exit && (msg = get_next_icb_msg(&msglen)) != NULL)
+			while (!want_exit &&
+			    (msg = get_next_icb_msg(&msglen)) != NULL) {
 				proceed_icb_msg(msg, msglen);
-		} else if (net_timeout &&
-		    ts_lastnetinput + net_timeout * max_pings < t) {
+				latency_msg_done();
+			}
+		} else if ((net_timeout &&
+		    ts_lastnetinput + net_timeout * max_pings < t) ||
+		    (rto && pings_sent >= max_pings && last_ping_age() >= rto)) {
 			push_stdout("Server timed out, exiting\n");
 			want_exit = 1;
 		}
 		prepare_stdout();
-		proceed_output(&tasks_stdout, STDOUT_FILENO);
+		proceed_output(&tasks_stdout, &stats.st_stdout, STDOUT_FILENO);
 		restore_rl();
 		proceed_history();
+		search_proceed();
 	}
 	return 0;
 }
+#endif // OICB_NO_MAIN
 
 int
 test_cmd(int count, int key) {
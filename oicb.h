@@ -18,6 +18,7 @@
 #define OICB_OICB_H
 
 #include <sys/queue.h>
+#include <stdint.h>
 #include "compat.h"
 
 #define NICKNAME_MAX 64
@@ -43,9 +44,25 @@ struct icb_task {
 	size_t	  it_ndone;
 	void	 *it_cb_data;
 	void	(*it_cb)(struct icb_task *);
+
+	// latency tracing of output, see latency.c
+	uint64_t	 it_rx_usec;
+	uint64_t	 it_queued_usec;
+	unsigned int	 it_rx_seq;
+
 	char	  it_data[0];
 };
-extern struct icb_task_queue	tasks_net;
+extern struct icb_task_queue	tasks_net, tasks_stdout;
+
+struct queue_stats;
+struct icb_task	*alloc_task(size_t datasz);
+void		 enqueue_task(struct icb_task_queue *q, struct queue_stats *qs,
+		              struct icb_task *it);
+struct icb_task	*dequeue_task(struct icb_task_queue *q, struct queue_stats *qs);
+void		 drop_tasks(struct icb_task_queue *q, struct queue_stats *qs);
+
+char	*get_next_icb_msg(size_t *msglen);
+extern size_t	 max_msg_size;
 
 struct line_cmd {
 	char	*start;	// same as the parse_cmd_line() argument
@@ -66,13 +83,13 @@ struct line_cmd {
 
 int	 parse_cmd_line(char *line, struct line_cmd *cmd);
 
-int	 push_stdout_untrusted(const char *text, ...);
 int	 push_stdout(const char *text, ...)
 	__attribute__((__format__ (printf, 1, 2)))
 	__attribute__((__nonnull__ (1)));
 
 
 extern int		 debug;
+extern int		 sock;
 extern int		 utf8_ready;
 
 extern char	*nick;
@@ -80,8 +97,6 @@ extern size_t	 nicklen;	// less than NICKNAME_MAX
 extern char	*hostname;
 extern char	*room;
 
-#define	PRIV_CHATS_MAX	5
-extern char	 priv_chats_nicks[PRIV_CHATS_MAX][NICKNAME_MAX];
 extern int	 repeat_priv_nick;
 extern int	 prefer_long_priv_cmd;
 
@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) 2026 Vadim Zhukov <zhuk@openbsd.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Round-trip time measurement.
+ *
+ * Each ping carries "<seq> <timestamp>" as message identifier, which
+ * servers send back in pong.  Send times are also remembered locally,
+ * so servers sending empty pongs are handled as well, assuming pongs
+ * come in order.
+ */
+
+#include <sys/types.h>
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "oicb.h"
+#include "chat.h"
+#include "ping.h"
+#include "stats.h"
+#include "trace.h"
+
+
+#define PINGS_MAX		8	// outstanding pings remembered
+#define PING_RETRY_MIN		1000000	// microseconds
+#define PING_RETRY_RTTS		4	// retry timeout in p99 RTTs
+#define PING_MIN_SAMPLES	3	// before adapting to RTT
+
+static uint64_t		 ping_sent_at[PINGS_MAX];
+static unsigned int	 ping_seq, pong_seq;	// last sent and answered
+static unsigned int	 ping_verbose_seq;	// report pong with this ID
+static struct histogram	 rtt_hist;
+
+int	 adaptive_pings = 0;
+
+
+/*
+ * Queue ping to be sent to server.  If 'verbose' is set, the round-trip
+ * time will be displayed when pong arrives.
+ */
+void
+send_ping(int verbose) {
+	char		 id[32];
+	uint64_t	 now;
+
+	now = now_usec();
+	ping_seq++;
+	ping_sent_at[ping_seq % PINGS_MAX] = now;
+	if (verbose)
+		ping_verbose_seq = ping_seq;
+	snprintf(id, sizeof(id), "%u %llu", ping_seq, (unsigned long long)now);
+	push_icb_msg('l', id, strlen(id));
+}
+
+void
+proceed_pong(const char *msg) {
+	unsigned long long	 seq;
+	uint64_t		 rtt;
+	char			*end;
+
+	if (*msg == '\0')
+		seq = pong_seq + 1;
+	else {
+		seq = strtoull(msg, &end, 10);
+		if (end == msg || (*end != ' ' && *end != '\0'))
+			seq = 0;
+	}
+	if (seq <= pong_seq || seq > ping_seq || ping_seq - seq >= PINGS_MAX) {
+		TRACE(TracePongUnexpected, seq, pong_seq, ping_seq);
+		if (debug)
+			warnx("%s: unexpected pong '%s'", __func__, msg);
+		return;
+	}
+	pong_seq = (unsigned int)seq;
+
+	rtt = now_usec() - ping_sent_at[pong_seq % PINGS_MAX];
+	hist_add(&rtt_hist, rtt);
+	TRACE(TracePong, pong_seq, rtt);
+	if (debug >= 2)
+		warnx("%s: pong #%u, rtt %llu us", __func__, pong_seq,
+		    (unsigned long long)rtt);
+	if (pong_seq == ping_verbose_seq) {
+		push_stdout("%s: pong from %s in %.1f ms\n", getprogname(),
+		    hostname, (double)rtt / 1000);
+		ping_verbose_seq = 0;
+	}
+}
+
+/*
+ * Returns number of microseconds passed since last ping was sent.
+ */
+uint64_t
+last_ping_age(void) {
+	return now_usec() - ping_sent_at[ping_seq % PINGS_MAX];
+}
+
+/*
+ * Returns time to wait for pong before sending next ping, when adaptive
+ * pings are enabled.  Until enough RTT samples are collected, 'maxusec'
+ * is returned, which is also an upper bound.
+ */
+uint64_t
+ping_retry_timeout(uint64_t maxusec) {
+	uint64_t	 rto;
+
+	if (rtt_hist.h_count < PING_MIN_SAMPLES)
+		return maxusec;
+	rto = hist_quantile(&rtt_hist, 0.99) * PING_RETRY_RTTS;
+	if (rto < PING_RETRY_MIN)
+		rto = PING_RETRY_MIN;
+	return rto < maxusec ? rto : maxusec;
+}
+
+void
+push_rtt_stats(void) {
+	if (rtt_hist.h_count == 0) {
+		push_stdout("%s: no round-trip time samples yet\n",
+		    getprogname());
+		return;
+	}
+	push_stdout("%s: rtt %llu samples, p50 %.1f ms, p99 %.1f ms,"
+	    " max %.1f ms, avg %.1f ms, %u pings unanswered\n",
+	    getprogname(), (unsigned long long)rtt_hist.h_count,
+	    (double)hist_quantile(&rtt_hist, 0.5) / 1000,
+	    (double)hist_quantile(&rtt_hist, 0.99) / 1000,
+	    (double)rtt_hist.h_max / 1000,
+	    (double)rtt_hist.h_sum / rtt_hist.h_count / 1000,
+	    ping_seq - pong_seq);
+}
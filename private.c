@@ -15,8 +15,10 @@
  */
 
 #include <sys/types.h>
+#include <sys/queue.h>
 #include <err.h>
 #include <limits.h>
+#include <stdint.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -24,32 +26,160 @@
 #include <readline/readline.h>
 
 #include "oicb.h"
+#include "intern.h"
 #include "private.h"
+#include "stats.h"
+#include "trace.h"
 
 
-static int	match_nick_from_history(const char *prefix, size_t prefixlen,
-	                        int forward);
-
-char		 priv_chats_nicks[PRIV_CHATS_MAX][NICKNAME_MAX];
-int		 priv_chats_cnt;
+/*
+ * Nick names used in private chats, the most recently used first.
+ * There could be many of them, so they're found by name through hash
+ * table, and by name prefix through array sorted by name.  None of
+ * these change when already remembered nick is used again.
+ */
+struct priv_chat {
+	TAILQ_ENTRY(priv_chat)	 pc_entry;
+	name_id			 pc_name;
+	uint64_t		 pc_used;	// priv_chats_uses when last used
+};
+TAILQ_HEAD(priv_chat_list, priv_chat);
+
+static void	 init_priv_chats(void);
+static size_t	 priv_chat_slot(name_id name);
+static struct priv_chat *find_priv_chat(name_id name);
+static void	 forget_priv_chat(struct priv_chat *pc);
+static size_t	 sorted_pos(name_id name);
+static struct priv_chat *match_nick_from_history(const char *prefix,
+		                  size_t prefixlen, int forward);
+
+static struct priv_chat_list	 priv_chats = TAILQ_HEAD_INITIALIZER(priv_chats);
+static struct priv_chat		*priv_chats_pool;
+static struct priv_chat		**priv_chats_tab;	// open addressing
+static size_t			 priv_chats_tab_size;
+static struct priv_chat		**priv_chats_sorted;	// by name
+static size_t			 priv_chats_cnt;
+static uint64_t			 priv_chats_uses;
+
+size_t		 priv_chats_max = PRIV_CHATS_DEFAULT;
 int		 repeat_priv_nick;
 int		 prefer_long_priv_cmd;
 
 
-int
-match_nick_from_history(const char *prefix, size_t prefixlen, int forward) {
-	int	i;
+/*
+ * Everything is allocated at once, the number of chats being limited.
+ */
+void
+init_priv_chats(void) {
+	priv_chats_tab_size = 16;
+	while (priv_chats_tab_size < priv_chats_max * 2)
+		priv_chats_tab_size *= 2;
+	priv_chats_pool = calloc(priv_chats_max, sizeof(struct priv_chat));
+	priv_chats_tab = calloc(priv_chats_tab_size, sizeof(struct priv_chat *));
+	priv_chats_sorted = calloc(priv_chats_max, sizeof(struct priv_chat *));
+	if (priv_chats_pool == NULL || priv_chats_tab == NULL ||
+	    priv_chats_sorted == NULL)
+		err(1, __func__);
+	STATS_ALLOC(priv_chats_max * sizeof(struct priv_chat) +
+	    priv_chats_tab_size * sizeof(struct priv_chat *) +
+	    priv_chats_max * sizeof(struct priv_chat *));
+}
 
-	if (forward) {
-		for (i = 0; i < priv_chats_cnt; i++)
-			if (!strncmp(prefix, priv_chats_nicks[i], prefixlen))
-				return i;
-	} else {
-		for (i = priv_chats_cnt - 1; i >= 0; i--)
-			if (!strncmp(prefix, priv_chats_nicks[i], prefixlen))
-				return i;
+/*
+ * Returns slot in hash table where the chat is, or should be put to.
+ */
+size_t
+priv_chat_slot(name_id name) {
+	size_t	 i, mask = priv_chats_tab_size - 1;
+
+	for (i = (name * 2654435761u) & mask; priv_chats_tab[i] != NULL &&
+	    priv_chats_tab[i]->pc_name != name; i = (i + 1) & mask)
+		;
+	return i;
+}
+
+struct priv_chat *
+find_priv_chat(name_id name) {
+	if (priv_chats_cnt == 0 || name == NAME_NONE)
+		return NULL;
+	return priv_chats_tab[priv_chat_slot(name)];
+}
+
+/*
+ * Removes the chat from all the indices, leaving it for reuse.
+ */
+void
+forget_priv_chat(struct priv_chat *pc) {
+	size_t	 i, j, k, mask = priv_chats_tab_size - 1;
+
+	TAILQ_REMOVE(&priv_chats, pc, pc_entry);
+
+	i = sorted_pos(pc->pc_name);
+	memmove(&priv_chats_sorted[i], &priv_chats_sorted[i + 1],
+	    (priv_chats_cnt - i - 1) * sizeof(priv_chats_sorted[0]));
+
+	// shift back entries that would become unreachable
+	i = priv_chat_slot(pc->pc_name);
+	priv_chats_tab[i] = NULL;
+	for (j = (i + 1) & mask; priv_chats_tab[j] != NULL;
+	    j = (j + 1) & mask) {
+		k = (priv_chats_tab[j]->pc_name * 2654435761u) & mask;
+		if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+			continue;
+		priv_chats_tab[i] = priv_chats_tab[j];
+		priv_chats_tab[j] = NULL;
+		i = j;
+	}
+	priv_chats_cnt--;
+}
+
+/*
+ * Returns position in priv_chats_sorted of the first name not less
+ * than the given one.
+ */
+size_t
+sorted_pos(name_id name) {
+	size_t	 lo = 0, hi = priv_chats_cnt, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (strcmp(name_str(priv_chats_sorted[mid]->pc_name),
+		    name_str(name)) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
 	}
-	return forward ? 0 :  priv_chats_cnt - 1;
+	return lo;
+}
+
+/*
+ * Returns the most (if forward) or least recently used private chat with
+ * nick starting with the prefix given, or NULL if there is no such one.
+ */
+struct priv_chat *
+match_nick_from_history(const char *prefix, size_t prefixlen, int forward) {
+	struct priv_chat	*pc, *found = NULL;
+	size_t			 lo = 0, hi = priv_chats_cnt, mid;
+	int			 rv;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		pc = priv_chats_sorted[mid];
+		rv = strncmp(name_str(pc->pc_name), prefix, prefixlen);
+		if (rv < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	for (; lo < priv_chats_cnt; lo++) {
+		pc = priv_chats_sorted[lo];
+		if (strncmp(name_str(pc->pc_name), prefix, prefixlen) != 0)
+			break;
+		if (found == NULL || (forward ? pc->pc_used > found->pc_used :
+		    pc->pc_used < found->pc_used))
+			found = pc;
+	}
+	return found;
 }
 
 //
@@ -89,8 +219,8 @@ match_nick_from_history(const char *prefix, size_t prefixlen, int forward) {
 int
 cycle_priv_chats(int forward) {
 	struct line_cmd cmd;
-	int		i;
-	int		newidx;		// index from history to use
+	struct priv_chat *pc;
+	struct priv_chat *newpc;	// from history to use
 	int		oldcurpos;	// initial rl_point value
 
 	enum {
@@ -99,6 +229,7 @@ cycle_priv_chats(int forward) {
 		AFTER_NICK
 	} cursor_zone = AFTER_NICK;
 
+	TRACE(TracePrivCycle, forward, priv_chats_cnt);
 	if (debug >= 3)
 		warnx("%s: forward=%d\n", __func__, forward);
 
@@ -132,12 +263,11 @@ cycle_priv_chats(int forward) {
 		if (cmd.peer_nick) {
 			// (5), (6), (7) or (8)
 
-			for (i = 0; i < priv_chats_cnt; i++)
-				if (strlen(priv_chats_nicks[i]) == (size_t)cmd.peer_nick_len &&
-				   memcmp(cmd.peer_nick, priv_chats_nicks[i], (size_t)cmd.peer_nick_len) == 0)
-					break;
-			if (( forward && i == priv_chats_cnt - 1) ||
-			    (!forward && i == 0)) {
+			pc = find_priv_chat(find_name(cmd.peer_nick,
+			    (size_t)cmd.peer_nick_len));
+			if (pc != NULL &&
+			    (( forward && pc == TAILQ_LAST(&priv_chats, priv_chat_list)) ||
+			     (!forward && pc == TAILQ_FIRST(&priv_chats)))) {
 				// (5)
 				rl_delete_text(0, cmd.private_prefix_len);
 				rl_point -= cmd.private_prefix_len;
@@ -146,20 +276,25 @@ cycle_priv_chats(int forward) {
 				return 0;
 			}
 
-			if (i == priv_chats_cnt) {
+			if (pc == NULL) {
 				// (6) or (7): do prefix matching check
-				newidx = match_nick_from_history(cmd.peer_nick,
+				newpc = match_nick_from_history(cmd.peer_nick,
 				    (size_t)cmd.peer_nick_len, forward);
+				if (newpc == NULL)
+					newpc = forward ? TAILQ_FIRST(&priv_chats) :
+					    TAILQ_LAST(&priv_chats, priv_chat_list);
 				goto replace_nick;
 			}
 
 			// (8)
-			newidx = i + (forward ? 1 : -1);
+			newpc = forward ? TAILQ_NEXT(pc, pc_entry) :
+			    TAILQ_PREV(pc, priv_chat_list, pc_entry);
 			goto replace_nick;
 		}
 
 		// (4)
-		newidx = forward ? 0 : priv_chats_cnt - 1;
+		newpc = forward ? TAILQ_FIRST(&priv_chats) :
+		    TAILQ_LAST(&priv_chats, priv_chat_list);
 	} else {
 		// (2)
 		rl_point = 0;
@@ -173,7 +308,8 @@ cycle_priv_chats(int forward) {
 			cmd.private_prefix_len = 3;
 		}
 		oldcurpos += cmd.peer_nick_offset + 1;
-		newidx = forward ? 0 : priv_chats_cnt - 1;
+		newpc = forward ? TAILQ_FIRST(&priv_chats) :
+		    TAILQ_LAST(&priv_chats, priv_chat_list);
 	}
 
 	// (2), (4), (6), (7) or (8)
@@ -185,8 +321,9 @@ replace_nick:
 	//   private_prefix_len
 
 	if (debug >= 2) {
-		warnx("%s: replace_nick: rl_line_buffer='%s' rl_point=%d oldcurpos=%d newidx=%d",
-		    __func__, rl_line_buffer, rl_point, oldcurpos, newidx);
+		warnx("%s: replace_nick: rl_line_buffer='%s' rl_point=%d oldcurpos=%d new='%s'",
+		    __func__, rl_line_buffer, rl_point, oldcurpos,
+		    name_str(newpc->pc_name));
 		warnx("%s: replace_nick: peer_nick_offset=%d peer_nick_len=%d cursor_zone=%d",
 		    __func__, cmd.peer_nick_offset, cmd.peer_nick_len, cursor_zone);
 	}
@@ -194,7 +331,7 @@ replace_nick:
 	if (cmd.peer_nick_len)
 		rl_delete_text(cmd.peer_nick_offset, cmd.private_prefix_len);
 	rl_point = cmd.peer_nick_offset;
-	rl_insert_text(priv_chats_nicks[newidx]);
+	rl_insert_text(name_str(newpc->pc_name));
 	rl_insert_text(" ");
 
 	// restoring cursor position
@@ -210,7 +347,7 @@ replace_nick:
 
 	case AFTER_NICK:
 		rl_point = oldcurpos
-		    + (int)strlen(priv_chats_nicks[newidx])
+		    + (int)name_len(newpc->pc_name)
 		    - cmd.peer_nick_len;
 		break;
 	}
@@ -219,60 +356,75 @@ replace_nick:
 
 int
 list_priv_chats_nicks() {
-	int	i;
+	const struct priv_chat	*pc;
 
 	if (priv_chats_cnt == 0) {
 		push_stdout("there are no private chats yet\n");
 		return 0;
 	}
 
-	push_stdout("there are %d private chats:\n", priv_chats_cnt);
-	for (i = 0; i < priv_chats_cnt; i++)
-		push_stdout("  * %s\n", priv_chats_nicks[i]);
+	push_stdout("there are %zu private chats:\n", priv_chats_cnt);
+	TAILQ_FOREACH(pc, &priv_chats, pc_entry)
+		push_stdout("  * %s\n", name_str(pc->pc_name));
 	return 0;
 }
 
-// Input: private message nick and text, or NULLs for public message.
+/*
+ * Returns nick used in the last private chat, or NAME_NONE.
+ */
+name_id
+last_priv_chat(void) {
+	const struct priv_chat	*pc;
+
+	pc = TAILQ_FIRST(&priv_chats);
+	return pc != NULL ? pc->pc_name : NAME_NONE;
+}
+
+// Input: private message nick.
 void
-update_nick_history(const char *peer_nick, const char *msg) {
-	if (debug >= 2)
-		warnx("%s: peer_nick='%s' msg='%s'", __func__, peer_nick, msg);
+update_nick_history(name_id peer) {
+	struct priv_chat	*pc;
+	size_t			 i;
 
-	if (peer_nick != NULL) {
-		size_t	peer_nicklen;
-		int	i;
+	if (debug >= 2)
+		warnx("%s: peer='%s'", __func__, name_str(peer));
 
-		peer_nicklen = strlen(peer_nick);
-		if (peer_nicklen >= NICKNAME_MAX) {
-			push_stdout("%s: warning: nickname is too long\n",
-			                getprogname());
-			return;
-		}
+	if (name_len(peer) >= NICKNAME_MAX) {
+		push_stdout("%s: warning: nickname is too long\n",
+		                getprogname());
+		return;
+	}
 
-		if (priv_chats_cnt > 0 &&
-		    strcmp(priv_chats_nicks[0], peer_nick) == 0)
+	if (priv_chats_pool == NULL)
+		init_priv_chats();
+	priv_chats_uses++;
+	if ((pc = find_priv_chat(peer)) != NULL) {
+		TRACE(TracePrivFound, priv_chats_uses - pc->pc_used);
+		if (debug >=2)
+			warnx("%s: found %s", __func__, name_str(peer));
+		pc->pc_used = priv_chats_uses;
+		if (pc == TAILQ_FIRST(&priv_chats))
 			return;		// already topmost one
-		for (i = 1; i < priv_chats_cnt; i++) {
-			if (strcmp(priv_chats_nicks[i], peer_nick) == 0) {
-				if (debug >=2)
-					warnx("%s: found %s", __func__, priv_chats_nicks[i]);
-				// make current nick the newest one
-				memmove(priv_chats_nicks[1], priv_chats_nicks[0], i * NICKNAME_MAX);
-				goto set_top_nick;
-			}
-		}
-
-		// add nick to history, possibly kicking out oldest one
-		memmove(priv_chats_nicks[1], priv_chats_nicks[0],
-		    (PRIV_CHATS_MAX - 1) * NICKNAME_MAX);
-		if (priv_chats_cnt < PRIV_CHATS_MAX - 1)
-			priv_chats_cnt++;
-
-set_top_nick:
-		if (debug >= 2)
-			warnx("%s: copying '%s' [%zu] to %p",
-			    __func__, peer_nick, peer_nicklen, priv_chats_nicks[0]);
-		memcpy(priv_chats_nicks[0], peer_nick, peer_nicklen);
-		memset(priv_chats_nicks[0] + peer_nicklen, 0, NICKNAME_MAX - peer_nicklen);
+		// make current nick the newest one
+		TAILQ_REMOVE(&priv_chats, pc, pc_entry);
+		TAILQ_INSERT_HEAD(&priv_chats, pc, pc_entry);
+		return;
 	}
+
+	// add nick to history, possibly kicking out oldest one
+	if (priv_chats_cnt == priv_chats_max) {
+		pc = TAILQ_LAST(&priv_chats, priv_chat_list);
+		forget_priv_chat(pc);
+	} else
+		pc = &priv_chats_pool[priv_chats_cnt];
+	pc->pc_name = peer;
+	pc->pc_used = priv_chats_uses;
+	TAILQ_INSERT_HEAD(&priv_chats, pc, pc_entry);
+	priv_chats_tab[priv_chat_slot(peer)] = pc;
+	i = sorted_pos(peer);
+	memmove(&priv_chats_sorted[i + 1], &priv_chats_sorted[i],
+	    (priv_chats_cnt - i) * sizeof(priv_chats_sorted[0]));
+	priv_chats_sorted[i] = pc;
+	priv_chats_cnt++;
+	TRACE(TracePrivAdded, name_len(peer), priv_chats_cnt);
 }
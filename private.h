@@ -17,8 +17,16 @@
 #ifndef OICB_PRIVATE_H
 #define OICB_PRIVATE_H
 
-void	update_nick_history(const char *peer_nick, const char *msg);
+#include "intern.h"
+
+#define PRIV_CHATS_DEFAULT	5
+#define PRIV_CHATS_MAX		10000
+
+void	update_nick_history(name_id peer);
+name_id	last_priv_chat(void);
 int	list_priv_chats_nicks(void);
 int	cycle_priv_chats(int forward);
 
+extern size_t	 priv_chats_max;
+
 #endif // OICB_PRIVATE_H
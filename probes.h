@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2026 Vadim Zhukov <zhuk@openbsd.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * User-level statically defined tracing (USDT) probes, provider "oicb".
+ *
+ * When <sys/sdt.h> is available (systemtap-sdt-dev on Linux), each probe
+ * compiles to a single nop plus an ELF note, and can be attached to with
+ * bpftrace, SystemTap, perf or DTrace without rebuilding, e.g.:
+ *
+ *   bpftrace -e 'usdt:./oicb:oicb:msg_received { @[arg0] = count(); }'
+ *
+ * Probes and their arguments:
+ *
+ *   msg_received(type, len, data)   incoming message, before handling;
+ *   msg_queued(type, len, data)     outgoing message, before splitting
+ *                                   into packets;
+ *   output_written(fd, nbytes, qlen)  write(2) from an output queue done,
+ *                                   qlen is number of tasks left;
+ *   history_queued(path, nbytes)    history line queued;
+ *   history_written(path, nbytes)   history data written;
+ *   poll_wake(nready, timeout)      poll(2) in main loop returned.
+ *
+ * Without <sys/sdt.h> the probes compile to nothing.
+ */
+
+#ifndef OICB_PROBES_H
+#define OICB_PROBES_H
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+
+#define OICB_PROBE2(name, a1, a2) \
+	DTRACE_PROBE2(oicb, name, a1, a2)
+#define OICB_PROBE3(name, a1, a2, a3) \
+	DTRACE_PROBE3(oicb, name, a1, a2, a3)
+#else
+#define OICB_PROBE2(name, a1, a2)
+#define OICB_PROBE3(name, a1, a2, a3)
+#endif
+
+#endif // OICB_PROBES_H
@@ -0,0 +1,353 @@
+/*
+ * Copyright (c) 2026 Vadim Zhukov <zhuk@openbsd.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Scrollback: the most recent lines shown, kept in memory for searching.
+ *
+ * Texts of lines go one after another into a fixed-size arena, wrapping
+ * to its start when the next line doesn't fit at the end, and a ring of
+ * descriptors points to them.  The oldest lines are dropped to make room
+ * for new ones, so memory used is bounded, and nothing gets allocated
+ * after the first line is added.
+ */
+
+#include <sys/types.h>
+#include <ctype.h>
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <readline/readline.h>
+
+#include "oicb.h"
+#include "linebuf.h"
+#include "scrollback.h"
+#include "stats.h"
+
+#define SB_AVG_LINE	64	// for sizing the descriptor ring
+#define SB_QUERY_MAX	64
+
+struct sb_line {
+	uint32_t	sl_off;
+	uint32_t	sl_len;
+};
+
+static void	 sb_drop(void);
+static int	 sb_init(void);
+static int	 sb_match(const struct sb_line *sl);
+static int	 isearch_find(uint64_t from, int older);
+static void	 isearch_show(void);
+static void	 isearch_leave(int print);
+static int	 isearch_insert(int count, int key);
+static int	 isearch_erase(int count, int key);
+static int	 isearch_older(int count, int key);
+static int	 isearch_newer(int count, int key);
+static int	 isearch_accept(int count, int key);
+static int	 isearch_abort(int count, int key);
+
+size_t			 scrollback_size = SCROLLBACK_DEFAULT * 1024;
+
+static char		*sb_arena;
+static struct sb_line	*sb_lines;
+static size_t		 sb_maxlines;
+static size_t		 sb_first;	// index of the oldest line
+static size_t		 sb_count;
+static size_t		 sb_head;	// where text of the next line goes
+static uint64_t		 sb_total;	// lines added ever
+
+// incremental search state
+static Keymap		 isearch_keymap, isearch_saved_keymap;
+static char		*isearch_saved_line;
+static int		 isearch_saved_point;
+static char		 isearch_query[SB_QUERY_MAX];
+static size_t		 isearch_qlen;
+static uint64_t		 isearch_seq;	// line matched, sb_total if none
+static int		 isearch_failed;
+
+#define SB_OLDEST_SEQ()	(sb_total - sb_count)
+#define SB_LINE(seq)	\
+	(&sb_lines[(sb_first + (size_t)((seq) - SB_OLDEST_SEQ())) % sb_maxlines])
+
+
+static int
+sb_init(void) {
+	sb_maxlines = scrollback_size / SB_AVG_LINE;
+	sb_arena = malloc(scrollback_size);
+	sb_lines = calloc(sb_maxlines, sizeof(struct sb_line));
+	if (sb_arena == NULL || sb_lines == NULL) {
+		warn("scrollback disabled");
+		free(sb_arena);
+		free(sb_lines);
+		sb_arena = NULL;
+		sb_lines = NULL;
+		scrollback_size = 0;
+		return 0;
+	}
+	STATS_ALLOC(scrollback_size + sb_maxlines * sizeof(struct sb_line));
+	return 1;
+}
+
+static void
+sb_drop(void) {
+	sb_first = (sb_first + 1) % sb_maxlines;
+	sb_count--;
+}
+
+/*
+ * Remembers the line given, without the trailing newline.  Lines longer
+ * than a quarter of scrollback are truncated.
+ */
+void
+scrollback_add(const char *line, size_t len) {
+	struct sb_line	*sl;
+
+	if (scrollback_size == 0 || (sb_arena == NULL && !sb_init()))
+		return;
+	if (len > 0 && line[len - 1] == '\n')
+		len--;
+	if (len == 0)
+		return;
+	if (len > scrollback_size / 4)
+		len = scrollback_size / 4;
+
+	if (sb_head + len > scrollback_size) {
+		// lines placed after the head are the oldest ones
+		while (sb_count > 0 && sb_lines[sb_first].sl_off >= sb_head)
+			sb_drop();
+		sb_head = 0;
+	}
+	while (sb_count > 0 && (sb_count == sb_maxlines ||
+	    (sb_lines[sb_first].sl_off < sb_head + len &&
+	    sb_head < sb_lines[sb_first].sl_off + sb_lines[sb_first].sl_len)))
+		sb_drop();
+
+	memcpy(sb_arena + sb_head, line, len);
+	sl = &sb_lines[(sb_first + sb_count) % sb_maxlines];
+	sl->sl_off = (uint32_t)sb_head;
+	sl->sl_len = (uint32_t)len;
+	sb_head += len;
+	sb_count++;
+	sb_total++;
+}
+
+/*
+ * Case-insensitive (for ASCII) substring search of query in the line.
+ */
+static int
+sb_match(const struct sb_line *sl) {
+	const char	*s = sb_arena + sl->sl_off;
+	size_t		 i, j;
+
+	for (i = 0; i + isearch_qlen <= sl->sl_len; i++) {
+		for (j = 0; j < isearch_qlen; j++)
+			if (tolower((unsigned char)s[i + j]) !=
+			    tolower((unsigned char)isearch_query[j]))
+				break;
+		if (j == isearch_qlen)
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * Looks for the next line matching, starting from 'from' and going back
+ * (older) or forth; sb_total as 'from' means the newest line.
+ * Returns 1 if found, updating isearch_seq.
+ */
+static int
+isearch_find(uint64_t from, int older) {
+	uint64_t	 seq;
+
+	if (sb_count == 0)
+		return 0;
+	if (from >= sb_total)
+		from = sb_total - 1;
+	if (from < SB_OLDEST_SEQ())
+		from = SB_OLDEST_SEQ();
+	for (seq = from; seq >= SB_OLDEST_SEQ() && seq < sb_total;
+	    older ? seq-- : seq++)
+		if (sb_match(SB_LINE(seq))) {
+			isearch_seq = seq;
+			return 1;
+		}
+	return 0;
+}
+
+/*
+ * The search prompt and line found are put into the input line, this way
+ * they survive output being printed.
+ */
+static void
+isearch_show(void) {
+	const struct sb_line	*sl = NULL;
+	char			 prefix[SB_QUERY_MAX + 32];
+	size_t			 plen, len = 0;
+
+	plen = (size_t)snprintf(prefix, sizeof(prefix),
+	    "(%sscrollback)`%.*s': ", isearch_failed ? "failed " : "", (int)isearch_qlen, isearch_query);
+	if (isearch_seq < sb_total && isearch_seq >= SB_OLDEST_SEQ()) {
+		sl = SB_LINE(isearch_seq);
+		len = sl->sl_len;
+	}
+	rl_extend_line_buffer((int)(plen + len + 1));
+	memcpy(rl_line_buffer, prefix, plen);
+	if (sl != NULL)
+		memcpy(rl_line_buffer + plen, sb_arena + sl->sl_off, len);
+	rl_line_buffer[plen + len] = '\0';
+	rl_end = (int)(plen + len);
+	rl_point = (int)plen - 3;
+	rl_mark = 0;
+	rl_redisplay();
+}
+
+static void
+isearch_leave(int print) {
+	const struct sb_line	*sl;
+	struct line_buf		 lb;
+
+	if (print && !isearch_failed && isearch_seq < sb_total &&
+	    isearch_seq >= SB_OLDEST_SEQ()) {
+		sl = SB_LINE(isearch_seq);
+		lb_init(&lb);
+		lb_raw(&lb, sb_arena + sl->sl_off, sl->sl_len);
+		lb_raw(&lb, "\n", 1);
+		lb_commit(&lb);
+	}
+
+	rl_set_keymap(isearch_saved_keymap);
+	rl_replace_line(isearch_saved_line, 0);
+	rl_point = isearch_saved_point;
+	free(isearch_saved_line);
+	isearch_saved_line = NULL;
+	rl_redisplay();
+}
+
+/*
+ * Readline command starting incremental search in scrollback.
+ */
+int
+scrollback_isearch(int count, int key) {
+	int	 c;
+
+	(void)count;
+	(void)key;
+	if (sb_count == 0) {
+		rl_ding();
+		return 0;
+	}
+
+	if (isearch_keymap == NULL) {
+		isearch_keymap = rl_make_bare_keymap();
+		for (c = ' '; c < 256; c++) {
+			isearch_keymap[c].type = ISFUNC;
+			isearch_keymap[c].function = isearch_insert;
+		}
+		isearch_keymap[RUBOUT].function = isearch_erase;
+		isearch_keymap[CTRL('h')].function = isearch_erase;
+		isearch_keymap[CTRL('r')].function = isearch_older;
+		isearch_keymap[CTRL('s')].function = isearch_newer;
+		isearch_keymap[CTRL('g')].function = isearch_abort;
+		isearch_keymap[CTRL('c')].function = isearch_abort;
+		isearch_keymap['\r'].function = isearch_accept;
+		isearch_keymap['\n'].function = isearch_accept;
+		isearch_keymap[ESC].function = isearch_accept;
+	}
+
+	if ((isearch_saved_line = strdup(rl_line_buffer)) == NULL) {
+		warn(__func__);
+		return 0;
+	}
+	STATS_ALLOC(strlen(isearch_saved_line) + 1);
+	isearch_saved_point = rl_point;
+	isearch_saved_keymap = rl_get_keymap();
+	rl_set_keymap(isearch_keymap);
+	isearch_qlen = 0;
+	isearch_seq = sb_total;
+	isearch_failed = 0;
+	isearch_show();
+	return 0;
+}
+
+static int
+isearch_insert(int count, int key) {
+	(void)count;
+	if (isearch_qlen == sizeof(isearch_query) || key < ' ' || key > 255) {
+		rl_ding();
+		return 0;
+	}
+	isearch_query[isearch_qlen++] = (char)key;
+	// current line is still the best candidate
+	isearch_failed = !isearch_find(isearch_seq, 1);
+	isearch_show();
+	return 0;
+}
+
+static int
+isearch_erase(int count, int key) {
+	(void)count;
+	(void)key;
+	if (isearch_qlen == 0) {
+		rl_ding();
+		return 0;
+	}
+	isearch_qlen--;
+	isearch_seq = sb_total;
+	isearch_failed = !isearch_find(sb_total, 1);
+	isearch_show();
+	return 0;
+}
+
+static int
+isearch_older(int count, int key) {
+	(void)count;
+	(void)key;
+	if (isearch_seq == SB_OLDEST_SEQ() || !isearch_find(isearch_seq - 1, 1))
+		rl_ding();
+	else
+		isearch_failed = 0;
+	isearch_show();
+	return 0;
+}
+
+static int
+isearch_newer(int count, int key) {
+	(void)count;
+	(void)key;
+	if (isearch_seq >= sb_total - 1 || !isearch_find(isearch_seq + 1, 0))
+		rl_ding();
+	else
+		isearch_failed = 0;
+	isearch_show();
+	return 0;
+}
+
+static int
+isearch_accept(int count, int key) {
+	(void)count;
+	(void)key;
+	isearch_leave(1);
+	return 0;
+}
+
+static int
+isearch_abort(int count, int key) {
+	(void)count;
+	(void)key;
+	isearch_leave(0);
+	return 0;
+}
@@ -0,0 +1,2131 @@
+/*
+ * Copyright (c) 2026 Vadim Zhukov <zhuk@openbsd.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Full-text search over history logs, backing the /search command.
+ *
+ * Every log line is a document; documents are numbered in the order
+ * they were indexed, and each knows its log file, offset and time.
+ * For every word (term) the list of documents containing it is kept,
+ * as differences between adjacent document numbers in varint encoding.
+ *
+ * The index consists of segments saved in history_path, used through
+ * mmap(2), and the in-memory part with documents indexed since.  The
+ * latter is saved as a new segment when it grows big, and on exit;
+ * segments never change after being written, and the small index file
+ * lists them along with the logs indexed.  Several segments of about
+ * the same size are merged into one in background, so there are only
+ * a few of them to look terms up in, and every document gets rewritten
+ * only a few times.  Nothing is done until the first /search; after
+ * that, lines get indexed as soon as they're written to history, and
+ * logs not indexed yet are processed in chunks from the main loop.
+ */
+
+#include <sys/types.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "oicb.h"
+#include "history.h"
+#include "json.h"
+#include "linebuf.h"
+#include "logfile.h"
+#include "search.h"
+#include "stats.h"
+
+
+#define SEARCH_MAGIC	"OICBSRX3"	// last character is format version
+#define SEGMENT_MAGIC	"OICBSRG3"
+#define SEARCH_CHUNK	(256*1024)	// read and indexed at once
+#define SEARCH_SYNC_MAX	(16*SEARCH_CHUNK) // indexed before answering
+#define SEARCH_MEM_MAX	(64*1024*1024)	// in-memory part limit
+#define SEARCH_TIER_MIN	(1024*1024)	// smaller segments are of one tier
+#define SEARCH_MERGE_WIDTH 4		// segments of a tier merged at once
+#define SEARCH_ORPHAN_AGE 3600		// seconds unlisted segments are kept
+#define SEARCH_TERMS	8		// words in query, at most
+#define TERM_MIN	2
+#define TERM_MAX	32		// longer ones are truncated
+#define RESULT_LINE_MAX	1024		// longer ones are truncated
+#define DATELEN		20		// "YYYY-MM-DD HH:MM:SS ", see history.c
+#define HEAD_LEN	64		// of text start, to check for reuse
+
+// document position: log file number and offset of line in it
+#define DOC_OFFSET_BITS	40
+#define DOC_POS(file, off)	(((uint64_t)(file) << DOC_OFFSET_BITS) | (off))
+#define DOC_FILE(pos)	((size_t)((pos) >> DOC_OFFSET_BITS))
+#define DOC_OFFSET(pos)	((pos) & (((uint64_t)1 << DOC_OFFSET_BITS) - 1))
+
+/*
+ * Index file layout: header, segments, files.  Segment file layout:
+ * header, document positions, document times, postings, term entries
+ * sorted by term, term names.  Sections start at 8-byte boundaries;
+ * everything is stored in host byte order.
+ */
+struct search_header {
+	char		 sh_magic[8];
+	uint32_t	 sh_nfiles;
+	uint32_t	 sh_nsegs;
+	uint64_t	 sh_nextseg;		// number of the next segment file
+	uint64_t	 sh_size;		// of the whole file
+};
+
+struct search_seg_ent {		// oldest first, documents numbered on
+	uint64_t	 sse_id;		// SEARCH_INDEX_NAME ".<id>"
+	uint32_t	 sse_ndocs;
+	uint32_t	 sse_reserved;
+};
+
+struct search_seg_header {
+	char		 ssh_magic[8];
+	uint32_t	 ssh_base;		// number of the first document
+	uint32_t	 ssh_ndocs;
+	uint32_t	 ssh_nterms;
+	uint32_t	 ssh_reserved;
+	uint64_t	 ssh_docpos;		// offsets of sections
+	uint64_t	 ssh_doctime;
+	uint64_t	 ssh_postings;
+	uint64_t	 ssh_terms;
+	uint64_t	 ssh_names;
+	uint64_t	 ssh_size;		// of the whole file
+};
+
+struct search_file_ent {	// followed by name, padded to 8 bytes
+	uint64_t	 sfe_dev;
+	uint64_t	 sfe_ino;
+	uint64_t	 sfe_indexed;
+	uint32_t	 sfe_lasttime;
+	uint16_t	 sfe_flags;
+	uint16_t	 sfe_namelen;
+	uint32_t	 sfe_head;
+	uint32_t	 sfe_headlen;
+};
+
+struct search_term_ent {
+	uint64_t	 ste_postings;		// relative to ssh_postings
+	uint32_t	 ste_postlen;
+	uint32_t	 ste_ndocs;
+	uint32_t	 ste_lastdoc;
+	uint32_t	 ste_name;		// relative to ssh_names
+	uint32_t	 ste_namelen;
+	uint32_t	 ste_reserved;
+};
+
+struct search_file {
+	char		*sf_name;	// relative to history_path
+	uint64_t	 sf_dev;	// tell the file apart from the one
+	uint64_t	 sf_ino;	// that replaced it under the same name
+	uint64_t	 sf_indexed;	// offset to continue from
+	uint32_t	 sf_lasttime;	// for lines without date
+	uint16_t	 sf_flags;
+	uint32_t	 sf_head;	// hash of text start, inodes get reused
+	uint32_t	 sf_headlen;
+};
+#define SF_DEAD		0x01	// replaced by a file with the same name
+#define SF_LONGLINE	0x02	// in the middle of a line skipped
+#define SF_PENDING	0x04	// not indexed up to the end, not saved
+#define SF_COMPLETE	0x08	// compressed, thus won't grow, indexed fully
+
+struct search_term {
+	uint8_t		*st_post;
+	size_t		 st_len;
+	size_t		 st_size;
+	uint32_t	 st_ndocs;
+	uint32_t	 st_lastdoc;
+	uint32_t	 st_hash;
+	uint8_t		 st_namelen;
+	char		 st_name[TERM_MAX];
+};
+
+struct log_dirent {
+	char		*ld_name;
+	uint64_t	 ld_dev;
+	uint64_t	 ld_ino;
+	uint64_t	 ld_size;
+	size_t		 ld_file;	// entry in files, if any
+};
+
+struct doc_list {
+	uint32_t	*dl_docs;
+	size_t		 dl_n;
+};
+
+struct index_seg {
+	uint64_t			 is_id;
+	int				 is_fd;		// locked shared, see seg_remove()
+	const char			*is_map;
+	size_t				 is_size;
+	const uint64_t			*is_docpos;
+	const uint32_t			*is_doctime;
+	const uint8_t			*is_postings;
+	const struct search_term_ent	*is_terms;
+	const char			*is_names;
+	uint32_t			 is_base;
+	uint32_t			 is_ndocs;
+	uint32_t			 is_nterms;
+};
+
+struct seg_writer {
+	FILE			*sw_f;
+	uint64_t		 sw_off;
+	struct search_seg_header sw_sh;
+	struct search_term_ent	*sw_ents;
+	size_t			 sw_nents, sw_ents_size;
+	char			*sw_names;
+	size_t			 sw_names_len, sw_names_size;
+};
+
+struct merge_job {
+	struct index_seg	*mj_segs;	// copies of ones being merged
+	size_t			 mj_nsegs;
+	uint64_t		 mj_id;		// of the result
+	int			 mj_fd;
+	int			 mj_errno;	// 0 if succeeded
+	int			 mj_done;
+};
+
+static int		 loaded;
+static int		 dirty;
+static struct search_file *files;
+static size_t		 nfiles, files_size;
+static char		*chunk;
+static struct log_reader idx_reader = { -1, NULL, 0 };
+static size_t		 idx_file = SIZE_MAX;	// opened in idx_reader
+
+// saved part
+static struct index_seg		*segs;		// oldest first
+static size_t			 nsegs, segs_size;
+static uint32_t			 seg_ndocs;	// in all of them
+static uint64_t			 next_seg_id;
+
+// merging, see merge_start()
+static pthread_mutex_t		 merge_mtx = PTHREAD_MUTEX_INITIALIZER;
+static struct merge_job		*merge_job;	// running, if any
+
+// in-memory part, documents are numbered after saved ones
+static uint64_t		*mem_docpos;
+static uint32_t		*mem_doctime;
+static size_t		 mem_ndocs, mem_docs_size;
+static struct search_term **mem_terms;	// open addressing hash table
+static size_t		 mem_nterms, mem_terms_size;
+static size_t		 mem_bytes;
+
+static size_t	 next_term(const char **pp, const char *end, char *buf);
+static uint32_t	 term_hash(const char *s, size_t len);
+static int	 term_cmp(const char *a, size_t alen, const char *b,
+		          size_t blen);
+static int	 parse_date(const char *s, uint32_t *tp);
+static struct search_term *mem_term_get(const char *name, size_t len,
+		                        int create);
+static size_t	 varint_put(uint8_t *p, uint32_t v);
+static size_t	 varint_get(const uint8_t *p, size_t len, uint32_t *vp);
+static void	 mem_add_posting(struct search_term *st, uint32_t doc);
+static void	 index_line(size_t fileid, const char *line, size_t len,
+		            uint64_t off);
+static size_t	 index_file(size_t fileid, size_t budget);
+static void	 index_file_close(void);
+static size_t	 catch_up(size_t budget);
+static int	 log_path(char *buf, const char *name);
+static size_t	 file_find(const char *name);
+static size_t	 file_add(const char *name);
+static int	 file_is(const struct search_file *sf, const struct stat *st);
+static void	 file_kill(size_t i);
+static size_t	 file_replace(size_t i, const struct stat *st);
+static int	 cmp_dirents(const void *a, const void *b);
+static int	 cmp_file_ids(const void *a, const void *b);
+static void	 rescan(void);
+static int	 seg_path(char *buf, uint64_t id);
+static int	 seg_create(uint64_t *idp);
+static void	 seg_unlink(uint64_t id);
+static void	 seg_remove(uint64_t id);
+static int	 seg_open(uint64_t id, uint32_t base, struct index_seg *is);
+static void	 seg_close(struct index_seg *is);
+static void	 seg_append(const struct index_seg *is);
+static int	 seg_tier(const struct index_seg *is);
+static void	 remove_orphans(void);
+static int	 load_index(void);
+static void	 free_mem_index(void);
+static int	 sw_begin(struct seg_writer *sw, int fd, uint32_t base,
+		          uint32_t ndocs);
+static int	 sw_write(struct seg_writer *sw, const void *p, size_t len);
+static int	 sw_align(struct seg_writer *sw);
+static int	 sw_add_term(struct seg_writer *sw, const char *name,
+		             size_t namelen, uint64_t start, uint32_t ndocs,
+		             uint32_t lastdoc);
+static int	 sw_finish(struct seg_writer *sw);
+static int	 sw_close(struct seg_writer *sw, int rv);
+static int	 save_mem_segment(void);
+static int	 save_index(void);
+static void	 save_index_at_exit(void);
+static int	 merge_segments(struct merge_job *mj);
+static void	*merge_worker(void *arg);
+static void	 merge_start(void);
+static void	 merge_finish(void);
+static const struct search_term_ent *seg_term_find(const struct index_seg *is,
+		                            const char *name, size_t len);
+static void	 decode_postings(struct doc_list *dl, size_t n,
+		                 const uint8_t *p, size_t len);
+static int	 term_docs(const char *name, size_t len,
+		           struct doc_list *dl);
+static const struct index_seg *doc_seg(uint32_t doc);
+static uint64_t	 doc_pos(uint32_t doc);
+static uint32_t	 doc_time(uint32_t doc);
+static void	 print_result(uint32_t doc, struct log_reader *lr,
+		              size_t *lrfile);
+
+
+static inline int
+is_term_char(unsigned char c) {
+	return c >= 0x80 || (c >= '0' && c <= '9') ||
+	    ((c | 0x20) >= 'a' && (c | 0x20) <= 'z');
+}
+
+/*
+ * Finds next term in [*pp, end), and puts it into buf, with ASCII letters
+ * lowercased.  Bytes of non-ASCII characters are taken as is.
+ *
+ * Returns term length, or 0 if there are no more terms.
+ */
+static size_t
+next_term(const char **pp, const char *end, char *buf) {
+	const char	*p = *pp;
+	size_t		 len;
+	unsigned char	 c;
+
+	do {
+		while (p < end && !is_term_char((unsigned char)*p))
+			p++;
+		for (len = 0; p < end && is_term_char((c = *p)); p++)
+			if (len < TERM_MAX)
+				buf[len++] = (c >= 'A' && c <= 'Z') ?
+				    (char)(c | 0x20) : (char)c;
+	} while (p < end && len < TERM_MIN);
+	*pp = p;
+	return len >= TERM_MIN ? len : 0;
+}
+
+static uint32_t
+term_hash(const char *s, size_t len) {
+	uint32_t	 h = 2166136261u;
+
+	while (len-- > 0) {
+		h ^= (unsigned char)*s++;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static int
+term_cmp(const char *a, size_t alen, const char *b, size_t blen) {
+	int	 rv;
+
+	if ((rv = memcmp(a, b, alen < blen ? alen : blen)) != 0)
+		return rv;
+	return alen < blen ? -1 : alen > blen;
+}
+
+/*
+ * Converts date prefix of history line into seconds since epoch,
+ * ignoring time zones: it's only used to order the results.
+ */
+static int
+parse_date(const char *s, uint32_t *tp) {
+	static const char	 pattern[] = "dddd-dd-dd dd:dd:dd ";
+	int			 i, y, m, d;
+	int64_t			 days;
+
+	for (i = 0; i < DATELEN; i++)
+		if (pattern[i] == 'd' ? (s[i] < '0' || s[i] > '9') :
+		    s[i] != pattern[i])
+			return 0;
+
+#define DIGITS2(p)	(((p)[0] - '0') * 10 + (p)[1] - '0')
+	y = DIGITS2(s) * 100 + DIGITS2(s + 2);
+	m = DIGITS2(s + 5);
+	d = DIGITS2(s + 8);
+	if (y < 1970 || m < 1 || m > 12 || d < 1 || d > 31)
+		return 0;
+
+	// days from civil, see http://howardhinnant.github.io/date_algorithms.html
+	y -= m <= 2;
+	days = (int64_t)(y / 400) * 146097 +
+	    ((y % 400) * 365 + (y % 400) / 4 - (y % 400) / 100) +
+	    (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1 - 719468;
+	*tp = (uint32_t)(days * 86400 + DIGITS2(s + 11) * 3600 +
+	    DIGITS2(s + 14) * 60 + DIGITS2(s + 17));
+#undef DIGITS2
+	return 1;
+}
+
+static struct search_term *
+mem_term_get(const char *name, size_t len, int create) {
+	struct search_term	**nt, *st;
+	uint32_t		  h;
+	size_t			  i, j, mask;
+
+	h = term_hash(name, len);
+	if (mem_terms_size != 0) {
+		mask = mem_terms_size - 1;
+		for (i = h & mask; (st = mem_terms[i]) != NULL;
+		    i = (i + 1) & mask)
+			if (st->st_hash == h && st->st_namelen == len &&
+			    memcmp(st->st_name, name, len) == 0)
+				return st;
+	}
+	if (!create)
+		return NULL;
+
+	// keep the table at most half full
+	if (mem_nterms * 2 >= mem_terms_size) {
+		size_t	newsize = mem_terms_size ? mem_terms_size * 2 : 4096;
+
+		if ((nt = calloc(newsize, sizeof(*nt))) == NULL)
+			err(1, __func__);
+		STATS_ALLOC(newsize * sizeof(*nt));
+		for (j = 0; j < mem_terms_size; j++) {
+			if ((st = mem_terms[j]) == NULL)
+				continue;
+			for (i = st->st_hash & (newsize - 1); nt[i] != NULL;
+			    i = (i + 1) & (newsize - 1))
+				;
+			nt[i] = st;
+		}
+		mem_bytes += (newsize - mem_terms_size) * sizeof(*nt);
+		free(mem_terms);
+		mem_terms = nt;
+		mem_terms_size = newsize;
+	}
+
+	if ((st = calloc(1, sizeof(*st))) == NULL)
+		err(1, __func__);
+	STATS_ALLOC(sizeof(*st));
+	mem_bytes += sizeof(*st);
+	st->st_hash = h;
+	st->st_namelen = (uint8_t)len;
+	memcpy(st->st_name, name, len);
+	mask = mem_terms_size - 1;
+	for (i = h & mask; mem_terms[i] != NULL; i = (i + 1) & mask)
+		;
+	mem_terms[i] = st;
+	mem_nterms++;
+	return st;
+}
+
+/*
+ * Varint encoding: 7 bits per byte, lowest first, the high bit is set
+ * in all bytes but the last one.
+ */
+static size_t
+varint_put(uint8_t *p, uint32_t v) {
+	size_t	 n = 0;
+
+	while (v >= 0x80) {
+		p[n++] = (uint8_t)(v | 0x80);
+		v >>= 7;
+	}
+	p[n++] = (uint8_t)v;
+	return n;
+}
+
+/*
+ * Returns number of bytes taken by the value.
+ */
+static size_t
+varint_get(const uint8_t *p, size_t len, uint32_t *vp) {
+	uint32_t	 v = 0;
+	size_t		 n = 0;
+
+	while (n < len && n < 5) {
+		v |= (uint32_t)(p[n] & 0x7f) << (7 * n);
+		if (!(p[n++] & 0x80))
+			break;
+	}
+	*vp = v;
+	return n;
+}
+
+/*
+ * The first posting is the document number itself, the rest are
+ * differences from the previous one.
+ */
+static void
+mem_add_posting(struct search_term *st, uint32_t doc) {
+	uint8_t		*p;
+	size_t		 newsize;
+
+	if (st->st_ndocs != 0 && st->st_lastdoc == doc)
+		return;
+	if (st->st_len + 5 > st->st_size) {
+		newsize = st->st_size ? st->st_size * 2 : 8;
+		if ((p = realloc(st->st_post, newsize)) == NULL)
+			err(1, __func__);
+		STATS_ALLOC(newsize);
+		mem_bytes += newsize - st->st_size;
+		st->st_post = p;
+		st->st_size = newsize;
+	}
+	st->st_len += varint_put(st->st_post + st->st_len,
+	    st->st_ndocs != 0 ? doc - st->st_lastdoc : doc);
+	st->st_ndocs++;
+	st->st_lastdoc = doc;
+}
+
+/*
+ * Both the author and the text get indexed, date doesn't.
+ */
+static void
+index_line(size_t fileid, const char *line, size_t len, uint64_t off) {
+	struct search_file	*sf = &files[fileid];
+	const char		*p = line, *end = line + len;
+	char			 term[TERM_MAX];
+	uint32_t		 doc, t;
+	size_t			 n, newsize;
+	void			*np;
+
+	if (len >= DATELEN && parse_date(line, &t)) {
+		sf->sf_lasttime = t;
+		p += DATELEN;
+	}
+
+	if (mem_ndocs == mem_docs_size) {
+		newsize = mem_docs_size ? mem_docs_size * 2 : 4096;
+		if ((np = reallocarray(mem_docpos, newsize,
+		    sizeof(*mem_docpos))) == NULL)
+			err(1, __func__);
+		mem_docpos = np;
+		if ((np = reallocarray(mem_doctime, newsize,
+		    sizeof(*mem_doctime))) == NULL)
+			err(1, __func__);
+		mem_doctime = np;
+		STATS_ALLOC(newsize * (sizeof(*mem_docpos) +
+		    sizeof(*mem_doctime)));
+		mem_bytes += (newsize - mem_docs_size) *
+		    (sizeof(*mem_docpos) + sizeof(*mem_doctime));
+		mem_docs_size = newsize;
+	}
+	doc = seg_ndocs + (uint32_t)mem_ndocs;
+	mem_docpos[mem_ndocs] = DOC_POS(fileid, off);
+	mem_doctime[mem_ndocs] = sf->sf_lasttime;
+	mem_ndocs++;
+
+	while ((n = next_term(&p, end, term)) != 0)
+		mem_add_posting(mem_term_get(term, n, 1), doc);
+}
+
+/*
+ * Indexes complete lines of the given log, reading about 'budget' bytes.
+ * Beginnings of lines longer than SEARCH_CHUNK are indexed, and the rest
+ * is skipped.
+ *
+ * Returns number of bytes processed.
+ */
+static size_t
+index_file(size_t fileid, size_t budget) {
+	struct search_file	*sf = &files[fileid];
+	struct stat		 st;
+	char			 path[PATH_MAX];
+	const char		*p, *end, *nl;
+	size_t			 done = 0, used;
+	ssize_t			 n;
+
+	if (chunk == NULL) {
+		if ((chunk = malloc(SEARCH_CHUNK)) == NULL)
+			err(1, __func__);
+		STATS_ALLOC(SEARCH_CHUNK);
+	}
+
+	// compressed logs are cheaper to read on, not from the start
+	if (idx_file != fileid) {
+		index_file_close();
+		if (!log_path(path, sf->sf_name) ||
+		    log_reader_open(&idx_reader, path) == -1) {
+			sf->sf_flags &= ~SF_PENDING;
+			return 0;
+		}
+		// offsets mean nothing in the file replaced since rescan()
+		if (fstat(idx_reader.lr_fd, &st) == 0 && (!file_is(sf, &st) ||
+		    (sf->sf_headlen != 0 &&
+		    (log_reader_pread(&idx_reader, chunk, sf->sf_headlen, 0) !=
+		    (ssize_t)sf->sf_headlen ||
+		    term_hash(chunk, sf->sf_headlen) != sf->sf_head)))) {
+			log_reader_close(&idx_reader);
+			file_replace(fileid, &st);
+			return 0;
+		}
+		idx_file = fileid;
+	}
+	while (done < budget) {
+		n = log_reader_pread(&idx_reader, chunk, SEARCH_CHUNK,
+		    sf->sf_indexed);
+		// space preallocated for mapped appends, see -P
+		if (n > 0 && (nl = memchr(chunk, '\0', (size_t)n)) != NULL)
+			n = nl - chunk;
+		if (n <= 0) {
+			if (n == -1)
+				warn("%s", sf->sf_name);
+			else if (idx_reader.lr_gz != NULL)
+				sf->sf_flags |= SF_COMPLETE;
+			sf->sf_flags &= ~SF_PENDING;
+			break;
+		}
+		p = chunk;
+		end = chunk + n;
+		if (sf->sf_indexed == 0) {
+			sf->sf_headlen = n < HEAD_LEN ? (uint32_t)n : HEAD_LEN;
+			sf->sf_head = term_hash(chunk, sf->sf_headlen);
+		}
+		if (sf->sf_flags & SF_LONGLINE) {
+			if ((nl = memchr(p, '\n', (size_t)n)) == NULL)
+				p = end;
+			else {
+				p = nl + 1;
+				sf->sf_flags &= ~SF_LONGLINE;
+			}
+		}
+		while (p < end && (nl = memchr(p, '\n', (size_t)(end - p)))) {
+			index_line(fileid, p, (size_t)(nl - p),
+			    sf->sf_indexed + (uint64_t)(p - chunk));
+			p = nl + 1;
+		}
+		if (p == chunk && n == SEARCH_CHUNK) {
+			index_line(fileid, chunk, SEARCH_CHUNK, sf->sf_indexed);
+			sf->sf_flags |= SF_LONGLINE;
+			p = end;
+		}
+
+		used = (size_t)(p - chunk);
+		sf->sf_indexed += used;
+		done += used;
+		if (used != 0)
+			dirty = 1;
+		if (n < SEARCH_CHUNK) {
+			// incomplete line at the end is left for later
+			if (idx_reader.lr_gz != NULL)
+				sf->sf_flags |= SF_COMPLETE;
+			sf->sf_flags &= ~SF_PENDING;
+			break;
+		}
+	}
+	if (!(sf->sf_flags & SF_PENDING))
+		index_file_close();
+	return done;
+}
+
+static void
+index_file_close(void) {
+	log_reader_close(&idx_reader);
+	idx_file = SIZE_MAX;
+}
+
+/*
+ * Indexes pending logs, up to 'budget' bytes.
+ *
+ * Returns number of bytes processed.
+ */
+static size_t
+catch_up(size_t budget) {
+	size_t	 i, n, done = 0;
+
+	for (i = 0; i < nfiles && done < budget; i++)
+		if ((files[i].sf_flags & (SF_PENDING|SF_DEAD)) == SF_PENDING) {
+			n = index_file(i, budget - done);
+			done += n;
+		}
+	return done;
+}
+
+/*
+ * Puts path to the file in history directory into buf of PATH_MAX bytes.
+ */
+static int
+log_path(char *buf, const char *name) {
+	int	 rv;
+
+	rv = snprintf(buf, PATH_MAX, "%s/%s", history_path, name);
+	if (rv < 0 || rv >= PATH_MAX) {
+		errno = ENAMETOOLONG;
+		return 0;
+	}
+	return 1;
+}
+
+/*
+ * Returns index of live file with the given name, or nfiles if not found.
+ */
+static size_t
+file_find(const char *name) {
+	size_t	 i;
+
+	for (i = 0; i < nfiles; i++)
+		if (!(files[i].sf_flags & SF_DEAD) &&
+		    strcmp(files[i].sf_name, name) == 0)
+			break;
+	return i;
+}
+
+static size_t
+file_add(const char *name) {
+	struct search_file	*sf;
+	size_t			 newsize;
+
+	if (nfiles == files_size) {
+		newsize = files_size ? files_size * 2 : 64;
+		if ((sf = reallocarray(files, newsize, sizeof(*sf))) == NULL)
+			err(1, __func__);
+		STATS_ALLOC(newsize * sizeof(*sf));
+		files = sf;
+		files_size = newsize;
+	}
+	sf = &files[nfiles];
+	memset(sf, 0, sizeof(*sf));
+	if ((sf->sf_name = strdup(name)) == NULL)
+		err(1, __func__);
+	STATS_ALLOC(strlen(name) + 1);
+	dirty = 1;
+	return nfiles++;
+}
+
+static int
+file_is(const struct search_file *sf, const struct stat *st) {
+	return sf->sf_dev == (uint64_t)st->st_dev &&
+	    sf->sf_ino == (uint64_t)st->st_ino;
+}
+
+/*
+ * Documents of the file are kept, since they're numbered in order,
+ * but they aren't shown anymore.
+ */
+static void
+file_kill(size_t i) {
+	if (idx_file == i)
+		index_file_close();
+	files[i].sf_flags |= SF_DEAD;
+	files[i].sf_flags &= ~SF_PENDING;
+	dirty = 1;
+}
+
+/*
+ * Called when the log got replaced by another file with the same name.
+ * Returns entry of the latter, to be indexed from the start.
+ */
+static size_t
+file_replace(size_t i, const struct stat *st) {
+	size_t	 j;
+
+	file_kill(i);
+	j = file_add(files[i].sf_name);
+	files[j].sf_dev = (uint64_t)st->st_dev;
+	files[j].sf_ino = (uint64_t)st->st_ino;
+	files[j].sf_flags |= SF_PENDING;
+	return j;
+}
+
+static int
+cmp_dirents(const void *a, const void *b) {
+	return strcmp(((const struct log_dirent *)a)->ld_name,
+	    ((const struct log_dirent *)b)->ld_name);
+}
+
+static int
+cmp_file_ids(const void *a, const void *b) {
+	const struct search_file	*fa = &files[*(const size_t *)a];
+	const struct search_file	*fb = &files[*(const size_t *)b];
+
+	if (fa->sf_dev != fb->sf_dev)
+		return fa->sf_dev < fb->sf_dev ? -1 : 1;
+	if (fa->sf_ino != fb->sf_ino)
+		return fa->sf_ino < fb->sf_ino ? -1 : 1;
+	return 0;
+}
+
+/*
+ * Looks for logs grown since they were indexed, including ones written
+ * by other oicb instances.  Logs are told apart by device and inode
+ * numbers, not names: the ones renamed behind our back, e.g., rotated
+ * by another instance or before the index was loaded, keep documents
+ * indexed already.  Logs that were replaced or became shorter are
+ * indexed again from the start.  Sizes of compressed segments say
+ * nothing about their text, but they don't change, either.
+ */
+static void
+rescan(void) {
+	struct dirent		*de;
+	struct stat		 st;
+	struct log_dirent	*ents = NULL, *ld, key;
+	struct search_file	*sf;
+	DIR			*dp;
+	size_t			 nents = 0, ents_size = 0, nids, i, lo, hi, mid;
+	size_t			*ids;
+	void			*np;
+
+	if ((dp = opendir(history_path)) == NULL) {
+		warn("%s", history_path);
+		return;
+	}
+	while ((de = readdir(dp)) != NULL) {
+		if (log_name_len(de->d_name) == 0)
+			continue;
+		if (fstatat(dirfd(dp), de->d_name, &st, 0) == -1 ||
+		    !S_ISREG(st.st_mode))
+			continue;
+		if (nents == ents_size) {
+			ents_size = ents_size ? ents_size * 2 : 64;
+			if ((np = reallocarray(ents, ents_size,
+			    sizeof(*ents))) == NULL)
+				err(1, __func__);
+			ents = np;
+		}
+		ld = &ents[nents++];
+		if ((ld->ld_name = strdup(de->d_name)) == NULL)
+			err(1, __func__);
+		ld->ld_dev = (uint64_t)st.st_dev;
+		ld->ld_ino = (uint64_t)st.st_ino;
+		ld->ld_size = (uint64_t)st.st_size;
+		ld->ld_file = SIZE_MAX;
+	}
+	closedir(dp);
+	qsort(ents, nents, sizeof(*ents), cmp_dirents);
+
+	// follow renames, looking up live entries by identity
+	if ((ids = reallocarray(NULL, nfiles ? nfiles : 1,
+	    sizeof(*ids))) == NULL)
+		err(1, __func__);
+	for (i = nids = 0; i < nfiles; i++)
+		if (!(files[i].sf_flags & SF_DEAD))
+			ids[nids++] = i;
+	qsort(ids, nids, sizeof(*ids), cmp_file_ids);
+	for (i = 0; i < nents; i++) {
+		ld = &ents[i];
+		for (lo = 0, hi = nids; lo < hi;) {
+			mid = lo + (hi - lo) / 2;
+			sf = &files[ids[mid]];
+			if (sf->sf_dev < ld->ld_dev ||
+			    (sf->sf_dev == ld->ld_dev &&
+			    sf->sf_ino < ld->ld_ino))
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		if (lo == nids)
+			continue;
+		sf = &files[ids[lo]];
+		if (sf->sf_dev != ld->ld_dev || sf->sf_ino != ld->ld_ino ||
+		    strcmp(sf->sf_name, ld->ld_name) == 0)
+			continue;
+		if ((np = strdup(ld->ld_name)) == NULL)
+			err(1, __func__);
+		STATS_ALLOC(strlen(ld->ld_name) + 1);
+		if (idx_file == ids[lo])
+			index_file_close();
+		free(sf->sf_name);
+		sf->sf_name = np;
+		dirty = 1;
+	}
+	free(ids);
+
+	// entries of logs gone, replaced or truncated are dead now
+	for (i = 0; i < nfiles; i++) {
+		sf = &files[i];
+		if (sf->sf_flags & SF_DEAD)
+			continue;
+		key.ld_name = sf->sf_name;
+		ld = bsearch(&key, ents, nents, sizeof(*ents), cmp_dirents);
+		if (ld == NULL || ld->ld_ino != sf->sf_ino ||
+		    ld->ld_dev != sf->sf_dev || ld->ld_file != SIZE_MAX ||
+		    (!log_is_compressed(sf->sf_name) &&
+		    ld->ld_size < sf->sf_indexed))
+			file_kill(i);
+		else
+			ld->ld_file = i;
+	}
+
+	for (i = 0; i < nents; i++) {
+		ld = &ents[i];
+		if (ld->ld_file == SIZE_MAX) {
+			ld->ld_file = file_add(ld->ld_name);
+			files[ld->ld_file].sf_dev = ld->ld_dev;
+			files[ld->ld_file].sf_ino = ld->ld_ino;
+		}
+		sf = &files[ld->ld_file];
+		if (log_is_compressed(sf->sf_name)) {
+			if (!(sf->sf_flags & SF_COMPLETE))
+				sf->sf_flags |= SF_PENDING;
+		} else if (ld->ld_size > sf->sf_indexed)
+			sf->sf_flags |= SF_PENDING;
+		free(ld->ld_name);
+	}
+	free(ents);
+}
+
+/*
+ * Puts path to the segment file into buf of PATH_MAX bytes.
+ */
+static int
+seg_path(char *buf, uint64_t id) {
+	char	 name[sizeof(SEARCH_INDEX_NAME) + 21];
+
+	snprintf(name, sizeof(name), "%s.%llu", SEARCH_INDEX_NAME,
+	    (unsigned long long)id);
+	return log_path(buf, name);
+}
+
+/*
+ * Creates new segment file, never overwriting one: it could be used by
+ * another oicb instance.  Returns descriptor, or -1 on failure.
+ */
+static int
+seg_create(uint64_t *idp) {
+	char	 path[PATH_MAX];
+	int	 fd;
+
+	for (;;) {
+		if (!seg_path(path, next_seg_id))
+			return -1;
+		fd = open(path, O_WRONLY|O_CREAT|O_EXCL, 0666);
+		if (fd != -1 || errno != EEXIST)
+			break;
+		next_seg_id++;
+	}
+	if (fd != -1)
+		*idp = next_seg_id++;
+	return fd;
+}
+
+static void
+seg_unlink(uint64_t id) {
+	char	 path[PATH_MAX];
+
+	if (seg_path(path, id) && unlink(path) == -1 && errno != ENOENT)
+		warn("%s", path);
+}
+
+/*
+ * Removes segment file, unless it's used by another oicb instance: the
+ * latter could have listed it in the index file it's going to write.
+ */
+static void
+seg_remove(uint64_t id) {
+	char	 path[PATH_MAX];
+	int	 fd;
+
+	if (!seg_path(path, id) || (fd = open(path, O_RDONLY)) == -1)
+		return;
+	if (flock(fd, LOCK_EX|LOCK_NB) == 0 && unlink(path) == -1 &&
+	    errno != ENOENT)
+		warn("%s", path);
+	close(fd);
+}
+
+/*
+ * Maps the segment file, checking it.  Returns -1 if it's unusable.
+ */
+static int
+seg_open(uint64_t id, uint32_t base, struct index_seg *is) {
+	const struct search_seg_header	*sh;
+	const struct search_term_ent	*ste;
+	struct stat			 st;
+	char				 path[PATH_MAX];
+	uint64_t			 names_size, postings_size;
+	size_t				 i;
+	int				 fd;
+
+	if (!seg_path(path, id) || (fd = open(path, O_RDONLY)) == -1) {
+		warn("%s", path);
+		return -1;
+	}
+	if (fstat(fd, &st) == -1) {
+		warn("%s", path);
+		close(fd);
+		return -1;
+	}
+	if ((size_t)st.st_size < sizeof(*sh)) {
+		close(fd);
+		warnx("%s: corrupted", path);
+		return -1;
+	}
+	is->is_id = id;
+	is->is_fd = fd;
+	is->is_size = (size_t)st.st_size;
+	is->is_map = mmap(NULL, is->is_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (is->is_map == MAP_FAILED) {
+		warn("%s", path);
+		close(fd);
+		return -1;
+	}
+	flock(fd, LOCK_SH);
+
+	sh = (const struct search_seg_header *)(const void *)is->is_map;
+	if (memcmp(sh->ssh_magic, SEGMENT_MAGIC, sizeof(sh->ssh_magic)) != 0 ||
+	    sh->ssh_base != base || sh->ssh_size != is->is_size ||
+	    (uint64_t)base + sh->ssh_ndocs > UINT32_MAX)
+		goto corrupted;
+	// sections go in order and fit, sizes are checked without overflow
+	if (sh->ssh_docpos < sizeof(*sh) ||
+	    sh->ssh_doctime < sh->ssh_docpos ||
+	    sh->ssh_postings < sh->ssh_doctime ||
+	    sh->ssh_terms < sh->ssh_postings ||
+	    sh->ssh_names < sh->ssh_terms || sh->ssh_names > is->is_size ||
+	    sh->ssh_ndocs > (sh->ssh_doctime - sh->ssh_docpos) / 8 ||
+	    sh->ssh_ndocs > (sh->ssh_postings - sh->ssh_doctime) / 4 ||
+	    sh->ssh_nterms > (sh->ssh_names - sh->ssh_terms) / sizeof(*ste) ||
+	    (sh->ssh_docpos | sh->ssh_doctime | sh->ssh_terms) % 8 != 0)
+		goto corrupted;
+
+	is->is_docpos = (const uint64_t *)(const void *)
+	    (is->is_map + sh->ssh_docpos);
+	is->is_doctime = (const uint32_t *)(const void *)
+	    (is->is_map + sh->ssh_doctime);
+	is->is_postings = (const uint8_t *)(is->is_map + sh->ssh_postings);
+	is->is_terms = (const struct search_term_ent *)(const void *)
+	    (is->is_map + sh->ssh_terms);
+	is->is_names = is->is_map + sh->ssh_names;
+	is->is_base = base;
+	is->is_ndocs = sh->ssh_ndocs;
+	is->is_nterms = sh->ssh_nterms;
+	names_size = is->is_size - sh->ssh_names;
+	postings_size = sh->ssh_terms - sh->ssh_postings;
+	for (i = 0; i < is->is_nterms; i++) {
+		ste = &is->is_terms[i];
+		if (ste->ste_postings > postings_size ||
+		    ste->ste_postlen > postings_size - ste->ste_postings ||
+		    (uint64_t)ste->ste_name + ste->ste_namelen > names_size ||
+		    ste->ste_namelen > TERM_MAX || ste->ste_ndocs == 0 ||
+		    ste->ste_lastdoc < base ||
+		    ste->ste_lastdoc - base >= is->is_ndocs)
+			goto corrupted;
+	}
+	for (i = 0; i < is->is_ndocs; i++)
+		if (DOC_FILE(is->is_docpos[i]) >= nfiles)
+			goto corrupted;
+	return 0;
+
+corrupted:
+	warnx("%s: corrupted", path);
+	seg_close(is);
+	return -1;
+}
+
+static void
+seg_close(struct index_seg *is) {
+	munmap((void *)(uintptr_t)is->is_map, is->is_size);
+	close(is->is_fd);
+}
+
+static void
+seg_append(const struct index_seg *is) {
+	void	*np;
+	size_t	 newsize;
+
+	if (nsegs == segs_size) {
+		newsize = segs_size ? segs_size * 2 : 16;
+		if ((np = reallocarray(segs, newsize, sizeof(*segs))) == NULL)
+			err(1, __func__);
+		STATS_ALLOC(newsize * sizeof(*segs));
+		segs = np;
+		segs_size = newsize;
+	}
+	segs[nsegs++] = *is;
+	seg_ndocs += is->is_ndocs;
+}
+
+/*
+ * Segments of the same tier differ in size less than SEARCH_MERGE_WIDTH
+ * times, all the small ones are of tier 0.
+ */
+static int
+seg_tier(const struct index_seg *is) {
+	size_t	 size = SEARCH_TIER_MIN;
+	int	 tier = 0;
+
+	while (is->is_size >= size && size <= SIZE_MAX / SEARCH_MERGE_WIDTH) {
+		size *= SEARCH_MERGE_WIDTH;
+		tier++;
+	}
+	return tier;
+}
+
+/*
+ * Removes segment files not listed in the index: left after crash, or
+ * by another oicb instance which index was replaced with ours.  Fresh
+ * ones could be still being written by another instance, so they're
+ * kept for a while, and ones mapped by it are never removed.
+ */
+static void
+remove_orphans(void) {
+	DIR		*dp;
+	struct dirent	*de;
+	struct stat	 st;
+	const char	*p;
+	char		*end;
+	unsigned long long id;
+	size_t		 i, len = strlen(SEARCH_INDEX_NAME ".");
+	time_t		 old;
+
+	if ((dp = opendir(history_path)) == NULL)
+		return;
+	old = time(NULL) - SEARCH_ORPHAN_AGE;
+	while ((de = readdir(dp)) != NULL) {
+		if (strncmp(de->d_name, SEARCH_INDEX_NAME ".", len) != 0)
+			continue;
+		p = de->d_name + len;
+		if (*p < '0' || *p > '9')
+			continue;
+		errno = 0;
+		id = strtoull(p, &end, 10);
+		if (*end != '\0' || errno != 0)
+			continue;
+		for (i = 0; i < nsegs && segs[i].is_id != id; i++)
+			;
+		if (i == nsegs &&
+		    fstatat(dirfd(dp), de->d_name, &st, 0) == 0 &&
+		    st.st_mtime < old)
+			seg_remove(id);
+	}
+	closedir(dp);
+}
+
+/*
+ * Loads saved index, if any, mapping its segments.  Returns 0 if there
+ * is none, or it's unusable.
+ */
+static int
+load_index(void) {
+	const struct search_header	*sh;
+	const struct search_seg_ent	*sse;
+	const struct search_file_ent	*sfe;
+	struct index_seg		 is;
+	struct stat			 st;
+	char				 path[PATH_MAX], name[NAME_MAX + 1];
+	const char			*map = NULL;
+	uint64_t			 off;
+	size_t				 i, j, size = 0;
+	int				 fd;
+
+	if (!log_path(path, SEARCH_INDEX_NAME) ||
+	    (fd = open(path, O_RDONLY)) == -1) {
+		if (errno != ENOENT)
+			warn("%s", path);
+		goto unusable;
+	}
+	if (fstat(fd, &st) == -1) {
+		warn("%s", path);
+		close(fd);
+		goto unusable;
+	}
+	if ((size_t)st.st_size < sizeof(*sh)) {
+		close(fd);
+		goto corrupted;
+	}
+	size = (size_t)st.st_size;
+	map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		warn("%s", path);
+		map = NULL;
+		goto unusable;
+	}
+
+	sh = (const struct search_header *)(const void *)map;
+	// made by another version, quietly rebuilt
+	if (memcmp(sh->sh_magic, SEARCH_MAGIC, sizeof(sh->sh_magic) - 1) == 0 &&
+	    sh->sh_magic[sizeof(sh->sh_magic) - 1] !=
+	    SEARCH_MAGIC[sizeof(sh->sh_magic) - 1])
+		goto unusable;
+	if (memcmp(sh->sh_magic, SEARCH_MAGIC, sizeof(sh->sh_magic)) != 0 ||
+	    sh->sh_size != size ||
+	    sizeof(*sh) + (uint64_t)sh->sh_nsegs * sizeof(*sse) > size)
+		goto corrupted;
+
+	// files go first, segments are checked against them
+	off = sizeof(*sh) + (uint64_t)sh->sh_nsegs * sizeof(*sse);
+	for (i = 0; i < sh->sh_nfiles; i++) {
+		if (off + sizeof(*sfe) > size)
+			goto corrupted;
+		sfe = (const struct search_file_ent *)(const void *)(map + off);
+		off += sizeof(*sfe);
+		if (sfe->sfe_namelen == 0 || sfe->sfe_namelen > NAME_MAX ||
+		    sfe->sfe_headlen > HEAD_LEN ||
+		    off + sfe->sfe_namelen > size)
+			goto corrupted;
+		memcpy(name, map + off, sfe->sfe_namelen);
+		name[sfe->sfe_namelen] = '\0';
+		off += (sfe->sfe_namelen + 7) & ~7;
+		j = file_add(name);
+		files[j].sf_dev = sfe->sfe_dev;
+		files[j].sf_ino = sfe->sfe_ino;
+		files[j].sf_head = sfe->sfe_head;
+		files[j].sf_headlen = sfe->sfe_headlen;
+		files[j].sf_indexed = sfe->sfe_indexed;
+		files[j].sf_lasttime = sfe->sfe_lasttime;
+		files[j].sf_flags = sfe->sfe_flags & ~SF_PENDING;
+	}
+
+	sse = (const struct search_seg_ent *)(const void *)(map + sizeof(*sh));
+	for (i = 0; i < sh->sh_nsegs; i++) {
+		if (seg_open(sse[i].sse_id, seg_ndocs, &is) == -1)
+			goto corrupted;
+		if (is.is_ndocs != sse[i].sse_ndocs) {
+			seg_close(&is);
+			goto corrupted;
+		}
+		seg_append(&is);
+	}
+	next_seg_id = sh->sh_nextseg;
+	munmap((void *)(uintptr_t)map, size);
+	remove_orphans();
+	dirty = 0;
+	return 1;
+
+corrupted:
+	warnx("%s: corrupted, will be rebuilt", path);
+unusable:
+	if (map != NULL)
+		munmap((void *)(uintptr_t)map, size);
+	for (i = 0; i < nsegs; i++)
+		seg_close(&segs[i]);
+	nsegs = 0;
+	seg_ndocs = 0;
+	for (i = 0; i < nfiles; i++)
+		free(files[i].sf_name);
+	nfiles = 0;
+	remove_orphans();
+	return 0;
+}
+
+static void
+free_mem_index(void) {
+	size_t	 i;
+
+	for (i = 0; i < mem_terms_size; i++)
+		if (mem_terms[i] != NULL) {
+			free(mem_terms[i]->st_post);
+			free(mem_terms[i]);
+		}
+	free(mem_terms);
+	free(mem_docpos);
+	free(mem_doctime);
+	mem_terms = NULL;
+	mem_docpos = NULL;
+	mem_doctime = NULL;
+	mem_nterms = mem_terms_size = 0;
+	mem_ndocs = mem_docs_size = 0;
+	mem_bytes = 0;
+}
+
+static int
+cmp_mem_terms(const void *a, const void *b) {
+	const struct search_term	*sa = *(struct search_term * const *)a;
+	const struct search_term	*sb = *(struct search_term * const *)b;
+
+	return term_cmp(sa->st_name, sa->st_namelen, sb->st_name,
+	    sb->st_namelen);
+}
+
+/*
+ * Segment writer: sections are written one after another, and term
+ * entries with names are collected and written by sw_finish(), along
+ * with the header.  Used from the merging thread, too.
+ */
+static int
+sw_begin(struct seg_writer *sw, int fd, uint32_t base, uint32_t ndocs) {
+	memset(sw, 0, sizeof(*sw));
+	if ((sw->sw_f = fdopen(fd, "w")) == NULL) {
+		close(fd);
+		return -1;
+	}
+	memcpy(sw->sw_sh.ssh_magic, SEGMENT_MAGIC, sizeof(sw->sw_sh.ssh_magic));
+	sw->sw_sh.ssh_base = base;
+	sw->sw_sh.ssh_ndocs = ndocs;
+	return sw_write(sw, &sw->sw_sh, sizeof(sw->sw_sh));
+}
+
+static int
+sw_write(struct seg_writer *sw, const void *p, size_t len) {
+	if (len != 0 && fwrite(p, 1, len, sw->sw_f) != len)
+		return -1;
+	sw->sw_off += len;
+	return 0;
+}
+
+static int
+sw_align(struct seg_writer *sw) {
+	static const char	 zeroes[8];
+
+	return sw_write(sw, zeroes, (size_t)(-sw->sw_off & 7));
+}
+
+/*
+ * Adds entry for the term, which postings were written since 'start'.
+ */
+static int
+sw_add_term(struct seg_writer *sw, const char *name, size_t namelen,
+    uint64_t start, uint32_t ndocs, uint32_t lastdoc) {
+	struct search_term_ent	*ste;
+	void			*np;
+	size_t			 newsize;
+
+	if (sw->sw_nents == sw->sw_ents_size) {
+		newsize = sw->sw_ents_size ? sw->sw_ents_size * 2 : 4096;
+		if ((np = reallocarray(sw->sw_ents, newsize,
+		    sizeof(*sw->sw_ents))) == NULL)
+			return -1;
+		sw->sw_ents = np;
+		sw->sw_ents_size = newsize;
+	}
+	if (sw->sw_names_len + namelen > sw->sw_names_size) {
+		newsize = sw->sw_names_size ? sw->sw_names_size * 2 : 65536;
+		if ((np = realloc(sw->sw_names, newsize)) == NULL)
+			return -1;
+		sw->sw_names = np;
+		sw->sw_names_size = newsize;
+	}
+	ste = &sw->sw_ents[sw->sw_nents++];
+	memset(ste, 0, sizeof(*ste));
+	ste->ste_postings = start - sw->sw_sh.ssh_postings;
+	ste->ste_postlen = (uint32_t)(sw->sw_off - start);
+	ste->ste_ndocs = ndocs;
+	ste->ste_lastdoc = lastdoc;
+	ste->ste_name = (uint32_t)sw->sw_names_len;
+	ste->ste_namelen = (uint32_t)namelen;
+	memcpy(sw->sw_names + sw->sw_names_len, name, namelen);
+	sw->sw_names_len += namelen;
+	return 0;
+}
+
+/*
+ * Writes term entries and names, then the header, and syncs the file.
+ * The file is closed in any case.
+ */
+static int
+sw_finish(struct seg_writer *sw) {
+	sw->sw_sh.ssh_nterms = (uint32_t)sw->sw_nents;
+	if (sw_align(sw) == -1)
+		return sw_close(sw, -1);
+	sw->sw_sh.ssh_terms = sw->sw_off;
+	if (sw_write(sw, sw->sw_ents, sw->sw_nents * sizeof(*sw->sw_ents)) ==
+	    -1)
+		return sw_close(sw, -1);
+	sw->sw_sh.ssh_names = sw->sw_off;
+	if (sw_write(sw, sw->sw_names, sw->sw_names_len) == -1)
+		return sw_close(sw, -1);
+	sw->sw_sh.ssh_size = sw->sw_off;
+	if (fseeko(sw->sw_f, 0, SEEK_SET) == -1 ||
+	    fwrite(&sw->sw_sh, sizeof(sw->sw_sh), 1, sw->sw_f) != 1 ||
+	    fflush(sw->sw_f) == EOF || fsync(fileno(sw->sw_f)) == -1)
+		return sw_close(sw, -1);
+	return sw_close(sw, 0);
+}
+
+/*
+ * Returns rv given, or -1 if closing failed; errno is kept.
+ */
+static int
+sw_close(struct seg_writer *sw, int rv) {
+	int	 saved_errno = errno;
+
+	if (sw->sw_f != NULL && fclose(sw->sw_f) == EOF && rv == 0) {
+		saved_errno = errno;
+		rv = -1;
+	}
+	sw->sw_f = NULL;
+	free(sw->sw_ents);
+	free(sw->sw_names);
+	sw->sw_ents = NULL;
+	sw->sw_names = NULL;
+	errno = saved_errno;
+	return rv;
+}
+
+/*
+ * Writes the in-memory part as a new segment, and starts using the latter
+ * instead.  Returns -1 on failure.
+ */
+static int
+save_mem_segment(void) {
+	struct seg_writer	 sw;
+	struct search_term	**sorted, *st;
+	struct index_seg	 is;
+	uint64_t		 id, start;
+	size_t			 i, j;
+	int			 fd, saved_errno;
+
+	if ((sorted = reallocarray(NULL, mem_nterms ? mem_nterms : 1,
+	    sizeof(*sorted))) == NULL)
+		return -1;
+	for (i = j = 0; i < mem_terms_size; i++)
+		if (mem_terms[i] != NULL)
+			sorted[j++] = mem_terms[i];
+	qsort(sorted, mem_nterms, sizeof(*sorted), cmp_mem_terms);
+
+	if ((fd = seg_create(&id)) == -1) {
+		free(sorted);
+		return -1;
+	}
+	if (sw_begin(&sw, fd, seg_ndocs, (uint32_t)mem_ndocs) == -1)
+		goto fail;
+	sw.sw_sh.ssh_docpos = sw.sw_off;
+	if (sw_write(&sw, mem_docpos, mem_ndocs * sizeof(*mem_docpos)) == -1)
+		goto fail;
+	sw.sw_sh.ssh_doctime = sw.sw_off;
+	if (sw_write(&sw, mem_doctime, mem_ndocs * sizeof(*mem_doctime)) ==
+	    -1 || sw_align(&sw) == -1)
+		goto fail;
+	sw.sw_sh.ssh_postings = sw.sw_off;
+	for (i = 0; i < mem_nterms; i++) {
+		st = sorted[i];
+		start = sw.sw_off;
+		if (sw_write(&sw, st->st_post, st->st_len) == -1 ||
+		    sw_add_term(&sw, st->st_name, st->st_namelen, start,
+		    st->st_ndocs, st->st_lastdoc) == -1)
+			goto fail;
+	}
+	free(sorted);
+	sorted = NULL;
+	if (sw_finish(&sw) == -1)
+		goto drop;
+	if (seg_open(id, seg_ndocs, &is) == -1) {
+		errno = EINVAL;
+		goto drop;
+	}
+	seg_append(&is);
+	free_mem_index();
+	dirty = 1;
+	return 0;
+
+fail:
+	sw_close(&sw, -1);
+drop:
+	saved_errno = errno;
+	seg_unlink(id);
+	free(sorted);
+	errno = saved_errno;
+	return -1;
+}
+
+#define WRITE_OR_FAIL(p, len)	do {					\
+		if (fwrite((p), 1, (len), f) != (len))			\
+			goto fail;					\
+		off += (len);						\
+	} while (0)
+#define ALIGN_OR_FAIL()	do {						\
+		static const char zeroes[8];				\
+		WRITE_OR_FAIL(zeroes, (size_t)(-off & 7));		\
+	} while (0)
+
+/*
+ * Saves the in-memory part as a new segment, then writes the index file
+ * listing segments and logs, which replaces the old one.  Segments saved
+ * before are left as is.  Returns -1 on failure.
+ */
+static int
+save_index(void) {
+	struct search_header	 sh;
+	struct search_seg_ent	 sse;
+	struct search_file_ent	 sfe;
+	char			 path[PATH_MAX], tmppath[PATH_MAX];
+	uint64_t		 off = 0;
+	size_t			 i;
+	int			 fd = -1;
+	FILE			*f = NULL;
+
+	if (mem_ndocs > 0 && save_mem_segment() == -1) {
+		warn("cannot save search index segment");
+		return -1;
+	}
+	if (!dirty)
+		return 0;
+	if (!log_path(path, SEARCH_INDEX_NAME) ||
+	    !log_path(tmppath, SEARCH_INDEX_NAME ".tmp")) {
+		warn("cannot save search index");
+		return -1;
+	}
+
+	if ((fd = open(tmppath, O_WRONLY|O_CREAT|O_TRUNC, 0666)) == -1 ||
+	    (f = fdopen(fd, "w")) == NULL)
+		goto fail;
+
+	memset(&sh, 0, sizeof(sh));
+	memcpy(sh.sh_magic, SEARCH_MAGIC, sizeof(sh.sh_magic));
+	sh.sh_nfiles = (uint32_t)nfiles;
+	sh.sh_nsegs = (uint32_t)nsegs;
+	sh.sh_nextseg = next_seg_id;
+	WRITE_OR_FAIL(&sh, sizeof(sh));
+
+	for (i = 0; i < nsegs; i++) {
+		memset(&sse, 0, sizeof(sse));
+		sse.sse_id = segs[i].is_id;
+		sse.sse_ndocs = segs[i].is_ndocs;
+		WRITE_OR_FAIL(&sse, sizeof(sse));
+	}
+
+	for (i = 0; i < nfiles; i++) {
+		memset(&sfe, 0, sizeof(sfe));
+		sfe.sfe_dev = files[i].sf_dev;
+		sfe.sfe_ino = files[i].sf_ino;
+		sfe.sfe_head = files[i].sf_head;
+		sfe.sfe_headlen = files[i].sf_headlen;
+		sfe.sfe_indexed = files[i].sf_indexed;
+		sfe.sfe_lasttime = files[i].sf_lasttime;
+		sfe.sfe_flags = files[i].sf_flags & ~SF_PENDING;
+		sfe.sfe_namelen = (uint16_t)strlen(files[i].sf_name);
+		WRITE_OR_FAIL(&sfe, sizeof(sfe));
+		WRITE_OR_FAIL(files[i].sf_name, sfe.sfe_namelen);
+		ALIGN_OR_FAIL();
+	}
+
+	sh.sh_size = off;
+	if (fseeko(f, 0, SEEK_SET) == -1 ||
+	    fwrite(&sh, sizeof(sh), 1, f) != 1 || fflush(f) == EOF ||
+	    fsync(fd) == -1)
+		goto fail;
+	fclose(f);
+	f = NULL;
+	if (rename(tmppath, path) == -1)
+		goto fail;
+	dirty = 0;
+	return 0;
+
+fail:
+	warn("cannot save search index to %s", tmppath);
+	if (f != NULL)
+		fclose(f);
+	else if (fd != -1)
+		close(fd);
+	unlink(tmppath);
+	return -1;
+}
+
+#undef ALIGN_OR_FAIL
+#undef WRITE_OR_FAIL
+
+/*
+ * Only documents indexed since the last save are written, as a small
+ * segment; merging isn't waited for.
+ */
+static void
+save_index_at_exit(void) {
+	save_index();
+}
+
+/*
+ * Writes segments of the job as one.  Term lists are sorted, so they're
+ * merged in one pass; postings of the same term are concatenated, with
+ * the first document number of each but the first list converted to the
+ * difference.  Runs in separate thread, so nothing but the job is used.
+ */
+static int
+merge_segments(struct merge_job *mj) {
+	struct seg_writer		 sw;
+	const struct index_seg		*is;
+	const struct search_term_ent	*ste;
+	const uint8_t			*p;
+	const char			*name = NULL;
+	uint8_t				 vbuf[5];
+	uint64_t			 start;
+	uint32_t			 ndocs = 0, lastdoc = 0, first;
+	size_t				 i, len, namelen = 0, *pos;
+	int				 have;
+
+	if ((pos = calloc(mj->mj_nsegs, sizeof(*pos))) == NULL) {
+		close(mj->mj_fd);
+		return -1;
+	}
+	for (i = 0; i < mj->mj_nsegs; i++)
+		ndocs += mj->mj_segs[i].is_ndocs;
+	if (sw_begin(&sw, mj->mj_fd, mj->mj_segs[0].is_base, ndocs) == -1)
+		goto fail;
+	sw.sw_sh.ssh_docpos = sw.sw_off;
+	for (i = 0; i < mj->mj_nsegs; i++) {
+		is = &mj->mj_segs[i];
+		if (sw_write(&sw, is->is_docpos,
+		    is->is_ndocs * sizeof(*is->is_docpos)) == -1)
+			goto fail;
+	}
+	sw.sw_sh.ssh_doctime = sw.sw_off;
+	for (i = 0; i < mj->mj_nsegs; i++) {
+		is = &mj->mj_segs[i];
+		if (sw_write(&sw, is->is_doctime,
+		    is->is_ndocs * sizeof(*is->is_doctime)) == -1)
+			goto fail;
+	}
+	if (sw_align(&sw) == -1)
+		goto fail;
+
+	sw.sw_sh.ssh_postings = sw.sw_off;
+	for (;;) {
+		// the least term among ones not written yet
+		for (i = 0, have = 0; i < mj->mj_nsegs; i++) {
+			is = &mj->mj_segs[i];
+			if (pos[i] == is->is_nterms)
+				continue;
+			ste = &is->is_terms[pos[i]];
+			if (!have || term_cmp(is->is_names + ste->ste_name,
+			    ste->ste_namelen, name, namelen) < 0) {
+				name = is->is_names + ste->ste_name;
+				namelen = ste->ste_namelen;
+				have = 1;
+			}
+		}
+		if (!have)
+			break;
+
+		start = sw.sw_off;
+		for (i = 0, ndocs = 0; i < mj->mj_nsegs; i++) {
+			is = &mj->mj_segs[i];
+			if (pos[i] == is->is_nterms)
+				continue;
+			ste = &is->is_terms[pos[i]];
+			if (term_cmp(is->is_names + ste->ste_name,
+			    ste->ste_namelen, name, namelen) != 0)
+				continue;
+			p = is->is_postings + ste->ste_postings;
+			len = ste->ste_postlen;
+			if (ndocs != 0) {
+				// re-encode the first one
+				len -= varint_get(p, len, &first);
+				p += ste->ste_postlen - len;
+				if (sw_write(&sw, vbuf,
+				    varint_put(vbuf, first - lastdoc)) == -1)
+					goto fail;
+			}
+			if (sw_write(&sw, p, len) == -1)
+				goto fail;
+			ndocs += ste->ste_ndocs;
+			lastdoc = ste->ste_lastdoc;
+			pos[i]++;
+		}
+		if (sw_add_term(&sw, name, namelen, start, ndocs, lastdoc) == -1)
+			goto fail;
+	}
+	free(pos);
+	return sw_finish(&sw);
+
+fail:
+	free(pos);
+	return sw_close(&sw, -1);
+}
+
+static void *
+merge_worker(void *arg) {
+	struct merge_job	*mj = arg;
+	int			 error = 0;
+
+	if (merge_segments(mj) == -1)
+		error = errno;
+	pthread_mutex_lock(&merge_mtx);
+	mj->mj_errno = error;
+	mj->mj_done = 1;
+	pthread_mutex_unlock(&merge_mtx);
+	return NULL;
+}
+
+/*
+ * Starts merging the newest SEARCH_MERGE_WIDTH segments in a row that are
+ * of the same tier, if there are such, in background thread.  Segments
+ * grow exponentially from tier to tier, so merges get rare quickly.
+ */
+static void
+merge_start(void) {
+	struct merge_job	*mj;
+	pthread_t		 thread;
+	size_t			 i, j;
+	int			 tier, error;
+
+	if (merge_job != NULL)
+		return;
+	for (j = nsegs; j >= SEARCH_MERGE_WIDTH; j--) {
+		tier = seg_tier(&segs[j - 1]);
+		for (i = j - SEARCH_MERGE_WIDTH; i < j - 1; i++)
+			if (seg_tier(&segs[i]) != tier)
+				break;
+		if (i == j - 1)
+			break;
+	}
+	if (j < SEARCH_MERGE_WIDTH)
+		return;
+
+	if ((mj = calloc(1, sizeof(*mj))) == NULL)
+		goto fail;
+	if ((mj->mj_segs = reallocarray(NULL, SEARCH_MERGE_WIDTH,
+	    sizeof(*mj->mj_segs))) == NULL)
+		goto fail;
+	STATS_ALLOC(sizeof(*mj) + SEARCH_MERGE_WIDTH * sizeof(*mj->mj_segs));
+	memcpy(mj->mj_segs, &segs[j - SEARCH_MERGE_WIDTH],
+	    SEARCH_MERGE_WIDTH * sizeof(*segs));
+	mj->mj_nsegs = SEARCH_MERGE_WIDTH;
+	if ((mj->mj_fd = seg_create(&mj->mj_id)) == -1)
+		goto fail;
+	if ((error = pthread_create(&thread, NULL, merge_worker, mj)) != 0) {
+		close(mj->mj_fd);
+		seg_unlink(mj->mj_id);
+		errno = error;
+		goto fail;
+	}
+	pthread_detach(thread);
+	merge_job = mj;
+	return;
+
+fail:
+	warn("cannot merge search index segments");
+	if (mj != NULL)
+		free(mj->mj_segs);
+	free(mj);
+}
+
+/*
+ * Puts the merged segment in place of ones it was made of, if merging is
+ * finished; to be called from the main loop.
+ */
+static void
+merge_finish(void) {
+	struct merge_job	*mj = merge_job;
+	struct index_seg	 is;
+	size_t			 i, first;
+	int			 done;
+
+	pthread_mutex_lock(&merge_mtx);
+	done = mj->mj_done;
+	pthread_mutex_unlock(&merge_mtx);
+	if (!done)
+		return;
+	merge_job = NULL;
+
+	if (mj->mj_errno != 0) {
+		errno = mj->mj_errno;
+		warn("cannot merge search index segments");
+		goto drop;
+	}
+	// segments are only removed here, so they're still in a row
+	for (first = 0; segs[first].is_id != mj->mj_segs[0].is_id; first++)
+		;
+	if (seg_open(mj->mj_id, segs[first].is_base, &is) == -1)
+		goto drop;
+	for (i = first; i < first + mj->mj_nsegs; i++)
+		seg_close(&segs[i]);
+	segs[first] = is;
+	memmove(&segs[first + 1], &segs[first + mj->mj_nsegs],
+	    (nsegs - first - mj->mj_nsegs) * sizeof(*segs));
+	nsegs -= mj->mj_nsegs - 1;
+	dirty = 1;
+
+	// old segments are needed until the index file lists the new one
+	if (save_index() == 0)
+		for (i = 0; i < mj->mj_nsegs; i++)
+			seg_remove(mj->mj_segs[i].is_id);
+	free(mj->mj_segs);
+	free(mj);
+	merge_start();
+	return;
+
+drop:
+	seg_unlink(mj->mj_id);
+	free(mj->mj_segs);
+	free(mj);
+}
+
+static const struct search_term_ent *
+seg_term_find(const struct index_seg *is, const char *name, size_t len) {
+	const struct search_term_ent	*ste;
+	size_t				 lo = 0, hi = is->is_nterms, mid;
+	int				 c;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		ste = &is->is_terms[mid];
+		c = term_cmp(is->is_names + ste->ste_name, ste->ste_namelen,
+		    name, len);
+		if (c == 0)
+			return ste;
+		if (c < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return NULL;
+}
+
+/*
+ * Appends document numbers from postings to the list of n at most.
+ */
+static void
+decode_postings(struct doc_list *dl, size_t n, const uint8_t *p,
+    size_t len) {
+	uint32_t	 doc = 0, v;
+	size_t		 used;
+
+	while (len > 0 && dl->dl_n < n) {
+		used = varint_get(p, len, &v);
+		p += used;
+		len -= used;
+		doc += v;
+		dl->dl_docs[dl->dl_n++] = doc;
+	}
+}
+
+/*
+ * Decodes postings of all segments and of the in-memory part into sorted
+ * array of document numbers.  Returns 0 if there are no documents with
+ * the term.
+ */
+static int
+term_docs(const char *name, size_t len, struct doc_list *dl) {
+	const struct search_term_ent	*ste;
+	const struct search_term	*st;
+	size_t				 i, n = 0;
+
+	for (i = 0; i < nsegs; i++)
+		if ((ste = seg_term_find(&segs[i], name, len)) != NULL)
+			n += ste->ste_ndocs;
+	if ((st = mem_term_get(name, len, 0)) != NULL)
+		n += st->st_ndocs;
+	dl->dl_n = 0;
+	dl->dl_docs = NULL;
+	if (n == 0)
+		return 0;
+	if ((dl->dl_docs = reallocarray(NULL, n, sizeof(uint32_t))) == NULL)
+		err(1, __func__);
+	STATS_ALLOC(n * sizeof(uint32_t));
+
+	for (i = 0; i < nsegs; i++)
+		if ((ste = seg_term_find(&segs[i], name, len)) != NULL)
+			decode_postings(dl, n,
+			    segs[i].is_postings + ste->ste_postings,
+			    ste->ste_postlen);
+	if (st != NULL)
+		decode_postings(dl, n, st->st_post, st->st_len);
+	return 1;
+}
+
+/*
+ * Returns the segment holding the saved document given.
+ */
+static const struct index_seg *
+doc_seg(uint32_t doc) {
+	size_t	 lo = 0, hi = nsegs, mid;
+
+	while (hi - lo > 1) {
+		mid = lo + (hi - lo) / 2;
+		if (segs[mid].is_base <= doc)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return &segs[lo];
+}
+
+static uint64_t
+doc_pos(uint32_t doc) {
+	const struct index_seg	*is;
+
+	if (doc >= seg_ndocs)
+		return mem_docpos[doc - seg_ndocs];
+	is = doc_seg(doc);
+	return is->is_docpos[doc - is->is_base];
+}
+
+static uint32_t
+doc_time(uint32_t doc) {
+	const struct index_seg	*is;
+
+	if (doc >= seg_ndocs)
+		return mem_doctime[doc - seg_ndocs];
+	is = doc_seg(doc);
+	return is->is_doctime[doc - is->is_base];
+}
+
+/*
+ * Prints the line found.  The log is kept open in lr, for the next
+ * result is likely to be in the same one.
+ */
+static void
+print_result(uint32_t doc, struct log_reader *lr, size_t *lrfile) {
+	const struct search_file	*sf;
+	struct line_buf			 lb;
+	char				 path[PATH_MAX], buf[RESULT_LINE_MAX];
+	const char			*nl;
+	uint64_t			 pos;
+	size_t				 len;
+	ssize_t				 n;
+
+	pos = doc_pos(doc);
+	sf = &files[DOC_FILE(pos)];
+	if (*lrfile != DOC_FILE(pos)) {
+		log_reader_close(lr);
+		*lrfile = SIZE_MAX;
+		if (!log_path(path, sf->sf_name) ||
+		    log_reader_open(lr, path) == -1)
+			return;
+		*lrfile = DOC_FILE(pos);
+	}
+	n = log_reader_pread(lr, buf, sizeof(buf), DOC_OFFSET(pos));
+	if (n <= 0)
+		return;
+	len = (nl = memchr(buf, '\n', (size_t)n)) ? (size_t)(nl - buf) :
+	    (size_t)n;
+
+	if (json_output) {
+		const struct json_field	 fields[] = {
+			JSON_STR("type", "search"),
+			JSON_STRN("log", sf->sf_name, log_name_len(sf->sf_name)),
+			JSON_STRN("text", buf, len),
+		};
+		push_stdout_json(fields, sizeof(fields) / sizeof(fields[0]));
+		return;
+	}
+
+	lb_init(&lb);
+	lb_untrusted(&lb, sf->sf_name, log_name_len(sf->sf_name));
+	lb_raw(&lb, ": ", 2);
+	lb_untrusted(&lb, buf, len);
+	if (nl == NULL)
+		lb_raw(&lb, "...", 3);
+	lb_raw(&lb, "\n", 1);
+	lb_commit(&lb);
+}
+
+/*
+ * Shows the most recent history lines containing all the words given,
+ * oldest first, so the newest one ends up right above the prompt.
+ */
+void
+search_history(const char *args) {
+	struct doc_list	 lists[SEARCH_TERMS], tmp;
+	struct log_reader lr = { -1, NULL, 0 };
+	char		 terms[SEARCH_TERMS][TERM_MAX];
+	size_t		 lens[SEARCH_TERMS];
+	uint32_t	 best[SEARCH_RESULTS_MAX], doc, t;
+	const char	*p, *end;
+	size_t		 i, j, k, n, nterms = 0, nbest = 0, nmatches = 0;
+	size_t		 lrfile = SIZE_MAX, pending = 0;
+
+	if (!enable_history) {
+		push_stdout("%s: history saving is disabled, nothing to "
+		    "search in\n", getprogname());
+		return;
+	}
+	if (args == NULL) {
+		push_stdout("usage: /search word ...\n");
+		return;
+	}
+
+	for (p = args, end = args + strlen(args); nterms < SEARCH_TERMS &&
+	    (n = next_term(&p, end, terms[nterms])) != 0;) {
+		for (i = 0; i < nterms; i++)
+			if (lens[i] == n && memcmp(terms[i], terms[nterms],
+			    n) == 0)
+				break;
+		if (i == nterms)
+			lens[nterms++] = n;
+	}
+	if (nterms == 0) {
+		push_stdout("%s: words to search for should be at least %d "
+		    "characters long\n", getprogname(), TERM_MIN);
+		return;
+	}
+
+	if (!loaded) {
+		load_index();
+		atexit(save_index_at_exit);
+		loaded = 1;
+		merge_start();
+	}
+	rescan();
+	catch_up(SEARCH_SYNC_MAX);
+
+	for (i = 0; i < nterms; i++)
+		if (!term_docs(terms[i], lens[i], &lists[i]))
+			break;
+	if (i < nterms) {
+		nterms = i + 1;
+		goto done;
+	}
+
+	// intersect, starting from the shortest list
+	for (i = 1; i < nterms; i++)
+		for (j = i; j > 0 && lists[j].dl_n < lists[j - 1].dl_n; j--) {
+			tmp = lists[j];
+			lists[j] = lists[j - 1];
+			lists[j - 1] = tmp;
+		}
+	for (i = 1; i < nterms; i++) {
+		for (j = k = n = 0; j < lists[0].dl_n && k < lists[i].dl_n;) {
+			if (lists[0].dl_docs[j] < lists[i].dl_docs[k])
+				j++;
+			else if (lists[0].dl_docs[j] > lists[i].dl_docs[k])
+				k++;
+			else {
+				lists[0].dl_docs[n++] = lists[0].dl_docs[j];
+				j++;
+				k++;
+			}
+		}
+		lists[0].dl_n = n;
+	}
+
+	// pick the most recent ones, keeping 'best' sorted by time
+	for (i = 0; i < lists[0].dl_n; i++) {
+		doc = lists[0].dl_docs[i];
+		if (doc >= seg_ndocs + mem_ndocs ||
+		    files[DOC_FILE(doc_pos(doc))].sf_flags & SF_DEAD)
+			continue;
+		nmatches++;
+		t = doc_time(doc);
+		if (nbest == SEARCH_RESULTS_MAX) {
+			// documents go in order, so later wins on equal times
+			if (t < doc_time(best[0]))
+				continue;
+			memmove(best, best + 1, --nbest * sizeof(best[0]));
+		}
+		for (j = nbest; j > 0 && doc_time(best[j - 1]) > t; j--)
+			best[j] = best[j - 1];
+		best[j] = doc;
+		nbest++;
+	}
+
+done:
+	if (nmatches > nbest)
+		push_stdout("%s: %zu matches found, showing the last %zu\n",
+		    getprogname(), nmatches, nbest);
+	else
+		push_stdout("%s: %zu matches found\n", getprogname(), nmatches);
+	for (i = 0; i < nbest; i++)
+		print_result(best[i], &lr, &lrfile);
+	log_reader_close(&lr);
+	for (i = 0; i < nterms; i++)
+		free(lists[i].dl_docs);
+
+	for (i = 0; i < nfiles; i++)
+		if ((files[i].sf_flags & (SF_PENDING|SF_DEAD)) == SF_PENDING)
+			pending++;
+	if (pending)
+		push_stdout("%s: %zu logs are still being indexed, "
+		    "results may be incomplete\n", getprogname(), pending);
+}
+
+/*
+ * Called after lines were appended to the history file by us.
+ */
+void
+search_history_written(const char *path) {
+	struct stat	 st;
+	const char	*name;
+	size_t		 i;
+
+	if (!loaded || stat(path, &st) == -1)
+		return;
+	name = strrchr(path, '/');
+	name = name ? name + 1 : path;
+	if ((i = file_find(name)) == nfiles) {
+		i = file_add(name);
+		files[i].sf_dev = (uint64_t)st.st_dev;
+		files[i].sf_ino = (uint64_t)st.st_ino;
+	} else if (!file_is(&files[i], &st))
+		i = file_replace(i, &st);
+	files[i].sf_flags |= SF_PENDING;
+}
+
+/*
+ * Called after the log was renamed by us: on rotation, and when it got
+ * replaced by compressed version.  Offsets in text stay the same, so
+ * the documents indexed already are kept.
+ */
+void
+search_history_renamed(const char *oldpath, const char *newpath) {
+	struct stat	 st;
+	const char	*oldname, *newname;
+	char		*name;
+	size_t		 i;
+	int		 complete;
+
+	if (!loaded)
+		return;
+	oldname = strrchr(oldpath, '/');
+	oldname = oldname ? oldname + 1 : oldpath;
+	newname = strrchr(newpath, '/');
+	newname = newname ? newname + 1 : newpath;
+	if ((i = file_find(oldname)) == nfiles)
+		return;
+
+	// the original is still there when compression is finished
+	if (stat(log_is_compressed(newname) ? oldpath : newpath, &st) == -1 ||
+	    !file_is(&files[i], &st)) {
+		// not the file indexed, rescan() will sort things out
+		file_kill(i);
+		return;
+	}
+	complete = log_is_compressed(newname) &&
+	    !(files[i].sf_flags & SF_LONGLINE) &&
+	    (uint64_t)st.st_size == files[i].sf_indexed;
+	if ((log_is_compressed(newname) && stat(newpath, &st) == -1) ||
+	    (name = strdup(newname)) == NULL) {
+		warn(__func__);
+		file_kill(i);
+		return;
+	}
+	STATS_ALLOC(strlen(name) + 1);
+	if (idx_file == i)
+		index_file_close();
+	free(files[i].sf_name);
+	files[i].sf_name = name;
+	files[i].sf_dev = (uint64_t)st.st_dev;
+	files[i].sf_ino = (uint64_t)st.st_ino;
+	if (complete) {
+		files[i].sf_flags |= SF_COMPLETE;
+		files[i].sf_flags &= ~SF_PENDING;
+	}
+	dirty = 1;
+}
+
+/*
+ * Returns non-zero if there are logs waiting to be indexed.
+ */
+int
+search_pending(void) {
+	size_t	 i;
+
+	if (!loaded)
+		return 0;
+	for (i = 0; i < nfiles; i++)
+		if ((files[i].sf_flags & (SF_PENDING|SF_DEAD)) == SF_PENDING)
+			return 1;
+	return 0;
+}
+
+/*
+ * Indexes a chunk of pending logs; to be called from the main loop.
+ */
+void
+search_proceed(void) {
+	if (!loaded)
+		return;
+	catch_up(SEARCH_CHUNK);
+	if (merge_job != NULL)
+		merge_finish();
+	if (mem_bytes > SEARCH_MEM_MAX && save_index() == 0)
+		merge_start();
+}
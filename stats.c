@@ -0,0 +1,210 @@
+/*
+ * Copyright (c) 2026 Vadim Zhukov <zhuk@openbsd.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/types.h>
+#include <ctype.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "oicb.h"
+#include "history.h"
+#include "stats.h"
+
+
+static unsigned int	 hist_bucket(uint64_t v);
+static uint64_t		 hist_bucket_max(unsigned int idx);
+static void	 push_queue_stats(const char *name, const struct queue_stats *qs);
+static void	 format_msg_counts(char *buf, size_t bufsz,
+		                   const uint64_t *counts);
+
+struct icb_stats	 stats;
+
+
+/*
+ * Monotonic time in microseconds, for measuring intervals.
+ */
+uint64_t
+now_usec(void) {
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+static unsigned int
+hist_bucket(uint64_t v) {
+	unsigned int	 e;
+
+	if (v < HIST_SUBBUCKETS)
+		return (unsigned int)v;
+	for (e = 0; (v >> e) >= 2 * HIST_SUBBUCKETS; e++)
+		;
+	// now HIST_SUBBUCKETS <= (v >> e) < 2 * HIST_SUBBUCKETS
+	return (e + 1) * HIST_SUBBUCKETS +
+	    (unsigned int)(v >> e) - HIST_SUBBUCKETS;
+}
+
+/*
+ * Returns the largest value falling into the given bucket.
+ */
+static uint64_t
+hist_bucket_max(unsigned int idx) {
+	unsigned int	 e;
+
+	if (idx < HIST_SUBBUCKETS)
+		return idx;
+	e = idx / HIST_SUBBUCKETS - 1;
+	return ((uint64_t)(idx % HIST_SUBBUCKETS + HIST_SUBBUCKETS + 1) << e) - 1;
+}
+
+void
+hist_add(struct histogram *h, uint64_t v) {
+	h->h_count++;
+	h->h_sum += v;
+	if (v > h->h_max)
+		h->h_max = v;
+	h->h_buckets[hist_bucket(v)]++;
+}
+
+/*
+ * Returns approximate value below which the given fraction of samples lie.
+ * The result never exceeds the maximum value seen.
+ */
+uint64_t
+hist_quantile(const struct histogram *h, double q) {
+	uint64_t	 rank, seen = 0, v;
+	unsigned int	 i;
+
+	if (h->h_count == 0)
+		return 0;
+	rank = (uint64_t)(q * (double)h->h_count);
+	if (rank >= h->h_count)
+		rank = h->h_count - 1;
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		seen += h->h_buckets[i];
+		if (seen > rank)
+			break;
+	}
+	v = hist_bucket_max(i);
+	return v < h->h_max ? v : h->h_max;
+}
+
+
+void
+queue_stats_add(struct queue_stats *qs, size_t len) {
+	qs->qs_len++;
+	qs->qs_bytes += len;
+	if (qs->qs_len > qs->qs_maxlen)
+		qs->qs_maxlen = qs->qs_len;
+	if (qs->qs_bytes > qs->qs_maxbytes)
+		qs->qs_maxbytes = qs->qs_bytes;
+}
+
+void
+queue_stats_remove(struct queue_stats *qs, size_t len) {
+	qs->qs_len--;
+	qs->qs_bytes -= len;
+}
+
+static void
+push_queue_stats(const char *name, const struct queue_stats *qs) {
+	push_stdout("%s: %-24s %6zu tasks %9zu bytes, max %6zu tasks"
+	    " %9zu bytes, written %llu bytes\n", getprogname(), name,
+	    qs->qs_len, qs->qs_bytes, qs->qs_maxlen, qs->qs_maxbytes,
+	    (unsigned long long)qs->qs_written);
+}
+
+/*
+ * Formats "type:count" list for all message types seen.
+ */
+static void
+format_msg_counts(char *buf, size_t bufsz, const uint64_t *counts) {
+	size_t	 len = 0;
+	int	 i, n;
+
+	buf[0] = '\0';
+	for (i = 0; i < 256 && len < bufsz; i++) {
+		if (counts[i] == 0)
+			continue;
+		n = snprintf(buf + len, bufsz - len,
+		    isprint(i) ? "%s%c:%llu" : "%s\\%03o:%llu",
+		    len ? " " : "", i, (unsigned long long)counts[i]);
+		if (n < 0)
+			break;
+		len += (size_t)n;
+	}
+}
+
+/*
+ * Queue statistics report to be displayed.
+ */
+void
+push_stats(void) {
+	const struct history_file	*hf;
+	const char			*name;
+	char				 types[256 * 8];
+	uint64_t			 nmsgs;
+	time_t				 uptime;
+	int				 i;
+
+	uptime = time(NULL) - stats.st_start;
+	push_stdout("%s: up %lld:%02d:%02d, %llu poll wakeups,"
+	    " %llu reads (%llu EAGAIN), %llu writes (%llu EAGAIN)\n",
+	    getprogname(), (long long)uptime / 3600,
+	    (int)(uptime / 60 % 60), (int)(uptime % 60),
+	    (unsigned long long)stats.st_poll_wakeups,
+	    (unsigned long long)stats.st_reads,
+	    (unsigned long long)stats.st_read_eagain,
+	    (unsigned long long)stats.st_writes,
+	    (unsigned long long)stats.st_write_eagain);
+
+	for (nmsgs = 0, i = 0; i < 256; i++)
+		nmsgs += stats.st_msgs_in[i];
+	format_msg_counts(types, sizeof(types), stats.st_msgs_in);
+	push_stdout("%s: in:  %llu bytes, %llu packets, %llu messages (%s)\n",
+	    getprogname(), (unsigned long long)stats.st_bytes_in,
+	    (unsigned long long)stats.st_pkts_in,
+	    (unsigned long long)nmsgs, types);
+	if (stats.st_msgs_truncated)
+		push_stdout("%s: in:  %llu messages truncated\n", getprogname(),
+		    (unsigned long long)stats.st_msgs_truncated);
+
+	for (nmsgs = 0, i = 0; i < 256; i++)
+		nmsgs += stats.st_msgs_out[i];
+	format_msg_counts(types, sizeof(types), stats.st_msgs_out);
+	push_stdout("%s: out: %llu bytes, %llu packets, %llu messages (%s)\n",
+	    getprogname(), (unsigned long long)stats.st_net.qs_written,
+	    (unsigned long long)stats.st_pkts_out,
+	    (unsigned long long)nmsgs, types);
+
+	push_stdout("%s: %llu allocations, %llu bytes\n", getprogname(),
+	    (unsigned long long)stats.st_allocs,
+	    (unsigned long long)stats.st_alloc_bytes);
+
+	push_queue_stats("network queue", &stats.st_net);
+	push_queue_stats("output queue", &stats.st_stdout);
+	push_queue_stats("history queues", &stats.st_history);
+	LIST_FOREACH(hf, &history_files, hf_entry) {
+		if ((name = strrchr(hf->hf_path, '/')) != NULL)
+			name++;
+		else
+			name = hf->hf_path;
+		push_queue_stats(name, &hf->hf_qstats);
+	}
+}
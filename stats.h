@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2026 Vadim Zhukov <zhuk@openbsd.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef OICB_STATS_H
+#define OICB_STATS_H
+
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * Log-linear histogram: each power of two range is split into
+ * HIST_SUBBUCKETS equal parts, so the relative error is bounded.
+ */
+#define HIST_SUBBUCKETS	4
+#define HIST_BUCKETS	(64 * HIST_SUBBUCKETS)
+
+struct histogram {
+	uint64_t	 h_count;
+	uint64_t	 h_sum;
+	uint64_t	 h_max;
+	uint64_t	 h_buckets[HIST_BUCKETS];
+};
+
+struct queue_stats {
+	size_t		 qs_len;	// tasks queued now
+	size_t		 qs_maxlen;	// high-water mark of the above
+	size_t		 qs_bytes;	// bytes queued now
+	size_t		 qs_maxbytes;	// high-water mark of the above
+	uint64_t	 qs_written;	// bytes written out, total
+};
+
+struct icb_stats {
+	time_t		 st_start;
+	uint64_t	 st_bytes_in;
+	uint64_t	 st_pkts_in, st_pkts_out;
+	uint64_t	 st_msgs_in[256], st_msgs_out[256];	// by ICB type
+	uint64_t	 st_msgs_truncated;	// longer than max_msg_size
+	uint64_t	 st_poll_wakeups;
+	uint64_t	 st_reads, st_read_eagain;
+	uint64_t	 st_writes, st_write_eagain;
+	uint64_t	 st_allocs, st_alloc_bytes;
+
+	struct queue_stats	 st_net;
+	struct queue_stats	 st_stdout;
+	struct queue_stats	 st_history;	// all history files together
+};
+extern struct icb_stats	 stats;
+
+#define STATS_ALLOC(sz)	do {				\
+		stats.st_allocs++;			\
+		stats.st_alloc_bytes += (sz);		\
+	} while (0)
+
+uint64_t	 now_usec(void);
+
+void		 hist_add(struct histogram *h, uint64_t v);
+uint64_t	 hist_quantile(const struct histogram *h, double q);
+
+void	 queue_stats_add(struct queue_stats *qs, size_t len);
+void	 queue_stats_remove(struct queue_stats *qs, size_t len);
+void	 push_stats(void);
+
+#endif // OICB_STATS_H
@@ -0,0 +1,748 @@
+/*
+ * Copyright (c) 2026 Vadim Zhukov <zhuk@openbsd.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Simulated ICB server, for testing and benchmarking oicb without
+ * having icbd installed.
+ *
+ * It implements just enough of the protocol for oicb: login, open,
+ * private and status messages, /who, /g, ping-pong and extended packets.
+ * Besides that, it can flood clients with messages from simulated users.
+ *
+ * Deliberately doesn't depend on libbsd or anything else from oicb.
+ */
+
+#include <sys/types.h>
+#include <sys/queue.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <netdb.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define NICKNAME_MAX	64
+#define GROUP_MAX	64
+#define MSG_MAX		(1024*1024)	// same as oicb default limit
+#define FLOOD_SIZE_MAX	(64*1024*1024)	// to test the above
+#define OUTBUF_HIWAT	(256*1024)	// pause flooding above this
+
+struct client {
+	TAILQ_ENTRY(client)	 c_entry;
+	int			 c_fd;
+	int			 c_loggedin;
+	char			 c_nick[NICKNAME_MAX];
+	char			 c_group[GROUP_MAX];
+	char			 c_addr[64];
+	time_t			 c_signon;
+	time_t			 c_lastmsg;
+
+	unsigned char		*c_in;
+	size_t			 c_inlen, c_insize;
+	unsigned char		*c_out;
+	size_t			 c_outlen, c_outsize, c_outoff;
+};
+TAILQ_HEAD(client_list, client);
+
+static void	 usage(void);
+static void	 add_client(int lsock);
+static void	 drop_client(struct client *c);
+static void	 read_client(struct client *c);
+static void	 write_client(struct client *c);
+static int	 next_msg(struct client *c, char *type, char *msg, size_t *len);
+static void	 handle_msg(struct client *c, char type, char *msg, size_t len);
+static void	 handle_login(struct client *c, char *msg);
+static void	 handle_cmd(struct client *c, char *msg);
+static void	 send_msg(struct client *c, char type, const char *data,
+	                  size_t len);
+static void	 sendf(struct client *c, char type, const char *fmt, ...)
+	__attribute__((__format__ (printf, 3, 4)));
+static void	 group_sendf(const char *group, const struct client *except,
+	                     char type, const char *fmt, ...)
+	__attribute__((__format__ (printf, 4, 5)));
+static struct client	*find_client(const char *nick);
+static void	 who(struct client *c);
+static int	 flood(void);
+static uint64_t	 now_usec(void);
+static void	 on_signal(int sig);
+
+static struct client_list	 clients = TAILQ_HEAD_INITIALIZER(clients);
+static size_t			 nclients, nloggedin;
+static int			 debug;
+static int			 use_extpkt;
+static int			 no_ping;
+static const char		*srvid = "icbsim";
+
+// flooding parameters and state
+static double			 flood_rate;	// msgs/sec, 0 means "max"
+static unsigned long long	 flood_count;	// 0 means "no flood"
+static unsigned long long	 flood_sent;
+static size_t			 flood_size = 64;
+static unsigned int		 flood_users = 10;
+static uint64_t			 flood_start;
+
+static unsigned long long	 nmsgs_in, nmsgs_out, nbytes_in, nbytes_out;
+static volatile sig_atomic_t	 want_exit;
+
+
+static void
+usage(void) {
+	fprintf(stderr, "usage: icbsim [-DdPx] [-f rate] [-n count]"
+	    " [-s size] [-S srvid] [-u users] [addr:]port\n");
+	exit(1);
+}
+
+static uint64_t
+now_usec(void) {
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+static void
+on_signal(int sig) {
+	(void)sig;
+	want_exit = 1;
+}
+
+static void
+add_client(int lsock) {
+	struct sockaddr_storage	 ss;
+	socklen_t		 sslen = sizeof(ss);
+	struct client		*c;
+	int			 fd, one = 1;
+
+	if ((fd = accept(lsock, (struct sockaddr *)&ss, &sslen)) == -1) {
+		if (errno != EAGAIN && errno != EINTR)
+			warn("accept");
+		return;
+	}
+	if (fcntl(fd, F_SETFL, O_NONBLOCK) == -1)
+		err(1, "fcntl");
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	if ((c = calloc(1, sizeof(*c))) == NULL)
+		err(1, __func__);
+	c->c_fd = fd;
+	if (getnameinfo((struct sockaddr *)&ss, sslen, c->c_addr,
+	    sizeof(c->c_addr), NULL, 0, NI_NUMERICHOST) != 0)
+		strcpy(c->c_addr, "unknown");
+	TAILQ_INSERT_TAIL(&clients, c, c_entry);
+	nclients++;
+	if (debug)
+		warnx("client %d connected from %s", fd, c->c_addr);
+
+	if (use_extpkt)
+		sendf(c, 'j', "1\001localhost\001%s ExtPkt", srvid);
+	else
+		sendf(c, 'j', "1\001localhost\001%s", srvid);
+}
+
+static void
+drop_client(struct client *c) {
+	if (debug)
+		warnx("client %d (%s) disconnected", c->c_fd, c->c_nick);
+	TAILQ_REMOVE(&clients, c, c_entry);
+	nclients--;
+	close(c->c_fd);
+	if (c->c_loggedin) {
+		nloggedin--;
+		group_sendf(c->c_group, NULL, 'd', "Depart\001%s (%s@%s) just left",
+		    c->c_nick, c->c_nick, c->c_addr);
+	}
+	free(c->c_in);
+	free(c->c_out);
+	free(c);
+}
+
+/*
+ * Queue message for the client, splitting it into extended packets if
+ * needed and enabled, or truncating it otherwise, like real servers do.
+ */
+static void
+send_msg(struct client *c, char type, const char *data, size_t len) {
+	size_t		 need, chunk;
+	unsigned char	*p, *nbuf;
+
+	if (!use_extpkt && len > 253)
+		len = 253;
+	need = (len + 1) / 254 * 256 + 257;
+	if (c->c_outlen + need > c->c_outsize) {
+		if (c->c_outoff) {
+			memmove(c->c_out, c->c_out + c->c_outoff,
+			    c->c_outlen - c->c_outoff);
+			c->c_outlen -= c->c_outoff;
+			c->c_outoff = 0;
+		}
+		while (c->c_outlen + need > c->c_outsize) {
+			c->c_outsize = c->c_outsize ? c->c_outsize * 2 : 4096;
+			if ((nbuf = realloc(c->c_out, c->c_outsize)) == NULL)
+				err(1, __func__);
+			c->c_out = nbuf;
+		}
+	}
+
+	p = c->c_out + c->c_outlen;
+	// every full extended packet carries 254 bytes of data
+	while (len + 1 > 254) {
+		*p++ = 0;
+		*p++ = (unsigned char)type;
+		memcpy(p, data, 254);
+		p += 254;
+		data += 254;
+		len -= 254;
+	}
+	chunk = len + 2;	// type and NUL
+	*p++ = (unsigned char)chunk;
+	*p++ = (unsigned char)type;
+	memcpy(p, data, len);
+	p += len;
+	*p++ = '\0';
+	c->c_outlen = (size_t)(p - c->c_out);
+	nmsgs_out++;
+}
+
+static void
+sendf(struct client *c, char type, const char *fmt, ...) {
+	static char	*buf;
+	static size_t	 bufsize;
+	va_list		 ap;
+	int		 len;
+	char		*nbuf;
+
+	va_start(ap, fmt);
+	len = vsnprintf(buf, bufsize, fmt, ap);
+	va_end(ap);
+	if (len < 0)
+		err(1, "vsnprintf");
+	if ((size_t)len >= bufsize) {
+		if ((nbuf = realloc(buf, (size_t)len + 1)) == NULL)
+			err(1, __func__);
+		buf = nbuf;
+		bufsize = (size_t)len + 1;
+		va_start(ap, fmt);
+		vsnprintf(buf, bufsize, fmt, ap);
+		va_end(ap);
+	}
+	send_msg(c, type, buf, (size_t)len);
+}
+
+static void
+group_sendf(const char *group, const struct client *except, char type,
+    const char *fmt, ...) {
+	struct client	*c;
+	va_list		 ap;
+	char		 buf[1024];
+	int		 len;
+
+	va_start(ap, fmt);
+	len = vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+	if (len < 0)
+		err(1, "vsnprintf");
+	if ((size_t)len >= sizeof(buf))
+		len = sizeof(buf) - 1;
+	TAILQ_FOREACH(c, &clients, c_entry)
+		if (c != except && c->c_loggedin &&
+		    strcmp(c->c_group, group) == 0)
+			send_msg(c, type, buf, (size_t)len);
+}
+
+static struct client *
+find_client(const char *nick) {
+	struct client	*c;
+
+	TAILQ_FOREACH(c, &clients, c_entry)
+		if (c->c_loggedin && strcmp(c->c_nick, nick) == 0)
+			return c;
+	return NULL;
+}
+
+static void
+read_client(struct client *c) {
+	unsigned char	*nbuf;
+	ssize_t		 n;
+	size_t		 len;
+	char		*msg;
+	char		 type;
+
+	for (;;) {
+		if (c->c_insize - c->c_inlen < 4096) {
+			if (c->c_insize >= MSG_MAX * 2) {
+				warnx("client %d: message too long", c->c_fd);
+				drop_client(c);
+				return;
+			}
+			c->c_insize = c->c_insize ? c->c_insize * 2 : 8192;
+			if ((nbuf = realloc(c->c_in, c->c_insize)) == NULL)
+				err(1, __func__);
+			c->c_in = nbuf;
+		}
+		n = read(c->c_fd, c->c_in + c->c_inlen,
+		    c->c_insize - c->c_inlen);
+		if (n == -1) {
+			if (errno == EAGAIN || errno == EINTR)
+				break;
+			warn("client %d: read", c->c_fd);
+			drop_client(c);
+			return;
+		} else if (n == 0) {
+			drop_client(c);
+			return;
+		}
+		c->c_inlen += (size_t)n;
+		nbytes_in += (size_t)n;
+	}
+
+	if ((msg = malloc(c->c_inlen + 1)) == NULL)
+		err(1, __func__);
+	while (next_msg(c, &type, msg, &len)) {
+		nmsgs_in++;
+		handle_msg(c, type, msg, len);
+	}
+	free(msg);
+}
+
+/*
+ * Extract next complete message from client input buffer, reassembling
+ * extended packets.  The 'msg' is NUL-terminated on return.
+ */
+static int
+next_msg(struct client *c, char *type, char *msg, size_t *len) {
+	size_t	 off = 0, pktlen;
+
+	*len = 0;
+	for (;;) {
+		if (off >= c->c_inlen)
+			return 0;
+		pktlen = c->c_in[off] ? c->c_in[off] : 255;
+		if (off + 1 + pktlen > c->c_inlen)
+			return 0;
+		*type = (char)c->c_in[off + 1];
+		memcpy(msg + *len, c->c_in + off + 2, pktlen - 1);
+		*len += pktlen - 1;
+		off += 1 + pktlen;
+		if (c->c_in[off - 1 - pktlen] != 0)
+			break;
+	}
+	memmove(c->c_in, c->c_in + off, c->c_inlen - off);
+	c->c_inlen -= off;
+
+	// trailing NUL is optional in ICB
+	if (*len > 0 && msg[*len - 1] == '\0')
+		(*len)--;
+	msg[*len] = '\0';
+	return 1;
+}
+
+static void
+write_client(struct client *c) {
+	ssize_t	n;
+
+	while (c->c_outoff < c->c_outlen) {
+		n = write(c->c_fd, c->c_out + c->c_outoff,
+		    c->c_outlen - c->c_outoff);
+		if (n == -1) {
+			if (errno == EAGAIN || errno == EINTR)
+				return;
+			warn("client %d: write", c->c_fd);
+			drop_client(c);
+			return;
+		}
+		c->c_outoff += (size_t)n;
+		nbytes_out += (size_t)n;
+	}
+	c->c_outoff = c->c_outlen = 0;
+}
+
+static void
+handle_login(struct client *c, char *msg) {
+	char	*fields[5] = { NULL }, *p;
+	int	 i;
+
+	for (i = 0, p = msg; i < 5 && p != NULL; i++) {
+		fields[i] = p;
+		if ((p = strchr(p, '\001')) != NULL)
+			*p++ = '\0';
+	}
+	if (fields[1] == NULL || *fields[1] == '\0' ||
+	    strlen(fields[1]) >= NICKNAME_MAX) {
+		sendf(c, 'e', "Invalid nickname");
+		sendf(c, 'g', "%s", "");
+		return;
+	}
+	if (find_client(fields[1]) != NULL) {
+		sendf(c, 'e', "Nickname already in use");
+		sendf(c, 'g', "%s", "");
+		return;
+	}
+	snprintf(c->c_nick, sizeof(c->c_nick), "%s", fields[1]);
+	snprintf(c->c_group, sizeof(c->c_group), "%s",
+	    (fields[2] && *fields[2]) ? fields[2] : "1");
+	c->c_loggedin = 1;
+	nloggedin++;
+	c->c_signon = c->c_lastmsg = time(NULL);
+
+	sendf(c, 'a', "%s", "");
+	sendf(c, 'd', "Status\001You are now in group %s", c->c_group);
+	group_sendf(c->c_group, c, 'd', "Arrive\001%s (%s@%s) entered group",
+	    c->c_nick, c->c_nick, c->c_addr);
+}
+
+static void
+who(struct client *c) {
+	struct client	*o;
+	time_t		 t;
+	unsigned int	 i;
+
+	t = time(NULL);
+	sendf(c, 'i', "co\001 ");
+	sendf(c, 'i', "co\001Group: %s", c->c_group);
+	TAILQ_FOREACH(o, &clients, c_entry) {
+		if (!o->c_loggedin)
+			continue;
+		sendf(c, 'i', "wl\001 \001%s\001%lld\0010\001%lld\001%s\001%s",
+		    o->c_nick, (long long)(t - o->c_lastmsg),
+		    (long long)o->c_signon, o->c_nick, o->c_addr);
+	}
+	if (flood_count)
+		for (i = 0; i < flood_users; i++)
+			sendf(c, 'i', "wl\001 \001sim%u\0010\0010\001%lld\001sim\001localhost",
+			    i, (long long)c->c_signon);
+	sendf(c, 'i', "co\001Total: %zu users", nclients +
+	    (flood_count ? flood_users : 0));
+}
+
+static void
+handle_cmd(struct client *c, char *msg) {
+	struct client	*peer;
+	char		*args, *text;
+
+	if ((args = strchr(msg, '\001')) != NULL)
+		*args++ = '\0';
+	else
+		args = "";
+
+	if (strcmp(msg, "m") == 0 || strcmp(msg, "msg") == 0) {
+		if ((text = strchr(args, ' ')) != NULL)
+			*text++ = '\0';
+		else
+			text = "";
+		if ((peer = find_client(args)) == NULL) {
+			sendf(c, 'e', "No such user %s", args);
+			return;
+		}
+		sendf(peer, 'c', "%s\001%s", c->c_nick, text);
+	} else if (strcmp(msg, "w") == 0) {
+		who(c);
+	} else if (strcmp(msg, "g") == 0) {
+		if (*args == '\0' || strlen(args) >= GROUP_MAX) {
+			sendf(c, 'e', "Invalid group name");
+			return;
+		}
+		group_sendf(c->c_group, c, 'd', "Depart\001%s (%s@%s) just left",
+		    c->c_nick, c->c_nick, c->c_addr);
+		snprintf(c->c_group, sizeof(c->c_group), "%s", args);
+		sendf(c, 'd', "Status\001You are now in group %s", c->c_group);
+		group_sendf(c->c_group, c, 'd', "Arrive\001%s (%s@%s) entered group",
+		    c->c_nick, c->c_nick, c->c_addr);
+	} else
+		sendf(c, 'e', "Unknown command %s", msg);
+}
+
+static void
+handle_msg(struct client *c, char type, char *msg, size_t len) {
+	struct client	*o;
+	char		*fwd;
+
+	if (debug >= 2)
+		warnx("client %d: got '%c' message, %zu bytes", c->c_fd, type,
+		    len);
+	if (!c->c_loggedin && type != 'a' && type != 'l' && type != 'n') {
+		sendf(c, 'e', "Login first");
+		return;
+	}
+	c->c_lastmsg = time(NULL);
+
+	switch (type) {
+	case 'a':
+		if (c->c_loggedin)
+			sendf(c, 'e', "Already logged in");
+		else
+			handle_login(c, msg);
+		break;
+
+	case 'b':
+		// can't use group_sendf(), message might be big
+		if ((fwd = malloc(strlen(c->c_nick) + 1 + len + 1)) == NULL)
+			err(1, __func__);
+		len = (size_t)sprintf(fwd, "%s\001%s", c->c_nick, msg);
+		TAILQ_FOREACH(o, &clients, c_entry)
+			if (o != c && o->c_loggedin &&
+			    strcmp(o->c_group, c->c_group) == 0)
+				send_msg(o, 'b', fwd, len);
+		free(fwd);
+		break;
+
+	case 'h':
+		handle_cmd(c, msg);
+		break;
+
+	case 'l':
+		if (no_ping)
+			sendf(c, 'e', "Undefined message type 108");
+		else
+			send_msg(c, 'm', msg, len);
+		break;
+
+	case 'm':
+	case 'n':
+		break;
+
+	default:
+		sendf(c, 'e', "Undefined message type %d", (int)type);
+	}
+}
+
+/*
+ * Generate flood messages due to the current time.
+ * Returns number of microseconds till the next message should be sent,
+ * or -1 if flooding is finished (or not enabled).
+ */
+static int
+flood(void) {
+	static char		*text;
+	struct client		*c;
+	unsigned long long	 due;
+	uint64_t		 elapsed;
+	size_t			 len, i;
+	int			 blocked;
+
+	if (flood_sent >= flood_count)
+		return -1;
+	if (text == NULL) {
+		static const char	 words[] = "lorem ipsum dolor sit amet, ";
+
+		if ((text = malloc(NICKNAME_MAX + flood_size + 2)) == NULL)
+			err(1, __func__);
+		flood_start = now_usec();
+		for (i = 0; i < flood_size; i++)
+			text[NICKNAME_MAX + 1 + i] = words[i % (sizeof(words) - 1)];
+	}
+
+	elapsed = now_usec() - flood_start;
+	if (flood_rate > 0)
+		due = (unsigned long long)((double)elapsed * flood_rate / 1e6) + 1;
+	else
+		due = flood_sent + 100;
+	if (due > flood_count)
+		due = flood_count;
+
+	while (flood_sent < due) {
+		blocked = 0;
+		TAILQ_FOREACH(c, &clients, c_entry)
+			if (c->c_outlen - c->c_outoff > OUTBUF_HIWAT)
+				blocked = 1;
+		if (blocked)
+			return 1000;
+
+		// nick is put right before text, so we can send it at once
+		len = (size_t)snprintf(text, NICKNAME_MAX + 1, "sim%llu\001",
+		    flood_sent % flood_users);
+		memmove(text + NICKNAME_MAX + 1 - len, text, len);
+		TAILQ_FOREACH(c, &clients, c_entry)
+			if (c->c_loggedin)
+				send_msg(c, 'b', text + NICKNAME_MAX + 1 - len,
+				    len + flood_size);
+		flood_sent++;
+	}
+	if (flood_sent >= flood_count) {
+		if (debug)
+			warnx("flood finished: %llu messages in %.3f s",
+			    flood_sent, (double)(now_usec() - flood_start) / 1e6);
+		return -1;
+	}
+	if (flood_rate > 0)
+		return (int)(1e6 / flood_rate);
+	return 0;
+}
+
+int
+main(int argc, char **argv) {
+	struct addrinfo		 hints, *res;
+	struct client		*c, *next;
+	struct pollfd		*pfd = NULL;
+	size_t			 npfd, i;
+	char			*addr, *port, *ep;
+	int			 ch, lsock, one = 1, detach = 0, timeout, ec;
+
+	while ((ch = getopt(argc, argv, "Ddf:n:Ps:S:u:x")) != -1) {
+		switch (ch) {
+		case 'D':
+			detach = 1;
+			break;
+		case 'd':
+			debug++;
+			break;
+		case 'f':
+			flood_rate = strtod(optarg, &ep);
+			if (*ep || flood_rate < 0)
+				errx(1, "invalid flood rate: %s", optarg);
+			break;
+		case 'n':
+			flood_count = strtoull(optarg, &ep, 10);
+			if (*ep)
+				errx(1, "invalid message count: %s", optarg);
+			break;
+		case 'P':
+			no_ping = 1;
+			break;
+		case 's':
+			flood_size = strtoul(optarg, &ep, 10);
+			if (*ep || flood_size > FLOOD_SIZE_MAX)
+				errx(1, "invalid message size: %s", optarg);
+			break;
+		case 'S':
+			srvid = optarg;
+			break;
+		case 'u':
+			flood_users = (unsigned int)strtoul(optarg, &ep, 10);
+			if (*ep || flood_users == 0)
+				errx(1, "invalid user count: %s", optarg);
+			break;
+		case 'x':
+			use_extpkt = 1;
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (argc != 1)
+		usage();
+	if (!use_extpkt && flood_size > 253 - NICKNAME_MAX)
+		errx(1, "messages longer than %d bytes need -x",
+		    253 - NICKNAME_MAX);
+
+	addr = argv[0];
+	if ((port = strrchr(addr, ':')) != NULL)
+		*port++ = '\0';
+	else {
+		port = addr;
+		addr = "127.0.0.1";
+	}
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = PF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	if ((ec = getaddrinfo(addr, port, &hints, &res)) != 0)
+		errx(1, "%s:%s: %s", addr, port, gai_strerror(ec));
+	if ((lsock = socket(res->ai_family, res->ai_socktype,
+	    res->ai_protocol)) == -1)
+		err(1, "socket");
+	setsockopt(lsock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if (bind(lsock, res->ai_addr, res->ai_addrlen) == -1)
+		err(1, "bind");
+	if (listen(lsock, 16) == -1)
+		err(1, "listen");
+	if (fcntl(lsock, F_SETFL, O_NONBLOCK) == -1)
+		err(1, "fcntl");
+	freeaddrinfo(res);
+
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+
+	// Now we're ready to accept connections, so let the caller continue.
+	if (detach) {
+		pid_t	pid;
+
+		if ((pid = fork()) == -1)
+			err(1, "fork");
+		if (pid != 0) {
+			printf("%ld\n", (long)pid);
+			exit(0);
+		}
+		if (setsid() == -1)
+			err(1, "setsid");
+		if (freopen("/dev/null", "w", stdout) == NULL)
+			err(1, "/dev/null");
+	}
+
+	while (!want_exit) {
+		timeout = nloggedin ? flood() : -1;
+		if (timeout > 0)
+			timeout = (timeout + 999) / 1000;
+
+		npfd = nclients + 1;
+		if ((pfd = realloc(pfd, npfd * sizeof(*pfd))) == NULL)
+			err(1, "realloc");
+		pfd[0].fd = lsock;
+		pfd[0].events = POLLIN;
+		i = 1;
+		TAILQ_FOREACH(c, &clients, c_entry) {
+			pfd[i].fd = c->c_fd;
+			pfd[i].events = POLLIN;
+			if (c->c_outoff < c->c_outlen)
+				pfd[i].events |= POLLOUT;
+			i++;
+		}
+		if (poll(pfd, npfd, timeout) == -1) {
+			if (errno == EINTR)
+				continue;
+			err(1, "poll");
+		}
+		if (pfd[0].revents & POLLIN)
+			add_client(lsock);
+
+		/*
+		 * New clients are added to the tail, and read_client() could
+		 * only drop the client being read, so pfd[] order matches.
+		 */
+		i = 1;
+		for (c = TAILQ_FIRST(&clients); c != NULL && i < npfd; c = next) {
+			next = TAILQ_NEXT(c, c_entry);
+			if (pfd[i].revents & (POLLIN|POLLHUP|POLLERR))
+				read_client(c);
+			i++;
+		}
+		for (c = TAILQ_FIRST(&clients); c != NULL; c = next) {
+			next = TAILQ_NEXT(c, c_entry);
+			if (c->c_outoff < c->c_outlen)
+				write_client(c);
+		}
+	}
+
+	fprintf(stderr, "icbsim: received %llu messages (%llu bytes),"
+	    " sent %llu messages (%llu bytes)\n",
+	    nmsgs_in, nbytes_in, nmsgs_out, nbytes_out);
+	return 0;
+}
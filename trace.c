@@ -0,0 +1,138 @@
+/*
+ * Copyright (c) 2026 Vadim Zhukov <zhuk@openbsd.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Flight recorder: binary trace records are always written to in-memory
+ * ring buffer, costing a clock read and a few stores each.  With -T, the
+ * ring is dumped to the given file on SIGUSR1, on crash and at exit, to
+ * be decoded by oicb-tracedump later.
+ *
+ * Dump file is opened in advance, so dumping needs only pwrite(2) and
+ * is async-signal-safe, and no pledge(2) or unveil(2) changes.  Records
+ * being written when signal arrives are detected by sequence numbers.
+ */
+
+#include <sys/types.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "oicb.h"
+#include "stats.h"
+#include "trace.h"
+
+
+#define TRACE_RECS	4096	// must be power of two
+
+static void	 trace_signal_handler(int sig);
+static void	 trace_dump_signal(int sig);
+
+static struct trace_rec	 trace_ring[TRACE_RECS];
+static atomic_uint_least64_t	 trace_head;
+static int			 trace_fd = -1;
+
+static const int	 crash_signals[] = {
+	SIGABRT, SIGBUS, SIGFPE, SIGILL, SIGSEGV
+};
+
+
+void
+trace_record(enum TraceEvent ev, int64_t a0, int64_t a1, int64_t a2,
+    int64_t a3) {
+	struct trace_rec	*tr;
+	uint64_t		 pos;
+
+	pos = atomic_fetch_add_explicit(&trace_head, 1, memory_order_relaxed);
+	tr = &trace_ring[pos & (TRACE_RECS - 1)];
+	tr->tr_seq = 0;
+	atomic_signal_fence(memory_order_release);
+	tr->tr_usec = now_usec();
+	tr->tr_event = ev;
+	tr->tr_args[0] = a0;
+	tr->tr_args[1] = a1;
+	tr->tr_args[2] = a2;
+	tr->tr_args[3] = a3;
+	atomic_signal_fence(memory_order_release);
+	tr->tr_seq = pos + 1;
+}
+
+static void
+trace_dump_signal(int sig) {
+	struct trace_header	 th;
+	int			 saved_errno;
+
+	if (trace_fd == -1)
+		return;
+	saved_errno = errno;
+	TRACE(TraceDump, sig);
+	memcpy(th.th_magic, TRACE_MAGIC, TRACE_MAGIC_LEN);
+	th.th_recsize = sizeof(struct trace_rec);
+	th.th_nrecs = TRACE_RECS;
+	th.th_head = atomic_load_explicit(&trace_head, memory_order_relaxed);
+	th.th_dump_usec = now_usec();
+	// errors are ignored: nothing to do about them here
+	if (pwrite(trace_fd, &th, sizeof(th), 0) == sizeof(th))
+		(void)pwrite(trace_fd, trace_ring, sizeof(trace_ring),
+		    sizeof(th));
+	errno = saved_errno;
+}
+
+static void
+trace_signal_handler(int sig) {
+	trace_dump_signal(sig);
+	if (sig != SIGUSR1) {
+		// handler was reset to default by SA_RESETHAND
+		raise(sig);
+	}
+}
+
+/*
+ * Dump trace ring buffer now, if enabled.  Suitable for atexit(3).
+ */
+void
+trace_dump(void) {
+	trace_dump_signal(0);
+}
+
+/*
+ * Enable dumping trace to the given file.  Must be called before pledge().
+ */
+void
+trace_start(const char *path) {
+	struct sigaction	 sa;
+	size_t			 i;
+
+	trace_fd = open(path, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0600);
+	if (trace_fd == -1)
+		err(1, "%s", path);
+
+	memset(&sa, 0, sizeof(sa));
+	sigemptyset(&sa.sa_mask);
+	sa.sa_handler = trace_signal_handler;
+	sa.sa_flags = SA_RESTART;
+	if (sigaction(SIGUSR1, &sa, NULL) == -1)
+		err(1, "sigaction(SIGUSR1)");
+	sa.sa_flags = SA_RESETHAND;
+	for (i = 0; i < sizeof(crash_signals) / sizeof(crash_signals[0]); i++)
+		if (sigaction(crash_signals[i], &sa, NULL) == -1)
+			err(1, "sigaction(%d)", crash_signals[i]);
+	atexit(trace_dump);
+}
@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2026 Vadim Zhukov <zhuk@openbsd.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef OICB_TRACE_H
+#define OICB_TRACE_H
+
+#include <stdint.h>
+
+/*
+ * Trace events: identifier, name and up to TRACE_ARGS argument names.
+ * Arguments named "type" are displayed as characters by decoder.
+ * Only append to this list, or old dumps will be decoded wrongly.
+ */
+#define TRACE_EVENTS \
+	TRACE_EVENT(TraceNone,		"none",		NULL, NULL, NULL, NULL) \
+	TRACE_EVENT(TracePollWake,	"poll_wake",	"nready", "timeout", NULL, NULL) \
+	TRACE_EVENT(TraceRead,		"read",		"nread", "buffered", NULL, NULL) \
+	TRACE_EVENT(TraceMsgReceived,	"msg_received",	"type", "len", NULL, NULL) \
+	TRACE_EVENT(TraceMsgQueued,	"msg_queued",	"type", "len", NULL, NULL) \
+	TRACE_EVENT(TraceExtSplit,	"ext_split",	"type", "len", "npkts", "lastlen") \
+	TRACE_EVENT(TraceOutput,	"output",	"fd", "ndone", "len", "nwritten") \
+	TRACE_EVENT(TraceNoPingPong,	"no_ping_pong",	NULL, NULL, NULL, NULL) \
+	TRACE_EVENT(TracePong,		"pong",		"seq", "rtt_usec", NULL, NULL) \
+	TRACE_EVENT(TracePongUnexpected, "pong_unexpected", "seq", "pong_seq", "ping_seq", NULL) \
+	TRACE_EVENT(TraceCmdParsed,	"cmd_parsed",	"namelen", "nicklen", "has_msg", NULL) \
+	TRACE_EVENT(TracePrivCycle,	"priv_cycle",	"forward", "nchats", NULL, NULL) \
+	TRACE_EVENT(TracePrivFound,	"priv_found",	"idx", NULL, NULL, NULL) \
+	TRACE_EVENT(TracePrivAdded,	"priv_added",	"nicklen", "nchats", NULL, NULL) \
+	TRACE_EVENT(TraceHistoryWrite,	"history_write", "fd", "nwritten", NULL, NULL) \
+	TRACE_EVENT(TraceDump,		"dump",		"signal", NULL, NULL, NULL) \
+	TRACE_EVENT(TraceMsgPart,	"msg_part",	"type", "len", "total", NULL) \
+	TRACE_EVENT(TraceMsgTruncated,	"msg_truncated", "type", "len", "dropped", NULL)
+
+#define TRACE_EVENT(id, name, a0, a1, a2, a3)	id,
+enum TraceEvent {
+	TRACE_EVENTS
+	TraceEventCount
+};
+#undef TRACE_EVENT
+
+#define TRACE_ARGS	4
+
+/*
+ * Dump file format, in native byte order:
+ *
+ *   struct trace_header;
+ *   th_nrecs of struct trace_rec, being the ring buffer as is.
+ *
+ * Record at ring position N is valid if its tr_seq is N + 1; others are
+ * either not written yet or were being overwritten at the dump time.
+ */
+#define TRACE_MAGIC		"OICBTRC\001"
+#define TRACE_MAGIC_LEN		8
+
+struct trace_header {
+	char		 th_magic[TRACE_MAGIC_LEN];
+	uint32_t	 th_recsize;
+	uint32_t	 th_nrecs;
+	uint64_t	 th_head;	// total number of records ever started
+	uint64_t	 th_dump_usec;
+};
+
+struct trace_rec {
+	uint64_t	 tr_seq;
+	uint64_t	 tr_usec;
+	uint32_t	 tr_event;
+	uint32_t	 tr_pad;
+	int64_t		 tr_args[TRACE_ARGS];
+};
+
+/*
+ * TRACE(event, args...) records event with up to TRACE_ARGS arguments,
+ * missing ones are zeroes.
+ */
+#define TRACE(...)	TRACE_(__VA_ARGS__, 0, 0, 0, 0, 0)
+#define TRACE_(ev, a0, a1, a2, a3, ...) \
+	trace_record(ev, (int64_t)(a0), (int64_t)(a1), (int64_t)(a2), \
+	    (int64_t)(a3))
+
+void	 trace_record(enum TraceEvent ev, int64_t a0, int64_t a1,
+	              int64_t a2, int64_t a3);
+void	 trace_start(const char *path);
+void	 trace_dump(void);
+
+#endif // OICB_TRACE_H
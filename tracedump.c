@@ -0,0 +1,146 @@
+/*
+ * Copyright (c) 2026 Vadim Zhukov <zhuk@openbsd.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Decoder for trace dumps written by "oicb -T file", see trace.c.
+ *
+ * Prints one line per record: time relative to the dump, in seconds,
+ * time since previous record, event name and arguments.
+ *
+ * Deliberately doesn't depend on libbsd or anything else from oicb.
+ */
+
+#include <sys/types.h>
+#include <ctype.h>
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+
+static const struct trace_event_desc {
+	const char	*ted_name;
+	const char	*ted_args[TRACE_ARGS];
+} events[TraceEventCount] = {
+#define TRACE_EVENT(id, name, a0, a1, a2, a3)	{ name, { a0, a1, a2, a3 } },
+	TRACE_EVENTS
+#undef TRACE_EVENT
+};
+
+static void	 usage(void);
+static void	 print_rec(const struct trace_rec *tr, uint64_t prev_usec,
+		           uint64_t dump_usec);
+
+
+static void
+usage(void) {
+	fprintf(stderr, "usage: oicb-tracedump [-n count] file\n");
+	exit(1);
+}
+
+static void
+print_rec(const struct trace_rec *tr, uint64_t prev_usec, uint64_t dump_usec) {
+	const struct trace_event_desc	*ted;
+	int64_t				 v;
+	int				 i;
+
+	printf("%14.6f %+11.6f ",
+	    (double)(int64_t)(tr->tr_usec - dump_usec) / 1000000,
+	    prev_usec ? (double)(tr->tr_usec - prev_usec) / 1000000 : 0.0);
+	if (tr->tr_event >= TraceEventCount) {
+		printf("event#%u", tr->tr_event);
+		for (i = 0; i < TRACE_ARGS; i++)
+			printf(" %lld", (long long)tr->tr_args[i]);
+		putchar('\n');
+		return;
+	}
+
+	ted = &events[tr->tr_event];
+	printf("%s", ted->ted_name);
+	for (i = 0; i < TRACE_ARGS && ted->ted_args[i] != NULL; i++) {
+		v = tr->tr_args[i];
+		if (strcmp(ted->ted_args[i], "type") == 0 &&
+		    v >= 0 && v < 256 && isprint((int)v))
+			printf(" %s=%c", ted->ted_args[i], (int)v);
+		else
+			printf(" %s=%lld", ted->ted_args[i], (long long)v);
+	}
+	putchar('\n');
+}
+
+int
+main(int argc, char **argv) {
+	struct trace_header	 th;
+	struct trace_rec	*ring, *tr;
+	FILE			*f;
+	uint64_t		 pos, first, prev_usec = 0, ntorn = 0;
+	unsigned long long	 count = 0;
+	char			*ep;
+	int			 ch;
+
+	while ((ch = getopt(argc, argv, "n:")) != -1) {
+		switch (ch) {
+		case 'n':
+			count = strtoull(optarg, &ep, 10);
+			if (*ep || count == 0)
+				errx(1, "invalid record count: %s", optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (argc != 1)
+		usage();
+
+	if ((f = fopen(argv[0], "r")) == NULL)
+		err(1, "%s", argv[0]);
+	if (fread(&th, sizeof(th), 1, f) != 1)
+		errx(1, "%s: truncated header", argv[0]);
+	if (memcmp(th.th_magic, TRACE_MAGIC, TRACE_MAGIC_LEN) != 0)
+		errx(1, "%s: not an oicb trace dump", argv[0]);
+	if (th.th_recsize != sizeof(struct trace_rec) || th.th_nrecs == 0)
+		errx(1, "%s: unsupported record format", argv[0]);
+	if ((ring = calloc(th.th_nrecs, sizeof(struct trace_rec))) == NULL)
+		err(1, NULL);
+	if (fread(ring, sizeof(struct trace_rec), th.th_nrecs, f) != th.th_nrecs)
+		errx(1, "%s: truncated", argv[0]);
+	fclose(f);
+
+	first = th.th_head > th.th_nrecs ? th.th_head - th.th_nrecs : 0;
+	if (count && th.th_head - first > count)
+		first = th.th_head - count;
+	for (pos = first; pos < th.th_head; pos++) {
+		tr = &ring[pos % th.th_nrecs];
+		if (tr->tr_seq != pos + 1) {
+			ntorn++;
+			continue;
+		}
+		print_rec(tr, prev_usec, th.th_dump_usec);
+		prev_usec = tr->tr_usec;
+	}
+	if (ntorn)
+		fprintf(stderr, "oicb-tracedump: %llu incomplete records"
+		    " skipped\n", (unsigned long long)ntorn);
+	printf("%llu records total\n", (unsigned long long)th.th_head);
+	free(ring);
+	return 0;
+}
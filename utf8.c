@@ -17,6 +17,9 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <sys/types.h>
+#include <ctype.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <wchar.h>
 #include <wctype.h>
@@ -48,29 +51,146 @@ mbsvalidate(const char *mbs)
 }
 
 /*
- * Finds place where the given string may be split, no longer than maxbytes.
- * If there is whitespace or punctuation, the last one in the given bounds is
- * used as last character.
- * Otherwise, the string is simply split between multi-byte characters.
- * Returned value is always not exceeding maxbytes.
+ * Decodes UTF-8 sequence of up to 'left' bytes, without going through
+ * mbtowc(3), which is much slower.  Returns its length, or 0 if invalid
+ * or truncated.
+ */
+static size_t
+utf8_decode(const unsigned char *s, size_t left, wchar_t *wc) {
+	size_t		 len, i;
+	uint32_t	 c, min;
+
+	if (s[0] < 0xc2)
+		return 0;	// continuation byte or overlong sequence
+	else if (s[0] < 0xe0) {
+		len = 2;
+		c = s[0] & 0x1f;
+		min = 0x80;
+	} else if (s[0] < 0xf0) {
+		len = 3;
+		c = s[0] & 0x0f;
+		min = 0x800;
+	} else if (s[0] < 0xf5) {
+		len = 4;
+		c = s[0] & 0x07;
+		min = 0x10000;
+	} else
+		return 0;
+	if (len > left)
+		return 0;
+	for (i = 1; i < len; i++) {
+		if ((s[i] & 0xc0) != 0x80)
+			return 0;
+		c = (c << 6) | (s[i] & 0x3f);
+	}
+	if (c < min || c > 0x10ffff || (c >= 0xd800 && c <= 0xdfff))
+		return 0;
+	*wc = (wchar_t)c;
+	return len;
+}
+
+/*
+ * Returns non-zero if 'len' bytes at 's' form valid UTF-8 text,
+ * without NUL bytes.
+ */
+int
+utf8_validate(const char *s, size_t len) {
+	const unsigned char	*p = (const unsigned char *)s, *end = p + len;
+	wchar_t			 wc;
+	size_t			 n;
+
+	while (p < end) {
+		if (*p >= 0x80) {
+			if ((n = utf8_decode(p, (size_t)(end - p), &wc)) == 0)
+				return 0;
+			p += n;
+		} else if (*p++ == '\0')
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * Returns length of character at the segmenter position, and sets 'brk'
+ * to non-zero if it's whitespace or punctuation, so the text could be
+ * broken after it.  Invalid bytes are taken one by one.
+ */
+static size_t
+mbsseg_char(const struct mbs_segmenter *ms, int *brk) {
+	wchar_t		 wc;
+	size_t		 len;
+	unsigned char	 c;
+
+	c = (unsigned char)*ms->ms_p;
+	if (ms->ms_mode == SegSingleByte || c < 0x80) {
+		*brk = isblank(c) || ispunct(c);
+		return 1;
+	}
+	if ((len = utf8_decode((const unsigned char *)ms->ms_p,
+	    (size_t)(ms->ms_end - ms->ms_p), &wc)) == 0) {
+		*brk = 0;
+		return 1;
+	}
+	*brk = iswblank(wc) || iswpunct(wc);
+	return len;
+}
+
+/*
+ * Prepares splitting of 'len' bytes of text into segments no longer than
+ * 'maxbytes'.  Unless 'mode' is SegBytes, the text is split after the last
+ * whitespace or punctuation character fitting in the segment, if any, and
+ * never in the middle of multi-byte character.
+ */
+void
+mbsseg_init(struct mbs_segmenter *ms, const char *text, size_t len,
+    size_t maxbytes, enum SegMode mode) {
+	ms->ms_start = ms->ms_p = text;
+	ms->ms_end = text + len;
+	ms->ms_lastgood = NULL;
+	ms->ms_max = maxbytes;
+	ms->ms_mode = mode;
+}
+
+/*
+ * Returns length of the next segment, with its start put in 'segp'.
+ * Returns 0 when the text is over, or for empty text.
+ *
+ * Every character is looked at only once: the scan stops at the first one
+ * not fitting in the current segment, and the characters following the
+ * break point already have no break points among them, being looked at,
+ * so the next segment continues the scan from there.
  */
 size_t
-mbsbreak(const char *mbs, size_t maxbytes) {
-	wchar_t		  wc;
-	int		  len;  /* length in bytes of UTF-8 encoded character */
-	const char	 *lastgood = NULL;  /* position of last space or punctuation */
-	const char	 *p;
+mbsseg_next(struct mbs_segmenter *ms, const char **segp) {
+	const char	*start = ms->ms_start, *end;
+	size_t		 len;
+	int		 brk;
+
+	*segp = start;
+	if ((size_t)(ms->ms_end - start) <= ms->ms_max) {
+		ms->ms_start = ms->ms_p = ms->ms_end;
+		return (size_t)(ms->ms_end - start);
+	}
+	if (ms->ms_mode == SegBytes) {
+		ms->ms_start = ms->ms_p = start + ms->ms_max;
+		return ms->ms_max;
+	}
 
-	for (p = mbs; *p != '\0';) {
-		if ((len = mbtowc(&wc, p, MB_CUR_MAX)) == -1)
-			len = 1;
-		if (p + len > mbs + maxbytes)
+	for (;;) {
+		len = mbsseg_char(ms, &brk);
+		if ((size_t)(ms->ms_p - start) + len > ms->ms_max)
 			break;
-		p += len;
-		if (iswblank(wc) || iswpunct(wc))
-			lastgood = p;
+		ms->ms_p += len;
+		if (brk)
+			ms->ms_lastgood = ms->ms_p;
 	}
-	if (lastgood != NULL)
-		p = lastgood;
-	return (size_t)(p - mbs);
+	if (ms->ms_lastgood != NULL)
+		end = ms->ms_lastgood;
+	else if (ms->ms_p > start)
+		end = ms->ms_p;
+	else
+		end = ms->ms_p += len;	// character longer than segment
+	ms->ms_lastgood = NULL;
+	ms->ms_start = end;
+	return (size_t)(end - start);
 }
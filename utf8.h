@@ -14,5 +14,35 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
-int mbsvalidate(const char *mbs);
-size_t mbsbreak(const char *mbs, size_t maxbytes);
+#ifndef OICB_UTF8_H
+#define OICB_UTF8_H
+
+#include <sys/types.h>
+
+enum SegMode {
+	SegBytes,		// split anywhere
+	SegSingleByte,		// prefer whitespace and punctuation
+	SegUTF8,		// same, for UTF-8 text in UTF-8 locale
+};
+
+/*
+ * Splits text to be sent into pieces, see mbsseg_init().
+ */
+struct mbs_segmenter {
+	const char	*ms_start;	// start of the next segment
+	const char	*ms_p;		// characters up to here were looked at
+	const char	*ms_end;
+	const char	*ms_lastgood;	// after whitespace or punctuation
+	size_t		 ms_max;
+	enum SegMode	 ms_mode;
+};
+
+#define mbsseg_done(ms)	((ms)->ms_start == (ms)->ms_end)
+
+int	 mbsvalidate(const char *mbs);
+int	 utf8_validate(const char *s, size_t len);
+void	 mbsseg_init(struct mbs_segmenter *ms, const char *text, size_t len,
+	             size_t maxbytes, enum SegMode mode);
+size_t	 mbsseg_next(struct mbs_segmenter *ms, const char **segp);
+
+#endif // OICB_UTF8_H